@@ -0,0 +1,227 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <inttypes.h>
+
+// Fixed point alpha-beta tracking filter.
+//
+// Smooths a noisy series of measurements and estimates the rate of
+// change (velocity) at the same time.  Each new value is compared to
+// the value predicted from the last position and velocity.  Alpha
+// (0-255 = 0-1) sets how much of the difference is applied to the
+// position and beta (0-255 = 0-1) sets how much is applied to the
+// velocity.  Smaller values are smoother but respond slower.
+//
+// The time of each value is passed in so missing values (like a lost
+// sonar ping) just make the next prediction longer.  If the gap
+// between values is longer than maxGap, the filter restarts at the
+// new value.
+//
+// All the math is done in 32 bit integers with one division per
+// value so it's fast enough to run at high rates on an 8 bit
+// processor.  Position is stored in 1/256 units and velocity in
+// 1/65536 units per millisecond.
+//
+//= EXAMPLE
+//
+//   AlphaBetaFilter filter;
+//   filter.init( 64, 16 ); // alpha = 0.25, beta = 0.0625
+//   filter.add( 100, 0 );
+//   filter.add( 102, 100 );
+//   filter.add( 104, 200 );
+//   int16_t speed = filter.velocity(); // units/sec
+//
+class AlphaBetaFilter
+{
+public:
+   AlphaBetaFilter();
+
+   void init( uint8_t alpha, uint8_t beta, uint16_t maxGap_ms=1000 );
+   void add( uint16_t value, uint32_t time_ms );
+   void clear();
+
+   bool isActive();
+   uint16_t value();
+   int16_t velocity();
+   uint16_t predict( uint32_t time_ms );
+
+private:
+   // Position and velocity gains in 1/256.  Alpha of zero means the
+   // filter is off.
+   uint8_t m_alpha;
+   uint8_t m_beta;
+
+   // True once the first value has been added.
+   bool m_started;
+
+   // Restart the filter if values are further apart than this.
+   uint16_t m_maxGap_ms;
+
+   // Time of the last value in millis.
+   uint32_t m_time_ms;
+
+   // Position estimate in 1/256 units.
+   int32_t m_pos;
+
+   // Velocity estimate in 1/65536 units per millisecond.
+   int32_t m_vel;
+};
+
+//============================================================================
+// Constructor
+//
+// The filter is off until init() is called.
+//
+inline
+AlphaBetaFilter::
+AlphaBetaFilter()
+   : m_alpha( 0 ),
+     m_beta( 0 ),
+     m_started( false ),
+     m_maxGap_ms( 1000 ),
+     m_time_ms( 0 ),
+     m_pos( 0 ),
+     m_vel( 0 )
+{
+}
+
+//============================================================================
+// Set the filter gains.
+//
+//= INPUTS
+//- alpha       Position gain 1-255 (0-1).  0 turns the filter off.
+//- beta        Velocity gain 0-255 (0-1).  Should be smaller than alpha.
+//- maxGap_ms   Restart the filter if the time between values is longer
+//              than this.
+//
+inline
+void
+AlphaBetaFilter::
+init( uint8_t alpha,
+      uint8_t beta,
+      uint16_t maxGap_ms )
+{
+   m_alpha = alpha;
+   m_beta = beta;
+   m_maxGap_ms = maxGap_ms;
+   clear();
+}
+
+//============================================================================
+// Clear the filter.  The next value will restart it.
+//
+inline
+void
+AlphaBetaFilter::
+clear()
+{
+   m_started = false;
+   m_pos = 0;
+   m_vel = 0;
+}
+
+//============================================================================
+// Return true if the filter has been turned on with init().
+//
+inline
+bool
+AlphaBetaFilter::
+isActive()
+{
+   return m_alpha != 0;
+}
+
+//============================================================================
+// Return the filtered value (rounded).
+//
+inline
+uint16_t
+AlphaBetaFilter::
+value()
+{
+   return m_pos < 0 ? 0 : ( m_pos + 128 ) >> 8;
+}
+
+//============================================================================
+// Return the filtered velocity in units per second.
+//
+inline
+int16_t
+AlphaBetaFilter::
+velocity()
+{
+   return ( m_vel * 1000 + 32768 ) >> 16;
+}
+
+//============================================================================
+// Return the predicted value at a time after the last value.
+//
+inline
+uint16_t
+AlphaBetaFilter::
+predict( uint32_t time_ms )
+{
+   int32_t dt = time_ms - m_time_ms;
+   if ( dt > m_maxGap_ms )
+   {
+      dt = m_maxGap_ms;
+   }
+
+   int32_t pos = m_pos + ( ( m_vel * dt + 128 ) >> 8 );
+   return pos < 0 ? 0 : ( pos + 128 ) >> 8;
+}
+
+//============================================================================
+// Add a value to the filter.
+//
+//= INPUTS
+//- value     The measured value.
+//- time_ms   The time the value was measured in milliseconds.
+//
+inline
+void
+AlphaBetaFilter::
+add( uint16_t value,
+     uint32_t time_ms )
+{
+   int32_t z = (int32_t)value << 8;
+   int32_t dt = time_ms - m_time_ms;
+   m_time_ms = time_ms;
+
+   // First value, a long gap, or the clock went backwards - start
+   // over at the value.
+   if ( ! m_started || dt > m_maxGap_ms || dt < 0 )
+   {
+      m_started = true;
+      m_pos = z;
+      m_vel = 0;
+      return;
+   }
+
+   // Predict the position at this time and compare it to the value.
+   // Shifts are rounded so the estimates don't drift downwards.
+   int32_t pos = m_pos + ( ( m_vel * dt + 128 ) >> 8 );
+   int32_t residual = z - pos;
+
+   m_pos = pos + ( ( m_alpha * residual + 128 ) >> 8 );
+
+   // A second value at the same time only moves the position.
+   if ( dt > 0 )
+   {
+      m_vel += ( m_beta * residual ) / dt;
+   }
+}
+
+//============================================================================
@@ -0,0 +1,103 @@
+#include "../../AlphaBetaFilter/AlphaBetaFilter.h"
+#include <iostream>
+
+// Compile and run:
+// g++ -o test main.cpp
+// ./test
+
+int
+main()
+{
+   bool fail = false;
+
+   // Constant velocity of 20 units/sec sampled at 50 Hz with +/- 2
+   // units of noise.  Every 10th sample is dropped.
+   AlphaBetaFilter f;
+   f.init( 64, 8 );
+
+   const int NOISE[5] = { 0, 2, -1, -2, 1 };
+   int worstPos = 0;
+   for ( int i = 0; i < 500; i++ )
+   {
+      uint32_t t = i * 20;
+      int truth = 100 + 20 * (int)t / 1000;
+      if ( i % 10 == 9 )
+      {
+         continue;
+      }
+
+      f.add( truth + NOISE[i % 5], t );
+
+      // Give it 2 seconds to converge.
+      if ( t >= 2000 )
+      {
+         int err = (int)f.value() - truth;
+         if ( err < 0 ) err = -err;
+         if ( err > worstPos ) worstPos = err;
+      }
+   }
+
+   int v = f.velocity();
+   if ( v < 18 || v > 22 || worstPos > 2 )
+   {
+      fail = true;
+      std::cout << "Error tracking velocity=" << v << " worst position error="
+                << worstPos << "\n";
+   }
+
+   // Prediction past the last value.
+   uint16_t p = f.predict( 10480 );
+   if ( p < 307 || p > 311 )
+   {
+      fail = true;
+      std::cout << "Error predict=" << p << " right=309\n";
+   }
+
+   // Long gap restarts the filter at the new value.
+   f.add( 50, 20000 );
+   if ( f.value() != 50 || f.velocity() != 0 )
+   {
+      fail = true;
+      std::cout << "Error after gap value=" << f.value() << " velocity="
+                << f.velocity() << "\n";
+   }
+
+   // Negative velocity.
+   f.clear();
+   for ( int i = 0; i < 200; i++ )
+   {
+      f.add( 500 - i, i * 20 ); // -50 units/sec
+   }
+   if ( f.velocity() > -48 || f.velocity() < -52 )
+   {
+      fail = true;
+      std::cout << "Error negative velocity=" << f.velocity() << "\n";
+   }
+
+   // A second value at the same time keeps tracking (it used to
+   // restart the filter and lose the velocity).
+   f.add( 300, 4000 );
+   f.add( 304, 4000 );
+   if ( f.velocity() > -48 || f.velocity() < -52 || f.value() != 301 )
+   {
+      fail = true;
+      std::cout << "Error same time value=" << f.value() << " velocity="
+                << f.velocity() << "\n";
+   }
+
+   // The clock going backwards restarts it.
+   f.add( 200, 3000 );
+   if ( f.value() != 200 || f.velocity() != 0 )
+   {
+      fail = true;
+      std::cout << "Error clock backwards value=" << f.value()
+                << " velocity=" << f.velocity() << "\n";
+   }
+
+   if ( ! fail )
+   {
+      std::cout << "Passed\n";
+   }
+
+   return 0;
+}
@@ -14,6 +14,8 @@
 // this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 #include "Arduino.h"
+#include "FlightRecorder.h"
+#include "Profile.h"
 
 // Debounced switch (digital input) class.
 //
@@ -56,6 +58,14 @@
 // shift register will be loaded.  During loop(), read the shift
 // register first and call poll() with the value of the switch.
 //
+//= Compact mode
+//
+// Define DIGITALINPUT_COMPACT to keep the debounce time as the low 16
+// bits of millis().  That saves 2 bytes per input (9 to 7 on AVR).
+// Presses longer than 16 seconds are still reported as long but
+// poll() must be called at least every 16 seconds (the Scheduler does
+// that).
+//
 
 // Time the input must be held for a "long" vs short close.
 #define DIGITALINPUT_LONG_CLOSE_TIME 2000 // millis
@@ -104,11 +114,21 @@ public:
    // see: http://playground.arduino.cc/Code/TimingRollover
    Status poll( long currentMillis, StateChangeCb callback=NULL,
                 int8_t identifier=0 );
+   long deadline( long currentMillis );
+
+   // Same as poll() with the handler bound at compile time - a
+   // function or a member function of an object.  The compiler can
+   // inline the poll and the handler together.
+   template< StateChangeCb CB >
+   Status poll( long currentMillis, int8_t identifier=0 );
+   template< typename T, void (T::*HANDLER)( Status, int8_t ) >
+   Status poll( long currentMillis, T& object, int8_t identifier=0 );
 
    bool isOn();     // with debouncing
    bool isOnRaw();  // without debouncing
    bool pressed();
    bool released();
+   bool isAnalog();
 
 private:
    // If m_buffer is null, then m_pin is the Arduino pin to control.
@@ -163,17 +183,256 @@ private:
    // Time in millis for a stable (debounced) value.  This is set when
    // the input changes value.  If the input stays in the same state
    // until this time, then it's stable.  This assumes that poll() is
-   // called more often than m_debounceMillis of course.
+   // called more often than m_debounceMillis of course.  In compact
+   // mode, it's the low 16 bits of the time.
+#if defined( DIGITALINPUT_COMPACT )
+   int16_t m_stopMillis;
+#else
    long m_stopMillis;
+#endif
+
+   Status update( long currentMillis );
+
+   // Debouncing and long press state machine.  DigitalInputPolicy
+   // uses the same code with its own Info bits.
+   template< typename SOURCE, bool LONG_PRESS, StateChangeCb CB >
+   friend class DigitalInputPolicy;
+
+   template< bool LONG_PRESS, typename INFO, typename STOP >
+   static Status debounce( INFO& info, STOP& stopMillis,
+                           uint8_t debounceMillis, bool isOn,
+                           long currentMillis, uint8_t id );
+   template< typename INFO >
+   static long debounceDeadline( const INFO& info, long since, bool isOn,
+                                 long currentMillis );
+   static long sinceStop( long currentMillis, long stopMillis );
 };
 
 //============================================================================
-#ifdef DIGITALINPUT_DEBUG
-#   define DIGITALINPUT_DBG( s, i ) Serial.print( s ); Serial.println( i ); 
+// Debug messages.  DIGITALINPUT_DEBUG prints them to Serial which can
+// block loop().  DIGITALINPUT_TELEMETRY logs them as TELEMETRY_DIGITALINPUT
+// records instead (see Telemetry.h) with a 1 byte message id from the
+// enum below and a 2 byte value.
+enum DigitalInputMsg {
+   DIGITALINPUT_MSG_INIT_PIN = 0,
+   DIGITALINPUT_MSG_INIT_SHIFT = 1,
+   DIGITALINPUT_MSG_CHANGE = 2,
+};
+
+#if defined( DIGITALINPUT_TELEMETRY )
+#   include "Telemetry.h"
+#   define DIGITALINPUT_DBG( msg, s, i )                                \
+      {                                                                 \
+         int16_t dbgValue = i;                                          \
+         uint8_t dbgData[3] = { msg, (uint8_t)dbgValue,                 \
+                                (uint8_t)( dbgValue >> 8 ) };           \
+         Telemetry::log( TELEMETRY_DIGITALINPUT, dbgData, 3 );          \
+      }
+#elif defined( DIGITALINPUT_DEBUG )
+#   define DIGITALINPUT_DBG( msg, s, i ) \
+      Serial.print( s ); Serial.println( i );
 #else
-#   define DIGITALINPUT_DBG( s, i ) 
+#   define DIGITALINPUT_DBG( msg, s, i ) 
 #endif
 
+//============================================================================
+// Poll the switch and run a handler function bound at compile time.
+//
+// Same as poll() with a callback.  Use it like:
+//
+//   g_button.poll< buttonChangedCb >( t );
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- identifier      Optional, arbitrary identifer to pass to the handler.
+//
+//= RETURNS
+//- Returns the same value as poll().
+//
+template< DigitalInput::StateChangeCb CB >
+inline
+DigitalInput::Status
+DigitalInput::
+poll( long currentMillis,
+      int8_t identifier )
+{
+   PROFILE_SCOPE( "DigitalInput::poll" );
+
+   Status result = update( currentMillis );
+   if ( result != NONE )
+   {
+      DIGITALINPUT_DBG( DIGITALINPUT_MSG_CHANGE, "DigitalInput status change ",
+                        result );
+      CB( result, identifier );
+   }
+
+   return result;
+}
+
+//============================================================================
+// Poll the switch and run a member function bound at compile time.
+//
+// Same as poll() with a callback.  Use it like:
+//
+//   g_button.poll< Board, &Board::buttonChanged >( t, g_board );
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- object          The object to run the member function on.
+//- identifier      Optional, arbitrary identifer to pass to the handler.
+//
+//= RETURNS
+//- Returns the same value as poll().
+//
+template< typename T, void (T::*HANDLER)( DigitalInput::Status, int8_t ) >
+inline
+DigitalInput::Status
+DigitalInput::
+poll( long currentMillis,
+      T& object,
+      int8_t identifier )
+{
+   PROFILE_SCOPE( "DigitalInput::poll" );
+
+   Status result = update( currentMillis );
+   if ( result != NONE )
+   {
+      DIGITALINPUT_DBG( DIGITALINPUT_MSG_CHANGE, "DigitalInput status change ",
+                        result );
+      ( object.*HANDLER )( result, identifier );
+   }
+
+   return result;
+}
+
+//============================================================================
+// Read the input and update the debouncing.
+//
+// This is poll() without the callback.  It's inline so the
+// compile time bound poll() variants get it inlined with the handler.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the poll() result.
+//
+inline
+DigitalInput::Status
+DigitalInput::
+update( long currentMillis )
+{
+   // Read the switch from the pin or the shift register.
+   return debounce< true >( m_info, m_stopMillis, m_debounceMillis,
+                            isOnRaw(), currentMillis, m_pin );
+}
+
+//============================================================================
+// Update the debouncing with a new read of the input.
+//
+// This is the state machine behind poll() for DigitalInput and
+// DigitalInputPolicy.  INFO is a bit field with unstable, stable,
+// changed, and longPress fields.
+//
+//= INPUTS
+//- info            The input's state bits.
+//- stopMillis      The input's stable time (see m_stopMillis).
+//- debounceMillis  Number of milliseconds the input must be in the same state
+//                  before it's reported.
+//- isOn            The current (unstable) state of the input.
+//- currentMillis   The current elapsed time in milliseconds.
+//- id              Input id for the FlightRecorder.
+//
+//= RETURNS
+//- Returns the poll() result.  OPENED_LONG is only returned if
+//  LONG_PRESS is true.
+//
+template< bool LONG_PRESS, typename INFO, typename STOP >
+inline
+DigitalInput::Status
+DigitalInput::
+debounce( INFO& info,
+          STOP& stopMillis,
+          uint8_t debounceMillis,
+          bool isOn,
+          long currentMillis,
+          uint8_t id )
+{
+   Status result = NONE;
+
+   // Clear the changed flag.
+   info.changed = 0;
+   long since = sinceStop( currentMillis, stopMillis );
+   
+   // If the current switch state is different than the last switch
+   // state, restart the debouncing counter.
+   if ( isOn != info.unstable )
+   {
+      // When the switch is released, record if it's a long press or a
+      // short press.
+      if ( LONG_PRESS && ! isOn )
+      {
+         bool isLong = since > DIGITALINPUT_LONG_CLOSE_TIME;
+         info.longPress = isLong;
+      }
+
+      // Update the next time at which we could have a stable value
+      // and store the switch state as the unstable value.
+      stopMillis = currentMillis + debounceMillis;
+      info.unstable = isOn;
+   }
+
+   // Current switch state is the same as the previous call, see if
+   // enough time has passed in this state to trigger the switch.  See
+   // m_stopMillis docs for roll-over comments.
+   else if ( since >= 0 )
+   {
+      // Only trigger a result if the current state is different than
+      // the last stable state.
+      if ( isOn != info.stable )
+      {
+         // Set the return values correctly.
+         if ( isOn )
+         {
+            result = CLOSED;
+         }
+         // Long press flag was set above on the first call to poll()
+         // after the switch is released.
+         else if ( LONG_PRESS && info.longPress )
+         {
+            result = OPENED_LONG;
+         }
+         else
+         {
+            result = OPENED;
+         }
+
+         // Save the switch state in the stable field and record that
+         // a change occurred.  The changed flag is used in the
+         // pressed() and released() methods.
+         info.stable = isOn;
+         info.changed = 1;
+
+#if FLIGHTRECORDER_ENABLE
+         FlightRecorder::record( currentMillis, FlightRecorder::DIGITAL_INPUT,
+                                 id, ! isOn, isOn );
+#else
+         (void)id; // only used by the flight recorder
+#endif
+      }
+#if defined( DIGITALINPUT_COMPACT )
+      // Keep the 16 bit time from wrapping while the input is steady.
+      // It only has to tell a long press from a short one.
+      else if ( LONG_PRESS && since > 0x3FFF )
+      {
+         stopMillis = currentMillis - 0x3FFF;
+      }
+#endif
+   }
+
+   return result;
+}
+
 //============================================================================
 // Return if the pin is current on or not.
 //
@@ -248,7 +507,8 @@ init( uint8_t pin,
    // Get the initial input value.  Assume the first read is stable.
    m_info.stable = isOnRaw();
 
-   DIGITALINPUT_DBG( "DigitalInput init on pin ", pin );
+   DIGITALINPUT_DBG( DIGITALINPUT_MSG_INIT_PIN, "DigitalInput init on pin ",
+                     pin );
 }
 
 //============================================================================
@@ -288,7 +548,8 @@ initShift( uint8_t* buffer,
    // Set the initial input value.  
    m_info.stable = initialState;
 
-   DIGITALINPUT_DBG( "DigitalInput init on buffer bit ", bitIndex );
+   DIGITALINPUT_DBG( DIGITALINPUT_MSG_INIT_SHIFT,
+                     "DigitalInput init on buffer bit ", bitIndex );
 }
 
 //============================================================================
@@ -327,3 +588,100 @@ released()
 }
 
 //============================================================================
+// Return true if the input is read with analogRead() (ANALOG mode).
+//
+inline
+bool
+DigitalInput::
+isAnalog()
+{
+   return m_info.isPin && ! m_info.isDigital;
+}
+
+//============================================================================
+// Return the time poll() next has something to do.
+//
+// If the input changed since the last poll(), that's now.  Same if
+// the last poll() reported a change so the next one clears the
+// pressed()/released() flag.  If it's debouncing, it's the time it
+// will be stable.  Otherwise nothing happens until the input changes.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the time in millis poll() should be called by.
+//
+inline
+long
+DigitalInput::
+deadline( long currentMillis )
+{
+   return debounceDeadline( m_info, sinceStop( currentMillis, m_stopMillis ),
+                            isOnRaw(), currentMillis );
+}
+
+//============================================================================
+// Return the time the debouncing next has something to do.
+//
+// See deadline().  Shared with DigitalInputPolicy.
+//
+//= INPUTS
+//- info            The input's state bits.
+//- since           The millis since the stable time (see sinceStop()).
+//- isOn            The current (unstable) state of the input.
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the time in millis poll() should be called by.
+//
+template< typename INFO >
+inline
+long
+DigitalInput::
+debounceDeadline( const INFO& info,
+                  long since,
+                  bool isOn,
+                  long currentMillis )
+{
+   if ( info.changed || isOn != info.unstable )
+   {
+      return currentMillis;
+   }
+   if ( info.unstable != info.stable )
+   {
+      return currentMillis - since;
+   }
+
+   // Nothing due - check back well before the times could wrap.
+#if defined( DIGITALINPUT_COMPACT )
+   return currentMillis + 0x3FFF;
+#else
+   return currentMillis + 0x3FFFFFFF;
+#endif
+}
+
+//============================================================================
+// Return the millis since the stable time.
+//
+// Negative while the input is debouncing.  In compact mode, that's
+// the difference of the low 16 bits.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- stopMillis      The input's stable time (see m_stopMillis).
+//
+inline
+long
+DigitalInput::
+sinceStop( long currentMillis,
+           long stopMillis )
+{
+#if defined( DIGITALINPUT_COMPACT )
+   return (int16_t)( (uint16_t)currentMillis - (uint16_t)stopMillis );
+#else
+   return currentMillis - stopMillis;
+#endif
+}
+
+//============================================================================
@@ -0,0 +1,463 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "DigitalInputBatch.h"
+#include <string.h>
+
+#if DIGITALINPUTBATCH_SIMD
+#   include <immintrin.h>
+#   define DIGITALINPUTBATCH_SSE2 __attribute__(( target( "sse2" ) ))
+#   define DIGITALINPUTBATCH_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+
+namespace
+{
+   // Kernel poll() uses.  -1 until it's picked.
+   int8_t s_kernel = -1;
+
+   //=========================================================================
+   // 32 bit time math that rolls over like an Arduino long.
+   inline int32_t
+   sub( int32_t a,
+        int32_t b )
+   {
+      return (int32_t)( (uint32_t)a - (uint32_t)b );
+   }
+
+#if DIGITALINPUTBATCH_SIMD
+   //=========================================================================
+   // Load 4 bytes into 32 bit lanes.
+   DIGITALINPUTBATCH_SSE2 inline __m128i
+   load4( const void* p )
+   {
+      int32_t bytes;
+      memcpy( &bytes, p, 4 );
+      __m128i zero = _mm_setzero_si128();
+      __m128i v = _mm_unpacklo_epi8( _mm_cvtsi32_si128( bytes ), zero );
+      return _mm_unpacklo_epi16( v, zero );
+   }
+
+   //=========================================================================
+   // Store the low byte of 4 32 bit lanes.  Lanes must be -128 to 127.
+   DIGITALINPUTBATCH_SSE2 inline void
+   store4( void* p,
+           __m128i v )
+   {
+      v = _mm_packs_epi32( v, v );
+      v = _mm_packs_epi16( v, v );
+      int32_t bytes = _mm_cvtsi128_si32( v );
+      memcpy( p, &bytes, 4 );
+   }
+
+   //=========================================================================
+   // Load 8 bytes into 32 bit lanes.
+   DIGITALINPUTBATCH_AVX2 inline __m256i
+   load8( const void* p )
+   {
+      return _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)p ) );
+   }
+
+   //=========================================================================
+   // Store the low byte of 8 32 bit lanes.  Lanes must be -128 to 127.
+   DIGITALINPUTBATCH_AVX2 inline void
+   store8( void* p,
+           __m256i v )
+   {
+      // Packing works in each 128 bit half so the bytes end up in the
+      // low 4 bytes of each half.
+      v = _mm256_packs_epi32( v, v );
+      v = _mm256_packs_epi16( v, v );
+      v = _mm256_permutevar8x32_epi32(
+         v, _mm256_setr_epi32( 0, 4, 0, 0, 0, 0, 0, 0 ) );
+      _mm_storel_epi64( (__m128i*)p, _mm256_castsi256_si128( v ) );
+   }
+#endif
+}
+
+//============================================================================
+// Return the fastest kernel the CPU supports.
+//
+DigitalInputKernel::Kernel
+DigitalInputKernel::
+best()
+{
+#if DIGITALINPUTBATCH_SIMD
+   if ( __builtin_cpu_supports( "avx2" ) )
+   {
+      return AVX2;
+   }
+   if ( __builtin_cpu_supports( "sse2" ) )
+   {
+      return SSE2;
+   }
+#endif
+   return SCALAR;
+}
+
+//============================================================================
+// Return the kernel poll() uses.
+//
+DigitalInputKernel::Kernel
+DigitalInputKernel::
+get()
+{
+   if ( s_kernel < 0 )
+   {
+      s_kernel = best();
+   }
+   return (Kernel)s_kernel;
+}
+
+//============================================================================
+// Pick the kernel poll() uses (e.g. to compare them).
+//
+//= INPUTS
+//- kernel   The kernel to use.
+//
+//= RETURNS
+//- Returns false if the CPU doesn't support the kernel.  The kernel
+//  isn't changed in that case.
+//
+bool
+DigitalInputKernel::
+set( Kernel kernel )
+{
+   if ( kernel > best() )
+   {
+      return false;
+   }
+   s_kernel = kernel;
+   return true;
+}
+
+//============================================================================
+// Poll a batch of inputs with the current kernel.
+//
+// See DigitalInputBatch::poll() for details.
+//
+uint16_t
+DigitalInputKernel::
+poll( long currentMillis,
+      uint16_t num,
+      const uint8_t* levels,
+      uint8_t* info,
+      const uint8_t* debounceMillis,
+      int32_t* stopMillis,
+      int8_t* events )
+{
+   int32_t t = (int32_t)currentMillis;
+   switch ( get() )
+   {
+#if DIGITALINPUTBATCH_SIMD
+   case AVX2:
+      return pollAvx2( t, num, levels, info, debounceMillis, stopMillis,
+                       events );
+   case SSE2:
+      return pollSse2( t, num, levels, info, debounceMillis, stopMillis,
+                       events );
+#endif
+   default:
+      return pollScalar( t, 0, num, levels, info, debounceMillis,
+                         stopMillis, events );
+   }
+}
+
+//============================================================================
+// Poll inputs one at a time.
+//
+// This is DigitalInput::poll() working on the arrays.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- begin           First input to poll.
+//- end             One past the last input to poll.
+//- levels          Level of each input.
+//- info            Info bits of each input.
+//- debounceMillis  Debounce time of each input.
+//- stopMillis      Stable time of each input.
+//
+//= OUTPUTS
+//- events          Status of each input.
+//
+//= RETURNS
+//- Returns the number of inputs that changed.
+//
+uint16_t
+DigitalInputKernel::
+pollScalar( int32_t currentMillis,
+            uint16_t begin,
+            uint16_t end,
+            const uint8_t* levels,
+            uint8_t* info,
+            const uint8_t* debounceMillis,
+            int32_t* stopMillis,
+            int8_t* events )
+{
+   uint16_t count = 0;
+   for ( uint16_t i = begin; i < end; ++i )
+   {
+      // Clear the changed flag and check the input.
+      uint8_t f = info[i] & ~CHANGED;
+      bool isOn = ( levels[i] != LOW ) == ( ( f & ON_STATE ) != 0 );
+      int8_t result = DigitalInput::NONE;
+
+      // Changed - restart the debouncing.  Record a long press on
+      // the release.
+      if ( isOn != ( ( f & UNSTABLE ) != 0 ) )
+      {
+         if ( ! isOn )
+         {
+            bool isLong = sub( currentMillis, stopMillis[i] ) >
+                          DIGITALINPUT_LONG_CLOSE_TIME;
+            f = isLong ? ( f | LONG_PRESS ) : ( f & ~LONG_PRESS );
+         }
+
+         stopMillis[i] = (int32_t)( (uint32_t)currentMillis +
+                                    debounceMillis[i] );
+         f = isOn ? ( f | UNSTABLE ) : ( f & ~UNSTABLE );
+      }
+
+      // Same as last time and stable long enough.  Report it if it's
+      // different than the last stable state.
+      else if ( sub( currentMillis, stopMillis[i] ) >= 0 &&
+                isOn != ( ( f & STABLE ) != 0 ) )
+      {
+         if ( isOn )
+         {
+            result = DigitalInput::CLOSED;
+         }
+         else if ( f & LONG_PRESS )
+         {
+            result = DigitalInput::OPENED_LONG;
+         }
+         else
+         {
+            result = DigitalInput::OPENED;
+         }
+
+         f = ( f & ~STABLE ) | ( isOn ? STABLE : 0 ) | CHANGED;
+         ++count;
+      }
+
+      info[i] = f;
+      events[i] = result;
+   }
+
+   return count;
+}
+
+#if DIGITALINPUTBATCH_SIMD
+//============================================================================
+// Poll inputs 4 at a time with SSE2.
+//
+// Same as pollScalar() but each branch is computed for all the lanes
+// as a mask (all ones for true) and the results are picked with the
+// masks.
+//
+DIGITALINPUTBATCH_SSE2
+uint16_t
+DigitalInputKernel::
+pollSse2( int32_t currentMillis,
+          uint16_t num,
+          const uint8_t* levels,
+          uint8_t* info,
+          const uint8_t* debounceMillis,
+          int32_t* stopMillis,
+          int8_t* events )
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i ones = _mm_set1_epi32( -1 );
+   const __m128i one = _mm_set1_epi32( 1 );
+   const __m128i now = _mm_set1_epi32( currentMillis );
+   const __m128i longTime = _mm_set1_epi32( DIGITALINPUT_LONG_CLOSE_TIME );
+   const __m128i onBit = _mm_set1_epi32( ON_STATE );
+   const __m128i unstableBit = _mm_set1_epi32( UNSTABLE );
+   const __m128i stableBit = _mm_set1_epi32( STABLE );
+   const __m128i changedBit = _mm_set1_epi32( CHANGED );
+   const __m128i longBit = _mm_set1_epi32( LONG_PRESS );
+   const __m128i keepBits = _mm_set1_epi32( ON_STATE );
+
+   // Number of changes in each lane (ready is -1 for a change).
+   __m128i counts = zero;
+   uint16_t i = 0;
+   for ( ; i + 4 <= num; i += 4 )
+   {
+      __m128i f = load4( info + i );
+      __m128i stop = _mm_loadu_si128( (const __m128i*)( stopMillis + i ) );
+
+      // isOn = ( level != LOW ) == onState
+      __m128i high = _mm_xor_si128(
+         _mm_cmpeq_epi32( load4( levels + i ), zero ), ones );
+      __m128i onState = _mm_cmpeq_epi32( _mm_and_si128( f, onBit ), onBit );
+      __m128i isOn = _mm_xor_si128( _mm_xor_si128( high, onState ), ones );
+
+      __m128i unstable =
+         _mm_cmpeq_epi32( _mm_and_si128( f, unstableBit ), unstableBit );
+      __m128i stable =
+         _mm_cmpeq_epi32( _mm_and_si128( f, stableBit ), stableBit );
+      __m128i longPress =
+         _mm_cmpeq_epi32( _mm_and_si128( f, longBit ), longBit );
+      __m128i elapsed = _mm_sub_epi32( now, stop );
+
+      // Changed - restart the debouncing and record a long press on
+      // the release.
+      __m128i changed = _mm_xor_si128( isOn, unstable );
+      __m128i release = _mm_andnot_si128( isOn, changed );
+      longPress = _mm_or_si128(
+         _mm_and_si128( release, _mm_cmpgt_epi32( elapsed, longTime ) ),
+         _mm_andnot_si128( release, longPress ) );
+      __m128i restart = _mm_add_epi32( now, load4( debounceMillis + i ) );
+      stop = _mm_or_si128( _mm_and_si128( changed, restart ),
+                           _mm_andnot_si128( changed, stop ) );
+
+      // Same as last time, stable long enough, and different than the
+      // last stable state.
+      __m128i due = _mm_xor_si128( _mm_cmpgt_epi32( zero, elapsed ), ones );
+      __m128i ready = _mm_andnot_si128(
+         changed, _mm_and_si128( due, _mm_xor_si128( isOn, stable ) ) );
+      stable = _mm_or_si128( _mm_and_si128( ready, isOn ),
+                             _mm_andnot_si128( ready, stable ) );
+
+      // CLOSED (1), OPENED (-1), or OPENED_LONG (-2).
+      __m128i opened = _mm_xor_si128( ones, _mm_and_si128( longPress, one ) );
+      __m128i result = _mm_and_si128(
+         ready, _mm_or_si128( _mm_and_si128( isOn, one ),
+                              _mm_andnot_si128( isOn, opened ) ) );
+
+      f = _mm_or_si128(
+         _mm_or_si128( _mm_and_si128( f, keepBits ),
+                       _mm_and_si128( isOn, unstableBit ) ),
+         _mm_or_si128( _mm_or_si128( _mm_and_si128( stable, stableBit ),
+                                     _mm_and_si128( ready, changedBit ) ),
+                       _mm_and_si128( longPress, longBit ) ) );
+
+      store4( info + i, f );
+      store4( events + i, result );
+      _mm_storeu_si128( (__m128i*)( stopMillis + i ), stop );
+      counts = _mm_sub_epi32( counts, ready );
+   }
+
+   // Add up the lanes.
+   counts = _mm_add_epi32( counts, _mm_srli_si128( counts, 8 ) );
+   counts = _mm_add_epi32( counts, _mm_srli_si128( counts, 4 ) );
+   uint16_t count = _mm_cvtsi128_si32( counts );
+
+   return count + pollScalar( currentMillis, i, num, levels, info,
+                              debounceMillis, stopMillis, events );
+}
+
+//============================================================================
+// Poll inputs 8 at a time with AVX2.
+//
+// Same as pollSse2() with twice the lanes.
+//
+DIGITALINPUTBATCH_AVX2
+uint16_t
+DigitalInputKernel::
+pollAvx2( int32_t currentMillis,
+          uint16_t num,
+          const uint8_t* levels,
+          uint8_t* info,
+          const uint8_t* debounceMillis,
+          int32_t* stopMillis,
+          int8_t* events )
+{
+   const __m256i zero = _mm256_setzero_si256();
+   const __m256i ones = _mm256_set1_epi32( -1 );
+   const __m256i one = _mm256_set1_epi32( 1 );
+   const __m256i now = _mm256_set1_epi32( currentMillis );
+   const __m256i longTime =
+      _mm256_set1_epi32( DIGITALINPUT_LONG_CLOSE_TIME );
+   const __m256i onBit = _mm256_set1_epi32( ON_STATE );
+   const __m256i unstableBit = _mm256_set1_epi32( UNSTABLE );
+   const __m256i stableBit = _mm256_set1_epi32( STABLE );
+   const __m256i changedBit = _mm256_set1_epi32( CHANGED );
+   const __m256i longBit = _mm256_set1_epi32( LONG_PRESS );
+   const __m256i keepBits = _mm256_set1_epi32( ON_STATE );
+
+   __m256i counts = zero;
+   uint16_t i = 0;
+   for ( ; i + 8 <= num; i += 8 )
+   {
+      __m256i f = load8( info + i );
+      __m256i stop =
+         _mm256_loadu_si256( (const __m256i*)( stopMillis + i ) );
+
+      __m256i high = _mm256_xor_si256(
+         _mm256_cmpeq_epi32( load8( levels + i ), zero ), ones );
+      __m256i onState =
+         _mm256_cmpeq_epi32( _mm256_and_si256( f, onBit ), onBit );
+      __m256i isOn =
+         _mm256_xor_si256( _mm256_xor_si256( high, onState ), ones );
+
+      __m256i unstable = _mm256_cmpeq_epi32(
+         _mm256_and_si256( f, unstableBit ), unstableBit );
+      __m256i stable = _mm256_cmpeq_epi32(
+         _mm256_and_si256( f, stableBit ), stableBit );
+      __m256i longPress = _mm256_cmpeq_epi32(
+         _mm256_and_si256( f, longBit ), longBit );
+      __m256i elapsed = _mm256_sub_epi32( now, stop );
+
+      __m256i changed = _mm256_xor_si256( isOn, unstable );
+      __m256i release = _mm256_andnot_si256( isOn, changed );
+      longPress = _mm256_or_si256(
+         _mm256_and_si256( release,
+                           _mm256_cmpgt_epi32( elapsed, longTime ) ),
+         _mm256_andnot_si256( release, longPress ) );
+      __m256i restart =
+         _mm256_add_epi32( now, load8( debounceMillis + i ) );
+      stop = _mm256_or_si256( _mm256_and_si256( changed, restart ),
+                              _mm256_andnot_si256( changed, stop ) );
+
+      __m256i due =
+         _mm256_xor_si256( _mm256_cmpgt_epi32( zero, elapsed ), ones );
+      __m256i ready = _mm256_andnot_si256(
+         changed,
+         _mm256_and_si256( due, _mm256_xor_si256( isOn, stable ) ) );
+      stable = _mm256_or_si256( _mm256_and_si256( ready, isOn ),
+                                _mm256_andnot_si256( ready, stable ) );
+
+      __m256i opened =
+         _mm256_xor_si256( ones, _mm256_and_si256( longPress, one ) );
+      __m256i result = _mm256_and_si256(
+         ready, _mm256_or_si256( _mm256_and_si256( isOn, one ),
+                                 _mm256_andnot_si256( isOn, opened ) ) );
+
+      f = _mm256_or_si256(
+         _mm256_or_si256( _mm256_and_si256( f, keepBits ),
+                          _mm256_and_si256( isOn, unstableBit ) ),
+         _mm256_or_si256(
+            _mm256_or_si256( _mm256_and_si256( stable, stableBit ),
+                             _mm256_and_si256( ready, changedBit ) ),
+            _mm256_and_si256( longPress, longBit ) ) );
+
+      store8( info + i, f );
+      store8( events + i, result );
+      _mm256_storeu_si256( (__m256i*)( stopMillis + i ), stop );
+      counts = _mm256_sub_epi32( counts, ready );
+   }
+
+   // Add up the lanes.
+   __m128i sum = _mm_add_epi32( _mm256_castsi256_si128( counts ),
+                                _mm256_extracti128_si256( counts, 1 ) );
+   sum = _mm_add_epi32( sum, _mm_srli_si128( sum, 8 ) );
+   sum = _mm_add_epi32( sum, _mm_srli_si128( sum, 4 ) );
+   uint16_t count = _mm_cvtsi128_si32( sum );
+
+   return count + pollScalar( currentMillis, i, num, levels, info,
+                              debounceMillis, stopMillis, events );
+}
+#endif
+
+//============================================================================
@@ -0,0 +1,281 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "DigitalInput.h"
+
+// Batch of debounced inputs polled together.
+//
+// Does the same debouncing as DigitalInput (same Status values at the
+// same times) for many inputs at once.  Meant for code that handles
+// a lot of inputs that aren't wired to pins - e.g. a gateway
+// debouncing remote switches or a simulation of many boards.  The
+// caller gathers the raw level (LOW/HIGH) of every input into an
+// array and passes that to poll() along with an array to get the
+// Status for each input.
+//
+// The state is kept as a structure of arrays (the Info bits, the
+// debounce times, and the stable times each in their own array)
+// instead of an array of DigitalInput objects.  That keeps the data
+// the poll needs together in memory and lets the kernel work on 4
+// (SSE2) or 8 (AVX2) inputs at a time with no branches.  The SIMD
+// kernels are used on x86 hosts if the CPU supports them (see
+// DigitalInputKernel).  Other machines (like the AVR) use the
+// scalar kernel which is the same code as DigitalInput::poll().
+//
+// Times are kept in 32 bits so roll overs happen at the same place
+// as a 32 bit long on the Arduino.  Changes are not recorded in the
+// FlightRecorder.
+//
+//= Example
+//
+//   DigitalInputBatch< 1024 > g_switches;
+//   uint8_t g_levels[1024];
+//   int8_t g_events[1024];
+//
+//   g_switches.init( LOW, 5 );
+//   ...
+//   readRemoteSwitches( g_levels );
+//   if ( g_switches.poll( millis(), g_levels, g_events ) )
+//   {
+//      for ( uint16_t i = 0; i < 1024; ++i )
+//      {
+//         if ( g_events[i] == DigitalInput::CLOSED ) ...
+//      }
+//   }
+//
+
+// Compile the SIMD kernels.  Only on x86 - other machines use the
+// scalar kernel.
+#ifndef DIGITALINPUTBATCH_SIMD
+#   if defined( __x86_64__ ) || defined( __i386__ )
+#      define DIGITALINPUTBATCH_SIMD 1
+#   else
+#      define DIGITALINPUTBATCH_SIMD 0
+#   endif
+#endif
+
+//============================================================================
+// Kernels that poll the arrays.  Used by DigitalInputBatch.
+//
+class DigitalInputKernel
+{
+public:
+   enum Kernel {
+      SCALAR = 0,
+      SSE2 = 1,
+      AVX2 = 2,
+   };
+
+   // Info bits (same order as the DigitalInput::Info bit field).
+   enum {
+      ON_STATE = 0x04,
+      UNSTABLE = 0x08,
+      STABLE = 0x10,
+      CHANGED = 0x20,
+      LONG_PRESS = 0x40,
+   };
+
+   // Kernel used by poll().  Defaults to the best one the CPU has.
+   static Kernel best();
+   static Kernel get();
+   static bool set( Kernel kernel );
+
+   static uint16_t poll( long currentMillis, uint16_t num,
+                         const uint8_t* levels, uint8_t* info,
+                         const uint8_t* debounceMillis, int32_t* stopMillis,
+                         int8_t* events );
+
+   // Each kernel.  The SIMD ones do the inputs that don't fill a full
+   // vector with the scalar kernel.
+   static uint16_t pollScalar( int32_t currentMillis, uint16_t begin,
+                               uint16_t end, const uint8_t* levels,
+                               uint8_t* info, const uint8_t* debounceMillis,
+                               int32_t* stopMillis, int8_t* events );
+#if DIGITALINPUTBATCH_SIMD
+   static uint16_t pollSse2( int32_t currentMillis, uint16_t num,
+                             const uint8_t* levels, uint8_t* info,
+                             const uint8_t* debounceMillis,
+                             int32_t* stopMillis, int8_t* events );
+   static uint16_t pollAvx2( int32_t currentMillis, uint16_t num,
+                             const uint8_t* levels, uint8_t* info,
+                             const uint8_t* debounceMillis,
+                             int32_t* stopMillis, int8_t* events );
+#endif
+};
+
+//============================================================================
+template< uint16_t NUM_INPUTS >
+class DigitalInputBatch
+{
+public:
+   // NOTE: Can't use constructors (even though we should) because
+   // Arduino sketch generally requires these to be global variables
+   // so we don't know that the ctor would be called after hardware
+   // init.
+   void init( uint8_t onState=LOW, uint8_t debounceMillis=5,
+              bool initialState=false );
+   void init( uint16_t input, uint8_t onState, uint8_t debounceMillis,
+              bool initialState=false );
+
+   // Returns the number of inputs that changed.  events[i] is the
+   // Status for input i (NONE if it didn't change).
+   uint16_t poll( long currentMillis, const uint8_t* levels,
+                  int8_t* events );
+
+   bool isOn( uint16_t input );     // with debouncing
+   bool pressed( uint16_t input );
+   bool released( uint16_t input );
+
+private:
+   // Info bits (see DigitalInputKernel) for each input.
+   uint8_t m_info[NUM_INPUTS];
+
+   // Number of milliseconds each input must be in the same state
+   // before it's reported.
+   uint8_t m_debounceMillis[NUM_INPUTS];
+
+   // Time in millis each input will be stable.  See
+   // DigitalInput::m_stopMillis.
+   int32_t m_stopMillis[NUM_INPUTS];
+};
+
+//============================================================================
+// Set up all of the inputs the same way.
+//
+//= INPUTS
+//- onState         LOW or HIGH, the level the inputs are at when they're on.
+//- debounceMillis  Number of milliseconds an input must be in the same
+//                  state before it's reported.
+//- initialState    Initial state of the inputs (0=off,1=on) to set.
+//
+template< uint16_t NUM_INPUTS >
+inline
+void
+DigitalInputBatch< NUM_INPUTS >::
+init( uint8_t onState,
+      uint8_t debounceMillis,
+      bool initialState )
+{
+   static_assert( NUM_INPUTS > 0, "DigitalInputBatch needs inputs" );
+
+   for ( uint16_t i = 0; i < NUM_INPUTS; ++i )
+   {
+      init( i, onState, debounceMillis, initialState );
+   }
+}
+
+//============================================================================
+// Set up one input.
+//
+// Same as DigitalInput::initShift().
+//
+//= INPUTS
+//- input           Index of the input to set up.
+//- onState         LOW or HIGH, the level the input is at when it's on.
+//- debounceMillis  Number of milliseconds the input must be in the same
+//                  state before it's reported.
+//- initialState    Initial state of the input (0=off,1=on) to set.
+//
+template< uint16_t NUM_INPUTS >
+inline
+void
+DigitalInputBatch< NUM_INPUTS >::
+init( uint16_t input,
+      uint8_t onState,
+      uint8_t debounceMillis,
+      bool initialState )
+{
+   m_info[input] = ( onState ? DigitalInputKernel::ON_STATE : 0 ) |
+                   ( initialState ? DigitalInputKernel::STABLE : 0 );
+   m_debounceMillis[input] = debounceMillis;
+   m_stopMillis[input] = 0;
+}
+
+//============================================================================
+// Poll the inputs.
+//
+// This should be called in each loop().
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- levels          Array of NUM_INPUTS levels (LOW or HIGH) read from
+//                  the inputs.
+//
+//= OUTPUTS
+//- events          Array of NUM_INPUTS Status values.  NONE if the
+//                  input didn't change, otherwise the same value
+//                  DigitalInput::poll() returns.
+//
+//= RETURNS
+//- Returns the number of inputs that changed.
+//
+template< uint16_t NUM_INPUTS >
+inline
+uint16_t
+DigitalInputBatch< NUM_INPUTS >::
+poll( long currentMillis,
+      const uint8_t* levels,
+      int8_t* events )
+{
+   PROFILE_SCOPE( "DigitalInputBatch::poll" );
+
+   return DigitalInputKernel::poll( currentMillis, NUM_INPUTS, levels,
+                                    m_info, m_debounceMillis, m_stopMillis,
+                                    events );
+}
+
+//============================================================================
+// Return true if the input is on (and stable).
+//
+template< uint16_t NUM_INPUTS >
+inline
+bool
+DigitalInputBatch< NUM_INPUTS >::
+isOn( uint16_t input )
+{
+   return m_info[input] & DigitalInputKernel::STABLE;
+}
+
+//============================================================================
+// Return true if the input has gone from open->closed in the last
+// poll() call.
+//
+template< uint16_t NUM_INPUTS >
+inline
+bool
+DigitalInputBatch< NUM_INPUTS >::
+pressed( uint16_t input )
+{
+   const uint8_t mask = DigitalInputKernel::STABLE |
+                        DigitalInputKernel::CHANGED;
+   return ( m_info[input] & mask ) == mask;
+}
+
+//============================================================================
+// Return true if the input has gone from closed->open in the last
+// poll() call.
+//
+template< uint16_t NUM_INPUTS >
+inline
+bool
+DigitalInputBatch< NUM_INPUTS >::
+released( uint16_t input )
+{
+   const uint8_t mask = DigitalInputKernel::STABLE |
+                        DigitalInputKernel::CHANGED;
+   return ( m_info[input] & mask ) == DigitalInputKernel::CHANGED;
+}
+
+//============================================================================
@@ -0,0 +1,542 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "DigitalInput.h"
+
+// Debounced input with the features picked at compile time.
+//
+// Runs the same debouncing code as DigitalInput (same Status values
+// at the same times) but the parts a sketch doesn't need are left out of
+// the code and the RAM instead of being checked on every poll():
+//
+// - SOURCE is where the level is read from.  DigitalInput checks
+//   pin/shift/analog on every poll().  Here it's a type and only its
+//   read() is compiled in:
+//
+//   DigitalInputPin      digitalRead() of a pin.
+//   DigitalInputPort     The pin's port input register (a load and a
+//                        mask instead of the digitalRead() pin table
+//                        lookups).  Pins only, not the analog only A6/A7.
+//   DigitalInputShift    A bit in a shift register buffer.
+//   DigitalInputAnalog   analogRead() > 128 for A6/A7.
+//
+// - LONG_PRESS false drops the long press timing and always reports
+//   OPENED on release.
+//
+// - CB is a state change callback bound at compile time.  The
+//   default (nullptr) has no callback so poll() doesn't check for
+//   one.  With a callback it's inlined into poll().
+//
+// See the README for the code size and time of each one.
+//
+//= Example
+//
+//   void buttonChangedCb( DigitalInput::Status status, int8_t id );
+//
+//   DigitalInputPolicy< DigitalInputPort, false, buttonChangedCb > g_button;
+//   DigitalInputPolicy< DigitalInputShift > g_switches[8];
+//   uint8_t g_shiftBuffer;
+//
+//   void setup()
+//   {
+//      g_button.init( DigitalInputPort( 2 ), LOW );
+//      for ( uint8_t i = 0; i < 8; ++i )
+//      {
+//         g_switches[i].init( DigitalInputShift( &g_shiftBuffer, i ), HIGH );
+//      }
+//   }
+//
+// DIGITALINPUT_COMPACT works the same as for DigitalInput.
+//
+
+//============================================================================
+// Source that reads a pin with digitalRead().
+//
+class DigitalInputPin
+{
+public:
+   DigitalInputPin( uint8_t pin=0 );
+
+   void begin( uint8_t onState );
+   uint8_t read();
+   uint8_t id();
+
+private:
+   uint8_t m_pin;
+};
+
+//============================================================================
+// Source that reads a pin from its port input register.
+//
+class DigitalInputPort
+{
+public:
+   DigitalInputPort( uint8_t pin=0 );
+
+   void begin( uint8_t onState );
+   uint8_t read();
+   uint8_t id();
+
+private:
+   volatile uint8_t* m_register;
+   uint8_t m_mask;
+   uint8_t m_pin;
+};
+
+//============================================================================
+// Source that reads a bit from a shift register buffer.  The buffer
+// should be loaded before init() so the first read is the initial
+// state.
+//
+class DigitalInputShift
+{
+public:
+   DigitalInputShift( uint8_t* buffer=0, uint8_t bitIndex=0 );
+
+   void begin( uint8_t onState );
+   uint8_t read();
+   uint8_t id();
+
+private:
+   uint8_t* m_buffer;
+
+   // Mask of the bit instead of the index.  The AVR shifts one bit
+   // per instruction so bitRead() with a variable index is a loop.
+   uint8_t m_mask;
+};
+
+//============================================================================
+// Source that reads an analog only pin (A6, A7 on Pro-Mini's).  An
+// external pull up (onState=LOW) or down (onState=HIGH) resistor MUST
+// be used.
+//
+class DigitalInputAnalog
+{
+public:
+   DigitalInputAnalog( uint8_t pin=0 );
+
+   void begin( uint8_t onState );
+   uint8_t read();
+   uint8_t id();
+
+private:
+   uint8_t m_pin;
+};
+
+//============================================================================
+// Runs the compile time callback.  The nullptr version does nothing.
+//
+template< DigitalInput::StateChangeCb CB >
+struct DigitalInputCallback
+{
+   static void run( DigitalInput::Status status, int8_t identifier );
+};
+
+template<>
+struct DigitalInputCallback< nullptr >
+{
+   static void run( DigitalInput::Status, int8_t ) {}
+};
+
+//============================================================================
+template< typename SOURCE, bool LONG_PRESS=true,
+          DigitalInput::StateChangeCb CB=nullptr >
+class DigitalInputPolicy
+{
+public:
+   typedef DigitalInput::Status Status;
+
+   // Sets the pin mode for pin sources and reads the initial state.
+   void init( const SOURCE& source, uint8_t onState=LOW,
+              uint8_t debounceMillis=5 );
+
+   // NOTE: long is better than unsigned long for milli values - code
+   // can ignore roll overs for duration computations.  For details,
+   // see: http://playground.arduino.cc/Code/TimingRollover
+   Status poll( long currentMillis, int8_t identifier=0 );
+   long deadline( long currentMillis );
+
+   bool isOn();     // with debouncing
+   bool isOnRaw();  // without debouncing
+   bool pressed();
+   bool released();
+
+private:
+   SOURCE m_source;
+
+   // Same as DigitalInput::Info without the source bits.
+   struct Info
+   {
+      uint8_t onState : 1;
+      uint8_t unstable : 1;
+      uint8_t stable : 1;
+      uint8_t changed : 1;
+      uint8_t longPress : 1;
+   };
+
+   Info m_info;
+
+   // Number of milliseconds the input must be in the same state
+   // before it's reported.
+   uint8_t m_debounceMillis;
+
+   // Time in millis for a stable (debounced) value.  See DigitalInput.
+#if defined( DIGITALINPUT_COMPACT )
+   int16_t m_stopMillis;
+#else
+   long m_stopMillis;
+#endif
+};
+
+//============================================================================
+// Create the source.
+//
+//= INPUTS
+//- pin   The Arduino pin the input is connected to.
+//
+inline
+DigitalInputPin::
+DigitalInputPin( uint8_t pin )
+   : m_pin( pin )
+{
+}
+
+//============================================================================
+// Set the pin to INPUT_PULLUP or INPUT if onState is LOW or HIGH
+// respectively.
+//
+inline
+void
+DigitalInputPin::
+begin( uint8_t onState )
+{
+   pinMode( m_pin, onState == HIGH ? INPUT : INPUT_PULLUP );
+}
+
+//============================================================================
+inline
+uint8_t
+DigitalInputPin::
+read()
+{
+   return digitalRead( m_pin );
+}
+
+//============================================================================
+// Id for the FlightRecorder.
+//
+inline
+uint8_t
+DigitalInputPin::
+id()
+{
+   return m_pin;
+}
+
+//============================================================================
+// Create the source.
+//
+//= INPUTS
+//- pin   The Arduino pin the input is connected to.
+//
+inline
+DigitalInputPort::
+DigitalInputPort( uint8_t pin )
+   : m_register( 0 ),
+     m_mask( 0 ),
+     m_pin( pin )
+{
+}
+
+//============================================================================
+// Set the pin mode and look up the port register.
+//
+inline
+void
+DigitalInputPort::
+begin( uint8_t onState )
+{
+   pinMode( m_pin, onState == HIGH ? INPUT : INPUT_PULLUP );
+   m_register = portInputRegister( digitalPinToPort( m_pin ) );
+   m_mask = digitalPinToBitMask( m_pin );
+}
+
+//============================================================================
+inline
+uint8_t
+DigitalInputPort::
+read()
+{
+   return ( *m_register & m_mask ) ? HIGH : LOW;
+}
+
+//============================================================================
+// Id for the FlightRecorder.
+//
+inline
+uint8_t
+DigitalInputPort::
+id()
+{
+   return m_pin;
+}
+
+//============================================================================
+// Create the source.
+//
+//= INPUTS
+//- buffer     Pointer to the integer the shift register is read into.
+//             This variable must remain in scope with the input.
+//- bitIndex   Bit index inside *buffer of the bit to read.
+//
+inline
+DigitalInputShift::
+DigitalInputShift( uint8_t* buffer,
+                   uint8_t bitIndex )
+   : m_buffer( buffer ),
+     m_mask( 1 << bitIndex )
+{
+}
+
+//============================================================================
+// Nothing to set up.
+//
+inline
+void
+DigitalInputShift::
+begin( uint8_t )
+{
+}
+
+//============================================================================
+inline
+uint8_t
+DigitalInputShift::
+read()
+{
+   return ( *m_buffer & m_mask ) ? HIGH : LOW;
+}
+
+//============================================================================
+// Id for the FlightRecorder.  That's the bit index.  Only used when
+// the input changes so the loop doesn't matter.
+//
+inline
+uint8_t
+DigitalInputShift::
+id()
+{
+   uint8_t index = 0;
+   while ( ( m_mask >> index ) > 1 )
+   {
+      index++;
+   }
+   return index;
+}
+
+//============================================================================
+// Create the source.
+//
+//= INPUTS
+//- pin   The Arduino analog pin the input is connected to.
+//
+inline
+DigitalInputAnalog::
+DigitalInputAnalog( uint8_t pin )
+   : m_pin( pin )
+{
+}
+
+//============================================================================
+// Set the pin to INPUT.  The pull resistor is external.
+//
+inline
+void
+DigitalInputAnalog::
+begin( uint8_t )
+{
+   pinMode( m_pin, INPUT );
+}
+
+//============================================================================
+inline
+uint8_t
+DigitalInputAnalog::
+read()
+{
+   return analogRead( m_pin ) > 128 ? HIGH : LOW;
+}
+
+//============================================================================
+// Id for the FlightRecorder.
+//
+inline
+uint8_t
+DigitalInputAnalog::
+id()
+{
+   return m_pin;
+}
+
+//============================================================================
+template< DigitalInput::StateChangeCb CB >
+inline
+void
+DigitalInputCallback< CB >::
+run( DigitalInput::Status status,
+     int8_t identifier )
+{
+   CB( status, identifier );
+}
+
+//============================================================================
+// Set up the input.
+//
+//= INPUTS
+//- source          The source to read the input from.
+//- onState         LOW or HIGH, the state the input is in when it's on.
+//- debounceMillis  Number of milliseconds the input must be in the same state
+//                  before it's reported.
+//
+template< typename SOURCE, bool LONG_PRESS, DigitalInput::StateChangeCb CB >
+inline
+void
+DigitalInputPolicy< SOURCE, LONG_PRESS, CB >::
+init( const SOURCE& source,
+      uint8_t onState,
+      uint8_t debounceMillis )
+{
+   m_source = source;
+   m_source.begin( onState );
+   m_info.onState = onState;
+   m_info.unstable = 0;
+   m_info.changed = 0;
+   m_info.longPress = 0;
+   m_debounceMillis = debounceMillis;
+   m_stopMillis = 0;
+
+   // Get the initial input value.  Assume the first read is stable.
+   m_info.stable = isOnRaw();
+}
+
+//============================================================================
+// Poll the input.
+//
+// This should be called in each loop().  Runs the CB callback (if
+// there is one) if the status changes.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- identifier      Optional, arbitrary identifer to pass to the callback.
+//
+//= RETURNS
+//- Returns the same values as DigitalInput::poll().  OPENED_LONG is
+//  only returned if LONG_PRESS is true.
+//
+template< typename SOURCE, bool LONG_PRESS, DigitalInput::StateChangeCb CB >
+inline
+DigitalInput::Status
+DigitalInputPolicy< SOURCE, LONG_PRESS, CB >::
+poll( long currentMillis,
+      int8_t identifier )
+{
+   PROFILE_SCOPE( "DigitalInputPolicy::poll" );
+
+   Status result = DigitalInput::debounce< LONG_PRESS >(
+      m_info, m_stopMillis, m_debounceMillis, isOnRaw(), currentMillis,
+      m_source.id() );
+   if ( result != DigitalInput::NONE )
+   {
+      DIGITALINPUT_DBG( DIGITALINPUT_MSG_CHANGE,
+                        "DigitalInput status change ", result );
+      DigitalInputCallback< CB >::run( result, identifier );
+   }
+
+   return result;
+}
+
+//============================================================================
+// Return the time poll() next has something to do.
+//
+// See DigitalInput::deadline().
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the time in millis poll() should be called by.
+//
+template< typename SOURCE, bool LONG_PRESS, DigitalInput::StateChangeCb CB >
+inline
+long
+DigitalInputPolicy< SOURCE, LONG_PRESS, CB >::
+deadline( long currentMillis )
+{
+   return DigitalInput::debounceDeadline(
+      m_info, DigitalInput::sinceStop( currentMillis, m_stopMillis ),
+      isOnRaw(), currentMillis );
+}
+
+//============================================================================
+// Return true if the input is currently activated (and stable).
+//
+template< typename SOURCE, bool LONG_PRESS, DigitalInput::StateChangeCb CB >
+inline
+bool
+DigitalInputPolicy< SOURCE, LONG_PRESS, CB >::
+isOn()
+{
+   return m_info.stable;
+}
+
+//============================================================================
+// Return if the input is currently on ignoring the debouncing.
+//
+template< typename SOURCE, bool LONG_PRESS, DigitalInput::StateChangeCb CB >
+inline
+bool
+DigitalInputPolicy< SOURCE, LONG_PRESS, CB >::
+isOnRaw()
+{
+   return m_source.read() == m_info.onState;
+}
+
+//============================================================================
+// Return true if the input has gone from open->closed in the last
+// poll() call.
+//
+template< typename SOURCE, bool LONG_PRESS, DigitalInput::StateChangeCb CB >
+inline
+bool
+DigitalInputPolicy< SOURCE, LONG_PRESS, CB >::
+pressed()
+{
+   return m_info.stable && m_info.changed;
+}
+
+//============================================================================
+// Return true if the input has gone from closed->open in the last
+// poll() call.
+//
+template< typename SOURCE, bool LONG_PRESS, DigitalInput::StateChangeCb CB >
+inline
+bool
+DigitalInputPolicy< SOURCE, LONG_PRESS, CB >::
+released()
+{
+   return ! m_info.stable && m_info.changed;
+}
+
+//============================================================================
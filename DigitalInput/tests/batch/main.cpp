@@ -0,0 +1,226 @@
+#include "HostSim.h"
+#include "DigitalInputBatch.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// DigitalInputBatch test and benchmark.
+//
+// Runs a few thousand bouncing switches (random on state, debounce
+// time, press lengths) through an array of DigitalInput objects and
+// through DigitalInputBatch with each kernel the CPU supports.  Checks
+// every kernel reports exactly the same events as DigitalInput::poll()
+// on every poll.  The run starts just before the 32 bit millis() roll
+// over to check the batch handles it the same way.
+//
+// Then times each one polling the inputs and prints the ns per input
+// per poll.
+//
+// Compile and run:
+// g++ -O2 -DFLIGHTRECORDER_ENABLE=0 -I../../DigitalInput -I../../../HostSim -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -o test main.cpp ../../DigitalInput/DigitalInput.cpp ../../DigitalInput/DigitalInputBatch.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+// Not a multiple of 8 so the SIMD kernels do some inputs with the
+// scalar code.
+static const uint16_t NUM = 4099;
+static const long START_MILLIS = 0x7FFFFFFFL - 60000;
+static const long CHECK_MILLIS = 300000;
+static const int BENCH_FRAMES = 1000;
+static const int BENCH_REPEAT = 20;
+
+static DigitalInput s_inputs[NUM];
+static DigitalInputBatch< NUM > s_batch[3];
+static uint8_t s_levels[NUM];
+static int8_t s_events[3][NUM];
+
+static const char* KERNEL_NAMES[3] = { "scalar", "SSE2", "AVX2" };
+
+//============================================================================
+// Simulated switches.  Each one changes state now and then and
+// bounces for a few ms after each change.
+//
+static uint32_t s_seed = 1;
+
+static uint32_t
+random32()
+{
+   s_seed ^= s_seed << 13;
+   s_seed ^= s_seed >> 17;
+   s_seed ^= s_seed << 5;
+   return s_seed;
+}
+
+struct Switch
+{
+   uint8_t level;
+   uint8_t bounce;
+};
+
+static Switch s_switches[NUM];
+
+static void
+step()
+{
+   for ( uint16_t i = 0; i < NUM; ++i )
+   {
+      Switch& s = s_switches[i];
+      uint32_t r = random32();
+      if ( s.bounce )
+      {
+         s.bounce--;
+         if ( r & 1 )
+         {
+            s_levels[i] ^= 1;
+         }
+         if ( ! s.bounce )
+         {
+            s_levels[i] = s.level;
+         }
+      }
+      else if ( r % 1500 == 0 )
+      {
+         s.level ^= 1;
+         s.bounce = ( r >> 16 ) % 10;
+         s_levels[i] = s.bounce ? ! s.level : s.level;
+      }
+   }
+}
+
+//============================================================================
+static void
+init()
+{
+   s_seed = 1;
+   for ( uint16_t i = 0; i < NUM; ++i )
+   {
+      uint32_t r = random32();
+      uint8_t onState = r & 1 ? HIGH : LOW;
+      uint8_t debounce = 1 + ( r >> 8 ) % 20;
+      bool initial = ( r >> 4 ) & 1;
+
+      s_switches[i].level = initial ? onState : ! onState;
+      s_switches[i].bounce = 0;
+      s_levels[i] = s_switches[i].level;
+
+      s_inputs[i].initShift( &s_levels[i], 0, onState, debounce, initial );
+      for ( int k = 0; k < 3; ++k )
+      {
+         s_batch[k].init( i, onState, debounce, initial );
+      }
+   }
+}
+
+//============================================================================
+int
+main()
+{
+   int numKernels = DigitalInputKernel::best() + 1;
+   std::cout << "Kernels: ";
+   for ( int k = 0; k < numKernels; ++k )
+   {
+      std::cout << KERNEL_NAMES[k] << " ";
+   }
+   std::cout << std::endl;
+
+   // Check every poll.
+   init();
+   bool ok = true;
+   long numEvents = 0;
+   int numTypes[4] = { 0, 0, 0, 0 };
+   for ( long t = START_MILLIS; t < START_MILLIS + CHECK_MILLIS && ok; ++t )
+   {
+      step();
+      for ( int k = 0; k < numKernels; ++k )
+      {
+         DigitalInputKernel::set( (DigitalInputKernel::Kernel)k );
+         s_batch[k].poll( (int32_t)t, s_levels, s_events[k] );
+      }
+
+      for ( uint16_t i = 0; i < NUM; ++i )
+      {
+         DigitalInput::Status status = s_inputs[i].poll( t );
+         if ( status != DigitalInput::NONE )
+         {
+            numEvents++;
+            numTypes[status + 2]++;
+         }
+         for ( int k = 0; k < numKernels; ++k )
+         {
+            if ( s_events[k][i] != status ||
+                 s_batch[k].isOn( i ) != s_inputs[i].isOn() ||
+                 s_batch[k].pressed( i ) != s_inputs[i].pressed() ||
+                 s_batch[k].released( i ) != s_inputs[i].released() )
+            {
+               std::cout << "FAILED: " << KERNEL_NAMES[k] << " input " << i
+                         << " at " << t << " " << (int)s_events[k][i]
+                         << " != " << status << std::endl;
+               ok = false;
+            }
+         }
+      }
+   }
+   std::cout << numEvents << " events (" << numTypes[3] << " closed, "
+             << numTypes[1] << " opened, " << numTypes[0]
+             << " opened long) matched" << std::endl;
+   ok &= numTypes[3] > 0 && numTypes[1] > 0 && numTypes[0] > 0;
+
+   // Benchmark with recorded frames so the switch simulation isn't
+   // timed.
+   std::vector< uint8_t > frames( (size_t)BENCH_FRAMES * NUM );
+   init();
+   for ( int f = 0; f < BENCH_FRAMES; ++f )
+   {
+      step();
+      memcpy( &frames[(size_t)f * NUM], s_levels, NUM );
+   }
+
+   long polls = (long)BENCH_FRAMES * BENCH_REPEAT;
+   double scalarNs = 0;
+   long sum = 0;
+   for ( int k = -1; k < numKernels; ++k )
+   {
+      init();
+      std::chrono::steady_clock::time_point start =
+         std::chrono::steady_clock::now();
+      for ( long p = 0; p < polls; ++p )
+      {
+         memcpy( s_levels, &frames[( p % BENCH_FRAMES ) * NUM], NUM );
+         if ( k < 0 )
+         {
+            for ( uint16_t i = 0; i < NUM; ++i )
+            {
+               sum += s_inputs[i].poll( p );
+            }
+         }
+         else
+         {
+            DigitalInputKernel::set( (DigitalInputKernel::Kernel)k );
+            sum += s_batch[k].poll( p, s_levels, s_events[k] );
+         }
+      }
+      double ns = std::chrono::duration< double, std::nano >(
+         std::chrono::steady_clock::now() - start ).count() / polls / NUM;
+
+      if ( k < 0 )
+      {
+         scalarNs = ns;
+         std::cout << "DigitalInput::poll(): " << ns << " ns/input"
+                   << std::endl;
+      }
+      else
+      {
+         std::cout << "DigitalInputBatch " << KERNEL_NAMES[k] << ": " << ns
+                   << " ns/input (" << scalarNs / ns << "x)" << std::endl;
+      }
+   }
+   if ( sum == 1 )
+   {
+      std::cout << std::endl;
+   }
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
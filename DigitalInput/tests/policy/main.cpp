@@ -0,0 +1,263 @@
+#include "HostSim.h"
+#include "DigitalInputPolicy.h"
+#include <chrono>
+#include <iostream>
+
+// DigitalInputPolicy test and benchmark.
+//
+// Runs a bouncing switch with short and long presses into a pin, a
+// shift register bit, and an analog pin for 20 simulated minutes.
+// Checks every DigitalInputPolicy configuration reports the same
+// events on every poll as DigitalInput with the same source (OPENED
+// for OPENED_LONG without LONG_PRESS) and that the bound callback
+// runs once per event.
+//
+// Then times each one polling 64 inputs per loop and prints the ns per
+// poll.  Pin reads go through the HostSim digitalRead() so those are
+// only useful compared to each other.
+//
+// Compile and run:
+// g++ -O2 -DFLIGHTRECORDER_ENABLE=0 -I../../DigitalInput -I../../../HostSim -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -o test main.cpp ../../DigitalInput/DigitalInput.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint8_t PIN = 2;
+static const uint8_t SHIFT_BIT = 5;
+static const uint8_t ANALOG_PIN = A6;
+static const long CHECK_MILLIS = 1200000;
+static const long BENCH_MILLIS = 100000;
+static const int BENCH_INPUTS = 64;
+
+static uint8_t s_shift = 0;
+static long s_callbacks = 0;
+static DigitalInput::Status s_lastCallback = DigitalInput::NONE;
+
+static void
+changedCb( DigitalInput::Status status,
+           int8_t identifier )
+{
+   s_callbacks++;
+   s_lastCallback = identifier == 7 ? status : DigitalInput::NONE;
+}
+
+typedef DigitalInputPolicy< DigitalInputPin > PinInput;
+typedef DigitalInputPolicy< DigitalInputPort > PortInput;
+typedef DigitalInputPolicy< DigitalInputPort, false > PortShortInput;
+typedef DigitalInputPolicy< DigitalInputPort, true, changedCb > PortCbInput;
+typedef DigitalInputPolicy< DigitalInputShift > ShiftInput;
+typedef DigitalInputPolicy< DigitalInputShift, false > ShiftShortInput;
+typedef DigitalInputPolicy< DigitalInputAnalog > AnalogInput;
+
+//============================================================================
+// Simulated switch.  Off for a while, then pressed for 30 ms to 4
+// seconds, with a few ms of bouncing on each edge.
+//
+static uint32_t s_seed = 1;
+
+static uint32_t
+random32()
+{
+   s_seed ^= s_seed << 13;
+   s_seed ^= s_seed >> 17;
+   s_seed ^= s_seed << 5;
+   return s_seed;
+}
+
+static bool s_pressed = false;
+static long s_next = 0;
+static int s_bounce = 0;
+
+// Returns true if the switch is on (pressed) at this milli.
+static bool
+step( long t )
+{
+   if ( t - s_next >= 0 )
+   {
+      s_pressed = ! s_pressed;
+      s_next = t + ( s_pressed ? 30 + random32() % 4000 :
+                     50 + random32() % 3000 );
+      s_bounce = random32() % 8;
+   }
+   if ( s_bounce )
+   {
+      s_bounce--;
+      if ( random32() & 1 )
+      {
+         return ! s_pressed;
+      }
+   }
+   return s_pressed;
+}
+
+// Set the sources.  Pin and analog pin are pulled up (on = LOW), the
+// shift register bit is on = HIGH.
+static void
+setSources( bool on )
+{
+   HostSim::setPin( PIN, on ? LOW : HIGH );
+   HostSim::setAnalog( ANALOG_PIN, on ? 0 : 1023 );
+   bitWrite( s_shift, SHIFT_BIT, on );
+}
+
+//============================================================================
+template< typename T >
+static bool
+same( T& input,
+      DigitalInput& ref,
+      DigitalInput::Status status,
+      DigitalInput::Status refStatus )
+{
+   return status == refStatus && input.isOn() == ref.isOn() &&
+      input.pressed() == ref.pressed() && input.released() == ref.released();
+}
+
+static bool
+check()
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   s_seed = 1;
+   setSources( false );
+
+   DigitalInput pinRef;
+   DigitalInput shiftRef;
+   DigitalInput analogRef;
+   pinRef.init( PIN, LOW );
+   shiftRef.initShift( &s_shift, SHIFT_BIT, HIGH );
+   analogRef.init( ANALOG_PIN, LOW, DigitalInput::ANALOG );
+
+   PinInput pin;
+   PortInput port;
+   PortShortInput portShort;
+   PortCbInput portCb;
+   ShiftInput shift;
+   AnalogInput analog;
+   pin.init( DigitalInputPin( PIN ), LOW );
+   port.init( DigitalInputPort( PIN ), LOW );
+   portShort.init( DigitalInputPort( PIN ), LOW );
+   portCb.init( DigitalInputPort( PIN ), LOW );
+   shift.init( DigitalInputShift( &s_shift, SHIFT_BIT ), HIGH );
+   analog.init( DigitalInputAnalog( ANALOG_PIN ), LOW );
+
+   long events[3] = { 0, 0, 0 };
+   for ( long t = 0; t < CHECK_MILLIS; ++t )
+   {
+      setSources( step( t ) );
+      HostSim::advance( 1000 );
+
+      DigitalInput::Status ref = pinRef.poll( t );
+      DigitalInput::Status refShort =
+         ref == DigitalInput::OPENED_LONG ? DigitalInput::OPENED : ref;
+      s_lastCallback = DigitalInput::NONE;
+      bool ok = same( pin, pinRef, pin.poll( t ), ref ) &&
+         same( port, pinRef, port.poll( t ), ref ) &&
+         same( portShort, pinRef, portShort.poll( t ), refShort ) &&
+         same( portCb, pinRef, portCb.poll( t, 7 ), ref ) &&
+         s_lastCallback == ref &&
+         same( shift, shiftRef, shift.poll( t ), shiftRef.poll( t ) ) &&
+         same( analog, analogRef, analog.poll( t ), analogRef.poll( t ) );
+      if ( ! ok )
+      {
+         std::cout << "FAILED: at " << t << std::endl;
+         return false;
+      }
+      if ( ref != DigitalInput::NONE )
+      {
+         events[ref == DigitalInput::CLOSED ? 0 :
+                ref == DigitalInput::OPENED_LONG ? 1 : 2]++;
+      }
+   }
+
+   std::cout << events[0] << " closed, " << events[2] << " opened, "
+             << events[1] << " opened long matched" << std::endl;
+   return events[0] > 0 && events[1] > 0 && events[2] > 0 &&
+      s_callbacks == events[0] + events[1] + events[2];
+}
+
+//============================================================================
+// Time polling BENCH_INPUTS inputs every milli.  Returns ns per poll.
+//
+template< typename T >
+static double
+bench( T* inputs )
+{
+   s_seed = 1;
+   s_pressed = false;
+   s_next = 0;
+   bool last = false;
+   setSources( false );
+
+   long sum = 0;
+   std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+   for ( long t = 0; t < BENCH_MILLIS; ++t )
+   {
+      bool on = step( t );
+      if ( on != last )
+      {
+         setSources( on );
+         last = on;
+      }
+      for ( int i = 0; i < BENCH_INPUTS; ++i )
+      {
+         sum += inputs[i].poll( t );
+      }
+   }
+   double ns = std::chrono::duration< double, std::nano >(
+      std::chrono::steady_clock::now() - start ).count() / BENCH_MILLIS /
+      BENCH_INPUTS;
+   return sum == 1 ? 0 : ns;
+}
+
+template< typename T, typename S >
+static double
+benchPolicy( const S& source,
+             uint8_t onState )
+{
+   static T inputs[BENCH_INPUTS];
+   for ( int i = 0; i < BENCH_INPUTS; ++i )
+   {
+      inputs[i].init( source, onState );
+   }
+   return bench( inputs );
+}
+
+//============================================================================
+int
+main()
+{
+   bool ok = check();
+
+   static DigitalInput refs[BENCH_INPUTS];
+   for ( int i = 0; i < BENCH_INPUTS; ++i )
+   {
+      refs[i].init( PIN, LOW );
+   }
+   double pinRef = bench( refs );
+   for ( int i = 0; i < BENCH_INPUTS; ++i )
+   {
+      refs[i].initShift( &s_shift, SHIFT_BIT, HIGH );
+   }
+   double shiftRef = bench( refs );
+
+   double pin = benchPolicy< PinInput >( DigitalInputPin( PIN ), LOW );
+   double port = benchPolicy< PortInput >( DigitalInputPort( PIN ), LOW );
+   double portShort =
+      benchPolicy< PortShortInput >( DigitalInputPort( PIN ), LOW );
+   double shift = benchPolicy< ShiftInput >(
+      DigitalInputShift( &s_shift, SHIFT_BIT ), HIGH );
+   double shiftShort = benchPolicy< ShiftShortInput >(
+      DigitalInputShift( &s_shift, SHIFT_BIT ), HIGH );
+
+   std::cout << "ns/poll: DigitalInput pin " << pinRef << ", policy pin "
+             << pin << ", port " << port << ", port no long " << portShort
+             << std::endl;
+   std::cout << "ns/poll: DigitalInput shift " << shiftRef
+             << ", policy shift " << shift << ", shift no long "
+             << shiftShort << std::endl;
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
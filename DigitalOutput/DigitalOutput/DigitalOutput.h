@@ -14,6 +14,8 @@
 // this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 #include "Arduino.h"
+#include "FlightRecorder.h"
+#include "Profile.h"
 #include "Timer.h"
 
 // Simple digital output control class for LED's, relays, etc.
@@ -37,6 +39,11 @@
 // should be added as well LED's):
 //    pin -> LOAD- -> LOAD+ -> VCC
 //
+// Loads on PWM capable pins can also be partially powered with
+// pwm().  The duty cycle is in on/off terms so it works with either
+// onState.  Shift register outputs can't do PWM so any non-zero duty
+// cycle just turns them on.
+//
 class DigitalOutput
 {
 public:
@@ -55,16 +62,18 @@ public:
    // overs for duration computations.  For details, see:
    // http://playground.arduino.cc/Code/TimingRollover
    void poll( long currentMillis );
+   long deadline( long currentMillis );
    
    bool isOn();
    
-   void on( long durationMillis=0 );
+   bool on( long durationMillis=0 );
    void off();
    void toggle();
+   void pwm( uint8_t duty );
 
    void blinkSlow( int num=-1 );
    void blinkFast( int num=-1 );
-   void blink( int num, long blinkMillis );
+   bool blink( int num, long blinkMillis );
 
 private:
    // If m_info.isPin is 1, then m_pin is the pin to use and m_buffer
@@ -89,6 +98,9 @@ private:
       // During blinking, this will toggle with the device vs isActive
       // which will stay 1 during blinking.
       uint8_t isOn : 1;
+
+      // isActive value last recorded in the FlightRecorder.
+      uint8_t recorded : 1;
    } Info;
 
    // Output info. see above.
@@ -120,6 +132,7 @@ init( uint8_t pin,
    m_info.onState = onState;
    m_info.isActive = 0;
    m_info.isOn = 0;
+   m_info.recorded = 0;
    
    pinMode( m_pin, OUTPUT );
    off();
@@ -146,6 +159,7 @@ initShift( uint8_t* buffer,
    m_info.onState = onState;
    m_info.isActive = 0;
    m_info.isOn = 0;
+   m_info.recorded = 0;
 
    off();
 }
@@ -196,8 +210,12 @@ blinkFast( int num )
 //- num          The number of times to blink or -1 to blink forever.
 //- blinkMillis  Number of milliseconds to use for each on and off period.
 //
+//= RETURNS
+//- Returns false if the period is too long for TIMER_COMPACT.  Any
+//  blinking stops and the load isn't changed.
+//
 inline
-void
+bool
 DigitalOutput::
 blink( int num,
        long blinkMillis )
@@ -212,10 +230,14 @@ blink( int num,
       num = 2 * num - 1;
    }
 
-   m_timer.repeat( blinkMillis, num );
+   if ( ! m_timer.repeat( blinkMillis, num ) )
+   {
+      return false;
+   }
 
    m_info.isActive = 1;
    setState( m_info.onState );
+   return true;
 }
 
 //============================================================================
@@ -227,15 +249,20 @@ blink( int num,
 //- durationMillis   Number of milliseconds to turn on for. If this is
 //                   zero (default), then it will stay on until off() is
 //                   called.
+//
+//= RETURNS
+//- Returns false if the duration is too long for TIMER_COMPACT.  Any
+//  blinking stops and the load isn't turned on.
+//
 inline
-void
+bool
 DigitalOutput::
 on( long durationMillis )
 {
    // blink once for the input duration.
    if ( durationMillis )
    {
-      blink( 1, durationMillis );
+      return blink( 1, durationMillis );
    }
    // Turn the pin on and turn off any blinking that might be happening.
    else
@@ -245,6 +272,7 @@ on( long durationMillis )
    }
 
    m_info.isActive = 1;
+   return true;
 }
 
 //============================================================================
@@ -282,6 +310,37 @@ toggle()
    }
 }
 
+//============================================================================
+// Partially power the load with PWM.
+//
+// This will also cancel any remaining blinks.  The pin must support
+// analogWrite().  Call on() or off() to stop the PWM.
+//
+//= INPUTS
+//- duty    Fraction of the time the load is on: 0 is off, 255 is on.
+//
+inline
+void
+DigitalOutput::
+pwm( uint8_t duty )
+{
+   if ( duty == 0 )
+   {
+      off();
+      return;
+   }
+   else if ( duty == 255 || ! m_info.isPin )
+   {
+      on();
+      return;
+   }
+
+   analogWrite( m_pin, m_info.onState == HIGH ? duty : 255 - duty );
+   m_info.isOn = 1;
+   m_info.isActive = 1;
+   m_timer.off();
+}
+
 //============================================================================
 // Poll the object.
 //
@@ -295,6 +354,8 @@ void
 DigitalOutput::
 poll( long currentMillis )
 {
+   PROFILE_SCOPE( "DigitalOutput::poll" );
+
    // If the timer triggers, toggle the state.
    int8_t left = m_timer.poll( currentMillis );
    if ( left )
@@ -310,6 +371,43 @@ poll( long currentMillis )
          setState( ! m_info.isOn );
       }
    }
+
+#if FLIGHTRECORDER_ENABLE
+   // Record on/blinking vs off changes (not each blink).  on() and
+   // off() don't have the time so changes are recorded here.
+   if ( m_info.isActive != m_info.recorded )
+   {
+      FlightRecorder::record( currentMillis, FlightRecorder::DIGITAL_OUTPUT,
+                              m_pin, m_info.recorded, m_info.isActive );
+      m_info.recorded = m_info.isActive;
+   }
+#endif
+}
+
+//============================================================================
+// Return the time poll() next has something to do.
+//
+// That's the next blink (or the end of a timed on()).
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the time in millis poll() should be called by.
+//
+inline
+long
+DigitalOutput::
+deadline( long currentMillis )
+{
+#if FLIGHTRECORDER_ENABLE
+   // on() or off() was called and poll() hasn't recorded it yet.
+   if ( m_info.isActive != m_info.recorded )
+   {
+      return currentMillis;
+   }
+#endif
+   return m_timer.deadline( currentMillis );
 }
 
 //============================================================================
@@ -0,0 +1,175 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "FlightRecorder.h"
+
+// Marks s_events as initialized.  Anything else in s_magic after a
+// reset means the memory is garbage (power on).
+static const uint16_t MAGIC = 0xF17E;
+
+// State of a slot that hasn't been written.  Can't be a real event
+// since RESET events have 0 for the states.
+static const uint8_t EMPTY = 0xFF;
+
+// Keep the events through a reset.  The C runtime doesn't clear
+// .noinit so begin() checks s_magic to see if they're valid.
+#ifdef __AVR__
+#define FLIGHTRECORDER_NOINIT __attribute__ ( ( section( ".noinit" ) ) )
+#else
+#define FLIGHTRECORDER_NOINIT
+#endif
+
+FlightRecorder::Event
+FlightRecorder::s_events[FLIGHTRECORDER_SIZE] FLIGHTRECORDER_NOINIT;
+uint8_t FlightRecorder::s_next FLIGHTRECORDER_NOINIT;
+uint16_t FlightRecorder::s_magic FLIGHTRECORDER_NOINIT;
+long FlightRecorder::s_lastMillis = 0;
+uint8_t FlightRecorder::s_resetFlags = 0;
+
+//============================================================================
+// Start recording.
+//
+// Call this at the start of setup().  Keeps the events from before the
+// reset if they survived, otherwise clears the buffer.  Then adds a
+// RESET event with the reset flags.
+//
+void
+FlightRecorder::
+begin()
+{
+#ifdef MCUSR
+   s_resetFlags = MCUSR;
+   MCUSR = 0;
+#endif
+
+   if ( s_magic != MAGIC || ( s_next & ~( FLIGHTRECORDER_SIZE - 1 ) ) )
+   {
+      clear();
+   }
+
+   // The time since the last event before the reset isn't known.
+   s_lastMillis = millis();
+   Event& e = s_events[s_next];
+   e.dtMillis = 0xFFFF;
+   e.id = s_resetFlags;
+   e.state = RESET << 6;
+   s_next = ( s_next + 1 ) & ( FLIGHTRECORDER_SIZE - 1 );
+}
+
+//============================================================================
+// Throw away all the events.
+//
+void
+FlightRecorder::
+clear()
+{
+   memset( s_events, EMPTY, sizeof( s_events ) );
+   s_next = 0;
+   s_magic = MAGIC;
+}
+
+//============================================================================
+// Return the number of events in the buffer.
+//
+uint16_t
+FlightRecorder::
+count()
+{
+   // Slots fill in order so if the next one is empty, the buffer
+   // hasn't wrapped yet.
+   if ( s_events[s_next].state == EMPTY )
+   {
+      return s_next;
+   }
+   return FLIGHTRECORDER_SIZE;
+}
+
+//============================================================================
+// Get an event.
+//
+//= INPUTS
+//- index   Event index from 0 (oldest) to count() - 1 (newest).
+//
+//= RETURNS
+//- Returns the event.
+//
+FlightRecorder::Event
+FlightRecorder::
+event( uint16_t index )
+{
+   uint16_t start = count() < FLIGHTRECORDER_SIZE ? 0 : s_next;
+   return s_events[( start + index ) & ( FLIGHTRECORDER_SIZE - 1 )];
+}
+
+//============================================================================
+// Print the events, oldest first.
+//
+// Each line is the time in millis since the previous RESET (or the
+// first event), the component, and the old and new states:
+//
+//    1503 VALVE 0: 3 -> 2
+//
+//= INPUTS
+//- out    Where to print (e.g. Serial).
+//
+void
+FlightRecorder::
+dump( Print& out )
+{
+   static const char* const TYPE_NAMES[] = {
+      "INPUT", "OUTPUT", "VALVE", "RESET" };
+
+   uint16_t num = count();
+   out.print( "FlightRecorder " );
+   out.print( num );
+   out.println( " events" );
+
+   unsigned long t = 0;
+   for ( uint16_t i = 0; i < num; ++i )
+   {
+      Event e = event( i );
+      uint8_t type = e.state >> 6;
+      if ( type == RESET )
+      {
+         t = 0;
+      }
+      else if ( i > 0 )
+      {
+         t += e.dtMillis;
+      }
+
+      out.print( "   " );
+      if ( e.dtMillis == 0xFFFF && type != RESET )
+      {
+         // Gap was too long to record.
+         out.print( '>' );
+      }
+      out.print( t );
+      out.print( ' ' );
+      out.print( TYPE_NAMES[type] );
+      out.print( ' ' );
+      if ( type == RESET )
+      {
+         out.print( "flags 0x" );
+         out.print( (int)e.id, 16 );
+         out.println();
+         continue;
+      }
+      out.print( e.id );
+      out.print( ": " );
+      out.print( ( e.state >> 3 ) & 7 );
+      out.print( " -> " );
+      out.println( e.state & 7 );
+   }
+}
@@ -0,0 +1,179 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Always on trace of state changes.
+//
+// When something goes wrong in the field (a valve that didn't close
+// on a leak), there's usually no record of what the inputs, outputs,
+// and valves did leading up to it.  The library poll() methods record
+// each state change they report into a small ring buffer so the last
+// FLIGHTRECORDER_SIZE changes can be printed with dump() on demand or
+// after a reset.
+//
+// Each event is 4 bytes: the millis since the previous event (16 bits,
+// stuck at 65535 for longer gaps), the component id, and a byte with
+// the component type and the old and new states (3 bits each).
+//
+//    Type             Id                     States
+//    DIGITAL_INPUT    pin (or shift bit)     0 = off, 1 = on
+//    DIGITAL_OUTPUT   pin (or shift bit)     0 = off, 1 = on or blinking
+//    VALVE            poll() identifier      Valve::Status
+//    RESET            reset flags (MCUSR)    begin() was called
+//
+// The buffer is in the .noinit section on AVR so it isn't cleared by a
+// watchdog (or any other non power on) reset.  Call begin() first
+// thing in setup().  If the buffer still has the events from before
+// the reset, they're kept and a RESET event is added.  Since Optiboot
+// clears MCUSR, wasWatchdogReset() only works with a bootloader that
+// doesn't (or without one).
+//
+// record() only uses the time passed to poll() (no millis() call) and
+// is a handful of byte stores - ~50 cycles (~3 us at 16 MHz) on AVR.
+// Define FLIGHTRECORDER_ENABLE to 0 for the whole build to take the
+// calls out of the library poll() methods.
+//
+//= Example
+//
+//   void setup()
+//   {
+//      FlightRecorder::begin();
+//      Serial.begin( 19200 );
+//      if ( FlightRecorder::wasWatchdogReset() )
+//      {
+//         FlightRecorder::dump( Serial );
+//      }
+//      wdt_enable( WDTO_2S );
+//      ...
+//   }
+//
+#ifndef FLIGHTRECORDER_ENABLE
+#define FLIGHTRECORDER_ENABLE 1
+#endif
+
+#ifndef FLIGHTRECORDER_SIZE
+#define FLIGHTRECORDER_SIZE 32
+#endif
+#if FLIGHTRECORDER_SIZE & ( FLIGHTRECORDER_SIZE - 1 ) || \
+    FLIGHTRECORDER_SIZE < 2 || FLIGHTRECORDER_SIZE > 256
+#error FLIGHTRECORDER_SIZE must be a power of 2 from 2 to 256
+#endif
+
+class FlightRecorder
+{
+public:
+   enum Type {
+      DIGITAL_INPUT = 0,
+      DIGITAL_OUTPUT = 1,
+      VALVE = 2,
+      RESET = 3,
+   };
+
+   // One state change.  Use count() and event() to read them.
+   typedef struct {
+      uint16_t dtMillis;
+      uint8_t id;
+      uint8_t state;   // type << 6 | old << 3 | new
+   } Event;
+
+   static void begin();
+   static void record( long currentMillis, uint8_t type, uint8_t id,
+                       uint8_t oldState, uint8_t newState );
+   static void clear();
+
+   static uint8_t resetFlags();
+   static bool wasWatchdogReset();
+
+   static uint16_t count();
+   static Event event( uint16_t index );
+   static void dump( Print& out );
+
+private:
+   // Ring of events.  s_next is the slot the next event goes in.
+   // Slots that have never been written have the state EMPTY.
+   static Event s_events[FLIGHTRECORDER_SIZE];
+   static uint8_t s_next;
+
+   // Time of the last event.
+   static long s_lastMillis;
+
+   // Set to MAGIC once the buffer has been initialized.
+   static uint16_t s_magic;
+
+   // Reset flags read in begin().
+   static uint8_t s_resetFlags;
+};
+
+//============================================================================
+// Record a state change.
+//
+// States are limited to 0-7.
+//
+//= INPUTS
+//- currentMillis   Time of the change (usually the time passed to poll()).
+//- type            Component type (see Type).
+//- id              Component id (see the table above).
+//- oldState        State before the change.
+//- newState        State after the change.
+//
+inline
+void
+FlightRecorder::
+record( long currentMillis,
+        uint8_t type,
+        uint8_t id,
+        uint8_t oldState,
+        uint8_t newState )
+{
+   long dt = currentMillis - s_lastMillis;
+   s_lastMillis = currentMillis;
+
+   // Mask the index in case begin() hasn't been called yet (s_next is
+   // garbage after power on).
+   Event& e = s_events[s_next & ( FLIGHTRECORDER_SIZE - 1 )];
+   e.dtMillis = (unsigned long)dt < 0xFFFF ? dt : 0xFFFF;
+   e.id = id;
+   e.state = type << 6 | ( oldState & 7 ) << 3 | ( newState & 7 );
+   s_next = ( s_next + 1 ) & ( FLIGHTRECORDER_SIZE - 1 );
+}
+
+//============================================================================
+// Return the reset flags read by begin().
+//
+// On AVR these are the MCUSR bits (WDRF, BORF, EXTRF, PORF).
+//
+inline
+uint8_t
+FlightRecorder::
+resetFlags()
+{
+   return s_resetFlags;
+}
+
+//============================================================================
+// Return true if the last reset was caused by the watchdog.
+//
+inline
+bool
+FlightRecorder::
+wasWatchdogReset()
+{
+#ifdef WDRF
+   return s_resetFlags & ( 1 << WDRF );
+#else
+   return false;
+#endif
+}
@@ -0,0 +1,157 @@
+#include "HostSim.h"
+#include "DigitalInput.h"
+#include "DigitalOutput.h"
+#include "FlightRecorder.h"
+#include <iostream>
+#include <string>
+
+// Flight recorder test.  Checks that input and output changes are
+// recorded with the right times and states, that the ring keeps the
+// newest events, that the events survive begin() (a reset), and the
+// dump() format.
+//
+// Compile and run:
+// g++ -I../../FlightRecorder -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../Profile/Profile -I../../../HostSim -o test main.cpp ../../FlightRecorder/FlightRecorder.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint8_t SWITCH_PIN = 3;
+static const uint8_t LED_PIN = 9;
+
+// Output that saves the text.
+class Capture : public Print
+{
+public:
+   std::string text;
+
+   size_t write( uint8_t c )
+   {
+      text += (char)c;
+      return 1;
+   }
+};
+
+static bool
+check( bool ok,
+       const char* msg,
+       long value )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << ": " << value << std::endl;
+   }
+   return ok;
+}
+
+static bool
+checkEvent( uint16_t index,
+            uint16_t dtMillis,
+            uint8_t type,
+            uint8_t id,
+            uint8_t oldState,
+            uint8_t newState )
+{
+   FlightRecorder::Event e = FlightRecorder::event( index );
+   uint8_t state = type << 6 | oldState << 3 | newState;
+   bool ok = e.dtMillis == dtMillis && e.id == id && e.state == state;
+   if ( ! ok )
+   {
+      std::cout << "FAILED event " << index << ": dt " << e.dtMillis
+                << " id " << (int)e.id << " state " << (int)e.state
+                << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   HostSim::reset();
+   FlightRecorder::begin();
+   bool ok = true;
+   ok &= check( FlightRecorder::count() == 1, "begin", FlightRecorder::count() );
+   ok &= checkEvent( 0, 0xFFFF, FlightRecorder::RESET, 0, 0, 0 );
+
+   DigitalInput button;
+   DigitalOutput led;
+   HostSim::setPin( SWITCH_PIN, HIGH );
+   button.init( SWITCH_PIN, LOW, DigitalInput::DIGITAL, 5 );
+   led.init( LED_PIN );
+
+   // Press the switch at 100 ms and release it at 300 ms.  The LED is
+   // on while the switch is pressed.
+   for ( long t = 0; t < 500; ++t )
+   {
+      if ( t == 100 || t == 300 )
+      {
+         HostSim::setPin( SWITCH_PIN, t == 100 ? LOW : HIGH );
+      }
+      if ( button.poll( millis() ) )
+      {
+         if ( button.isOn() )
+         {
+            led.on();
+         }
+         else
+         {
+            led.off();
+         }
+      }
+      led.poll( millis() );
+      HostSim::advance( 1000 );
+   }
+
+   // Switch is stable 5 ms after it changes, the LED is recorded in
+   // the same loop.
+   ok &= check( FlightRecorder::count() == 5, "count", FlightRecorder::count() );
+   ok &= checkEvent( 1, 105, FlightRecorder::DIGITAL_INPUT, SWITCH_PIN, 0, 1 );
+   ok &= checkEvent( 2, 0, FlightRecorder::DIGITAL_OUTPUT, LED_PIN, 0, 1 );
+   ok &= checkEvent( 3, 200, FlightRecorder::DIGITAL_INPUT, SWITCH_PIN, 1, 0 );
+   ok &= checkEvent( 4, 0, FlightRecorder::DIGITAL_OUTPUT, LED_PIN, 1, 0 );
+
+   Capture out;
+   FlightRecorder::dump( out );
+   const char* expect =
+      "FlightRecorder 5 events\n"
+      "   0 RESET flags 0x0\n"
+      "   105 INPUT 3: 0 -> 1\n"
+      "   105 OUTPUT 9: 0 -> 1\n"
+      "   305 INPUT 3: 1 -> 0\n"
+      "   305 OUTPUT 9: 1 -> 0\n";
+   ok &= check( out.text == expect, "dump", out.text.size() );
+   if ( out.text != expect )
+   {
+      std::cout << out.text;
+   }
+
+   // Fill past the end.  The oldest events are dropped.  A long gap is
+   // stuck at the max.
+   long t = millis();
+   for ( int i = 0; i < FLIGHTRECORDER_SIZE + 3; ++i )
+   {
+      t += i == FLIGHTRECORDER_SIZE + 2 ? 100000 : 10;
+      FlightRecorder::record( t, FlightRecorder::VALVE, i, i, i + 1 );
+   }
+   ok &= check( FlightRecorder::count() == FLIGHTRECORDER_SIZE, "full",
+                FlightRecorder::count() );
+   ok &= checkEvent( 0, 10, FlightRecorder::VALVE, 3, 3, 4 );
+   ok &= checkEvent( FLIGHTRECORDER_SIZE - 1, 0xFFFF, FlightRecorder::VALVE,
+                     FLIGHTRECORDER_SIZE + 2, 2, 3 );
+
+   // A reset keeps the events and adds a RESET.
+   FlightRecorder::begin();
+   ok &= check( FlightRecorder::count() == FLIGHTRECORDER_SIZE, "reset",
+                FlightRecorder::count() );
+   ok &= checkEvent( 0, 10, FlightRecorder::VALVE, 4, 4, 5 );
+   ok &= checkEvent( FLIGHTRECORDER_SIZE - 1, 0xFFFF, FlightRecorder::RESET,
+                     0, 0, 0 );
+
+   FlightRecorder::clear();
+   ok &= check( FlightRecorder::count() == 0, "clear",
+                FlightRecorder::count() );
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+// Host (Linux, etc) stand in for the Arduino core header.
+//
+// This lets the library classes and test sketches compile and run on
+// a normal computer.  Pins, interrupts, and time are all simulated by
+// the HostSim class - see HostSim.h for how to drive them from a test.
+// Only the parts of the Arduino API used by this library are
+// declared.
+//
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+
+#define bit( b ) ( 1UL << ( b ) )
+#define bitRead( value, b ) ( ( ( value ) >> ( b ) ) & 0x01 )
+#define bitSet( value, b ) ( ( value ) |= ( 1UL << ( b ) ) )
+#define bitClear( value, b ) ( ( value ) &= ~( 1UL << ( b ) ) )
+#define bitWrite( value, b, bitvalue ) \
+   ( bitvalue ? bitSet( value, b ) : bitClear( value, b ) )
+
+// The Arduino core defines these as macros which breaks the standard
+// C++ headers so use templates instead.
+template< typename T >
+inline T min( T a, T b ) { return a < b ? a : b; }
+template< typename T >
+inline T max( T a, T b ) { return a > b ? a : b; }
+template< typename T >
+inline T constrain( T x, T lo, T hi ) { return x < lo ? lo : x > hi ? hi : x; }
+
+// Constant tables.  Host memory is all the same so PROGMEM does
+// nothing.
+#define PROGMEM
+#define pgm_read_byte( addr ) ( *(const uint8_t*)( addr ) )
+
+// Time.
+unsigned long millis();
+unsigned long micros();
+void delay( unsigned long ms );
+void delayMicroseconds( unsigned int us );
+
+// Pins.
+void pinMode( uint8_t pin, uint8_t mode );
+int digitalRead( uint8_t pin );
+void digitalWrite( uint8_t pin, uint8_t value );
+int analogRead( uint8_t pin );
+void analogWrite( uint8_t pin, int value );
+
+// Interrupts.  Every pin can be used as an external interrupt and the
+// interrupt number is the pin number.
+#define digitalPinToInterrupt( p ) ( p )
+void attachInterrupt( uint8_t interruptNum, void (*func)(), int mode );
+void detachInterrupt( uint8_t interruptNum );
+void noInterrupts();
+void interrupts();
+
+// Pin change interrupts.  Each block of 8 pins is a port with an
+// input register that mirrors the pin levels.  The control and mask
+// registers are accepted but every pin change interrupt is always
+// enabled.  The ISR for a port is set with HostSim::attachPinChange().
+// The registers belong to the current HostSim context.
+#define NUM_PORTS 4
+extern thread_local volatile uint8_t* g_hostPortInput;
+extern thread_local volatile uint8_t* g_hostPCICR;
+extern thread_local volatile uint8_t* g_hostPCMSK;
+#define digitalPinToPort( p ) ( ( p ) / 8 )
+#define digitalPinToBitMask( p ) ( (uint8_t)( 1 << ( ( p ) % 8 ) ) )
+#define portInputRegister( port ) ( &g_hostPortInput[port] )
+#define digitalPinToPCICR( p ) ( g_hostPCICR )
+#define digitalPinToPCICRbit( p ) ( ( p ) / 8 )
+#define digitalPinToPCMSK( p ) ( &g_hostPCMSK[( p ) / 8] )
+#define digitalPinToPCMSKbit( p ) ( ( p ) % 8 )
+
+// Serial output.  Written to stdout unless changed with
+// HostSim::serialOutput().
+class Print
+{
+public:
+   virtual ~Print() {}
+   virtual size_t write( uint8_t c );
+   size_t write( const uint8_t* buffer, size_t size );
+   size_t write( const char* str );
+   virtual int availableForWrite();
+
+   size_t print( const char* s );
+   size_t print( char c );
+   size_t print( int n, int base=10 );
+   size_t print( unsigned int n, int base=10 );
+   size_t print( long n, int base=10 );
+   size_t print( unsigned long n, int base=10 );
+   size_t print( double n, int digits=2 );
+
+   size_t println();
+   template< typename T > size_t println( T v );
+};
+
+class HardwareSerial : public Print
+{
+public:
+   void begin( unsigned long baud );
+   void flush();
+};
+
+extern HardwareSerial Serial;
+
+template< typename T >
+inline
+size_t
+Print::
+println( T v )
+{
+   size_t n = print( v );
+   return n + println();
+}
+
@@ -0,0 +1,38 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Host stand in for the DigitalIO library.
+//
+// DigitalPin< PIN > maps directly on to the simulated digitalRead()
+// and digitalWrite() calls.
+//
+template< uint8_t PIN >
+class DigitalPin
+{
+public:
+   void mode( uint8_t pinMode_ ) { pinMode( PIN, pinMode_ ); }
+   void config( uint8_t pinMode_, bool level )
+   {
+      pinMode( PIN, pinMode_ );
+      write( level );
+   }
+   bool read() const { return digitalRead( PIN ); }
+   void write( bool level ) { digitalWrite( PIN, level ); }
+   void high() { write( HIGH ); }
+   void low() { write( LOW ); }
+   void toggle() { write( ! read() ); }
+};
@@ -0,0 +1,37 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Host stand in for the Arduino EEPROM library.
+//
+// The contents are kept in memory and start erased (0xFF).  Call
+// HostSim::eepromFile() to load them from a file and write every
+// change back to it so the data survives a simulated reboot (i.e.
+// HostSim::reset() and a new run of setup()).  HostSim::eepromWrites()
+// returns the number of writes to each address for wear testing.
+//
+#define E2END 0x3FF
+
+class EEPROMClass
+{
+public:
+   uint8_t read( int idx );
+   void write( int idx, uint8_t value );
+   void update( int idx, uint8_t value );
+   uint16_t length() { return E2END + 1; }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,936 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "HostSim.h"
+#include "EEPROM.h"
+#include "SPI.h"
+#include <map>
+
+//============================================================================
+//
+// Simulation state
+//
+//============================================================================
+namespace
+{
+   struct Event
+   {
+      HostSim::EventCb callback;
+      void* data;
+   };
+
+   struct Pin
+   {
+      uint8_t mode;
+      uint8_t level;
+      int analogIn;
+      int analogOut;
+      HostSim::WriteCb writeCb;
+      void* writeData;
+      void (*isr)();
+      int isrMode;
+
+      // True once setPin() has been called so pinMode() doesn't pull
+      // up a pin the simulation is driving.
+      bool driven;
+   };
+}
+
+//============================================================================
+// Everything one simulation needs.  Each board in a multi-board
+// simulation has its own (see setContext()).
+//
+struct HostSim::Context
+{
+   uint64_t time_us = 0;
+
+   // Events ordered by time.  Events at the same time run in the
+   // order they were added.
+   std::multimap< uint64_t, Event > events;
+
+   Pin pins[HostSim::NUM_PINS] = {};
+   void (*pinChange[NUM_PORTS])() = {};
+
+   // Port registers (see the g_host pointers).
+   volatile uint8_t portInput[NUM_PORTS] = {};
+   volatile uint8_t pcicr = 0;
+   volatile uint8_t pcmsk[NUM_PORTS] = {};
+
+   // Interrupts which arrived while they were disabled.
+   bool interruptsOn = true;
+   uint8_t pendingPort = 0;
+   void (*pendingIsr[HostSim::NUM_PINS])() = {};
+
+   FILE* serial = stdout;
+
+   HostSim::SpiCb spiCb = 0;
+   void* spiData = 0;
+
+   // Input change callback (e.g. recording a trace).
+   HostSim::WriteCb inputCb = 0;
+   void* inputData = 0;
+
+   // EEPROM contents, number of writes to each address, and the file
+   // that backs them (or NULL).
+   uint8_t eeprom[E2END + 1] = {};
+   uint32_t eepromWrites[E2END + 1] = {};
+   FILE* eepromFile = 0;
+};
+
+namespace
+{
+   // Default context used until setContext() is called.
+   HostSim::Context s_default;
+
+   // Current context for this thread.
+   thread_local HostSim::Context* s_sim = &s_default;
+
+   //=========================================================================
+   // Run events up to and including the input time.
+   void
+   runEvents( uint64_t time_us )
+   {
+      while ( ! s_sim->events.empty() && s_sim->events.begin()->first <= time_us )
+      {
+         std::multimap< uint64_t, Event >::iterator it = s_sim->events.begin();
+         Event e = it->second;
+         s_sim->time_us = it->first;
+         s_sim->events.erase( it );
+
+         e.callback( e.data );
+      }
+
+      s_sim->time_us = time_us;
+   }
+
+   //=========================================================================
+   // Run an interrupt routine now or save it until interrupts are on.
+   void
+   runIsr( void (*isr)(),
+           uint8_t pendingIdx )
+   {
+      if ( s_sim->interruptsOn )
+      {
+         isr();
+      }
+      else
+      {
+         s_sim->pendingIsr[pendingIdx] = isr;
+      }
+   }
+}
+
+thread_local volatile uint8_t* g_hostPortInput = s_default.portInput;
+thread_local volatile uint8_t* g_hostPCICR = &s_default.pcicr;
+thread_local volatile uint8_t* g_hostPCMSK = s_default.pcmsk;
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+SPIClass SPI;
+
+//============================================================================
+//
+// HostSim
+//
+//============================================================================
+// Reset the simulation.
+//
+// Sets the time back to zero, removes all events, and sets all the
+// pins to LOW inputs.  The EEPROM is erased and disconnected from
+// any file - call eepromFile() again to reload it.
+//
+void
+HostSim::
+reset()
+{
+   s_sim->time_us = 0;
+   s_sim->events.clear();
+   memset( s_sim->pins, 0, sizeof( s_sim->pins ) );
+   memset( s_sim->pinChange, 0, sizeof( s_sim->pinChange ) );
+   memset( s_sim->pendingIsr, 0, sizeof( s_sim->pendingIsr ) );
+   memset( (void*)s_sim->portInput, 0, sizeof( s_sim->portInput ) );
+   memset( (void*)s_sim->pcmsk, 0, sizeof( s_sim->pcmsk ) );
+   s_sim->pcicr = 0;
+   s_sim->pendingPort = 0;
+   s_sim->interruptsOn = true;
+   s_sim->spiCb = 0;
+   s_sim->spiData = 0;
+   s_sim->inputCb = 0;
+   s_sim->inputData = 0;
+
+   if ( s_sim->eepromFile )
+   {
+      fclose( s_sim->eepromFile );
+      s_sim->eepromFile = 0;
+   }
+   memset( s_sim->eeprom, 0xFF, sizeof( s_sim->eeprom ) );
+   memset( s_sim->eepromWrites, 0, sizeof( s_sim->eepromWrites ) );
+}
+
+//============================================================================
+// Create a new simulation context.
+//
+// The context starts out the same as after reset().  Use setContext()
+// to make it current.  Delete it with deleteContext().
+//
+HostSim::Context*
+HostSim::
+newContext()
+{
+   Context* context = new Context;
+
+   Context* prev = setContext( context );
+   reset();
+   setContext( prev );
+
+   return context;
+}
+
+//============================================================================
+// Delete a context created by newContext().
+//
+// If the context is current on this thread, the default context
+// becomes current.
+//
+void
+HostSim::
+deleteContext( Context* context )
+{
+   if ( ! context || context == &s_default )
+   {
+      return;
+   }
+
+   if ( context == s_sim )
+   {
+      setContext( NULL );
+   }
+
+   if ( context->eepromFile )
+   {
+      fclose( context->eepromFile );
+   }
+
+   delete context;
+}
+
+//============================================================================
+// Set the current context for this thread.
+//
+// Every other HostSim call, the Arduino functions, and the port
+// registers use the current context.  A context must only be current
+// on one thread at a time.
+//
+//= INPUTS
+//- context  The context to use.  NULL for the default context.
+//
+//= RETURNS
+//- Returns the previous context.
+//
+HostSim::Context*
+HostSim::
+setContext( Context* context )
+{
+   Context* prev = s_sim;
+
+   s_sim = context ? context : &s_default;
+   g_hostPortInput = s_sim->portInput;
+   g_hostPCICR = &s_sim->pcicr;
+   g_hostPCMSK = s_sim->pcmsk;
+
+   return prev;
+}
+
+//============================================================================
+// Return the current simulation time in microseconds.
+//
+uint64_t
+HostSim::
+time_us()
+{
+   return s_sim->time_us;
+}
+
+//============================================================================
+// Advance the clock, running any events that come due.
+//
+void
+HostSim::
+advance( uint64_t dt_us )
+{
+   runEvents( s_sim->time_us + dt_us );
+}
+
+//============================================================================
+// Advance the clock to an absolute time, running any events that
+// come due.  Times in the past are ignored.
+//
+void
+HostSim::
+advanceTo( uint64_t time_us )
+{
+   if ( time_us > s_sim->time_us )
+   {
+      runEvents( time_us );
+   }
+}
+
+//============================================================================
+// Advance the clock to a time or to the next scheduled event,
+// whichever is first, and run the events at that time.
+//
+// Use this to skip ahead to the next time the code has something to
+// do (see the deadline() methods in the library classes).  Since the
+// time stops at each event, the code gets a chance to react to it
+// before the clock moves on.
+//
+//= INPUTS
+//- time_us   Time to advance to if there are no events before then.
+//
+//= RETURNS
+//- Returns the new time.
+//
+uint64_t
+HostSim::
+fastForward( uint64_t time_us )
+{
+   if ( ! s_sim->events.empty() && s_sim->events.begin()->first < time_us )
+   {
+      time_us = s_sim->events.begin()->first;
+   }
+
+   // Events scheduled for now (or the past) still have to run.
+   runEvents( max( time_us, s_sim->time_us ) );
+   return s_sim->time_us;
+}
+
+//============================================================================
+// Schedule a callback at a future time.
+//
+// Times in the past will run on the next call to advance().
+//
+void
+HostSim::
+at( uint64_t time_us,
+    EventCb callback,
+    void* data )
+{
+   Event e = { callback, data };
+   s_sim->events.insert( std::make_pair( time_us, e ) );
+}
+
+//============================================================================
+// Get the time of the next scheduled event.
+//
+// Returns false if there are no events.
+//
+bool
+HostSim::
+nextEvent( uint64_t& time_us )
+{
+   if ( s_sim->events.empty() )
+   {
+      return false;
+   }
+
+   time_us = s_sim->events.begin()->first;
+   return true;
+}
+
+//============================================================================
+// Drive an input pin.
+//
+// If the level changes, any interrupt routines attached to the pin
+// are run.  Once a pin is driven, turning on its pull up with
+// pinMode() doesn't change the level (like a switch to ground).
+//
+void
+HostSim::
+setPin( uint8_t pin,
+        uint8_t level )
+{
+   Pin& p = s_sim->pins[pin];
+   p.driven = true;
+   level = level ? HIGH : LOW;
+   if ( p.level == level )
+   {
+      return;
+   }
+
+   p.level = level;
+   bitWrite( g_hostPortInput[pin / 8], pin % 8, level );
+
+   if ( s_sim->inputCb )
+   {
+      s_sim->inputCb( pin, level, s_sim->inputData );
+   }
+
+   // External interrupt on the pin.
+   if ( p.isr &&
+        ( p.isrMode == CHANGE ||
+          ( p.isrMode == RISING && level == HIGH ) ||
+          ( p.isrMode == FALLING && level == LOW ) ) )
+   {
+      runIsr( p.isr, pin );
+   }
+
+   // Pin change interrupt on the port.
+   if ( s_sim->pinChange[pin / 8] )
+   {
+      if ( s_sim->interruptsOn )
+      {
+         s_sim->pinChange[pin / 8]();
+      }
+      else
+      {
+         s_sim->pendingPort |= bit( pin / 8 );
+      }
+   }
+}
+
+//============================================================================
+// Set the value analogRead() returns for a pin.
+//
+void
+HostSim::
+setAnalog( uint8_t pin,
+           int value )
+{
+   s_sim->pins[pin].analogIn = value;
+}
+
+//============================================================================
+// Return the current level of a pin.
+//
+uint8_t
+HostSim::
+pin( uint8_t pin )
+{
+   return s_sim->pins[pin].level;
+}
+
+//============================================================================
+// Return the mode (INPUT, OUTPUT, INPUT_PULLUP) of a pin.
+//
+uint8_t
+HostSim::
+mode( uint8_t pin )
+{
+   return s_sim->pins[pin].mode;
+}
+
+//============================================================================
+// Return the last value passed to analogWrite() for a pin.
+//
+int
+HostSim::
+analogOut( uint8_t pin )
+{
+   return s_sim->pins[pin].analogOut;
+}
+
+//============================================================================
+// Watch the writes to a pin.
+//
+void
+HostSim::
+onWrite( uint8_t pin,
+         WriteCb callback,
+         void* data )
+{
+   s_sim->pins[pin].writeCb = callback;
+   s_sim->pins[pin].writeData = data;
+}
+
+//============================================================================
+// Set the pin change interrupt routine for a port.
+//
+void
+HostSim::
+attachPinChange( uint8_t port,
+                 void (*isr)() )
+{
+   s_sim->pinChange[port] = isr;
+}
+
+//============================================================================
+// Watch the inputs.
+//
+// The callback is run each time setPin() changes a level (before any
+// interrupt routines).  Used to record traces (see PinTrace.h).  NULL
+// to remove it.
+//
+void
+HostSim::
+onInput( WriteCb callback,
+         void* data )
+{
+   s_sim->inputCb = callback;
+   s_sim->inputData = data;
+}
+
+//============================================================================
+// Set the device on the SPI bus.
+//
+// The callback is run for each byte transferred.  NULL to remove it.
+//
+void
+HostSim::
+onSpi( SpiCb callback,
+       void* data )
+{
+   s_sim->spiCb = callback;
+   s_sim->spiData = data;
+}
+
+//============================================================================
+// Set where Serial output is written.
+//
+void
+HostSim::
+serialOutput( FILE* fd )
+{
+   s_sim->serial = fd;
+}
+
+//============================================================================
+FILE*
+HostSim::
+serialOutput()
+{
+   return s_sim->serial;
+}
+
+//============================================================================
+// Keep the EEPROM contents in a file.
+//
+// If the file exists, the EEPROM is loaded from it.  Otherwise it's
+// created with the current (normally erased) contents.  Every write
+// after this is written through to the file.
+//
+//= RETURNS
+//- Returns false if the file couldn't be opened.
+//
+bool
+HostSim::
+eepromFile( const char* path )
+{
+   if ( s_sim->eepromFile )
+   {
+      fclose( s_sim->eepromFile );
+      s_sim->eepromFile = 0;
+   }
+   if ( ! path )
+   {
+      return true;
+   }
+
+   s_sim->eepromFile = fopen( path, "r+b" );
+   if ( s_sim->eepromFile )
+   {
+      size_t num = fread( s_sim->eeprom, 1, sizeof( s_sim->eeprom ), s_sim->eepromFile );
+      (void)num; // short files leave the rest erased
+   }
+   else
+   {
+      s_sim->eepromFile = fopen( path, "w+b" );
+      if ( ! s_sim->eepromFile )
+      {
+         return false;
+      }
+   }
+
+   fseek( s_sim->eepromFile, 0, SEEK_SET );
+   fwrite( s_sim->eeprom, 1, sizeof( s_sim->eeprom ), s_sim->eepromFile );
+   fflush( s_sim->eepromFile );
+   return true;
+}
+
+//============================================================================
+// Return the number of times an EEPROM address has been written.
+//
+uint32_t
+HostSim::
+eepromWrites( int idx )
+{
+   return s_sim->eepromWrites[idx];
+}
+
+//============================================================================
+//
+// Arduino API
+//
+//============================================================================
+unsigned long
+millis()
+{
+   return (unsigned long)(uint32_t)( s_sim->time_us / 1000 );
+}
+
+//============================================================================
+unsigned long
+micros()
+{
+   return (unsigned long)(uint32_t)s_sim->time_us;
+}
+
+//============================================================================
+void
+delay( unsigned long ms )
+{
+   HostSim::advance( (uint64_t)ms * 1000 );
+}
+
+//============================================================================
+void
+delayMicroseconds( unsigned int us )
+{
+   HostSim::advance( us );
+}
+
+//============================================================================
+void
+pinMode( uint8_t pin,
+         uint8_t mode )
+{
+   Pin& p = s_sim->pins[pin];
+   p.mode = mode;
+
+   // The pull up only sets the level if nothing else drives the pin.
+   if ( mode == INPUT_PULLUP && ! p.driven )
+   {
+      HostSim::setPin( pin, HIGH );
+      p.driven = false;
+   }
+}
+
+//============================================================================
+int
+digitalRead( uint8_t pin )
+{
+   return s_sim->pins[pin].level;
+}
+
+//============================================================================
+void
+digitalWrite( uint8_t pin,
+              uint8_t value )
+{
+   Pin& p = s_sim->pins[pin];
+   p.level = value ? HIGH : LOW;
+   p.analogOut = value ? 255 : 0;
+   bitWrite( g_hostPortInput[pin / 8], pin % 8, p.level );
+
+   if ( p.writeCb )
+   {
+      p.writeCb( pin, p.level, p.writeData );
+   }
+}
+
+//============================================================================
+int
+analogRead( uint8_t pin )
+{
+   return s_sim->pins[pin].analogIn;
+}
+
+//============================================================================
+void
+analogWrite( uint8_t pin,
+             int value )
+{
+   Pin& p = s_sim->pins[pin];
+   p.analogOut = value;
+   p.level = value >= 128 ? HIGH : LOW;
+   bitWrite( g_hostPortInput[pin / 8], pin % 8, p.level );
+
+   if ( p.writeCb )
+   {
+      p.writeCb( pin, p.level, p.writeData );
+   }
+}
+
+//============================================================================
+void
+attachInterrupt( uint8_t interruptNum,
+                 void (*func)(),
+                 int mode )
+{
+   s_sim->pins[interruptNum].isr = func;
+   s_sim->pins[interruptNum].isrMode = mode;
+}
+
+//============================================================================
+void
+detachInterrupt( uint8_t interruptNum )
+{
+   s_sim->pins[interruptNum].isr = 0;
+}
+
+//============================================================================
+void
+noInterrupts()
+{
+   s_sim->interruptsOn = false;
+}
+
+//============================================================================
+// Turn interrupts back on and run any that arrived while they were off.
+void
+interrupts()
+{
+   s_sim->interruptsOn = true;
+
+   for ( uint8_t i = 0; i < HostSim::NUM_PINS; i++ )
+   {
+      if ( s_sim->pendingIsr[i] )
+      {
+         void (*isr)() = s_sim->pendingIsr[i];
+         s_sim->pendingIsr[i] = 0;
+         isr();
+      }
+   }
+
+   for ( uint8_t i = 0; s_sim->pendingPort && i < NUM_PORTS; i++ )
+   {
+      if ( s_sim->pendingPort & bit( i ) )
+      {
+         s_sim->pendingPort &= ~bit( i );
+         s_sim->pinChange[i]();
+      }
+   }
+}
+
+//============================================================================
+//
+// Serial output
+//
+//============================================================================
+size_t
+Print::
+write( uint8_t c )
+{
+   if ( s_sim->serial )
+   {
+      fputc( c, s_sim->serial );
+   }
+   return 1;
+}
+
+//============================================================================
+size_t
+Print::
+write( const uint8_t* buffer,
+       size_t size )
+{
+   for ( size_t i = 0; i < size; i++ )
+   {
+      write( buffer[i] );
+   }
+   return size;
+}
+
+//============================================================================
+size_t
+Print::
+write( const char* str )
+{
+   return write( (const uint8_t*)str, strlen( str ) );
+}
+
+//============================================================================
+// The simulated serial port never blocks.
+int
+Print::
+availableForWrite()
+{
+   return 64;
+}
+
+//============================================================================
+size_t
+Print::
+print( const char* s )
+{
+   return write( s );
+}
+
+//============================================================================
+size_t
+Print::
+print( char c )
+{
+   return write( (uint8_t)c );
+}
+
+//============================================================================
+size_t
+Print::
+print( int n,
+       int base )
+{
+   return print( (long)n, base );
+}
+
+//============================================================================
+size_t
+Print::
+print( unsigned int n,
+       int base )
+{
+   return print( (unsigned long)n, base );
+}
+
+//============================================================================
+size_t
+Print::
+print( long n,
+       int base )
+{
+   if ( n < 0 && base == 10 )
+   {
+      return print( '-' ) + print( (unsigned long)-n, base );
+   }
+   return print( (unsigned long)n, base );
+}
+
+//============================================================================
+size_t
+Print::
+print( unsigned long n,
+       int base )
+{
+   char buf[8 * sizeof( long ) + 1];
+   char* s = &buf[sizeof( buf ) - 1];
+   *s = '\0';
+
+   if ( base < 2 )
+   {
+      base = 10;
+   }
+
+   do
+   {
+      unsigned long d = n % base;
+      n /= base;
+      *--s = d < 10 ? '0' + d : 'A' + d - 10;
+   } while ( n );
+
+   return write( s );
+}
+
+//============================================================================
+size_t
+Print::
+print( double n,
+       int digits )
+{
+   char buf[64];
+   snprintf( buf, sizeof( buf ), "%.*f", digits, n );
+   return write( buf );
+}
+
+//============================================================================
+size_t
+Print::
+println()
+{
+   return write( "\n" );
+}
+
+//============================================================================
+void
+HardwareSerial::
+begin( unsigned long )
+{
+}
+
+//============================================================================
+void
+HardwareSerial::
+flush()
+{
+   if ( s_sim->serial )
+   {
+      fflush( s_sim->serial );
+   }
+}
+
+//============================================================================
+//
+// EEPROM
+//
+//============================================================================
+uint8_t
+EEPROMClass::
+read( int idx )
+{
+   return s_sim->eeprom[idx];
+}
+
+//============================================================================
+void
+EEPROMClass::
+write( int idx,
+       uint8_t value )
+{
+   s_sim->eeprom[idx] = value;
+   s_sim->eepromWrites[idx]++;
+
+   if ( s_sim->eepromFile )
+   {
+      fseek( s_sim->eepromFile, idx, SEEK_SET );
+      fputc( value, s_sim->eepromFile );
+      fflush( s_sim->eepromFile );
+   }
+}
+
+//============================================================================
+void
+EEPROMClass::
+update( int idx,
+        uint8_t value )
+{
+   if ( s_sim->eeprom[idx] != value )
+   {
+      write( idx, value );
+   }
+}
+
+//============================================================================
+//
+// SPI
+//
+//============================================================================
+uint8_t
+SPIClass::
+transfer( uint8_t data )
+{
+   return s_sim->spiCb ? s_sim->spiCb( data, s_sim->spiData ) : 0;
+}
+
+//============================================================================
+void
+SPIClass::
+transfer( void* buffer,
+          size_t size )
+{
+   uint8_t* bytes = (uint8_t*)buffer;
+   for ( size_t i = 0; i < size; ++i )
+   {
+      bytes[i] = transfer( bytes[i] );
+   }
+}
+
+//============================================================================
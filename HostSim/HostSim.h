@@ -0,0 +1,136 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+#include <stdio.h>
+
+// Host simulation of the Arduino hardware.
+//
+// Provides a virtual clock, simulated pins, and interrupts so the
+// library classes can be tested on a normal computer.  Time only
+// moves when the test calls advance() (or the code under test calls
+// delay()) so tests are repeatable and run much faster than real
+// time.
+//
+// Devices (sensors, switches, etc) are simulated by scheduling events
+// at future times with at() and by watching the outputs the code
+// writes with onWrite().  Changing an input pin with setPin() runs
+// any attached interrupt routines immediately, just like the
+// hardware.
+//
+//= Example
+//
+//   // Close a switch on pin 3 after 1 second and open it at 3 seconds.
+//   HostSim::at( 1000000, pinLow, (void*)3 );
+//   HostSim::at( 3000000, pinHigh, (void*)3 );
+//
+//   while ( HostSim::time_us() < 5000000 )
+//   {
+//      loop();
+//      HostSim::advance( 100 ); // 100 us per loop()
+//   }
+//
+// Most of the time nothing is happening (the code is waiting for a
+// switch or a time out) so running a loop() per milli second wastes
+// time.  The library classes have a deadline() method that returns
+// the time poll() next has something to do.  fastForward() jumps to
+// that time or the next scheduled event, whichever is first, so only
+// the loops where something can happen are run:
+//
+//   while ( HostSim::time_us() < end_us )
+//   {
+//      loop();
+//      long t = millis();
+//      long next = g_valve.deadline( t );
+//      ...earliest of the other deadline() values...
+//      HostSim::fastForward( ( t + max( next - t, 1L ) ) * 1000ULL );
+//   }
+//
+// The EEPROM (see EEPROM.h) can be backed by a file to test code that
+// has to survive a reboot.
+//
+// All of the state (clock, events, pins, EEPROM) lives in a context.
+// Tests use the default one.  To simulate several boards, create a
+// context for each with newContext() and make it current with
+// setContext() before running that board's code.  The current context
+// is per thread so different boards can run on different threads.
+//
+// Internally time is kept in 64 bit microseconds.  millis() and
+// micros() return the low 32 bits so roll overs happen at the same
+// place as the hardware.
+//
+class HostSim
+{
+public:
+   enum { NUM_PINS = NUM_PORTS * 8 };
+
+   // Event callback for at().  Input is the data passed to at().
+   typedef void (*EventCb)( void* data );
+
+   // Output change callback for onWrite().  Called when the code
+   // writes a value to a pin (even if the level doesn't change).
+   typedef void (*WriteCb)( uint8_t pin, uint8_t level, void* data );
+
+   // SPI device callback for onSpi().  Input is the byte the code
+   // sent.  Returns the byte the device sends back.
+   typedef uint8_t (*SpiCb)( uint8_t out, void* data );
+
+   // Simulation state.  Only used through the pointer.
+   struct Context;
+
+   static void reset();
+
+   // Separate simulations (e.g. a fleet of boards).
+   static Context* newContext();
+   static void deleteContext( Context* context );
+   static Context* setContext( Context* context );
+
+   // Virtual clock.
+   static uint64_t time_us();
+   static void advance( uint64_t dt_us );
+   static void advanceTo( uint64_t time_us );
+   static uint64_t fastForward( uint64_t time_us );
+
+   // Scheduled events.
+   static void at( uint64_t time_us, EventCb callback, void* data=NULL );
+   static bool nextEvent( uint64_t& time_us );
+
+   // Inputs driven by the simulation.
+   static void setPin( uint8_t pin, uint8_t level );
+   static void setAnalog( uint8_t pin, int value );
+   static void onInput( WriteCb callback, void* data=NULL );
+
+   // Outputs written by the code.
+   static uint8_t pin( uint8_t pin );
+   static uint8_t mode( uint8_t pin );
+   static int analogOut( uint8_t pin );
+   static void onWrite( uint8_t pin, WriteCb callback, void* data=NULL );
+
+   // Pin change interrupt routine for a port (8 pins).
+   static void attachPinChange( uint8_t port, void (*isr)() );
+
+   // Device on the SPI bus (see SPI.h).
+   static void onSpi( SpiCb callback, void* data=NULL );
+
+   // Where to write Serial output.  NULL to discard it.
+   static void serialOutput( FILE* fd );
+   static FILE* serialOutput();
+
+   // File to keep the EEPROM contents in.  NULL for memory only.
+   static bool eepromFile( const char* path );
+   static uint32_t eepromWrites( int idx );
+};
+
+//============================================================================
@@ -0,0 +1,357 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "PinTrace.h"
+#include "HostSim.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[4] = { 'P', 'T', 'R', 'C' };
+static const uint16_t VERSION = 1;
+static const uint16_t RECORD_SIZE = 4;
+static const size_t HEADER_SIZE = 8;
+
+static const uint32_t MAX_DT = 0xFFFFFF;
+static const uint8_t GAP_PIN = 127;
+
+//============================================================================
+//
+// PinTraceWriter
+//
+//============================================================================
+PinTraceWriter::
+PinTraceWriter()
+   : m_fd( 0 ),
+     m_last_us( 0 ),
+     m_count( 0 ),
+     m_recording( false )
+{
+}
+
+//============================================================================
+PinTraceWriter::
+~PinTraceWriter()
+{
+   close();
+}
+
+//============================================================================
+// Create a trace file.
+//
+// Times passed to add() are relative to time 0 so start recording
+// right after HostSim::reset().
+//
+//= RETURNS
+//- Returns false if the file can't be created.
+//
+bool
+PinTraceWriter::
+open( const char* path )
+{
+   close();
+   m_fd = fopen( path, "wb" );
+   if ( ! m_fd )
+   {
+      return false;
+   }
+
+   uint8_t header[HEADER_SIZE] = {
+      (uint8_t)MAGIC[0], (uint8_t)MAGIC[1], (uint8_t)MAGIC[2],
+      (uint8_t)MAGIC[3], VERSION & 0xFF, VERSION >> 8, RECORD_SIZE, 0 };
+   fwrite( header, 1, sizeof( header ), m_fd );
+   m_last_us = 0;
+   m_count = 0;
+   return true;
+}
+
+//============================================================================
+// Add a pin change.
+//
+// Times must not go backwards.
+//
+//= INPUTS
+//- time_us   Time of the change in micro seconds.
+//- pin       Pin number (0-126).
+//- level     LOW or HIGH.
+//
+void
+PinTraceWriter::
+add( uint64_t time_us,
+     uint8_t pin,
+     uint8_t level )
+{
+   if ( ! m_fd )
+   {
+      return;
+   }
+
+   uint64_t dt = time_us > m_last_us ? time_us - m_last_us : 0;
+   while ( dt > MAX_DT )
+   {
+      write( MAX_DT | (uint32_t)GAP_PIN << 24 );
+      dt -= MAX_DT;
+   }
+   write( (uint32_t)dt | (uint32_t)( pin & 0x7F ) << 24 |
+          (uint32_t)( level ? 1 : 0 ) << 31 );
+
+   m_last_us = time_us > m_last_us ? time_us : m_last_us;
+   m_count++;
+}
+
+//============================================================================
+// Add every HostSim input change (HostSim::setPin()) to the trace
+// until close() is called.
+//
+void
+PinTraceWriter::
+recordInputs()
+{
+   HostSim::onInput( inputCb, this );
+   m_recording = true;
+}
+
+//============================================================================
+// Finish the file.
+//
+// Also stops recordInputs().  An input hook set some other way is
+// left alone.
+//
+void
+PinTraceWriter::
+close()
+{
+   if ( m_recording )
+   {
+      HostSim::onInput( NULL );
+      m_recording = false;
+   }
+
+   if ( m_fd )
+   {
+      fclose( m_fd );
+      m_fd = 0;
+   }
+}
+
+//============================================================================
+void
+PinTraceWriter::
+write( uint32_t record )
+{
+   uint8_t bytes[RECORD_SIZE] = {
+      (uint8_t)record, (uint8_t)( record >> 8 ), (uint8_t)( record >> 16 ),
+      (uint8_t)( record >> 24 ) };
+   fwrite( bytes, 1, sizeof( bytes ), m_fd );
+}
+
+//============================================================================
+void
+PinTraceWriter::
+inputCb( uint8_t pin,
+         uint8_t level,
+         void* data )
+{
+   ( (PinTraceWriter*)data )->add( HostSim::time_us(), pin, level );
+}
+
+//============================================================================
+//
+// PinTraceReader
+//
+//============================================================================
+PinTraceReader::
+PinTraceReader()
+   : m_map( 0 ),
+     m_mapSize( 0 ),
+     m_records( 0 ),
+     m_size( 0 ),
+     m_next( 0 ),
+     m_time_us( 0 ),
+     m_start_us( 0 ),
+     m_pending( false ),
+     m_pin( 0 ),
+     m_level( 0 ),
+     m_replayed( 0 )
+{
+}
+
+//============================================================================
+PinTraceReader::
+~PinTraceReader()
+{
+   close();
+}
+
+//============================================================================
+// Map a trace file into memory.
+//
+//= RETURNS
+//- Returns false if the file can't be read or isn't a trace.
+//
+bool
+PinTraceReader::
+open( const char* path )
+{
+   close();
+
+   int fd = ::open( path, O_RDONLY );
+   if ( fd < 0 )
+   {
+      return false;
+   }
+
+   struct stat st;
+   if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < HEADER_SIZE )
+   {
+      ::close( fd );
+      return false;
+   }
+
+   void* map = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+   ::close( fd );
+   if ( map == MAP_FAILED )
+   {
+      return false;
+   }
+
+   const uint8_t* header = (const uint8_t*)map;
+   if ( memcmp( header, MAGIC, sizeof( MAGIC ) ) != 0 ||
+        ( header[4] | header[5] << 8 ) != VERSION ||
+        header[6] != RECORD_SIZE )
+   {
+      munmap( map, st.st_size );
+      return false;
+   }
+
+   m_map = map;
+   m_mapSize = st.st_size;
+   m_records = header + HEADER_SIZE;
+   m_size = ( m_mapSize - HEADER_SIZE ) / RECORD_SIZE;
+   rewind();
+   return true;
+}
+
+//============================================================================
+// Unmap the file.
+//
+// Don't close the reader while a replay is running.
+//
+void
+PinTraceReader::
+close()
+{
+   if ( m_map )
+   {
+      munmap( m_map, m_mapSize );
+   }
+   m_map = 0;
+   m_mapSize = 0;
+   m_records = 0;
+   m_size = 0;
+   m_pending = false;
+   rewind();
+}
+
+//============================================================================
+// Go back to the first record.
+//
+void
+PinTraceReader::
+rewind()
+{
+   m_next = 0;
+   m_time_us = 0;
+}
+
+//============================================================================
+// Read the next pin change.
+//
+//= OUTPUTS
+//- time_us   Time of the change in micro seconds from the trace start.
+//- pin       Pin number.
+//- level     LOW or HIGH.
+//
+//= RETURNS
+//- Returns false at the end of the trace.
+//
+bool
+PinTraceReader::
+next( uint64_t& time_us,
+      uint8_t& pin,
+      uint8_t& level )
+{
+   while ( m_next < m_size )
+   {
+      const uint8_t* r = m_records + m_next * RECORD_SIZE;
+      m_next++;
+      m_time_us += r[0] | r[1] << 8 | (uint32_t)r[2] << 16;
+
+      if ( ( r[3] & 0x7F ) != GAP_PIN )
+      {
+         time_us = m_time_us;
+         pin = r[3] & 0x7F;
+         level = r[3] >> 7;
+         return true;
+      }
+   }
+   return false;
+}
+
+//============================================================================
+// Start driving the pins from the trace.
+//
+// Each change is scheduled with HostSim::at() when the one before it
+// runs so only one event is in the queue at a time.  Setting a pin
+// runs its interrupt routines like any other HostSim input.
+//
+//= INPUTS
+//- start_us   Simulation time of the start of the trace.
+//
+void
+PinTraceReader::
+replay( uint64_t start_us )
+{
+   rewind();
+   m_start_us = start_us;
+   m_replayed = 0;
+   scheduleNext();
+}
+
+//============================================================================
+void
+PinTraceReader::
+scheduleNext()
+{
+   uint64_t time_us;
+   m_pending = next( time_us, m_pin, m_level );
+   if ( m_pending )
+   {
+      HostSim::at( m_start_us + time_us, replayCb, this );
+   }
+}
+
+//============================================================================
+void
+PinTraceReader::
+replayCb( void* data )
+{
+   PinTraceReader* reader = (PinTraceReader*)data;
+   HostSim::setPin( reader->m_pin, reader->m_level );
+   reader->m_replayed++;
+   reader->scheduleNext();
+}
+
+//============================================================================
@@ -0,0 +1,169 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+#include <stdio.h>
+
+// Pin level traces for record and replay.
+//
+// A trace is the list of times an input pin changed level.  It can
+// come from a simulation (PinTraceWriter::recordInputs()) or be converted
+// from a field capture (a logic analyzer export, etc) with
+// PinTraceWriter::add().  Replaying it with PinTraceReader drives the
+// simulated pins at the recorded times so the interrupt routines and
+// poll() methods see exactly the same inputs every run.
+//
+// File format (little endian):
+//
+//    header   "PTRC"  version (uint16)  record size (uint16)
+//    records  uint32: bits 0-23   micro seconds since the last record
+//                     bits 24-30  pin (127 = gap, no pin change)
+//                     bit  31     level
+//
+// Gaps longer than ~16.7 sec are written as extra gap records.  At 4
+// bytes per change, a switch that bounces 10 times per press for a
+// million presses is 40 MB.  The reader memory maps the file so it
+// doesn't matter how big the trace is.
+//
+//= Example
+//
+//   // Record the inputs of a simulated run.
+//   PinTraceWriter writer;
+//   writer.open( "run.trace" );
+//   writer.recordInputs();
+//   ...run the simulation...
+//   writer.close();
+//
+//   // Replay them.
+//   HostSim::reset();
+//   PinTraceReader reader;
+//   reader.open( "run.trace" );
+//   reader.replay();
+//   while ( ! reader.done() )
+//   {
+//      loop();
+//      HostSim::advance( 1000 );
+//   }
+//
+class PinTraceWriter
+{
+public:
+   PinTraceWriter();
+   ~PinTraceWriter();
+
+   bool open( const char* path );
+   void add( uint64_t time_us, uint8_t pin, uint8_t level );
+   void recordInputs();
+   void close();
+
+   uint32_t count();
+
+private:
+   FILE* m_fd;
+   uint64_t m_last_us;
+   uint32_t m_count;
+
+   // True if recordInputs() set the HostSim input hook.
+   bool m_recording;
+
+   void write( uint32_t record );
+   static void inputCb( uint8_t pin, uint8_t level, void* data );
+};
+
+class PinTraceReader
+{
+public:
+   PinTraceReader();
+   ~PinTraceReader();
+
+   bool open( const char* path );
+   void close();
+   uint32_t size();
+
+   void rewind();
+   bool next( uint64_t& time_us, uint8_t& pin, uint8_t& level );
+
+   void replay( uint64_t start_us=0 );
+   bool done();
+   uint32_t replayed();
+
+private:
+   // Memory mapped file and the records in it.
+   void* m_map;
+   size_t m_mapSize;
+   const uint8_t* m_records;
+   uint32_t m_size;
+
+   // Index of the next record to read and the time of the last one.
+   uint32_t m_next;
+   uint64_t m_time_us;
+
+   // Replay start time, the change waiting to be applied, and the
+   // number of pin changes replayed.
+   uint64_t m_start_us;
+   bool m_pending;
+   uint8_t m_pin;
+   uint8_t m_level;
+   uint32_t m_replayed;
+
+   void scheduleNext();
+   static void replayCb( void* data );
+};
+
+//============================================================================
+// Return the number of pin changes written.
+//
+inline
+uint32_t
+PinTraceWriter::
+count()
+{
+   return m_count;
+}
+
+//============================================================================
+// Return the number of records in the trace.
+//
+inline
+uint32_t
+PinTraceReader::
+size()
+{
+   return m_size;
+}
+
+//============================================================================
+// Return true once every record has been replayed.
+//
+inline
+bool
+PinTraceReader::
+done()
+{
+   return ! m_pending;
+}
+
+//============================================================================
+// Return the number of pin changes replayed.
+//
+inline
+uint32_t
+PinTraceReader::
+replayed()
+{
+   return m_replayed;
+}
+
+//============================================================================
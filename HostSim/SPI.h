@@ -0,0 +1,52 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Host stand in for the Arduino SPI library.
+//
+// Each byte sent with transfer() is passed to the callback set with
+// HostSim::onSpi() and the byte it returns is the byte read back.
+// That's enough to simulate shift registers on the bus (e.g. a 74HC595
+// output and a 74HC165 input chained on MOSI/MISO).  With no callback,
+// transfer() reads 0.
+//
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+class SPISettings
+{
+public:
+   SPISettings() {}
+   SPISettings( uint32_t, uint8_t, uint8_t ) {}
+};
+
+class SPIClass
+{
+public:
+   void begin() {}
+   void end() {}
+   void beginTransaction( SPISettings ) {}
+   void endTransaction() {}
+
+   uint8_t transfer( uint8_t data );
+   void transfer( void* buffer, size_t size );
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,121 @@
+#include "HostSim.h"
+#include "EEPROM.h"
+#include <iostream>
+#include <thread>
+
+// Separate simulation contexts.
+//
+// Checks that the clock, events, pins, port registers, and EEPROM of
+// each context don't leak into the others, that the default context
+// comes back, and that contexts run on different threads at the same
+// time.
+//
+// Compile and run:
+// g++ -O2 -pthread -I../.. -o test main.cpp ../../HostSim.cpp
+// ./test
+
+static bool s_ok = true;
+
+static void
+check( bool ok,
+       const char* msg )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED: " << msg << std::endl;
+      s_ok = false;
+   }
+}
+
+static int s_fired[2] = { 0, 0 };
+
+static void
+fire( void* data )
+{
+   s_fired[(uintptr_t)data]++;
+}
+
+// Run one context on its own thread.  Each thread toggles a pin and
+// counts the port register changes it sees.
+static void
+runBoard( HostSim::Context* context,
+          int id,
+          int* changes )
+{
+   HostSim::setContext( context );
+   unsigned long start = millis();
+   uint8_t last = *portInputRegister( 0 );
+   for ( int i = 0; i < 100000; ++i )
+   {
+      HostSim::setPin( 2 + id, i % 2 ? HIGH : LOW );
+      HostSim::advance( 1000 );
+      uint8_t port = *portInputRegister( 0 );
+      if ( port != last )
+      {
+         ( *changes )++;
+         last = port;
+      }
+   }
+   check( millis() - start == 100000, "thread clock" );
+}
+
+int
+main()
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::setPin( 2, HIGH );
+   EEPROM.write( 0, 42 );
+   HostSim::advance( 5000 );
+
+   HostSim::Context* a = HostSim::newContext();
+   HostSim::Context* b = HostSim::newContext();
+
+   // New contexts start out reset.
+   HostSim::Context* prev = HostSim::setContext( a );
+   check( HostSim::time_us() == 0, "new clock" );
+   check( HostSim::pin( 2 ) == LOW, "new pin" );
+   check( *portInputRegister( 0 ) == 0, "new port" );
+   check( EEPROM.read( 0 ) == 0xFF, "new EEPROM" );
+
+   HostSim::at( 1000, fire, (void*)0 );
+   HostSim::setPin( 3, HIGH );
+
+   HostSim::setContext( b );
+   HostSim::at( 2000, fire, (void*)1 );
+   HostSim::advance( 10000 );
+   check( s_fired[0] == 0 && s_fired[1] == 1, "events b" );
+   check( HostSim::pin( 3 ) == LOW, "pin b" );
+
+   HostSim::setContext( a );
+   check( HostSim::time_us() == 0, "clock a" );
+   HostSim::advance( 1000 );
+   check( s_fired[0] == 1 && s_fired[1] == 1, "events a" );
+   check( *portInputRegister( 0 ) == bit( 3 ), "port a" );
+
+   // Back to the default.
+   HostSim::setContext( prev );
+   check( HostSim::time_us() == 5000, "default clock" );
+   check( HostSim::pin( 2 ) == HIGH && HostSim::pin( 3 ) == LOW,
+          "default pins" );
+   check( *portInputRegister( 0 ) == bit( 2 ), "default port" );
+   check( EEPROM.read( 0 ) == 42, "default EEPROM" );
+
+   // Run both at once.
+   int changes[2] = { 0, 0 };
+   std::thread t0( runBoard, a, 0, &changes[0] );
+   std::thread t1( runBoard, b, 1, &changes[1] );
+   t0.join();
+   t1.join();
+   check( changes[0] == 99999 && changes[1] == 99999, "thread ports" );
+
+   HostSim::deleteContext( a );
+   HostSim::deleteContext( b );
+   check( HostSim::time_us() == 5000, "default after delete" );
+
+   if ( s_ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return s_ok ? 0 : 1;
+}
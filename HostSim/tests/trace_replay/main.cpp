@@ -0,0 +1,399 @@
+#include "HostSim.h"
+#include "PinTrace.h"
+#include "DigitalInput.h"
+#include "Valve.h"
+#include "Sonar.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Trace record and replay test.
+//
+// Capture: runs a bouncing switch (DigitalInput), a valve and its
+// limit switches (Valve), and an ultrasonic sensor (Sonar) against
+// simulated devices for 10 minutes, recording the input pins to a
+// trace and the status changes the classes report to a golden log.
+//
+// Replay: runs the same classes with no simulated devices, only the
+// trace driving the pins, and checks they report exactly the golden
+// log.  Prints the number of pin changes replayed per second.
+//
+// To check a field capture instead (converted to a trace with
+// PinTraceWriter using the pins below), pass the trace and golden log
+// files: ./test capture.trace capture.golden
+//
+// Compile and run:
+// g++ -O2 -I../.. -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Valve/Valve -I../../../Timer/Timer -I../../../Sonar/Sonar -I../../../MedianFilter/MedianFilter -I../../../AlphaBetaFilter/AlphaBetaFilter -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -o test main.cpp ../../PinTrace.cpp ../../HostSim.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Valve/Valve/Valve.cpp ../../../Valve/Valve/ValveStats.cpp ../../../Valve/Valve/ValveStore.cpp ../../../Timer/Timer/Timer.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp
+// ./test
+
+static const uint8_t SWITCH_PIN = 2;
+static const uint8_t ECHO_PIN = 3;
+static const uint8_t TRIGGER_PIN = 5;
+static const uint8_t OPEN_PIN = 16;
+static const uint8_t CLOSE_PIN = 17;
+static const uint8_t OPENED_PIN = 18;
+static const uint8_t CLOSED_PIN = 19;
+
+static const uint64_t RUN_US = 600000000; // 10 minutes
+static const uint64_t LOOP_US = 1000;
+static const long VALVE_CYCLE_MS = 20000;
+
+static const char* TRACE_FILE = "trace_replay.trace";
+static const char* GOLDEN_FILE = "trace_replay.golden";
+
+static uint32_t s_seed = 1;
+
+static int
+random( int num )
+{
+   s_seed = s_seed * 1103515245 + 12345;
+   return ( s_seed >> 16 ) % num;
+}
+
+//============================================================================
+//
+// Simulated devices (capture only)
+//
+//============================================================================
+static void
+switchLow( void* )
+{
+   HostSim::setPin( SWITCH_PIN, LOW );
+}
+
+static void
+switchHigh( void* )
+{
+   HostSim::setPin( SWITCH_PIN, HIGH );
+}
+
+// Switch presses and releases every 0.5-3 sec.  Each one bounces 2-8
+// times over up to ~4 ms before settling.
+static void
+switchChange( void* level )
+{
+   uint64_t t = HostSim::time_us();
+   int numBounces = 2 + random( 7 );
+   for ( int i = 0; i < numBounces; ++i )
+   {
+      t += 50 + random( 500 );
+      HostSim::at( t, ( i % 2 ) == ( level != 0 ) ? switchLow : switchHigh );
+   }
+   t += 50 + random( 500 );
+   HostSim::at( t, level ? switchHigh : switchLow );
+
+   t += 500000 + random( 2500 ) * 1000;
+   HostSim::at( t, switchChange, (void*)(uintptr_t)( level ? 0 : 1 ) );
+}
+
+// Valve takes 2.5 sec end to end.  The limit switch opens 40 ms after
+// the motor starts and closes when it gets to the end.
+struct SimValve
+{
+   int dir;
+   uintptr_t move;
+   bool opened;
+};
+
+static SimValve s_valve;
+
+static void
+valveStop( void* move )
+{
+   if ( (uintptr_t)move != s_valve.move )
+   {
+      return;
+   }
+   s_valve.opened = s_valve.dir > 0;
+   HostSim::setPin( OPENED_PIN, s_valve.opened ? LOW : HIGH );
+   HostSim::setPin( CLOSED_PIN, s_valve.opened ? HIGH : LOW );
+}
+
+static void
+valveLeave( void* move )
+{
+   if ( (uintptr_t)move == s_valve.move )
+   {
+      HostSim::setPin( OPENED_PIN, HIGH );
+      HostSim::setPin( CLOSED_PIN, HIGH );
+   }
+}
+
+static void
+motorWrite( uint8_t,
+            uint8_t,
+            void* )
+{
+   bool open = HostSim::pin( OPEN_PIN );
+   bool close = HostSim::pin( CLOSE_PIN );
+   int dir = ( open && ! close ) ? 1 : ( ! open && close ) ? -1 : 0;
+   if ( dir == s_valve.dir )
+   {
+      return;
+   }
+
+   s_valve.dir = dir;
+   s_valve.move++;
+   if ( dir && s_valve.opened != ( dir > 0 ) )
+   {
+      uint64_t t = HostSim::time_us();
+      HostSim::at( t + 40000, valveLeave, (void*)s_valve.move );
+      HostSim::at( t + 2500000 + random( 200 ) * 1000, valveStop,
+                   (void*)s_valve.move );
+   }
+}
+
+// HR-S04 with a target moving back and forth between 20 and 180 cm
+// and an echo jitter of up to 100 us.  1% of the pings are lost.
+static uint64_t s_triggerHigh_us = 0;
+
+static void
+echoHigh( void* )
+{
+   HostSim::setPin( ECHO_PIN, HIGH );
+}
+
+static void
+echoLow( void* )
+{
+   HostSim::setPin( ECHO_PIN, LOW );
+}
+
+static void
+triggerWrite( uint8_t,
+              uint8_t level,
+              void* )
+{
+   uint64_t t = HostSim::time_us();
+   if ( level == HIGH )
+   {
+      s_triggerHigh_us = t;
+      return;
+   }
+   if ( t - s_triggerHigh_us < 10 || HostSim::pin( ECHO_PIN ) == HIGH ||
+        random( 100 ) == 0 )
+   {
+      return;
+   }
+
+   uint32_t phase = ( t / 100000 ) % 320;
+   uint32_t dist_cm = 20 + ( phase < 160 ? phase : 320 - phase );
+   t += 450;
+   HostSim::at( t, echoHigh );
+   HostSim::at( t + dist_cm * 58 + random( 100 ), echoLow );
+}
+
+//============================================================================
+//
+// Board under test
+//
+//============================================================================
+static std::ostringstream s_log;
+
+static void
+switchCb( DigitalInput::Status status,
+          int8_t )
+{
+   s_log << millis() << " switch " << status << "\n";
+}
+
+static void
+valveCb( Valve::Status status,
+         int8_t )
+{
+   s_log << millis() << " valve " << status << "\n";
+}
+
+static void
+sonarCb( uint16_t dist_cm )
+{
+   s_log << millis() << " sonar " << dist_cm << "\n";
+}
+
+// Run the classes for RUN_US and return the log of what they reported.
+static std::string
+run()
+{
+   s_log.str( "" );
+
+   DigitalInput button;
+   button.init( SWITCH_PIN, LOW, DigitalInput::DIGITAL, 5 );
+
+   Valve valve;
+   valve.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN, CLOSED_PIN, 5000, 2000 );
+
+   Sonar< ECHO_PIN, TRIGGER_PIN, 3 > sonar;
+   sonar.init( 20 );
+   sonar.setMaxRange( 250 );
+
+   long nextCommand = VALVE_CYCLE_MS;
+   bool open = true;
+   while ( HostSim::time_us() < RUN_US )
+   {
+      long t = millis();
+      if ( t - nextCommand >= 0 )
+      {
+         if ( open )
+         {
+            valve.open();
+         }
+         else
+         {
+            valve.close();
+         }
+         open = ! open;
+         nextCommand += VALVE_CYCLE_MS;
+      }
+
+      button.poll( t, switchCb );
+      valve.poll( t, valveCb );
+      sonar.poll( sonarCb );
+      HostSim::advance( LOOP_US );
+   }
+
+   return s_log.str();
+}
+
+// Initial pin levels: switch up, echo low, valve closed.
+static void
+initPins()
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::setPin( SWITCH_PIN, HIGH );
+   HostSim::setPin( ECHO_PIN, LOW );
+   HostSim::setPin( OPENED_PIN, HIGH );
+   HostSim::setPin( CLOSED_PIN, LOW );
+}
+
+//============================================================================
+// Run the simulated devices and record the trace and golden log.
+static bool
+capture( const char* tracePath,
+         const char* goldenPath )
+{
+   initPins();
+   PinTraceWriter writer;
+   if ( ! writer.open( tracePath ) )
+   {
+      return false;
+   }
+   writer.recordInputs();
+
+   s_seed = 1;
+   s_valve.dir = 0;
+   s_valve.move = 0;
+   s_valve.opened = false;
+   HostSim::onWrite( OPEN_PIN, motorWrite );
+   HostSim::onWrite( CLOSE_PIN, motorWrite );
+   HostSim::onWrite( TRIGGER_PIN, triggerWrite );
+   HostSim::at( 1000000, switchChange, (void*)0 );
+
+   std::string log = run();
+   std::cout << "Captured " << writer.count() << " pin changes" << std::endl;
+   writer.close();
+
+   std::ofstream golden( goldenPath );
+   golden << log;
+   return golden.good();
+}
+
+//============================================================================
+// Replay a trace and compare what the classes report to the golden log.
+static bool
+replay( const char* tracePath,
+        const char* goldenPath )
+{
+   std::ifstream golden( goldenPath );
+   std::stringstream expect;
+   expect << golden.rdbuf();
+
+   initPins();
+   PinTraceReader reader;
+   if ( ! reader.open( tracePath ) )
+   {
+      std::cout << "FAILED can't read " << tracePath << std::endl;
+      return false;
+   }
+   reader.replay();
+
+   std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+   std::string log = run();
+   double wall = std::chrono::duration< double >(
+      std::chrono::steady_clock::now() - start ).count();
+
+   std::cout << "Replayed " << reader.replayed() << " pin changes in "
+             << wall << " s = " << (long)( reader.replayed() / wall )
+             << " changes/s" << std::endl;
+
+   // Report the first line that doesn't match.
+   if ( log != expect.str() )
+   {
+      std::istringstream a( log );
+      std::istringstream b( expect.str() );
+      std::string lineA;
+      std::string lineB;
+      for ( int line = 1; ; ++line )
+      {
+         bool moreA = (bool)std::getline( a, lineA );
+         bool moreB = (bool)std::getline( b, lineB );
+         if ( ! moreA && ! moreB )
+         {
+            break;
+         }
+         if ( lineA != lineB || moreA != moreB )
+         {
+            std::cout << "FAILED line " << line << ": got '" << lineA
+                      << "' expected '" << lineB << "'" << std::endl;
+            break;
+         }
+      }
+      return false;
+   }
+
+   // Also decode the whole trace straight from the mapped file.
+   reader.close();
+   reader.open( tracePath );
+   start = std::chrono::steady_clock::now();
+   uint64_t time_us;
+   uint8_t pin;
+   uint8_t level;
+   uint32_t num = 0;
+   while ( reader.next( time_us, pin, level ) )
+   {
+      num++;
+   }
+   wall = std::chrono::duration< double >(
+      std::chrono::steady_clock::now() - start ).count();
+   std::cout << "Decoded " << num << " pin changes at "
+             << (long)( num / wall ) << " changes/s" << std::endl;
+   return true;
+}
+
+//============================================================================
+int
+main( int argc,
+      char** argv )
+{
+   bool ok;
+   if ( argc == 3 )
+   {
+      ok = replay( argv[1], argv[2] );
+   }
+   else
+   {
+      ok = capture( TRACE_FILE, GOLDEN_FILE );
+      ok = ok && replay( TRACE_FILE, GOLDEN_FILE );
+      remove( TRACE_FILE );
+      remove( GOLDEN_FILE );
+   }
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
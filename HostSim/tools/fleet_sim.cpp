@@ -0,0 +1,833 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Simulate a fleet of leak sensor boards.
+//
+// Build and run on a normal computer (from this directory):
+// g++ -O2 -pthread -DVALVE_STORE -DVALVE_DEADLINE -DFLIGHTRECORDER_ENABLE=0 -I.. -I../../Valve/Valve -I../../DigitalInput/DigitalInput -I../../DigitalOutput/DigitalOutput -I../../Timer/Timer -I../../Profile/Profile -I../../FlightRecorder/FlightRecorder -o fleet_sim fleet_sim.cpp ../HostSim.cpp ../../Valve/Valve/Valve.cpp ../../Valve/Valve/ValveStats.cpp ../../Valve/Valve/ValveStore.cpp ../../DigitalInput/DigitalInput/DigitalInput.cpp ../../Timer/Timer/Timer.cpp
+// ./fleet_sim [-devices N] [-threads N] [-hours N] [-faults PCT] [-seed N]
+//
+// Each device is a copy of the leak_sensor sketch (leak sensor and
+// button DigitalInput, LED DigitalOutput, Valve with a ValveStore,
+// and a once a minute heartbeat Timer) running in its own
+// HostSim::Context so it has its own pins, clock, and EEPROM.  The
+// simulated valve, leaks, and button presses are the same as the
+// Valve leak_sensor_sim test.
+//
+// Between leaks, a device gets a fault with the -faults percent
+// chance:
+//
+//    JAM      The valve sticks half way closed until the next clear.
+//             The next leak must end in STALLED instead of CLOSED.
+//    CHATTER  A burst of sensor pulses shorter than the debounce time.
+//             Must not be reported as a leak.
+//    REBOOT   setup() runs again (the EEPROM is kept).  The valve and
+//             leak status must carry on as if nothing happened.
+//
+// Every leak must close (or stall) the valve and every clear must
+// open it again within 15 seconds.  Devices run in one simulated
+// hour slices on a pool of threads.  Each thread takes slices from
+// its own queue and steals from the others when it runs out so a
+// device with lots of events doesn't hold up the rest.  The exit code
+// is 1 if any check failed.
+//
+// The libraries are compiled with FLIGHTRECORDER_ENABLE=0 since the
+// flight recorder is one static buffer shared by every device.
+// Profile and Telemetry are static too - leave them off.
+//
+#include "HostSim.h"
+#include "DigitalInput.h"
+#include "DigitalOutput.h"
+#include "Timer.h"
+#include "Valve.h"
+#include "ValveStore.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pins used by the sketch.
+static const uint8_t BUTTON_PIN = 14;
+static const uint8_t SENSOR_PIN = 3;
+static const uint8_t LED_PIN = 6;
+static const uint8_t OPEN_PIN = 16;
+static const uint8_t CLOSE_PIN = 17;
+static const uint8_t OPENED_PIN = 18;
+static const uint8_t CLOSED_PIN = 19;
+
+static const uint64_t SECOND = 1000000;
+static const uint64_t HOUR = 3600 * SECOND;
+
+// Time it takes the valve to go end to end.
+static const int64_t TRAVEL_US = 3 * SECOND;
+
+// Max time to react to a leak or a clear.
+static const uint64_t MAX_REACT_US = 15 * SECOND;
+
+// Amount of simulated time a thread runs a device for at once.
+static const uint64_t SLICE_US = HOUR;
+
+enum Fault {
+   NO_FAULT = 0,
+   JAM = 1,
+   CHATTER = 2,
+   REBOOT = 3,
+};
+
+//============================================================================
+//
+// One simulated board
+//
+//============================================================================
+class Device
+{
+public:
+   void init( int id, uint64_t runTime, int faultPct, uint32_t seed );
+   bool run( uint64_t durationUs );
+   void finish();
+
+   // Results.
+   uint64_t loops;
+   int leaks;
+   int stalls;
+   int heartbeats;
+   int faults[4];
+   int failures;
+
+private:
+   // Sketch.
+   enum Status {
+      NORMAL = 0,
+      LEAK_SHUTOFF = 2,
+   };
+   void setup();
+   void loop();
+   void statusChange( Status status );
+   static void buttonChangedCb( DigitalInput::Status status, int8_t id );
+   static void sensorChangedCb( DigitalInput::Status status, int8_t id );
+
+   DigitalInput m_button;
+   DigitalInput m_sensor;
+   DigitalOutput m_led;
+   Valve m_valve;
+   ValveStore m_store;
+   Timer m_heartbeat;
+   Status m_status;
+
+   // Simulated valve.  The position is the micro seconds of travel
+   // from closed.  Each change of direction bumps the move number so
+   // events from earlier moves are ignored.
+   void valveUpdate();
+   static void valveArrived( void* data );
+   static void motorWrite( uint8_t pin, uint8_t level, void* data );
+   int64_t m_position;
+   int m_dir;
+   uint64_t m_lastTime;
+   uintptr_t m_move;
+   bool m_jammed;
+
+   // Leaks, button presses, and faults.
+   uint32_t random();
+   void scheduleLeak( uint64_t fromTime );
+   static void leak( void* data );
+   static void leakEnd( void* data );
+   static void clear( void* data );
+   static void buttonUp( void* data );
+   static void fault( void* data );
+   static void chatter( void* data );
+   static void checkClosed( void* data );
+   static void checkOpened( void* data );
+   void check( bool ok, const char* msg );
+
+   int m_id;
+   HostSim::Context* m_context;
+   uint64_t m_runTime;
+   int m_faultPct;
+   uint32_t m_random;
+   bool m_leaking;
+   bool m_reboot;
+   bool m_expectStall;
+   Fault m_fault;
+   int m_chatterLeft;
+};
+
+// Device running on this thread.  The sketch callbacks don't take a
+// data pointer so this is how they find their device.
+static thread_local Device* s_device = NULL;
+
+//============================================================================
+// Return the earlier of two times in millis.
+static long
+earliest( long a,
+          long b )
+{
+   return a - b < 0 ? a : b;
+}
+
+//============================================================================
+void
+Device::
+init( int id,
+      uint64_t runTime,
+      int faultPct,
+      uint32_t seed )
+{
+   m_id = id;
+   m_runTime = runTime;
+   m_faultPct = faultPct;
+   m_random = seed * 2654435761u + id;
+   m_leaking = false;
+   m_reboot = false;
+   m_expectStall = false;
+   m_fault = NO_FAULT;
+   m_chatterLeft = 0;
+
+   loops = 0;
+   leaks = 0;
+   stalls = 0;
+   heartbeats = 0;
+   memset( faults, 0, sizeof( faults ) );
+   failures = 0;
+
+   m_context = HostSim::newContext();
+   HostSim::Context* prev = HostSim::setContext( m_context );
+   s_device = this;
+   HostSim::serialOutput( NULL );
+
+   // Valve starts opened, no leak, button up.
+   m_position = TRAVEL_US;
+   m_dir = 0;
+   m_lastTime = 0;
+   m_move = 0;
+   m_jammed = false;
+   valveUpdate();
+   HostSim::setPin( SENSOR_PIN, LOW );
+   HostSim::setPin( BUTTON_PIN, HIGH );
+   HostSim::onWrite( OPEN_PIN, motorWrite, this );
+   HostSim::onWrite( CLOSE_PIN, motorWrite, this );
+   scheduleLeak( 0 );
+
+   setup();
+   check( m_valve.status() == Valve::OPENED, "valve not opened at start" );
+
+   HostSim::setContext( prev );
+}
+
+//============================================================================
+// Run the device for a while.
+//
+//= INPUTS
+//- durationUs   Simulated time to run for in micro seconds.
+//
+//= RETURNS
+//- Returns true if the device has reached the end of the run.
+//
+bool
+Device::
+run( uint64_t durationUs )
+{
+   HostSim::Context* prev = HostSim::setContext( m_context );
+   s_device = this;
+
+   uint64_t untilTime = min( HostSim::time_us() + durationUs, m_runTime );
+   while ( HostSim::time_us() < untilTime )
+   {
+      if ( m_reboot )
+      {
+         m_reboot = false;
+         setup();
+      }
+
+      loop();
+      ++loops;
+
+      // Skip to the next time the sketch has something to do.
+      long t = millis();
+      long next = m_valve.deadline( t );
+      next = earliest( next, m_button.deadline( t ) );
+      next = earliest( next, m_sensor.deadline( t ) );
+      next = earliest( next, m_led.deadline( t ) );
+      next = earliest( next, m_heartbeat.deadline( t ) );
+      uint64_t nextTime = ( t + max( next - t, 1L ) ) * 1000ULL;
+      HostSim::fastForward( min( nextTime, untilTime ) );
+   }
+
+   HostSim::setContext( prev );
+   return untilTime >= m_runTime;
+}
+
+//============================================================================
+// Free the simulation after the run.
+//
+void
+Device::
+finish()
+{
+   HostSim::deleteContext( m_context );
+   m_context = NULL;
+}
+
+//============================================================================
+// Record the result of a check.
+//
+void
+Device::
+check( bool ok,
+       const char* msg )
+{
+   if ( ! ok )
+   {
+      failures++;
+      fprintf( stderr, "Device %d at %.3f h: %s (valve status %d)\n",
+               m_id, (double)HostSim::time_us() / HOUR, msg,
+               m_valve.status() );
+   }
+}
+
+//============================================================================
+//
+// Sketch (the leak_sensor sketch without the secondary sensor)
+//
+//============================================================================
+void
+Device::
+setup()
+{
+   m_status = NORMAL;
+   m_button.init( BUTTON_PIN, LOW );
+   m_sensor.init( SENSOR_PIN, HIGH );
+   m_led.init( LED_PIN );
+   m_heartbeat.repeat( 60000 );
+
+   Valve::Status status = m_valve.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN,
+                                        CLOSED_PIN, 10000, 10000 );
+   m_store.init( 0, 16 );
+   status = m_valve.setStore( &m_store );
+   if ( status != Valve::OPENED && status != Valve::OPENING )
+   {
+      statusChange( LEAK_SHUTOFF );
+   }
+}
+
+//============================================================================
+void
+Device::
+loop()
+{
+   long t = millis();
+
+   m_led.poll( t );
+   m_button.poll( t, buttonChangedCb );
+   m_sensor.poll( t, sensorChangedCb );
+   Valve::Status status = m_valve.poll( t );
+   if ( status == Valve::STALLED )
+   {
+      stalls++;
+   }
+   if ( m_heartbeat.poll( t ) )
+   {
+      heartbeats++;
+   }
+}
+
+//============================================================================
+void
+Device::
+statusChange( Status status )
+{
+   if ( status == m_status )
+   {
+      return;
+   }
+
+   // A stalled valve won't take a normal command.  The clear means
+   // it's been fixed so force it open.
+   if ( status == NORMAL )
+   {
+      m_led.off();
+      m_valve.open( m_valve.status() == Valve::STALLED );
+   }
+   else
+   {
+      m_valve.close();
+      m_led.blinkFast();
+   }
+
+   m_status = status;
+}
+
+//============================================================================
+void
+Device::
+buttonChangedCb( DigitalInput::Status status,
+                 int8_t )
+{
+   if ( status == DigitalInput::OPENED )
+   {
+      s_device->statusChange( NORMAL );
+   }
+}
+
+//============================================================================
+void
+Device::
+sensorChangedCb( DigitalInput::Status status,
+                 int8_t )
+{
+   if ( status == DigitalInput::CLOSED )
+   {
+      s_device->check( s_device->m_leaking, "false leak alarm" );
+      s_device->statusChange( LEAK_SHUTOFF );
+   }
+}
+
+//============================================================================
+//
+// Simulated valve
+//
+//============================================================================
+void
+Device::
+valveUpdate()
+{
+   uint64_t now = HostSim::time_us();
+   m_position += m_dir * (int64_t)( now - m_lastTime );
+   m_position = constrain( m_position, m_jammed ? TRAVEL_US / 2 : 0,
+                           TRAVEL_US );
+   m_lastTime = now;
+
+   HostSim::setPin( OPENED_PIN, m_position == TRAVEL_US ? LOW : HIGH );
+   HostSim::setPin( CLOSED_PIN, m_position == 0 ? LOW : HIGH );
+}
+
+//============================================================================
+// Motor reached the end or moved off of a switch.
+//
+void
+Device::
+valveArrived( void* data )
+{
+   if ( (uintptr_t)data == s_device->m_move )
+   {
+      s_device->valveUpdate();
+   }
+}
+
+//============================================================================
+// Motor pins written by the sketch.
+//
+void
+Device::
+motorWrite( uint8_t,
+            uint8_t,
+            void* data )
+{
+   Device* d = (Device*)data;
+   bool open = HostSim::pin( OPEN_PIN );
+   bool close = HostSim::pin( CLOSE_PIN );
+   int dir = ( open && ! close ) ? 1 : ( ! open && close ) ? -1 : 0;
+   if ( dir == d->m_dir )
+   {
+      return;
+   }
+
+   d->valveUpdate();
+   d->m_dir = dir;
+   d->m_move++;
+   if ( dir )
+   {
+      uint64_t now = HostSim::time_us();
+      int64_t left = dir > 0 ? TRAVEL_US - d->m_position : d->m_position;
+      HostSim::at( now + left, valveArrived, (void*)d->m_move );
+
+      // The end switch opens once the valve moves a little.
+      HostSim::at( now + 50000, valveArrived, (void*)d->m_move );
+   }
+}
+
+//============================================================================
+//
+// Leaks, button presses, and faults
+//
+//============================================================================
+uint32_t
+Device::
+random()
+{
+   m_random = m_random * 1103515245 + 12345;
+   return m_random >> 8;
+}
+
+//============================================================================
+// Next leak 1-48 hours after the last one is cleared.  No leaks in
+// the last 2 hours so they're all cleared by the end.  Maybe add a
+// fault somewhere in between.
+//
+void
+Device::
+scheduleLeak( uint64_t fromTime )
+{
+   uint64_t time = fromTime + HOUR +
+      random() % ( 47 * HOUR / SECOND ) * SECOND;
+   if ( time >= m_runTime - 2 * HOUR )
+   {
+      return;
+   }
+   HostSim::at( time, leak, this );
+
+   if ( (int)( random() % 100 ) < m_faultPct )
+   {
+      // At least a minute after the clear and before the leak.
+      uint64_t start = fromTime + 60 * SECOND;
+      uint64_t faultTime = start + random() % ( time - start - 60 * SECOND );
+      m_fault = (Fault)( 1 + random() % 3 );
+      HostSim::at( faultTime, fault, this );
+   }
+}
+
+//============================================================================
+// Leak ends after 10 minutes.  An hour after the leak, the button is
+// pressed for 300 ms to clear it.
+//
+void
+Device::
+leak( void* data )
+{
+   Device* d = (Device*)data;
+   uint64_t now = HostSim::time_us();
+   d->leaks++;
+   d->m_leaking = true;
+   HostSim::setPin( SENSOR_PIN, HIGH );
+   HostSim::at( now + MAX_REACT_US, checkClosed, d );
+   HostSim::at( now + 600 * SECOND, leakEnd, d );
+   HostSim::at( now + HOUR, clear, d );
+}
+
+//============================================================================
+void
+Device::
+leakEnd( void* data )
+{
+   Device* d = (Device*)data;
+   HostSim::setPin( SENSOR_PIN, LOW );
+   d->m_leaking = false;
+}
+
+//============================================================================
+// Press the button.  Somebody fixed the jammed valve too.
+//
+void
+Device::
+clear( void* data )
+{
+   Device* d = (Device*)data;
+   uint64_t now = HostSim::time_us();
+   d->m_jammed = false;
+   d->m_expectStall = false;
+   HostSim::setPin( BUTTON_PIN, LOW );
+   HostSim::at( now + 300000, buttonUp, d );
+   HostSim::at( now + MAX_REACT_US, checkOpened, d );
+   d->scheduleLeak( now );
+}
+
+//============================================================================
+void
+Device::
+buttonUp( void* )
+{
+   HostSim::setPin( BUTTON_PIN, HIGH );
+}
+
+//============================================================================
+void
+Device::
+fault( void* data )
+{
+   Device* d = (Device*)data;
+   d->faults[d->m_fault]++;
+   switch ( d->m_fault )
+   {
+   case JAM:
+      d->m_jammed = true;
+      d->m_expectStall = true;
+      break;
+
+   case CHATTER:
+      // 2 ms pulses, 2 ms apart, with a 5 ms debounce.
+      d->m_chatterLeft = 20;
+      chatter( d );
+      break;
+
+   case REBOOT:
+      d->m_reboot = true;
+      break;
+
+   case NO_FAULT:
+      break;
+   }
+   d->m_fault = NO_FAULT;
+}
+
+//============================================================================
+void
+Device::
+chatter( void* data )
+{
+   Device* d = (Device*)data;
+   uint8_t level = d->m_chatterLeft-- % 2 ? LOW : HIGH;
+   HostSim::setPin( SENSOR_PIN, level );
+   if ( d->m_chatterLeft > 0 )
+   {
+      HostSim::at( HostSim::time_us() + 2000, chatter, d );
+   }
+}
+
+//============================================================================
+void
+Device::
+checkClosed( void* data )
+{
+   Device* d = (Device*)data;
+   if ( d->m_expectStall )
+   {
+      d->check( d->m_valve.status() == Valve::STALLED,
+                "jammed valve not stalled after a leak" );
+   }
+   else
+   {
+      d->check( d->m_valve.status() == Valve::CLOSED,
+                "valve not closed after a leak" );
+   }
+}
+
+//============================================================================
+void
+Device::
+checkOpened( void* data )
+{
+   Device* d = (Device*)data;
+   d->check( d->m_valve.status() == Valve::OPENED,
+             "valve not opened after a clear" );
+}
+
+//============================================================================
+//
+// Work stealing pool
+//
+//============================================================================
+struct Worker
+{
+   std::mutex lock;
+   std::deque< int > jobs;
+   std::thread thread;
+   uint64_t slices;
+   uint64_t steals;
+};
+
+static std::vector< Device > s_devices;
+static std::vector< Worker* > s_workers;
+static std::atomic< int > s_remaining;
+
+//============================================================================
+// Get the next device to run.  Newest first from our own queue, then
+// oldest first from the others.
+//
+static int
+nextJob( int self )
+{
+   Worker* w = s_workers[self];
+   {
+      std::lock_guard< std::mutex > guard( w->lock );
+      if ( ! w->jobs.empty() )
+      {
+         int job = w->jobs.back();
+         w->jobs.pop_back();
+         return job;
+      }
+   }
+
+   int num = s_workers.size();
+   for ( int i = 1; i < num; ++i )
+   {
+      Worker* victim = s_workers[( self + i ) % num];
+      std::lock_guard< std::mutex > guard( victim->lock );
+      if ( ! victim->jobs.empty() )
+      {
+         int job = victim->jobs.front();
+         victim->jobs.pop_front();
+         w->steals++;
+         return job;
+      }
+   }
+
+   return -1;
+}
+
+//============================================================================
+static void
+work( int self )
+{
+   Worker* w = s_workers[self];
+   while ( s_remaining > 0 )
+   {
+      int job = nextJob( self );
+      if ( job < 0 )
+      {
+         std::this_thread::yield();
+         continue;
+      }
+
+      Device& d = s_devices[job];
+      w->slices++;
+      if ( d.run( SLICE_US ) )
+      {
+         d.finish();
+         s_remaining--;
+      }
+      else
+      {
+         std::lock_guard< std::mutex > guard( w->lock );
+         w->jobs.push_back( job );
+      }
+   }
+}
+
+//============================================================================
+int
+main( int argc,
+      char** argv )
+{
+   int numDevices = 100;
+   int numThreads = std::thread::hardware_concurrency();
+   int hours = 1000;
+   int faultPct = 20;
+   uint32_t seed = 1;
+   for ( int i = 1; i < argc; ++i )
+   {
+      if ( i + 1 < argc && strcmp( argv[i], "-devices" ) == 0 )
+      {
+         numDevices = atoi( argv[++i] );
+      }
+      else if ( i + 1 < argc && strcmp( argv[i], "-threads" ) == 0 )
+      {
+         numThreads = atoi( argv[++i] );
+      }
+      else if ( i + 1 < argc && strcmp( argv[i], "-hours" ) == 0 )
+      {
+         hours = atoi( argv[++i] );
+      }
+      else if ( i + 1 < argc && strcmp( argv[i], "-faults" ) == 0 )
+      {
+         faultPct = atoi( argv[++i] );
+      }
+      else if ( i + 1 < argc && strcmp( argv[i], "-seed" ) == 0 )
+      {
+         seed = atoi( argv[++i] );
+      }
+      else
+      {
+         fprintf( stderr, "Usage: %s [-devices N] [-threads N] [-hours N] "
+                  "[-faults PCT] [-seed N]\n", argv[0] );
+         return 1;
+      }
+   }
+
+   // millis() is 32 bits so stay under the 49.7 day roll over.
+   numDevices = max( numDevices, 1 );
+   numThreads = max( numThreads, 1 );
+   hours = constrain( hours, 3, 1000 );
+
+   s_devices.resize( numDevices );
+   for ( int i = 0; i < numDevices; ++i )
+   {
+      s_devices[i].init( i, hours * HOUR, faultPct, seed );
+   }
+
+   // Give each thread a block of devices.
+   for ( int i = 0; i < numThreads; ++i )
+   {
+      Worker* w = new Worker;
+      w->slices = 0;
+      w->steals = 0;
+      for ( int j = i * numDevices / numThreads;
+            j < ( i + 1 ) * numDevices / numThreads; ++j )
+      {
+         w->jobs.push_back( j );
+      }
+      s_workers.push_back( w );
+   }
+   s_remaining = numDevices;
+
+   std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+   for ( int i = 0; i < numThreads; ++i )
+   {
+      s_workers[i]->thread = std::thread( work, i );
+   }
+   for ( int i = 0; i < numThreads; ++i )
+   {
+      s_workers[i]->thread.join();
+   }
+
+   double wall = std::chrono::duration< double >(
+      std::chrono::steady_clock::now() - start ).count();
+
+   uint64_t loops = 0;
+   long leaks = 0;
+   long stalls = 0;
+   long heartbeats = 0;
+   long faults[4] = { 0, 0, 0, 0 };
+   long failures = 0;
+   for ( int i = 0; i < numDevices; ++i )
+   {
+      Device& d = s_devices[i];
+      loops += d.loops;
+      leaks += d.leaks;
+      stalls += d.stalls;
+      heartbeats += d.heartbeats;
+      failures += d.failures;
+      for ( int j = 0; j < 4; ++j )
+      {
+         faults[j] += d.faults[j];
+      }
+   }
+
+   double deviceSec = (double)numDevices * hours * 3600;
+   printf( "%d devices x %d hours on %d threads: %.3f s wall\n",
+           numDevices, hours, numThreads, wall );
+   printf( "%.0f device-seconds/s, %.0f loops/s\n", deviceSec / wall,
+           loops / wall );
+   printf( "%ld leaks, %ld stalls, %ld heartbeats\n", leaks, stalls,
+           heartbeats );
+   printf( "faults: %ld jam, %ld chatter, %ld reboot\n", faults[JAM],
+           faults[CHATTER], faults[REBOOT] );
+   for ( int i = 0; i < numThreads; ++i )
+   {
+      printf( "thread %d: %llu slices, %llu stolen\n", i,
+              (unsigned long long)s_workers[i]->slices,
+              (unsigned long long)s_workers[i]->steals );
+   }
+   printf( "%ld check failures\n", failures );
+
+   return failures ? 1 : 0;
+}
+
+//============================================================================
@@ -1,4 +1,7 @@
 #include "LoopFreq.h"
+#if defined( LOOPFREQ_TELEMETRY )
+#include "Telemetry.h"
+#endif
 
 //============================================================================
 // Constructor
@@ -16,6 +19,12 @@ LoopFreq( int numCalls,
      m_count( 0 ),
      m_start( 0 )
 {
+#if defined( LOOPFREQ_HISTOGRAM )
+   m_hist = false;
+   m_haveLast = false;
+   m_deadline_us = 0;
+   m_last_us = 0;
+#endif
 }
 
 //============================================================================
@@ -35,14 +44,37 @@ poll()
    else if ( m_count == 0 )
    {
       m_start = millis();
+#if defined( LOOPFREQ_HISTOGRAM )
+      if ( m_hist )
+      {
+         clearHistogram();
+      }
+#endif
    }
 
+#if defined( LOOPFREQ_HISTOGRAM )
+   if ( m_hist )
+   {
+      unsigned long now_us = micros();
+      if ( m_haveLast )
+      {
+         addTime( now_us - m_last_us );
+      }
+      m_last_us = now_us;
+      m_haveLast = true;
+   }
+#endif
+
    if ( ++m_count == m_numCalls )
    {
       long elapsed = millis() - m_start;
-      float avg = (float)elapsed / m_numCalls;
       m_count = m_repeat ? 0 : -1;
-      
+
+#if defined( LOOPFREQ_TELEMETRY )
+      logReport( elapsed );
+#else
+      float avg = (float)elapsed / m_numCalls;
+
       Serial.print( "LoopFreq " );
       Serial.print( m_numCalls );
       Serial.println( " calls" );
@@ -52,7 +84,248 @@ poll()
       Serial.print( "   Avg : " );
       Serial.print( avg );
       Serial.println( " ms/call" );
+
+#if defined( LOOPFREQ_HISTOGRAM )
+      if ( m_hist )
+      {
+         report();
+      }
+#endif
+#endif
+   }
+}
+
+#if defined( LOOPFREQ_TELEMETRY )
+//============================================================================
+// Log the results as telemetry records.
+//
+// TELEMETRY_LOOPFREQ has the number of calls (uint16) and the elapsed
+// time in ms (uint32).  TELEMETRY_LOOPFREQ_HIST has the Snapshot
+// fields in order (uint16 count, uint16 over, uint32 min, max, p50,
+// p99, p999) and the uint32 deadline in us.
+//
+//= INPUTS
+//- elapsed    Time for all the calls in millis.
+//
+void
+LoopFreq::
+logReport( long elapsed )
+{
+   uint8_t calls[6];
+   uint16_t numCalls = m_numCalls;
+   uint32_t elapsedMillis = elapsed;
+   memcpy( calls, &numCalls, 2 );
+   memcpy( calls + 2, &elapsedMillis, 4 );
+   Telemetry::log( TELEMETRY_LOOPFREQ, calls, sizeof( calls ) );
+
+#if defined( LOOPFREQ_HISTOGRAM )
+   if ( m_hist )
+   {
+      Snapshot snap;
+      readSnapshot( snap );
+
+      uint8_t hist[sizeof( snap ) + 4];
+      uint32_t deadline = m_deadline_us;
+      memcpy( hist, &snap, sizeof( snap ) );
+      memcpy( hist + sizeof( snap ), &deadline, 4 );
+      Telemetry::log( TELEMETRY_LOOPFREQ_HIST, hist, sizeof( hist ) );
+   }
+#endif
+}
+#endif
+
+#if defined( LOOPFREQ_HISTOGRAM )
+
+//============================================================================
+// Get the histogram results.
+//
+// Interrupts are turned off while the counters are read so this is
+// safe to call if poll() is run from an interrupt.
+//
+//= OUTPUTS
+//- snap    The loop time results.  All zero if no times were recorded.
+//
+void
+LoopFreq::
+snapshot( Snapshot& snap )
+{
+   noInterrupts();
+   readSnapshot( snap );
+   interrupts();
+}
+
+//============================================================================
+// Compute the histogram results.
+//
+//= OUTPUTS
+//- snap    The loop time results.  All zero if no times were recorded.
+//
+void
+LoopFreq::
+readSnapshot( Snapshot& snap )
+{
+   memset( &snap, 0, sizeof( snap ) );
+
+   uint16_t count = m_numTimes;
+   if ( count )
+   {
+      snap.count = count;
+      snap.over = m_over;
+      snap.min = m_min_us;
+      snap.max = m_max_us;
+
+      // Number of times at or below each percentile (rounded up).
+      uint16_t n50 = ( count + 1 ) / 2;
+      uint16_t n99 = count - count / 100;
+      uint16_t n999 = count - count / 1000;
+
+      // Walk the buckets once to find all the percentiles.  Each one
+      // is the end of the bucket it falls in (but not past the max).
+      uint16_t sum = 0;
+      for ( uint8_t i = 0; i < LOOPFREQ_NUM_BUCKETS && sum < n999; ++i )
+      {
+         sum += m_buckets[i];
+         uint32_t end = min( bucketEnd( i ), (uint32_t)m_max_us );
+         if ( ! snap.p50 && sum >= n50 )
+         {
+            snap.p50 = end;
+         }
+         if ( ! snap.p99 && sum >= n99 )
+         {
+            snap.p99 = end;
+         }
+         if ( sum >= n999 )
+         {
+            snap.p999 = end;
+         }
+      }
+   }
+}
+
+//============================================================================
+// Clear the histogram counters.
+//
+void
+LoopFreq::
+clearHistogram()
+{
+   m_numTimes = 0;
+   m_over = 0;
+   m_min_us = 0xFFFFFFFF;
+   m_max_us = 0;
+   for ( uint8_t i = 0; i < LOOPFREQ_NUM_BUCKETS; ++i )
+   {
+      m_buckets[i] = 0;
    }
+
+   // Don't count the time since the last poll() (which includes the
+   // report when repeating).
+   m_haveLast = false;
+}
+
+//============================================================================
+// Add a loop time to the histogram.
+//
+// Times below LOOPFREQ_SUB_BUCKETS * 2 us have their own bucket.  Above
+// that, each power of 2 is split into LOOPFREQ_SUB_BUCKETS buckets
+// using the bits below the highest set bit.
+//
+//= INPUTS
+//- dt_us    Loop time in micro seconds.
+//
+void
+LoopFreq::
+addTime( uint32_t dt_us )
+{
+   uint8_t index = dt_us;
+   if ( dt_us >= 2 * LOOPFREQ_SUB_BUCKETS )
+   {
+      // Position of the highest bit set.
+      uint8_t octave = 8 * sizeof( unsigned long ) - 1 -
+                       __builtin_clzl( dt_us );
+      uint8_t shift = octave - LOOPFREQ_SUB_BITS;
+      index = ( shift + 1 ) * LOOPFREQ_SUB_BUCKETS +
+              ( ( dt_us >> shift ) & ( LOOPFREQ_SUB_BUCKETS - 1 ) );
+      if ( octave >= LOOPFREQ_NUM_OCTAVES )
+      {
+         index = LOOPFREQ_NUM_BUCKETS - 1;
+      }
+   }
+
+   // Stop counting before anything overflows.
+   if ( m_numTimes == 0xFFFF )
+   {
+      return;
+   }
+
+   m_numTimes++;
+   m_buckets[index]++;
+   if ( dt_us > m_deadline_us )
+   {
+      m_over++;
+   }
+   if ( dt_us < m_min_us )
+   {
+      m_min_us = dt_us;
+   }
+   if ( dt_us > m_max_us )
+   {
+      m_max_us = dt_us;
+   }
+}
+
+//============================================================================
+// Return the largest time in a histogram bucket.
+//
+uint32_t
+LoopFreq::
+bucketEnd( uint8_t index )
+{
+   if ( index < 2 * LOOPFREQ_SUB_BUCKETS )
+   {
+      return index;
+   }
+   if ( index == LOOPFREQ_NUM_BUCKETS - 1 )
+   {
+      return 0xFFFFFFFF;
+   }
+
+   uint8_t shift = index / LOOPFREQ_SUB_BUCKETS - 1;
+   uint32_t sub = LOOPFREQ_SUB_BUCKETS + index % LOOPFREQ_SUB_BUCKETS;
+   return ( ( sub + 1 ) << shift ) - 1;
+}
+
+//============================================================================
+// Print the histogram results.
+//
+void
+LoopFreq::
+report()
+{
+   Snapshot snap;
+   readSnapshot( snap );
+
+   Serial.print( "   Min : " );
+   Serial.print( snap.min );
+   Serial.println( " us" );
+   Serial.print( "   Max : " );
+   Serial.print( snap.max );
+   Serial.println( " us" );
+   Serial.print( "   P50 : " );
+   Serial.print( snap.p50 );
+   Serial.println( " us" );
+   Serial.print( "   P99 : " );
+   Serial.print( snap.p99 );
+   Serial.println( " us" );
+   Serial.print( "   P99.9: " );
+   Serial.print( snap.p999 );
+   Serial.println( " us" );
+   Serial.print( "   Over: " );
+   Serial.print( snap.over );
+   Serial.print( " > " );
+   Serial.print( m_deadline_us );
+   Serial.println( " us" );
 }
+#endif
       
 //============================================================================
@@ -29,12 +29,60 @@
 //       ...
 //    }
 //
+// The average hides the occasional slow loop that actually breaks
+// debouncing and sonar timing.  Define LOOPFREQ_HISTOGRAM for the whole
+// build to add setHistogram() which times each call with micros() and
+// keeps a histogram of the loop times so the report also has the min,
+// max, 50th, 99th, and 99.9th percentile times and the number of loops
+// over a deadline.  Without it, LoopFreq doesn't pay for the histogram
+// memory (~140 bytes on AVR).
+//
+// The histogram buckets are logarithmic: each power of 2 is split into
+// LOOPFREQ_SUB_BUCKETS buckets so the percentiles are within ~25% (the
+// max is exact).  Times up to 2^LOOPFREQ_NUM_OCTAVES us are binned and
+// longer times go in the last bucket.  The memory is fixed no matter
+// how many calls are made.  The results can be read at any time with
+// snapshot() which is safe to use even if poll() is being called from
+// an interrupt.
+//
+//    g_dbgLoop.setHistogram( 2000 ); // count loops over 2 ms
+//
+// Printing the report to Serial can block loop() for a long time on a
+// slow link.  Define LOOPFREQ_TELEMETRY for the whole build to log the
+// report as binary Telemetry records instead (see Telemetry.h).
+//
+#if defined( LOOPFREQ_HISTOGRAM )
+#ifndef LOOPFREQ_NUM_OCTAVES
+#define LOOPFREQ_NUM_OCTAVES 16
+#endif
+#define LOOPFREQ_SUB_BITS 2
+#define LOOPFREQ_SUB_BUCKETS ( 1 << LOOPFREQ_SUB_BITS )
+#define LOOPFREQ_NUM_BUCKETS \
+   ( ( LOOPFREQ_NUM_OCTAVES - LOOPFREQ_SUB_BITS + 1 ) * LOOPFREQ_SUB_BUCKETS )
+#endif
+
 class LoopFreq
 {
 public:
    LoopFreq( int numCalls, bool repeat=false );
    void poll();
 
+#if defined( LOOPFREQ_HISTOGRAM )
+   // Loop time histogram results.  Times are in micro seconds.
+   typedef struct {
+      uint16_t count;     // number of loop times recorded
+      uint16_t over;      // number of loops longer than the deadline
+      uint32_t min;
+      uint32_t max;
+      uint32_t p50;
+      uint32_t p99;
+      uint32_t p999;
+   } Snapshot;
+
+   void setHistogram( unsigned long deadline_us );
+   void snapshot( Snapshot& snap );
+#endif
+
 private:
    // Number of calls to make between reports.
    int m_numCalls;
@@ -47,5 +95,55 @@ private:
 
    // Starting time of the reporting cycline in millis.
    long m_start;
+
+#if defined( LOOPFREQ_HISTOGRAM )
+   // True if the histogram is being recorded.
+   bool m_hist;
+
+   // True once m_last_us has been set.
+   bool m_haveLast;
+
+   // Loops longer than this are counted in m_over.
+   unsigned long m_deadline_us;
+
+   // Time of the last call in micros.
+   unsigned long m_last_us;
+
+   // Histogram counters.  Volatile since poll() may be run from an
+   // interrupt.
+   volatile uint16_t m_numTimes;
+   volatile uint16_t m_over;
+   volatile uint32_t m_min_us;
+   volatile uint32_t m_max_us;
+   volatile uint16_t m_buckets[LOOPFREQ_NUM_BUCKETS];
+
+   void clearHistogram();
+   void readSnapshot( Snapshot& snap );
+   void addTime( uint32_t dt_us );
+   uint32_t bucketEnd( uint8_t index );
+   void report();
+#endif
+
+   void logReport( long elapsed );
 };
 
+#if defined( LOOPFREQ_HISTOGRAM )
+//============================================================================
+// Record a loop time histogram.
+//
+//= INPUTS
+//- deadline_us   Loops longer than this many micro seconds are counted as
+//                over the deadline.
+//
+inline
+void
+LoopFreq::
+setHistogram( unsigned long deadline_us )
+{
+   m_deadline_us = deadline_us;
+   clearHistogram();
+   m_hist = true;
+}
+#endif
+
+//============================================================================
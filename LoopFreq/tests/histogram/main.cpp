@@ -0,0 +1,81 @@
+#include "HostSim.h"
+#include "LoopFreq.h"
+#include <iostream>
+
+// Loop time histogram test.  Runs loops with known times and checks
+// the percentiles, min, max, and deadline count.
+//
+// Compile and run:
+// g++ -DLOOPFREQ_HISTOGRAM -I../.. -I../../../HostSim -o test main.cpp ../../LoopFreq.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static bool
+check( bool ok,
+       const char* msg,
+       uint32_t value )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << ": " << value << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   HostSim::reset();
+
+   // 10000 loop times: 98.85% at 100 us, 0.95% at 1 ms, and 0.2% at
+   // 20 ms.  Report once at the end.
+   LoopFreq loopFreq( 10001 );
+   loopFreq.setHistogram( 5000 );
+   loopFreq.poll();
+   for ( int i = 0; i < 10000; ++i )
+   {
+      uint64_t dt = 100;
+      if ( i % 1000 == 500 || ( i % 1000 == 900 && i < 5000 ) ||
+           i % 2000 == 1 )
+      {
+         dt = 20000;
+      }
+      else if ( i % 100 == 50 && i < 9500 )
+      {
+         dt = 1000;
+      }
+      HostSim::advance( dt );
+      loopFreq.poll();
+   }
+
+   LoopFreq::Snapshot snap;
+   loopFreq.snapshot( snap );
+
+   bool ok = true;
+   ok &= check( snap.count == 10000, "count", snap.count );
+   ok &= check( snap.min == 100, "min", snap.min );
+   ok &= check( snap.max == 20000, "max", snap.max );
+   ok &= check( snap.p50 >= 100 && snap.p50 < 125, "P50", snap.p50 );
+   ok &= check( snap.p99 >= 1000 && snap.p99 < 1250, "P99", snap.p99 );
+   ok &= check( snap.p999 == 20000, "P99.9", snap.p999 );
+   ok &= check( snap.over == 20, "over", snap.over );
+
+   // Repeated reports.  The 50 ms spent printing the first report
+   // isn't a loop time in the second one.
+   HostSim::serialOutput( NULL );
+   LoopFreq repeat( 11, true );
+   repeat.setHistogram( 5000 );
+   for ( int i = 0; i < 22; ++i )
+   {
+      HostSim::advance( i == 11 ? 50000 : 100 );
+      repeat.poll();
+   }
+   repeat.snapshot( snap );
+   ok &= check( snap.count == 10, "repeat count", snap.count );
+   ok &= check( snap.max == 100, "repeat max", snap.max );
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
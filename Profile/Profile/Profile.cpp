@@ -0,0 +1,117 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "Profile.h"
+
+Profile::Section Profile::s_sections[PROFILE_MAX_SECTIONS];
+uint8_t Profile::s_numSections = 0;
+
+//============================================================================
+// Add a section to the table.
+//
+// Sections with the same name share an entry.
+//
+//= INPUTS
+//- name    Section name.  Must be a string constant.
+//
+//= RETURNS
+//- Returns the section index or PROFILE_MAX_SECTIONS if the table is
+//  full.
+//
+uint8_t
+Profile::
+section( const char* name )
+{
+   uint8_t id = find( name );
+   if ( id < s_numSections || s_numSections == PROFILE_MAX_SECTIONS )
+   {
+      return id;
+   }
+
+   Section& s = s_sections[s_numSections];
+   s.name = name;
+   s.calls = 0;
+   s.total_us = 0;
+   s.max_us = 0;
+   return s_numSections++;
+}
+
+//============================================================================
+// Find a section by name.
+//
+//= RETURNS
+//- Returns the section index or PROFILE_MAX_SECTIONS if it's not found.
+//
+uint8_t
+Profile::
+find( const char* name )
+{
+   for ( uint8_t i = 0; i < s_numSections; ++i )
+   {
+      if ( strcmp( s_sections[i].name, name ) == 0 )
+      {
+         return i;
+      }
+   }
+   return PROFILE_MAX_SECTIONS;
+}
+
+//============================================================================
+// Reset the times for all the sections.
+//
+void
+Profile::
+clear()
+{
+   for ( uint8_t i = 0; i < s_numSections; ++i )
+   {
+      s_sections[i].calls = 0;
+      s_sections[i].total_us = 0;
+      s_sections[i].max_us = 0;
+   }
+}
+
+//============================================================================
+// Print the results.
+//
+// Prints one line per section with the number of calls and the
+// average, max, and total times in micro seconds:
+//
+//    Profile calls avg max total
+//    Valve::poll 51234 12 388 614808
+//
+//= INPUTS
+//- out    Where to print the results (e.g. Serial).
+//
+void
+Profile::
+report( Print& out )
+{
+   out.println( "Profile calls avg max total" );
+   for ( uint8_t i = 0; i < s_numSections; ++i )
+   {
+      const Section& s = s_sections[i];
+      out.print( s.name );
+      out.print( ' ' );
+      out.print( s.calls );
+      out.print( ' ' );
+      out.print( s.calls ? s.total_us / s.calls : 0 );
+      out.print( ' ' );
+      out.print( s.max_us );
+      out.print( ' ' );
+      out.println( s.total_us );
+   }
+}
+
+//============================================================================
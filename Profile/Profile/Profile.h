@@ -0,0 +1,177 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Code section profiling.
+//
+// LoopFreq measures all of loop() but doesn't say which part is using
+// the time.  Put PROFILE_SCOPE( "name" ) at the top of a block (a
+// function, a callback, etc) to record the number of calls and the
+// total and max time in micro seconds spent in the rest of that block.
+// The poll() methods in this library already have scopes.  Print the
+// results with PROFILE_REPORT( Serial ).
+//
+// Profiling is off unless PROFILE_ENABLE is defined to 1 for the whole
+// build (e.g. -DPROFILE_ENABLE=1 in the compiler flags) since the
+// library code needs to see it too.  When it's off, the macros are
+// empty and cost nothing.
+//
+// Sections are stored in a static table of PROFILE_MAX_SECTIONS
+// entries.  Each scope finds its entry once (the first time it runs)
+// so after that it only costs two calls to micros().  Scopes can be
+// nested - the outer scope time includes the inner one.  Scopes
+// after the table is full are ignored.
+//
+//= Example
+//
+//   void
+//   valveChangedCb( Valve::Status status, int8_t valveId )
+//   {
+//      PROFILE_SCOPE( "valveCb" );
+//      ...
+//   }
+//
+//   // Report and restart the profile every 10 seconds.
+//   if ( g_reportTimer.poll( t ) )
+//   {
+//      PROFILE_REPORT( Serial );
+//      PROFILE_CLEAR();
+//   }
+//
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 0
+#endif
+
+#ifndef PROFILE_MAX_SECTIONS
+#define PROFILE_MAX_SECTIONS 16
+#endif
+
+class Profile
+{
+public:
+   static uint8_t section( const char* name );
+   static void record( uint8_t id, uint32_t dt_us );
+   static void clear();
+   static void report( Print& out );
+
+   static uint8_t find( const char* name );
+   static uint32_t calls( uint8_t id );
+   static uint32_t totalTime( uint8_t id );
+   static uint32_t maxTime( uint8_t id );
+
+private:
+   // One profiled section.
+   typedef struct {
+      const char* name;
+      uint32_t calls;
+      uint32_t total_us;
+      uint32_t max_us;
+   } Section;
+
+   static Section s_sections[PROFILE_MAX_SECTIONS];
+   static uint8_t s_numSections;
+};
+
+// Records the time from construction to destruction in a section.
+// Use PROFILE_SCOPE() instead of this directly.
+class ProfileScope
+{
+public:
+   ProfileScope( uint8_t id ) : m_id( id ), m_start_us( micros() ) {}
+   ~ProfileScope() { Profile::record( m_id, micros() - m_start_us ); }
+
+private:
+   uint8_t m_id;
+   uint32_t m_start_us;
+};
+
+#if PROFILE_ENABLE
+#define PROFILE_CAT2( a, b ) a ## b
+#define PROFILE_CAT( a, b ) PROFILE_CAT2( a, b )
+#define PROFILE_SCOPE( name )                                            \
+   static uint8_t PROFILE_CAT( s_profileId, __LINE__ ) =                 \
+      Profile::section( name );                                          \
+   ProfileScope PROFILE_CAT( profileScope, __LINE__ )(                   \
+      PROFILE_CAT( s_profileId, __LINE__ ) )
+#define PROFILE_REPORT( out ) Profile::report( out )
+#define PROFILE_CLEAR() Profile::clear()
+#else
+#define PROFILE_SCOPE( name )
+#define PROFILE_REPORT( out )
+#define PROFILE_CLEAR()
+#endif
+
+//============================================================================
+// Return the number of calls recorded for a section.
+//
+inline
+uint32_t
+Profile::
+calls( uint8_t id )
+{
+   return id < s_numSections ? s_sections[id].calls : 0;
+}
+
+//============================================================================
+// Return the total time in micro seconds recorded for a section.
+//
+inline
+uint32_t
+Profile::
+totalTime( uint8_t id )
+{
+   return id < s_numSections ? s_sections[id].total_us : 0;
+}
+
+//============================================================================
+// Return the longest time in micro seconds recorded for a section.
+//
+inline
+uint32_t
+Profile::
+maxTime( uint8_t id )
+{
+   return id < s_numSections ? s_sections[id].max_us : 0;
+}
+
+//============================================================================
+// Add a time to a section.
+//
+//= INPUTS
+//- id       Section index from section().
+//- dt_us    Time spent in the section in micro seconds.
+//
+inline
+void
+Profile::
+record( uint8_t id,
+        uint32_t dt_us )
+{
+   if ( id >= s_numSections )
+   {
+      return;
+   }
+
+   Section& s = s_sections[id];
+   s.calls++;
+   s.total_us += dt_us;
+   if ( dt_us > s.max_us )
+   {
+      s.max_us = dt_us;
+   }
+}
+
+//============================================================================
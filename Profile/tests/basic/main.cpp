@@ -0,0 +1,86 @@
+#include "HostSim.h"
+#include "DigitalOutput.h"
+#include "Profile.h"
+#include <iostream>
+
+// Profiling scope test.  Times sections with known durations on the
+// simulated clock and checks the counts, totals, max times, and that
+// the library poll() methods show up.
+//
+// Compile and run:
+// g++ -DPROFILE_ENABLE=1 -I../../Profile -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../Profile/Profile.cpp ../../../Timer/Timer/Timer.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static void
+callback( uint64_t dt_us )
+{
+   PROFILE_SCOPE( "callback" );
+   HostSim::advance( dt_us );
+}
+
+static void
+work( uint64_t dt_us )
+{
+   PROFILE_SCOPE( "work" );
+   HostSim::advance( 10 );
+   callback( dt_us );
+}
+
+static bool
+check( bool ok,
+       const char* msg,
+       uint32_t value )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << ": " << value << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   HostSim::reset();
+   DigitalOutput led;
+   led.init( 6 );
+   led.blinkFast();
+
+   for ( int i = 0; i < 100; ++i )
+   {
+      led.poll( millis() );
+      work( i == 50 ? 500 : 20 );
+   }
+
+   Profile::report( Serial );
+
+   bool ok = true;
+   uint8_t cb = Profile::find( "callback" );
+   uint8_t wk = Profile::find( "work" );
+   uint8_t out = Profile::find( "DigitalOutput::poll" );
+   uint8_t timer = Profile::find( "Timer::poll" );
+   ok &= check( Profile::calls( cb ) == 100, "callback calls",
+                Profile::calls( cb ) );
+   ok &= check( Profile::totalTime( cb ) == 99 * 20 + 500, "callback total",
+                Profile::totalTime( cb ) );
+   ok &= check( Profile::maxTime( cb ) == 500, "callback max",
+                Profile::maxTime( cb ) );
+
+   // The outer scope includes the inner one.
+   ok &= check( Profile::totalTime( wk ) == Profile::totalTime( cb ) + 1000,
+                "work total", Profile::totalTime( wk ) );
+   ok &= check( Profile::calls( out ) == 100 && Profile::calls( timer ) == 100,
+                "poll calls", Profile::calls( out ) );
+
+   // Clearing keeps the sections.
+   Profile::clear();
+   work( 5 );
+   ok &= check( Profile::calls( cb ) == 1 && Profile::maxTime( cb ) == 5,
+                "clear", Profile::calls( cb ) );
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,368 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+#include "Profile.h"
+#include "Timer.h"
+
+// Polls a fixed list of components with one time stamp per pass.
+//
+// Instead of reading millis() in loop() and calling poll() on every
+// object by hand, list the objects (and their callbacks) in the
+// Scheduler type and call its poll() in loop().  Each pass reads
+// millis() once and passes that time to every poll() (none of the
+// library poll() methods read the clock again).
+//
+// Each pass asks every component for its deadline() first.  That's
+// cheap - no pins are written and no callbacks run - and only the
+// components with something to do now are polled.  Idle components
+// (an output that's off or steady on, a valve that's settled, a timer
+// that isn't due, an input that isn't changing) are skipped.
+// active() returns which ones were polled on the last pass.  poll()
+// returns the earliest deadline so a sketch can sleep until then.
+//
+// The list is a template parameter so there are no tables or virtual
+// functions - the pass compiles to the same code as the hand written
+// calls plus the deadline checks.  The objects must be globals (they
+// are template parameters) and declared before the Scheduler.  Up to
+// 32 items.
+//
+// Callbacks are template parameters too so they inline into the pass.
+// Use PollMember and PollTimerMember to run a member function of an
+// object (e.g. a class that owns the sketch state) instead of a plain
+// function.
+//
+//= Example
+//
+//   DigitalInput g_button;
+//   DigitalInput g_sensor;
+//   DigitalOutput g_led;
+//   Valve g_valve;
+//   Timer g_report;
+//
+//   Scheduler<
+//      PollItem< DigitalOutput, g_led >,
+//      PollCallback< DigitalInput, g_button, buttonChangedCb >,
+//      PollCallback< DigitalInput, g_sensor, sensorChangedCb >,
+//      PollCallback< Valve, g_valve, valveChangedCb >,
+//      PollTimer< g_report, reportCb >
+//   > g_scheduler;
+//
+//   void loop()
+//   {
+//      g_scheduler.poll();
+//   }
+//
+
+//============================================================================
+// Scheduler item for a component with no callback (DigitalOutput,
+// or any class with poll( long ) and deadline( long )).
+//
+template< typename T, T& OBJ >
+struct PollItem
+{
+   static long deadline( long currentMillis );
+   static void poll( long currentMillis );
+};
+
+//============================================================================
+// Scheduler item for a component with a state change callback and
+// identifier (DigitalInput, Valve).
+//
+template< typename T, T& OBJ, typename T::StateChangeCb CB, int8_t ID=0 >
+struct PollCallback
+{
+   static long deadline( long currentMillis );
+   static void poll( long currentMillis );
+};
+
+//============================================================================
+// Scheduler item for a Timer with a callback.
+//
+template< Timer& OBJ, Timer::TimerCb CB >
+struct PollTimer
+{
+   static long deadline( long currentMillis );
+   static void poll( long currentMillis );
+};
+
+//============================================================================
+// Scheduler item for a component with a state change handler that's
+// a member function of an object (DigitalInput, Valve).
+//
+template< typename T, T& OBJ, typename H, H& HOBJ,
+          void (H::*FN)( typename T::Status, int8_t ), int8_t ID=0 >
+struct PollMember
+{
+   static long deadline( long currentMillis );
+   static void poll( long currentMillis );
+};
+
+//============================================================================
+// Scheduler item for a Timer with a handler that's a member function
+// of an object.
+//
+template< Timer& OBJ, typename H, H& HOBJ, void (H::*FN)( int8_t ) >
+struct PollTimerMember
+{
+   static long deadline( long currentMillis );
+   static void poll( long currentMillis );
+};
+
+//============================================================================
+// One pass over the items.  Recursive so it works in C++11.
+//
+template< uint8_t INDEX, typename... ITEMS >
+struct SchedulerPass
+{
+   static long poll( long currentMillis, long next, uint32_t& active );
+};
+
+//============================================================================
+template< typename... ITEMS >
+class Scheduler
+{
+public:
+   enum { NUM_ITEMS = sizeof...( ITEMS ) };
+
+   void init();
+
+   // Returns the time in millis the next pass has something to do.
+   long poll();
+   long poll( long currentMillis );
+
+   // Bit i is set if item i was polled on the last pass.
+   uint32_t active();
+
+private:
+   uint32_t m_active;
+};
+
+//============================================================================
+template< typename T, T& OBJ >
+inline
+long
+PollItem< T, OBJ >::
+deadline( long currentMillis )
+{
+   return OBJ.deadline( currentMillis );
+}
+
+//============================================================================
+template< typename T, T& OBJ >
+inline
+void
+PollItem< T, OBJ >::
+poll( long currentMillis )
+{
+   OBJ.poll( currentMillis );
+}
+
+//============================================================================
+template< typename T, T& OBJ, typename T::StateChangeCb CB, int8_t ID >
+inline
+long
+PollCallback< T, OBJ, CB, ID >::
+deadline( long currentMillis )
+{
+   return OBJ.deadline( currentMillis );
+}
+
+//============================================================================
+template< typename T, T& OBJ, typename T::StateChangeCb CB, int8_t ID >
+inline
+void
+PollCallback< T, OBJ, CB, ID >::
+poll( long currentMillis )
+{
+   OBJ.template poll< CB >( currentMillis, ID );
+}
+
+//============================================================================
+template< Timer& OBJ, Timer::TimerCb CB >
+inline
+long
+PollTimer< OBJ, CB >::
+deadline( long currentMillis )
+{
+   return OBJ.deadline( currentMillis );
+}
+
+//============================================================================
+template< Timer& OBJ, Timer::TimerCb CB >
+inline
+void
+PollTimer< OBJ, CB >::
+poll( long currentMillis )
+{
+   OBJ.template poll< CB >( currentMillis );
+}
+
+//============================================================================
+template< typename T, T& OBJ, typename H, H& HOBJ,
+          void (H::*FN)( typename T::Status, int8_t ), int8_t ID >
+inline
+long
+PollMember< T, OBJ, H, HOBJ, FN, ID >::
+deadline( long currentMillis )
+{
+   return OBJ.deadline( currentMillis );
+}
+
+//============================================================================
+template< typename T, T& OBJ, typename H, H& HOBJ,
+          void (H::*FN)( typename T::Status, int8_t ), int8_t ID >
+inline
+void
+PollMember< T, OBJ, H, HOBJ, FN, ID >::
+poll( long currentMillis )
+{
+   OBJ.template poll< H, FN >( currentMillis, HOBJ, ID );
+}
+
+//============================================================================
+template< Timer& OBJ, typename H, H& HOBJ, void (H::*FN)( int8_t ) >
+inline
+long
+PollTimerMember< OBJ, H, HOBJ, FN >::
+deadline( long currentMillis )
+{
+   return OBJ.deadline( currentMillis );
+}
+
+//============================================================================
+template< Timer& OBJ, typename H, H& HOBJ, void (H::*FN)( int8_t ) >
+inline
+void
+PollTimerMember< OBJ, H, HOBJ, FN >::
+poll( long currentMillis )
+{
+   OBJ.template poll< H, FN >( currentMillis, HOBJ );
+}
+
+//============================================================================
+// End of the list.
+//
+template< uint8_t INDEX >
+struct SchedulerPass< INDEX >
+{
+   static long
+   poll( long,
+         long next,
+         uint32_t& )
+   {
+      return next;
+   }
+};
+
+//============================================================================
+// Poll the first item if it's due and then the rest.
+//
+template< uint8_t INDEX, typename ITEM, typename... REST >
+struct SchedulerPass< INDEX, ITEM, REST... >
+{
+   static long
+   poll( long currentMillis,
+         long next,
+         uint32_t& active )
+   {
+      long deadline = ITEM::deadline( currentMillis );
+      if ( deadline - currentMillis <= 0 )
+      {
+         ITEM::poll( currentMillis );
+         active |= 1UL << INDEX;
+         deadline = ITEM::deadline( currentMillis );
+      }
+      if ( deadline - next < 0 )
+      {
+         next = deadline;
+      }
+      return SchedulerPass< INDEX + 1, REST... >::poll( currentMillis,
+                                                        next, active );
+   }
+};
+
+//============================================================================
+// Initialize the scheduler.
+//
+// The items must be initialized separately (their init() methods).
+//
+template< typename... ITEMS >
+inline
+void
+Scheduler< ITEMS... >::
+init()
+{
+   static_assert( NUM_ITEMS > 0 && NUM_ITEMS <= 32,
+                  "Scheduler supports 1 to 32 items" );
+   m_active = 0;
+}
+
+//============================================================================
+// Poll the items that are due at the current time.
+//
+// This should be called in each loop().
+//
+//= RETURNS
+//- Returns the time in millis the next pass has something to do.
+//
+template< typename... ITEMS >
+inline
+long
+Scheduler< ITEMS... >::
+poll()
+{
+   return poll( millis() );
+}
+
+//============================================================================
+// Poll the items that are due.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the time in millis the next pass has something to do.
+//
+template< typename... ITEMS >
+inline
+long
+Scheduler< ITEMS... >::
+poll( long currentMillis )
+{
+   PROFILE_SCOPE( "Scheduler::poll" );
+
+   // Nothing due - check back well before the times could wrap.
+   m_active = 0;
+   return SchedulerPass< 0, ITEMS... >::poll(
+      currentMillis, currentMillis + 0x3FFFFFFF, m_active );
+}
+
+//============================================================================
+// Return which items were polled on the last pass.
+//
+//= RETURNS
+//- Returns a bit mask with bit i set if item i was polled.
+//
+template< typename... ITEMS >
+inline
+uint32_t
+Scheduler< ITEMS... >::
+active()
+{
+   return m_active;
+}
+
+//============================================================================
@@ -0,0 +1,267 @@
+#include "HostSim.h"
+#include "Scheduler.h"
+#include "DigitalInput.h"
+#include "DigitalOutput.h"
+#include "Timer.h"
+#include "Valve.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Scheduler test.
+//
+// Runs a small leak sensor sketch (button, sensor, LED, valve, and a
+// report timer) for 20 simulated minutes with a loop() every milli
+// second, once polling every object by hand and once with the
+// Scheduler.  Checks both runs make exactly the same callbacks at the
+// same times and that the Scheduler skipped the idle components on
+// most passes.
+//
+// Compile and run:
+// g++ -O2 -I../../Scheduler -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../Valve/Valve -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../Valve/Valve/Valve.cpp ../../../Valve/Valve/ValveStats.cpp ../../../Valve/Valve/ValveStore.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint8_t BUTTON_PIN = 2;
+static const uint8_t SENSOR_PIN = 3;
+static const uint8_t LED_PIN = 6;
+static const uint8_t OPEN_PIN = 16;
+static const uint8_t CLOSE_PIN = 17;
+static const uint8_t OPENED_PIN = 18;
+static const uint8_t CLOSED_PIN = 19;
+
+static const uint64_t SECOND = 1000000;
+static const uint64_t RUN_US = 1200 * SECOND;
+
+//============================================================================
+//
+// Sketch
+//
+//============================================================================
+DigitalInput g_button;
+DigitalInput g_sensor;
+DigitalOutput g_led;
+Valve g_valve;
+Timer g_report;
+
+static std::ostringstream s_log;
+
+void
+buttonChangedCb( DigitalInput::Status status,
+                 int8_t )
+{
+   s_log << millis() << " button " << status << "\n";
+   if ( status == DigitalInput::OPENED )
+   {
+      g_valve.open();
+      g_led.off();
+   }
+}
+
+void
+sensorChangedCb( DigitalInput::Status status,
+                 int8_t )
+{
+   s_log << millis() << " sensor " << status << "\n";
+   if ( status == DigitalInput::CLOSED )
+   {
+      g_valve.close();
+      g_led.blinkFast();
+   }
+}
+
+void
+valveChangedCb( Valve::Status status,
+                int8_t id )
+{
+   s_log << millis() << " valve " << (int)id << " " << status << "\n";
+}
+
+void
+reportCb( int8_t )
+{
+   s_log << millis() << " report " << g_led.isOn() << "\n";
+}
+
+Scheduler<
+   PollItem< DigitalOutput, g_led >,
+   PollCallback< DigitalInput, g_button, buttonChangedCb >,
+   PollCallback< DigitalInput, g_sensor, sensorChangedCb >,
+   PollCallback< Valve, g_valve, valveChangedCb, 7 >,
+   PollTimer< g_report, reportCb >
+> g_scheduler;
+
+static void
+setup()
+{
+   g_button.init( BUTTON_PIN, LOW );
+   g_sensor.init( SENSOR_PIN, HIGH );
+   g_led.init( LED_PIN );
+   g_valve.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN, CLOSED_PIN, 10000, 5000 );
+   g_report.repeat( 60000 );
+   g_scheduler.init();
+}
+
+static void
+loopByHand()
+{
+   long t = millis();
+   g_led.poll( t );
+   g_button.poll( t, buttonChangedCb );
+   g_sensor.poll( t, sensorChangedCb );
+   g_valve.poll( t, valveChangedCb, 7 );
+   g_report.poll( t, reportCb );
+}
+
+//============================================================================
+//
+// Simulated devices
+//
+//============================================================================
+// Valve takes 2 seconds to move.  The switch opens as soon as it
+// starts moving.
+static uintptr_t s_move = 0;
+
+static void
+valveArrived( void* move )
+{
+   if ( (uintptr_t)move != s_move )
+   {
+      return;
+   }
+   bool open = HostSim::pin( OPEN_PIN ) && ! HostSim::pin( CLOSE_PIN );
+   HostSim::setPin( open ? OPENED_PIN : CLOSED_PIN, LOW );
+}
+
+static void
+motorWrite( uint8_t,
+            uint8_t,
+            void* )
+{
+   bool open = HostSim::pin( OPEN_PIN );
+   bool close = HostSim::pin( CLOSE_PIN );
+   s_move++;
+   if ( open != close )
+   {
+      HostSim::setPin( open ? CLOSED_PIN : OPENED_PIN, HIGH );
+      HostSim::at( HostSim::time_us() + 2 * SECOND, valveArrived,
+                   (void*)s_move );
+   }
+}
+
+static void
+pinLow( void* pin )
+{
+   HostSim::setPin( (uintptr_t)pin, LOW );
+}
+
+static void
+pinHigh( void* pin )
+{
+   HostSim::setPin( (uintptr_t)pin, HIGH );
+}
+
+// Bouncing change of a pin at a time.
+static void
+change( uint64_t time_us,
+        uint8_t pin,
+        uint8_t level )
+{
+   HostSim::EventCb set = level ? pinHigh : pinLow;
+   HostSim::EventCb unset = level ? pinLow : pinHigh;
+   for ( int i = 0; i < 3; ++i )
+   {
+      HostSim::at( time_us + i * 1500, set, (void*)(uintptr_t)pin );
+      HostSim::at( time_us + i * 1500 + 700, unset, (void*)(uintptr_t)pin );
+   }
+   HostSim::at( time_us + 4500, set, (void*)(uintptr_t)pin );
+}
+
+static void
+scenario()
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::setPin( BUTTON_PIN, HIGH );
+   HostSim::setPin( SENSOR_PIN, LOW );
+   HostSim::setPin( OPENED_PIN, LOW );
+   HostSim::setPin( CLOSED_PIN, HIGH );
+   HostSim::onWrite( OPEN_PIN, motorWrite );
+   HostSim::onWrite( CLOSE_PIN, motorWrite );
+   s_move = 0;
+   s_log.str( "" );
+
+   // Leaks and button presses (one long) every few minutes.
+   for ( int i = 0; i < 4; ++i )
+   {
+      uint64_t t = ( 60 + i * 280 ) * SECOND;
+      change( t, SENSOR_PIN, HIGH );
+      change( t + 30 * SECOND, SENSOR_PIN, LOW );
+      change( t + 120 * SECOND, BUTTON_PIN, LOW );
+      uint64_t hold = i == 2 ? 3 * SECOND : SECOND / 4;
+      change( t + 120 * SECOND + hold, BUTTON_PIN, HIGH );
+   }
+}
+
+//============================================================================
+int
+main()
+{
+   bool ok = true;
+
+   // By hand.
+   scenario();
+   setup();
+   while ( HostSim::time_us() < RUN_US )
+   {
+      loopByHand();
+      HostSim::advance( 1000 );
+   }
+   std::string byHand = s_log.str();
+
+   // With the scheduler.
+   scenario();
+   setup();
+   long passes = 0;
+   long polls[5] = { 0, 0, 0, 0, 0 };
+   while ( HostSim::time_us() < RUN_US )
+   {
+      g_scheduler.poll();
+      passes++;
+      for ( int i = 0; i < 5; ++i )
+      {
+         polls[i] += ( g_scheduler.active() >> i ) & 1;
+      }
+      HostSim::advance( 1000 );
+   }
+   std::string scheduled = s_log.str();
+
+   if ( byHand != scheduled || byHand.empty() )
+   {
+      std::cout << "FAILED: logs differ\nBy hand:\n" << byHand
+                << "Scheduler:\n" << scheduled;
+      ok = false;
+   }
+
+   int lines = 0;
+   for ( size_t i = 0; i < byHand.size(); ++i )
+   {
+      lines += byHand[i] == '\n';
+   }
+   const char* names[5] = { "led", "button", "sensor", "valve", "report" };
+   std::cout << lines << " callbacks matched.  Polled of " << passes
+             << " passes:";
+   for ( int i = 0; i < 5; ++i )
+   {
+      std::cout << " " << names[i] << "=" << polls[i];
+
+      // Everything is idle most of the time.
+      ok &= polls[i] > 0 && polls[i] < passes / 10;
+   }
+   std::cout << std::endl;
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
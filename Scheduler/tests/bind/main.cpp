@@ -0,0 +1,238 @@
+#include "HostSim.h"
+#include "Scheduler.h"
+#include "DigitalInput.h"
+#include "Timer.h"
+#include <chrono>
+#include <iostream>
+
+// Compile time handler binding test and benchmark.
+//
+// A Board object owns the sketch state and handles the input changes
+// and timer firings with member functions.  Runs a few inputs and a
+// timer through a Scheduler using PollMember and PollTimerMember and
+// checks it makes the same handler calls as polling by hand with
+// function pointer callbacks that forward to the Board.
+//
+// Then polls a large array of noisy inputs with a function pointer
+// callback (poll() is out of line so the call is indirect) and with
+// the member function bound at compile time (poll() and the handler
+// inline together), checks both see the same changes and prints the
+// ns per poll.
+//
+// Compile and run:
+// g++ -O2 -DFLIGHTRECORDER_ENABLE=0 -I../../Scheduler -I../../../DigitalInput/DigitalInput -I../../../Timer/Timer -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint16_t NUM = 1000;
+static const long BENCH_MILLIS = 20000;
+static const long CHECK_MILLIS = 600000;
+
+//============================================================================
+// Sketch state.  counts[id][status + 2] is the number of each input
+// change and ticks the number of timer firings.
+//
+class Board
+{
+public:
+   void
+   inputChanged( DigitalInput::Status status,
+                 int8_t identifier )
+   {
+      counts[(uint8_t)identifier][status + 2]++;
+      last = ( last * 31 ) ^ ( identifier + status );
+   }
+
+   void
+   tick( int8_t )
+   {
+      ticks++;
+   }
+
+   long counts[256][5];
+   long ticks;
+   uint32_t last;
+};
+
+Board g_board;
+
+static void
+inputChangedCb( DigitalInput::Status status,
+                int8_t identifier )
+{
+   g_board.inputChanged( status, identifier );
+}
+
+static void
+tickCb( int8_t identifier )
+{
+   g_board.tick( identifier );
+}
+
+//============================================================================
+// Noisy switches.  Each level flips now and then.
+//
+static uint32_t s_seed = 1;
+static uint8_t s_levels[NUM];
+
+static uint32_t
+random32()
+{
+   s_seed ^= s_seed << 13;
+   s_seed ^= s_seed >> 17;
+   s_seed ^= s_seed << 5;
+   return s_seed;
+}
+
+static void
+step( uint16_t num )
+{
+   for ( uint16_t i = 0; i < num; ++i )
+   {
+      if ( random32() % 64 == 0 )
+      {
+         s_levels[i] ^= 1;
+      }
+   }
+}
+
+static DigitalInput s_inputs[NUM];
+
+static void
+init( uint16_t num )
+{
+   s_seed = 1;
+   memset( &g_board, 0, sizeof( g_board ) );
+   for ( uint16_t i = 0; i < num; ++i )
+   {
+      s_levels[i] = 0;
+      s_inputs[i].initShift( &s_levels[i], 0, HIGH, 1 + i % 8 );
+   }
+}
+
+//============================================================================
+// Scheduler with member handlers.
+//
+DigitalInput g_in0;
+DigitalInput g_in1;
+DigitalInput g_in2;
+Timer g_timer;
+
+Scheduler<
+   PollMember< DigitalInput, g_in0, Board, g_board, &Board::inputChanged, 0 >,
+   PollMember< DigitalInput, g_in1, Board, g_board, &Board::inputChanged, 1 >,
+   PollMember< DigitalInput, g_in2, Board, g_board, &Board::inputChanged, 2 >,
+   PollTimerMember< g_timer, Board, g_board, &Board::tick >
+> g_scheduler;
+
+static bool
+checkScheduler()
+{
+   DigitalInput* inputs[3] = { &g_in0, &g_in1, &g_in2 };
+   Board byHand;
+   for ( int pass = 0; pass < 2; ++pass )
+   {
+      HostSim::reset();
+      init( 3 );
+      for ( uint16_t i = 0; i < 3; ++i )
+      {
+         inputs[i]->initShift( &s_levels[i], 0, HIGH, 1 + i % 8 );
+      }
+      g_timer.repeat( 1000 );
+      g_scheduler.init();
+      for ( long t = 0; t < CHECK_MILLIS; ++t )
+      {
+         step( 3 );
+         if ( pass == 0 )
+         {
+            for ( uint16_t i = 0; i < 3; ++i )
+            {
+               inputs[i]->poll( t, inputChangedCb, i );
+            }
+            g_timer.poll( t, tickCb );
+         }
+         else
+         {
+            g_scheduler.poll( t );
+         }
+         HostSim::advance( 1000 );
+      }
+      if ( pass == 0 )
+      {
+         byHand = g_board;
+      }
+   }
+
+   long changes = 0;
+   for ( int i = 0; i < 3; ++i )
+   {
+      changes += g_board.counts[i][1] + g_board.counts[i][3];
+   }
+   std::cout << "Scheduler: " << changes << " changes, " << g_board.ticks
+             << " ticks" << std::endl;
+   return changes > 0 && g_board.ticks == CHECK_MILLIS / 1000 - 1 &&
+      memcmp( &byHand, &g_board, sizeof( Board ) ) == 0;
+}
+
+//============================================================================
+// Poll every input for the run.  Returns ns per poll.
+//
+template< bool BOUND >
+static double
+bench()
+{
+   init( NUM );
+   std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+   for ( long t = 0; t < BENCH_MILLIS; ++t )
+   {
+      step( NUM );
+      for ( uint16_t i = 0; i < NUM; ++i )
+      {
+         if ( BOUND )
+         {
+            s_inputs[i].poll< Board, &Board::inputChanged >( t, g_board,
+                                                              i % 256 );
+         }
+         else
+         {
+            s_inputs[i].poll( t, inputChangedCb, i % 256 );
+         }
+      }
+   }
+   return std::chrono::duration< double, std::nano >(
+      std::chrono::steady_clock::now() - start ).count() / BENCH_MILLIS / NUM;
+}
+
+//============================================================================
+int
+main()
+{
+   bool ok = checkScheduler();
+
+   // The step() time is included in both.  Run it alone to take it
+   // out.
+   init( NUM );
+   std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+   for ( long t = 0; t < BENCH_MILLIS; ++t )
+   {
+      step( NUM );
+   }
+   double stepNs = std::chrono::duration< double, std::nano >(
+      std::chrono::steady_clock::now() - start ).count() / BENCH_MILLIS / NUM;
+
+   double pointerNs = bench< false >() - stepNs;
+   Board pointer = g_board;
+   double boundNs = bench< true >() - stepNs;
+
+   ok &= memcmp( &pointer, &g_board, sizeof( Board ) ) == 0;
+   std::cout << "Function pointer: " << pointerNs << " ns/poll" << std::endl;
+   std::cout << "Bound member: " << boundNs << " ns/poll ("
+             << pointerNs / boundNs << "x)" << std::endl;
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
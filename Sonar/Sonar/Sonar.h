@@ -16,6 +16,8 @@
 #include <Arduino.h>
 #include <DigitalIO.h>
 #include <MedianFilter.h>
+#include <AlphaBetaFilter.h>
+#include <Profile.h>
 
 // Interrupt based HR-S04 ultrasonic sonar class
 //
@@ -28,11 +30,36 @@
 // fast and reliable operations.  But - the echo pin must support
 // interrupts so on an Arduino Uno or Pro Mini, that is D2 or D3.
 //
+// The maximum range defaults to 5 meters.  If the sensor is used for
+// something shorter (like a tank level), call setMaxRange() so that
+// lost echos time out sooner and the next ping can be sent earlier.
+//
+// The ping rate can be fixed (setRate()) or adaptive
+// (setAdaptiveRate()).  In adaptive mode, the sonar pings at the
+// maximum rate while the distance is changing and backs off
+// exponentially to the minimum rate while it's stable.  This is good
+// for things that sit still most of the time since it saves power and
+// processing time.
+//
 // The 3rd templte parameter is for the number of samples to use in an
 // optional median filter to eliminate outlier results.  Set it zero
 // for no filtering.  The median filter returns the median of the last
 // N values received by the class.
 //
+// Distances are in cm by default.  Call setUnits( MM ) to use
+// millimeters instead.  The median filter, tracker, adaptive rate
+// threshold, poll() return value, and callback all use the selected
+// units.  The echo time is converted with a fixed point multiply and
+// shift instead of a division.  By default the conversion uses the
+// datasheet value of 58 us/cm.  Call setTemperature() to correct the
+// speed of sound for the air temperature.
+//
+// An optional alpha-beta tracking filter can be run after the median
+// filter by calling setTracker().  It gives a smoothed distance and
+// the velocity (trackedDistance(), velocity()) which is much better
+// than differencing the distances.  Lost pings are handled by the
+// tracker using the time between the pings that are received.
+//
 //= Example
 //
 //   static const int ECHO_PIN = 3;
@@ -60,13 +87,20 @@
 //      g_sonar.poll( callback );
 //   }
 //
-typedef void (*SonarChangeCb)( uint16_t distance_cm );
+// Input is the distance in the sonar units (cm by default).
+typedef void (*SonarChangeCb)( uint16_t distance );
 
 // ECHO_PIN must be interrupt capable (D2 or D3 on pro mini).  
 template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES=0 >
 class Sonar
 {
 public:
+   // Distance units.
+   enum Units {
+      CM = 0,
+      MM = 1,
+   };
+
    // NOTE: Can't use constructors (even though we should) because
    // Arduino sketch generally requires these to be global variables
    // so we don't know that the ctor would be called after hardware
@@ -80,11 +114,30 @@ public:
    void on( uint16_t rate_hz=0 );
    void off();
    void setRate( uint16_t rate_hz );
+   void setAdaptiveRate( uint16_t minRate_hz, uint16_t maxRate_hz,
+                         uint8_t threshold=1 );
+   void setMaxRange( uint16_t range_cm );
+   void setUnits( Units units );
+   void setTemperature( int8_t temp_c );
+   void clearTemperature();
+   void setTracker( uint8_t alpha, uint8_t beta, uint16_t maxGap_ms=1000 );
    void clear();
 
+   uint16_t trackedDistance();
+   int16_t velocity();
+
 private:
-   enum { SONAR_MAX_TIME_US = 500 * 58 }; // 5 meters * 58 us/cm 
-   
+   enum { SONAR_MAX_RANGE_CM = 500 }; // 5 meters
+   enum { SONAR_US_PER_CM = 58 }; // value from datasheet
+   enum { SONAR_NO_TEMP = -128 };
+
+   // Ping states.
+   enum State {
+      IDLE = 0,     // Waiting to send the next ping.
+      SENT = 1,     // Ping was sent, waiting for the echo.
+      RECOVER = 2,  // Ping timed out, waiting for the echo line to go low.
+   };
+
    // Echo and trigger pins for the sonar module.
    DigitalPin< ECHO_PIN > m_echo;
    DigitalPin< TRIGGER_PIN > m_trigger;
@@ -95,19 +148,55 @@ private:
    // Time to wait in between pings in microseconds.  
    uint32_t m_rate_us;
 
-   // True if a ping was sent and we're waiting for a return.
-   bool m_sent;
+   // Adaptive rate limits.  These are the time between pings in
+   // microseconds at the minimum and maximum rates.  m_fastRate_us
+   // is zero if the rate is fixed.
+   uint32_t m_slowRate_us;
+   uint32_t m_fastRate_us;
+
+   // Distance change that switches back to the fast rate in adaptive
+   // mode.
+   uint8_t m_threshold;
+
+   // Distance when the adaptive rate was last reset to the fast rate.
+   // Changes are measured from here so slow movements still add up
+   // to a change.
+   uint16_t m_refDist;
+
+   // Current ping state.  See the State enum.
+   uint8_t m_state;
+
+   // Time to wait for an echo before giving up in microseconds.  Set
+   // from the maximum range.
+   uint32_t m_maxTime_us;
 
    // Time in microseconds the last ping was sent.
    uint32_t m_lastSent_us;
 
-   // Distance in cm of the last ping.
-   uint16_t m_lastDist_cm;
+   // Distance of the last ping.
+   uint16_t m_lastDist;
+
+   // Distance units (see the Units enum).
+   uint8_t m_units;
+
+   // Temperature for the speed of sound or SONAR_NO_TEMP to use the
+   // datasheet conversion.
+   int8_t m_temp_c;
+
+   // Echo time to distance conversion factor.  Distance is
+   // ( dt_us * m_usToDist ) >> 16.
+   uint16_t m_usToDist;
+
+   void setConversion();
 
    // Filter for removing outliers.  Returns the median value of the
    // last NUM_SAMPLES pings.
    MedianFilter< uint16_t, NUM_SAMPLES > m_filter;
 
+   // Optional tracking filter run after m_filter.  Off unless
+   // setTracker() is called.
+   AlphaBetaFilter m_tracker;
+
    void sendPing();
    static void echoRise();
    static void echoFall();
@@ -136,11 +225,16 @@ init( uint8_t rate_hz )
    
    s_pingBeg_us = 0;
    s_pingEnd_us = 0;
-   m_sent = false;
+   m_state = IDLE;
    m_on = true;
    m_lastSent_us = 0;
-   m_lastDist_cm = 0;
+   m_lastDist = 0;
+   m_units = CM;
+   m_temp_c = SONAR_NO_TEMP;
+   setConversion();
+   m_fastRate_us = 0;
    setRate( rate_hz );
+   setMaxRange( SONAR_MAX_RANGE_CM );
 }
 
 //============================================================================
@@ -182,6 +276,8 @@ off()
 //============================================================================
 // Set the ping rate to use.
 //
+// This turns off the adaptive rate if it was on.
+//
 //= INPUTS
 //
 //- rate_hz    Ping rate in Hz (times/sec).  Set to zero to ping as fast
@@ -192,6 +288,7 @@ void
 Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
 setRate( uint16_t rate_hz )
 {
+   m_fastRate_us = 0;
    if ( rate_hz == 0 )
    {
       m_rate_us = 1;
@@ -204,7 +301,189 @@ setRate( uint16_t rate_hz )
 }
 
 //============================================================================
-// Clear previous values from the median filter.
+// Use an adaptive ping rate.
+//
+// The sonar starts at the maximum rate.  Each time a ping is within
+// the threshold of the reference distance, the time between pings is
+// doubled until the minimum rate is reached.  As soon as the distance
+// moves away from the reference by the threshold or more, it goes
+// back to the maximum rate and that distance becomes the new
+// reference.  So the faster the distance changes, the more time is
+// spent at the maximum rate.  The distance used is the median
+// filtered value so single outliers don't speed up the rate.
+//
+//= INPUTS
+//
+//- minRate_hz    Slowest ping rate in Hz (times/sec) to use when the
+//                distance is stable.  Must be > 0.
+//- maxRate_hz    Fastest ping rate in Hz (times/sec) to use when the
+//                distance is changing.  Set to zero to ping as fast
+//                as possible.
+//- threshold     Distance change (in the sonar units) which is considered
+//                a change.
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+inline
+void
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+setAdaptiveRate( uint16_t minRate_hz,
+                 uint16_t maxRate_hz,
+                 uint8_t threshold )
+{
+   setRate( maxRate_hz );
+
+   m_fastRate_us = m_rate_us;
+   m_slowRate_us = 1000000 / ( minRate_hz ? minRate_hz : 1 );
+   m_threshold = threshold ? threshold : 1;
+   m_refDist = m_lastDist;
+   if ( m_slowRate_us < m_fastRate_us )
+   {
+      m_slowRate_us = m_fastRate_us;
+   }
+}
+
+//============================================================================
+// Set the maximum range to measure.
+//
+// Echos that take longer than this to return are treated as lost.
+// Shorter ranges time out sooner so the next ping can be sent
+// sooner after a lost echo.
+//
+//= INPUTS
+//
+//- range_cm   Maximum range in cm.  Zero or values larger than 5 meters
+//             use 5 meters (the sensor limit).
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+inline
+void
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+setMaxRange( uint16_t range_cm )
+{
+   if ( range_cm == 0 || range_cm > SONAR_MAX_RANGE_CM )
+   {
+      range_cm = SONAR_MAX_RANGE_CM;
+   }
+
+   m_maxTime_us = (uint32_t)range_cm * SONAR_US_PER_CM;
+}
+
+//============================================================================
+// Set the distance units.
+//
+// This clears the filters since the old values are in the old units.
+// Adaptive rate thresholds are not changed.
+//
+//= INPUTS
+//
+//- units   CM or MM.
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+inline
+void
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+setUnits( Units units )
+{
+   if ( units != m_units )
+   {
+      m_units = units;
+      m_lastDist = 0;
+      m_refDist = 0;
+      clear();
+      setConversion();
+   }
+}
+
+//============================================================================
+// Set the air temperature.
+//
+// The speed of sound changes by about 0.6 m/s (0.2%) per deg C so this
+// is only needed for accurate long distance measurements.  This can
+// be called as often as needed.
+//
+//= INPUTS
+//
+//- temp_c   Air temperature in deg C.
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+inline
+void
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+setTemperature( int8_t temp_c )
+{
+   if ( temp_c == SONAR_NO_TEMP )
+   {
+      temp_c++;
+   }
+
+   m_temp_c = temp_c;
+   setConversion();
+}
+
+//============================================================================
+// Go back to the datasheet conversion (58 us/cm).
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+inline
+void
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+clearTemperature()
+{
+   m_temp_c = SONAR_NO_TEMP;
+   setConversion();
+}
+
+//============================================================================
+// Compute the echo time to distance conversion factor.
+//
+// This is the only place a division is done so it's only done when
+// the units or temperature change, not on each ping.
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+void
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+setConversion()
+{
+   // Distance is half the round trip time so the 16 bit fixed point
+   // factor is 65536 / ( 2 * us per unit ).
+   if ( m_temp_c == SONAR_NO_TEMP )
+   {
+      // Datasheet value: 58 us/cm round trip.  Rounded up so exact
+      // multiples of 58 us aren't truncated to the unit below.
+      m_usToDist = ( m_units == MM ? 655360L : 65536L ) / SONAR_US_PER_CM + 1;
+   }
+   else
+   {
+      // Speed of sound in 0.1 m/s is 3313 + 6.06 * temp.  Distance in
+      // mm = dt_us * c / 20000 or in cm = dt_us * c / 200000.
+      int32_t c = 3313 + ( 606L * m_temp_c ) / 100;
+      m_usToDist = ( c * 65536L ) / ( m_units == MM ? 20000L : 200000L );
+   }
+}
+
+//============================================================================
+// Turn on the alpha-beta tracking filter.
+//
+//= INPUTS
+//
+//- alpha       Distance gain 1-255 (0-1).  0 turns the tracker off.
+//- beta        Velocity gain 0-255 (0-1).  Should be smaller than alpha.
+//- maxGap_ms   If no ping is received for this long, the tracker restarts
+//              at the next distance.
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+inline
+void
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+setTracker( uint8_t alpha,
+            uint8_t beta,
+            uint16_t maxGap_ms )
+{
+   m_tracker.init( alpha, beta, maxGap_ms );
+}
+
+//============================================================================
+// Clear previous values from the median and tracking filters.
 //
 template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
 inline
@@ -213,6 +492,36 @@ Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
 clear()
 {
    m_filter.clear();
+   m_tracker.clear();
+}
+
+//============================================================================
+// Return the tracking filter distance in the sonar units.
+//
+// setTracker() must be called first.
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+inline
+uint16_t
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+trackedDistance()
+{
+   return m_tracker.value();
+}
+
+//============================================================================
+// Return the tracking filter velocity in units/sec (cm/sec by default).
+//
+// Positive values are moving away from the sensor.  setTracker() must
+// be called first.
+//
+template< uint8_t ECHO_PIN, uint8_t TRIGGER_PIN, uint8_t NUM_SAMPLES >
+inline
+int16_t
+Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
+velocity()
+{
+   return m_tracker.velocity();
 }
 
 //============================================================================
@@ -232,30 +541,45 @@ uint16_t
 Sonar< ECHO_PIN, TRIGGER_PIN, NUM_SAMPLES >::
 poll( SonarChangeCb callback )
 {
+   PROFILE_SCOPE( "Sonar::poll" );
+
    // Sonar is off - do nothing.
    if ( ! m_on )
    {
       return 0;
    }
    // If no ping has been sent, see if we should send one.
-   else if ( ! m_sent )
+   else if ( m_state == IDLE )
    {
-      // NOTE: if we get a time out - it can take a long time (200
-      // msec) to "reset" the sensor and have the echo line go low
-      // again.  Not sure why that is, but it we try to send a ping
-      // which echo is high, it will lock up the arduino somehow.
+      // NOTE: if we try to send a ping while echo is high, it will
+      // lock up the arduino somehow.
       if ( m_echo.read() == LOW &&
-           (int32_t)( micros() - m_lastSent_us ) > m_rate_us )
+           (int32_t)( micros() - m_lastSent_us ) > (int32_t)m_rate_us )
+      {
+         sendPing();
+      }
+
+      return 0;
+   }
+   // Last ping timed out.  It can take a long time (up to 200 msec)
+   // to "reset" the sensor and have the echo line go low again.  Not
+   // sure why that is.  The lost ping already used up it's time slot
+   // so send the next one as soon as the echo line goes low.
+   else if ( m_state == RECOVER )
+   {
+      if ( m_echo.read() == LOW )
       {
          sendPing();
       }
 
       return 0;
    }
-   // Time out - reset our flags so we can send another ping.
-   else if ( (int32_t)(micros() - m_lastSent_us ) > SONAR_MAX_TIME_US )
+   // Time out - stop listening and wait for the echo line to recover
+   // so we can send another ping.
+   else if ( (int32_t)( micros() - m_lastSent_us ) > (int32_t)m_maxTime_us )
    {
-      m_sent = false;
+      detachInterrupt( digitalPinToInterrupt( ECHO_PIN ) );
+      m_state = RECOVER;
       s_pingBeg_us = s_pingEnd_us = 0;
       return 0;
    }   
@@ -265,38 +589,64 @@ poll( SonarChangeCb callback )
       return 0;
    }
 
-   // We have a ping response.  Clear the sent flag so we know we can
+   // We have a ping response.  Clear the sent state so we know we can
    // send another one the next time through.
-   m_sent = false;
+   m_state = IDLE;
 
    // If the interrupts fire too fast (if something covers the
    // sensor), things can get weird and we'll get a negative time or a
    // zero value for the beg time.
    uint32_t dt_us = s_pingEnd_us - s_pingBeg_us;
-   if ( s_pingBeg_us == 0 || dt_us > SONAR_MAX_TIME_US )
+   if ( s_pingBeg_us == 0 || dt_us > m_maxTime_us )
    {
       return 0;
    }
 
-   // Convert from usec to cm (value from datasheet)
-   uint32_t dt_cm = dt_us / 58;
+   // Convert from usec to distance using a fixed point multiply
+   // (much faster than dividing on an 8 bit processor).
+   uint16_t dist = ( dt_us * m_usToDist ) >> 16;
 
    // If requested, run a median filter on the result to eliminate
    // outliers.
    if ( NUM_SAMPLES )
    {
-      m_filter.add( dt_cm );
-      dt_cm = m_filter.median();
+      m_filter.add( dist );
+      dist = m_filter.median();
+   }
+
+   // Update the tracker with the filtered distance.  Lost pings are
+   // just a longer time since the last one.
+   if ( m_tracker.isActive() )
+   {
+      m_tracker.add( dist, millis() );
    }
 
    // Run the callback if the distance changed.
-   if ( callback && dt_cm != m_lastDist_cm )
+   if ( callback && dist != m_lastDist )
+   {
+      callback( dist );
+   }
+
+   // Adaptive rate - go fast if the distance is changing, otherwise
+   // back off the rate by doubling the time between pings.
+   if ( m_fastRate_us )
    {
-      callback( dt_cm );
+      uint16_t change = dist > m_refDist ? dist - m_refDist :
+                                           m_refDist - dist;
+      if ( change >= m_threshold )
+      {
+         m_rate_us = m_fastRate_us;
+         m_refDist = dist;
+      }
+      else if ( m_rate_us < m_slowRate_us )
+      {
+         m_rate_us = m_rate_us * 2 < m_slowRate_us ? m_rate_us * 2 :
+                                                     m_slowRate_us;
+      }
    }
    
-   m_lastDist_cm = dt_cm;
-   return dt_cm;
+   m_lastDist = dist;
+   return dist;
 }
 
 //============================================================================
@@ -309,7 +659,7 @@ sendPing()
 {
    s_pingBeg_us = 0;
    s_pingEnd_us = 0;
-   m_sent = true;
+   m_state = SENT;
 
    // Monitor the echo ping for a rising signal.
    attachInterrupt( digitalPinToInterrupt( ECHO_PIN ), echoRise, RISING );
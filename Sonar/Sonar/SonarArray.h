@@ -0,0 +1,697 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <Arduino.h>
+#include <MedianFilter.h>
+#include <Profile.h>
+
+// Pin change interrupt based array of HR-S04 ultrasonic sensors.
+//
+// The Sonar class only supports one sensor because it uses the
+// external interrupt pins.  This class supports up to 8 sensors by
+// using pin change interrupts on the echo pins instead.  All of the
+// echo pins are handled by one interrupt routine which must be
+// defined in the sketch (see the example) and which calls
+// echoChange().  The echo pins can be any pin that supports pin
+// change interrupts (all of them on an Uno or Pro Mini).  If the
+// echo pins are on more than one port (D0-D7, D8-D13, A0-A5), then
+// define the interrupt routine for each port.
+//
+// Sensors which are close to each other or pointing the same way
+// will hear each others pings.  The crosstalk matrix tells the class
+// which sensors interfere with each other.  The sensors are grouped
+// into slots where each slot is a set of sensors that don't
+// interfere.  All of the sensors in a slot are pinged at the same
+// time and the slots are pinged in round robin order.  The slots are
+// computed to use the fewest possible number of slots which gives the
+// highest total ping rate.  By default, all sensors interfere with
+// each other so each sensor gets it's own slot.
+//
+// The 2nd template parameter is for the number of samples to use in
+// an optional median filter to eliminate outlier results.  Each
+// sensor has it's own filter.  Set it zero for no filtering.
+//
+//= Example
+//
+//   static const uint8_t ECHO_PINS[] = { 8, 9, 10, 11 };
+//   static const uint8_t TRIGGER_PINS[] = { 4, 5, 6, 7 };
+//   static const int SONAR_RATE = 10; // 10 Hz pinging of each sensor
+//
+//   // 4 sensors, 5 sample median filter.
+//   SonarArray< 4, 5 > g_sonars;
+//
+//   // D8-D13 pin change interrupt.
+//   ISR( PCINT0_vect )
+//   {
+//      g_sonars.echoChange();
+//   }
+//
+//   void setup()
+//   {
+//      Serial.begin( 19200 );
+//      g_sonars.init( ECHO_PINS, TRIGGER_PINS, SONAR_RATE );
+//
+//      // Sensors 0 and 1 point the same way and interfere with each
+//      // other.  Sensors 2 and 3 point the other way.
+//      g_sonars.setCrosstalk( 0, bit( 1 ) );
+//      g_sonars.setCrosstalk( 2, bit( 3 ) );
+//   }
+//
+//   void callback( uint8_t sensor, uint16_t dist_cm )
+//   {
+//      Serial.print( "Sensor " );
+//      Serial.print( sensor );
+//      Serial.print( ": " );
+//      Serial.print( dist_cm );
+//      Serial.println( " cm" );
+//   }
+//
+//   void loop()
+//   {
+//      g_sonars.poll( callback );
+//   }
+//
+typedef void (*SonarArrayChangeCb)( uint8_t sensor, uint16_t distance_cm );
+
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES=0 >
+class SonarArray
+{
+public:
+   // NOTE: Can't use constructors (even though we should) because
+   // Arduino sketch generally requires these to be global variables
+   // so we don't know that the ctor would be called after hardware
+   // init.
+   void init( const uint8_t* echoPins, const uint8_t* triggerPins,
+              uint16_t rate_hz );
+
+   // Returns a bit mask of the sensors which received a ping.  Will
+   // call the callback for each sensor when the distance changes.
+   uint8_t poll( SonarArrayChangeCb callback=NULL );
+
+   void on( uint16_t rate_hz=0 );
+   void off();
+   void setRate( uint16_t rate_hz );
+   void setCrosstalk( uint8_t sensor, uint8_t interferes );
+   void clear();
+
+   uint16_t distance( uint8_t sensor );
+   uint8_t numSlots();
+
+   // Must be called from the pin change interrupt routine.
+   void echoChange();
+
+private:
+   enum { SONAR_MAX_TIME_US = 500 * 58 }; // 5 meters * 58 us/cm
+
+   struct Sensor
+   {
+      // Input register and bit mask to read the echo pin with.  This
+      // is much faster than digitalRead() inside the interrupt.
+      volatile uint8_t* echoReg;
+      uint8_t echoMask;
+
+      // Trigger pin for the sonar module.
+      uint8_t trigger;
+
+      // Bit mask of the other sensors that this one interferes with.
+      uint8_t crosstalk;
+
+      // Distance in cm of the last ping.
+      uint16_t lastDist_cm;
+
+      // Filter for removing outliers.  Returns the median value of
+      // the last NUM_SAMPLES pings.
+      MedianFilter< uint16_t, NUM_SAMPLES > filter;
+   };
+
+   Sensor m_sensors[NUM_SENSORS];
+
+   // Bit mask of the sensors that are pinged together in each slot.
+   // Only the first m_numSlots entries are used.
+   uint8_t m_slots[NUM_SENSORS];
+   uint8_t m_numSlots;
+
+   // Index of the slot to ping next (or that is being pinged).
+   uint8_t m_slot;
+
+   // on/off flag.  If off, then no pings are sent.
+   bool m_on;
+
+   // Requested ping rate of each sensor.
+   uint16_t m_rate_hz;
+
+   // Time to wait in between pinging slots in microseconds.
+   uint32_t m_rate_us;
+
+   // True if a slot was pinged and we're waiting for the returns.
+   bool m_sent;
+
+   // Time in microseconds the last slot was pinged.
+   uint32_t m_lastSent_us;
+
+   // Bit mask of the sensors that are waiting for the echo pin to
+   // fall.  Bits are cleared by the interrupt.
+   volatile uint8_t m_waiting;
+
+   // Echo rise and fall times for each sensor.
+   volatile uint32_t m_pingBeg_us[NUM_SENSORS];
+   volatile uint32_t m_pingEnd_us[NUM_SENSORS];
+
+   void schedule();
+   bool assign( uint8_t sensor, uint8_t numSlots );
+   bool echoLow( uint8_t mask );
+   void sendPing( uint8_t mask );
+};
+
+//============================================================================
+// Initialize the module.
+//
+// Enables the pin change interrupts for all the echo pins.  All the
+// sensors are assumed to interfere with each other until
+// setCrosstalk() is called.
+//
+//= INPUTS
+//
+//- echoPins     Array of NUM_SENSORS echo pins.
+//- triggerPins  Array of NUM_SENSORS trigger pins.
+//- rate_hz      Ping rate of each sensor in Hz (times/sec).  Set to zero
+//               to ping as fast as possible.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+init( const uint8_t* echoPins,
+      const uint8_t* triggerPins,
+      uint16_t rate_hz )
+{
+   static_assert( NUM_SENSORS > 0 && NUM_SENSORS <= 8,
+                  "SonarArray supports 1 to 8 sensors" );
+
+   m_waiting = 0;
+   m_sent = false;
+   m_on = true;
+   m_slot = 0;
+   m_lastSent_us = 0;
+
+   for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+   {
+      Sensor& s = m_sensors[i];
+      uint8_t echo = echoPins[i];
+
+      s.echoReg = portInputRegister( digitalPinToPort( echo ) );
+      s.echoMask = digitalPinToBitMask( echo );
+      s.trigger = triggerPins[i];
+      s.lastDist_cm = 0;
+      s.filter.clear();
+
+      // Every other sensor interferes.
+      s.crosstalk = ( (uint8_t)( ( 1 << NUM_SENSORS ) - 1 ) ) & ~bit( i );
+
+      pinMode( echo, INPUT );
+      pinMode( s.trigger, OUTPUT );
+      digitalWrite( s.trigger, LOW );
+
+      m_pingBeg_us[i] = 0;
+      m_pingEnd_us[i] = 0;
+
+      // Turn on the pin change interrupt for the echo pin.
+      *digitalPinToPCICR( echo ) |= bit( digitalPinToPCICRbit( echo ) );
+      *digitalPinToPCMSK( echo ) |= bit( digitalPinToPCMSKbit( echo ) );
+   }
+
+   m_rate_hz = rate_hz;
+   schedule();
+}
+
+//============================================================================
+// Turn the module on.
+//
+//= INPUTS
+//
+//- rate_hz    Ping rate of each sensor in Hz (times/sec).  Set to zero to
+//             ping as fast as possible.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+on( uint16_t rate_hz )
+{
+   m_on = true;
+   if ( rate_hz )
+   {
+      setRate( rate_hz );
+   }
+}
+
+//============================================================================
+// Turn the module off.
+//
+// No pings are sent until on() is called.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+off()
+{
+   m_on = false;
+   m_sent = false;
+   m_waiting = 0;
+   clear();
+}
+
+//============================================================================
+// Set the ping rate to use.
+//
+// The rate is per sensor.  The time between slots is the inverse of
+// the rate divided by the number of slots.
+//
+//= INPUTS
+//
+//- rate_hz    Ping rate of each sensor in Hz (times/sec).  Set to zero to
+//             ping as fast as possible.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+setRate( uint16_t rate_hz )
+{
+   m_rate_hz = rate_hz;
+   if ( rate_hz == 0 )
+   {
+      m_rate_us = 1;
+   }
+   else
+   {
+      // Convert rate in Hz (1/sec) to time in microseconds and spread
+      // it across the slots.
+      m_rate_us = 1000000 / ( (uint32_t)rate_hz * m_numSlots );
+   }
+}
+
+//============================================================================
+// Set which sensors interfere with a sensor.
+//
+// Crosstalk is symmetric - if sensor A interferes with B, then B also
+// interferes with A so the other sensor rows are updated as well.
+// The ping slots are recomputed after each call.
+//
+//= INPUTS
+//
+//- sensor       Index of the sensor to set.
+//- interferes   Bit mask of the other sensors which hear the pings of
+//               this sensor (bit i for sensor i).  Zero if the sensor
+//               can be pinged at the same time as any other sensor.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+setCrosstalk( uint8_t sensor,
+              uint8_t interferes )
+{
+   interferes &= ~bit( sensor );
+   m_sensors[sensor].crosstalk = interferes;
+
+   for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+   {
+      if ( i == sensor )
+      {
+         continue;
+      }
+
+      if ( interferes & bit( i ) )
+      {
+         m_sensors[i].crosstalk |= bit( sensor );
+      }
+      else
+      {
+         m_sensors[i].crosstalk &= ~bit( sensor );
+      }
+   }
+
+   // Don't change the slots while a ping is in flight.
+   m_sent = false;
+   m_waiting = 0;
+   schedule();
+}
+
+//============================================================================
+// Clear previous values from the median filters.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+clear()
+{
+   for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+   {
+      m_sensors[i].filter.clear();
+   }
+}
+
+//============================================================================
+// Return the last distance in cm measured by a sensor.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+uint16_t
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+distance( uint8_t sensor )
+{
+   return m_sensors[sensor].lastDist_cm;
+}
+
+//============================================================================
+// Return the number of ping slots.
+//
+// This is the number of pings it takes to cycle through all of the
+// sensors.  1 means every sensor is pinged at once.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+uint8_t
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+numSlots()
+{
+   return m_numSlots;
+}
+
+//============================================================================
+// Poll the module.
+//
+// If enough time has elapsed, the next slot of sensors will be
+// pinged.  When all of the sensors in the slot have returned (or
+// timed out), the distances are processed.
+//
+//= INPUTS
+//
+//- callback   Optional callback to call when a ping is returned.  Only
+//             called when the distance for that sensor changes.
+//
+//= RETURNS
+//- Returns a bit mask of the sensors that had a ping returned (bit i
+//  for sensor i).  Zero if there were none.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+uint8_t
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+poll( SonarArrayChangeCb callback )
+{
+   PROFILE_SCOPE( "SonarArray::poll" );
+
+   // Sonar is off - do nothing.
+   if ( ! m_on )
+   {
+      return 0;
+   }
+   // If no ping has been sent, see if we should send one.
+   else if ( ! m_sent )
+   {
+      // NOTE: see Sonar - if we try to send a ping while echo is
+      // high, the sensor can lock up.  So wait for all the echo pins
+      // in the slot to go low.
+      uint8_t mask = m_slots[m_slot];
+      if ( echoLow( mask ) &&
+           (int32_t)( micros() - m_lastSent_us ) > (int32_t)m_rate_us )
+      {
+         sendPing( mask );
+      }
+
+      return 0;
+   }
+   // Pings were sent, but we haven't seen all of the return pulses
+   // yet and we haven't timed out.
+   else if ( m_waiting &&
+             (int32_t)( micros() - m_lastSent_us ) <= SONAR_MAX_TIME_US )
+   {
+      return 0;
+   }
+
+   // The slot is finished.  Any sensors still waiting timed out so
+   // stop the interrupt from updating them.
+   uint8_t mask = m_slots[m_slot];
+   noInterrupts();
+   uint8_t timedOut = m_waiting;
+   m_waiting = 0;
+   interrupts();
+
+   m_sent = false;
+   if ( ++m_slot >= m_numSlots )
+   {
+      m_slot = 0;
+   }
+
+   uint8_t result = 0;
+   mask &= ~timedOut;
+   for ( uint8_t i = 0; mask; i++, mask >>= 1 )
+   {
+      if ( ! ( mask & 1 ) )
+      {
+         continue;
+      }
+
+      // If the interrupts fire too fast (if something covers the
+      // sensor), things can get weird and we'll get a negative time
+      // or a zero value for the beg time.
+      uint32_t dt_us = m_pingEnd_us[i] - m_pingBeg_us[i];
+      if ( m_pingBeg_us[i] == 0 || dt_us > SONAR_MAX_TIME_US )
+      {
+         continue;
+      }
+
+      // Convert from usec to cm (value from datasheet)
+      uint16_t dt_cm = dt_us / 58;
+
+      // If requested, run a median filter on the result to eliminate
+      // outliers.
+      Sensor& s = m_sensors[i];
+      if ( NUM_SAMPLES )
+      {
+         s.filter.add( dt_cm );
+         dt_cm = s.filter.median();
+      }
+
+      // Run the callback if the distance changed.
+      if ( callback && dt_cm != s.lastDist_cm )
+      {
+         callback( i, dt_cm );
+      }
+
+      s.lastDist_cm = dt_cm;
+      result |= bit( i );
+   }
+
+   return result;
+}
+
+//============================================================================
+// Pin change interrupt handler.
+//
+// This must be called from the ISR for the port(s) the echo pins are
+// on.  Records the rise and fall times for each sensor that is
+// waiting for a return.  Pins for other sensors and other devices on
+// the same port are ignored.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+echoChange()
+{
+   uint32_t now = micros();
+   uint8_t waiting = m_waiting;
+
+   for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+   {
+      if ( ! ( waiting & bit( i ) ) )
+      {
+         continue;
+      }
+
+      bool high = *m_sensors[i].echoReg & m_sensors[i].echoMask;
+
+      // Rising edge is the start of the timing.
+      if ( high && m_pingBeg_us[i] == 0 )
+      {
+         m_pingBeg_us[i] = now;
+      }
+      // Falling edge is the end of the timing.
+      else if ( ! high && m_pingBeg_us[i] != 0 )
+      {
+         m_pingEnd_us[i] = now;
+         waiting &= ~bit( i );
+      }
+   }
+
+   m_waiting = waiting;
+}
+
+//============================================================================
+// Compute the ping slots from the crosstalk matrix.
+//
+// This is a graph coloring problem - each slot is a set of sensors
+// that don't interfere.  Tries 1 slot, then 2, etc until the sensors
+// fit.  With at most 8 sensors the backtracking search is fast and
+// it's only done when the crosstalk changes.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+schedule()
+{
+   for ( m_numSlots = 1; m_numSlots < NUM_SENSORS; m_numSlots++ )
+   {
+      for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+      {
+         m_slots[i] = 0;
+      }
+
+      if ( assign( 0, m_numSlots ) )
+      {
+         break;
+      }
+   }
+
+   // Worst case: every sensor gets it's own slot.
+   if ( m_numSlots == NUM_SENSORS )
+   {
+      for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+      {
+         m_slots[i] = bit( i );
+      }
+   }
+
+   m_slot = 0;
+   setRate( m_rate_hz );
+}
+
+//============================================================================
+// Recursively assign sensors to slots.
+//
+//= INPUTS
+//- sensor     Index of the sensor to assign.  Sensors before this are
+//             already in a slot.
+//- numSlots   Number of slots that can be used.
+//
+//= RETURNS
+//- Returns true if the sensors fit in the slots.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+bool
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+assign( uint8_t sensor,
+        uint8_t numSlots )
+{
+   if ( sensor == NUM_SENSORS )
+   {
+      return true;
+   }
+
+   uint8_t crosstalk = m_sensors[sensor].crosstalk;
+   for ( uint8_t s = 0; s < numSlots; s++ )
+   {
+      if ( m_slots[s] & crosstalk )
+      {
+         continue;
+      }
+
+      bool wasEmpty = ( m_slots[s] == 0 );
+      m_slots[s] |= bit( sensor );
+      if ( assign( sensor + 1, numSlots ) )
+      {
+         return true;
+      }
+      m_slots[s] &= ~bit( sensor );
+
+      // All the empty slots are the same - no need to try the rest.
+      if ( wasEmpty )
+      {
+         break;
+      }
+   }
+
+   return false;
+}
+
+//============================================================================
+// Return true if all the echo pins in a mask of sensors are low.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+inline
+bool
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+echoLow( uint8_t mask )
+{
+   for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+   {
+      if ( ( mask & bit( i ) ) &&
+           ( *m_sensors[i].echoReg & m_sensors[i].echoMask ) )
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+//============================================================================
+// Ping a set of sensors at the same time.
+//
+template< uint8_t NUM_SENSORS, uint8_t NUM_SAMPLES >
+void
+SonarArray< NUM_SENSORS, NUM_SAMPLES >::
+sendPing( uint8_t mask )
+{
+   for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+   {
+      if ( mask & bit( i ) )
+      {
+         m_pingBeg_us[i] = 0;
+         m_pingEnd_us[i] = 0;
+      }
+   }
+
+   m_sent = true;
+   m_waiting = mask;
+
+   // Pulse the trigger pins for 10us to send the pings.
+   for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+   {
+      if ( mask & bit( i ) )
+      {
+         digitalWrite( m_sensors[i].trigger, HIGH );
+      }
+   }
+
+   delayMicroseconds( 10 );
+
+   for ( uint8_t i = 0; i < NUM_SENSORS; i++ )
+   {
+      if ( mask & bit( i ) )
+      {
+         digitalWrite( m_sensors[i].trigger, LOW );
+      }
+   }
+
+   m_lastSent_us = micros();
+}
+
+//============================================================================
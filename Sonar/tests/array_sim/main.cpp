@@ -0,0 +1,193 @@
+#include "HostSim.h"
+#include "SonarArray.h"
+#include <iostream>
+
+// Simulated sensor array test.  Uses the wiring from the sonar_array
+// sketch: sensors 0 and 1 point forward and sensors 2 and 3 point
+// backward so each one hears the pings of the other sensor pointing
+// the same way.  Checks that those neighbours are never pinged while
+// the other one's ping is in the air and that each echo is reported
+// for the sensor that heard it.
+//
+// Compile and run:
+// g++ -I../../Sonar -I../../../MedianFilter/MedianFilter -I../../../Profile/Profile -I../../../HostSim -o test main.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint8_t NUM_SONAR = 4;
+static const uint8_t ECHO_PINS[NUM_SONAR] = { 8, 9, 10, 11 };
+static const uint8_t TRIGGER_PINS[NUM_SONAR] = { 4, 5, 6, 7 };
+
+// Echo pins D8-D11 are on the second pin change port.
+static const uint8_t ECHO_PORT = 1;
+
+// Bit mask of the sensors that hear each sensor's pings.
+static const uint8_t CROSSTALK[NUM_SONAR] = {
+   bit( 1 ), bit( 0 ), bit( 3 ), bit( 2 )
+};
+
+// Simulated HR-S04s.  When the trigger pulse ends, the echo line goes
+// high after a short delay and stays high for 58 us/cm of distance.
+// If a neighbour's ping is still in the air, the sensor hears that
+// one instead and the echo ends when the neighbour's does.
+struct SimSonar
+{
+   uint16_t dist_cm;
+   uint64_t triggerHigh_us;
+   uint64_t echoEnd_us;   // time the last echo falls (0 = never pinged)
+   int numPings;
+   int numReadings;
+   int numWrong;
+};
+
+static SimSonar s_sim[NUM_SONAR];
+static int s_numOverlaps = 0;
+static int s_numShared = 0;
+static uint64_t s_lastPing_us = 0;
+
+static SonarArray< NUM_SONAR, 0 > s_sonars;
+
+static void
+pinChange()
+{
+   s_sonars.echoChange();
+}
+
+static void
+echoHigh( void* data )
+{
+   HostSim::setPin( ECHO_PINS[(intptr_t)data], HIGH );
+}
+
+static void
+echoLow( void* data )
+{
+   HostSim::setPin( ECHO_PINS[(intptr_t)data], LOW );
+}
+
+static void
+triggerWrite( uint8_t pin,
+              uint8_t level,
+              void* )
+{
+   intptr_t i = pin - TRIGGER_PINS[0];
+   SimSonar& s = s_sim[i];
+   uint64_t now = HostSim::time_us();
+
+   if ( level == HIGH )
+   {
+      s.triggerHigh_us = now;
+      return;
+   }
+   // Need a 10 us pulse to fire.
+   if ( now - s.triggerHigh_us < 10 )
+   {
+      return;
+   }
+
+   s.numPings++;
+   if ( now == s_lastPing_us )
+   {
+      s_numShared++;
+   }
+   s_lastPing_us = now;
+
+   uint64_t t = now + 450;
+   uint64_t end = t + (uint32_t)s.dist_cm * 58;
+   for ( uint8_t j = 0; j < NUM_SONAR; j++ )
+   {
+      if ( ( CROSSTALK[i] & bit( j ) ) && s_sim[j].echoEnd_us > now )
+      {
+         s_numOverlaps++;
+         end = s_sim[j].echoEnd_us > t ? s_sim[j].echoEnd_us : t + 58;
+      }
+   }
+   s.echoEnd_us = end;
+
+   HostSim::at( t, echoHigh, (void*)i );
+   HostSim::at( end, echoLow, (void*)i );
+}
+
+//============================================================================
+int
+main()
+{
+   const uint64_t DURATION_US = 2000000;
+   const uint64_t LOOP_US = 20;
+   const uint16_t DIST_CM[NUM_SONAR] = { 40, 150, 75, 220 };
+
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::attachPinChange( ECHO_PORT, pinChange );
+   for ( uint8_t i = 0; i < NUM_SONAR; i++ )
+   {
+      HostSim::onWrite( TRIGGER_PINS[i], triggerWrite );
+      s_sim[i].dist_cm = DIST_CM[i];
+   }
+
+   s_sonars.init( ECHO_PINS, TRIGGER_PINS, 0 ); // as fast as possible
+   s_sonars.setCrosstalk( 0, CROSSTALK[0] );
+   s_sonars.setCrosstalk( 2, CROSSTALK[2] );
+
+   // Each sensor has a different distance so a reading for the wrong
+   // sensor is easy to spot.
+   while ( HostSim::time_us() < DURATION_US )
+   {
+      uint8_t mask = s_sonars.poll();
+      for ( uint8_t i = 0; i < NUM_SONAR; i++ )
+      {
+         if ( mask & bit( i ) )
+         {
+            SimSonar& s = s_sim[i];
+            uint16_t d = s_sonars.distance( i );
+            s.numReadings++;
+            if ( d + 1 < s.dist_cm || d > s.dist_cm )
+            {
+               s.numWrong++;
+            }
+         }
+      }
+      HostSim::advance( LOOP_US );
+   }
+
+   bool fail = false;
+   std::cout << "Slots: " << (int)s_sonars.numSlots() << "\n";
+   if ( s_sonars.numSlots() != 2 )
+   {
+      fail = true;
+      std::cout << "Error: expected 2 slots\n";
+   }
+
+   for ( uint8_t i = 0; i < NUM_SONAR; i++ )
+   {
+      const SimSonar& s = s_sim[i];
+      std::cout << "Sensor " << (int)i << ": " << s.numPings << " pings, "
+                << s.numReadings << " readings\n";
+      if ( s.numReadings < 20 || s.numWrong )
+      {
+         fail = true;
+         std::cout << "Error: sensor " << (int)i << " wrong="
+                   << s.numWrong << "\n";
+      }
+   }
+
+   // The sensors that don't interfere share a slot so half the pings
+   // go out with another one.
+   int numPings = 0;
+   for ( uint8_t i = 0; i < NUM_SONAR; i++ )
+   {
+      numPings += s_sim[i].numPings;
+   }
+   if ( s_numOverlaps || 2 * s_numShared != numPings )
+   {
+      fail = true;
+      std::cout << "Error: overlaps=" << s_numOverlaps << " shared="
+                << s_numShared << " of " << numPings << " pings\n";
+   }
+
+   if ( ! fail )
+   {
+      std::cout << "Passed\n";
+   }
+
+   return 0;
+}
@@ -0,0 +1,379 @@
+#include "HostSim.h"
+#include "Sonar.h"
+#include <iostream>
+
+// Simulated sensor test.  Measures the number of pings per second
+// that the Sonar class can send for different maximum ranges and
+// types of lost echos and checks the adaptive ping rate, the
+// tracking filter, and the distance units.
+//
+// Compile and run:
+// g++ -I../../Sonar -I../../../MedianFilter/MedianFilter -I../../../AlphaBetaFilter/AlphaBetaFilter -I../../../Profile/Profile -I../../../HostSim -o test main.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint8_t ECHO_PIN = 3;
+static const uint8_t TRIGGER_PIN = 5;
+
+// Simulated HR-S04.  When the trigger pulse ends, the echo line goes
+// high after a short delay and stays high for 58 us/cm of distance.
+// Some of the pings are lost and either never raise the echo line or
+// hold it high for a long time.
+struct SimSonar
+{
+   uint16_t dist_cm;
+
+   // Distance changes by speed_cmps between moveBeg_us and moveEnd_us.
+   int speed_cmps;
+   uint64_t moveBeg_us;
+   uint64_t moveEnd_us;
+
+   int lostPct;      // percent of pings that are lost
+   bool lostHigh;    // lost pings hold echo high (vs never raise it)
+   uint32_t lostHigh_us;
+   uint32_t seed;
+
+   int numPings;
+   int numLockups;
+   uint64_t triggerHigh_us;
+
+   uint16_t
+   distance( uint64_t t )
+   {
+      if ( t <= moveBeg_us )
+      {
+         return dist_cm;
+      }
+      uint64_t end = t < moveEnd_us ? t : moveEnd_us;
+      return dist_cm + (int)( speed_cmps * (int64_t)( end - moveBeg_us ) /
+                              1000000 );
+   }
+
+   int
+   random( int num )
+   {
+      seed = seed * 1103515245 + 12345;
+      return ( seed >> 16 ) % num;
+   }
+};
+
+static SimSonar s_sim;
+
+static void
+echoHigh( void* )
+{
+   HostSim::setPin( ECHO_PIN, HIGH );
+}
+
+static void
+echoLow( void* )
+{
+   HostSim::setPin( ECHO_PIN, LOW );
+}
+
+static void
+triggerWrite( uint8_t,
+              uint8_t level,
+              void* )
+{
+   if ( level == HIGH )
+   {
+      s_sim.triggerHigh_us = HostSim::time_us();
+      return;
+   }
+   // Need a 10 us pulse to fire.
+   if ( HostSim::time_us() - s_sim.triggerHigh_us < 10 )
+   {
+      return;
+   }
+   // Triggering while echo is high locks up the hardware.
+   if ( HostSim::pin( ECHO_PIN ) == HIGH )
+   {
+      s_sim.numLockups++;
+      return;
+   }
+
+   s_sim.numPings++;
+   uint64_t t = HostSim::time_us() + 450;
+
+   if ( s_sim.random( 100 ) < s_sim.lostPct )
+   {
+      if ( s_sim.lostHigh )
+      {
+         HostSim::at( t, echoHigh );
+         HostSim::at( t + s_sim.lostHigh_us, echoLow );
+      }
+      return;
+   }
+
+   HostSim::at( t, echoHigh );
+   HostSim::at( t + (uint32_t)s_sim.distance( t ) * 58, echoLow );
+}
+
+static int s_numReadings = 0;
+static int s_numWrong = 0;
+
+static void
+callback( uint16_t )
+{
+}
+
+//============================================================================
+// Run one scenario and return the number of pings per second.
+static double
+run( uint16_t maxRange_cm,
+     uint16_t dist_cm,
+     int lostPct,
+     bool lostHigh )
+{
+   const uint64_t DURATION_US = 10000000; // 10 sec
+   const uint64_t LOOP_US = 20; // time for each loop() call
+
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::onWrite( TRIGGER_PIN, triggerWrite );
+
+   s_sim.dist_cm = dist_cm;
+   s_sim.speed_cmps = 0;
+   s_sim.moveBeg_us = s_sim.moveEnd_us = 0;
+   s_sim.lostPct = lostPct;
+   s_sim.lostHigh = lostHigh;
+   s_sim.lostHigh_us = 200000;
+   s_sim.seed = 1;
+   s_sim.numPings = 0;
+   s_sim.numLockups = 0;
+   s_numReadings = 0;
+   s_numWrong = 0;
+
+   Sonar< ECHO_PIN, TRIGGER_PIN, 0 > sonar;
+   sonar.init( 0 ); // ping as fast as possible
+   sonar.setMaxRange( maxRange_cm );
+
+   while ( HostSim::time_us() < DURATION_US )
+   {
+      uint16_t d = sonar.poll( callback );
+      if ( d )
+      {
+         s_numReadings++;
+         if ( d + 1 < dist_cm || d > dist_cm )
+         {
+            s_numWrong++;
+         }
+      }
+      HostSim::advance( LOOP_US );
+   }
+
+   return s_sim.numPings * 1e6 / DURATION_US;
+}
+
+//============================================================================
+// Adaptive rate.  The distance is stable for 60 sec, then changes at
+// 5 cm/sec for 10 sec, then is stable for another 60 sec.  Returns the
+// number of pings in each of those periods.
+static void
+runAdaptive( int pings[3] )
+{
+   const uint64_t STILL_US = 60000000;
+   const uint64_t MOVE_US = 10000000;
+   const uint64_t LOOP_US = 20;
+
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::onWrite( TRIGGER_PIN, triggerWrite );
+
+   s_sim.dist_cm = 90;
+   s_sim.speed_cmps = -5;
+   s_sim.moveBeg_us = STILL_US;
+   s_sim.moveEnd_us = STILL_US + MOVE_US;
+   s_sim.lostPct = 0;
+   s_sim.seed = 1;
+   s_sim.numPings = 0;
+   s_sim.numLockups = 0;
+
+   Sonar< ECHO_PIN, TRIGGER_PIN, 3 > sonar;
+   sonar.init( 0 );
+   sonar.setMaxRange( 100 );
+   sonar.setAdaptiveRate( 1, 20 ); // 1 to 20 Hz
+
+   const uint64_t END[3] = { STILL_US, STILL_US + MOVE_US,
+                             2 * STILL_US + MOVE_US };
+   int prev = 0;
+   for ( int i = 0; i < 3; i++ )
+   {
+      while ( HostSim::time_us() < END[i] )
+      {
+         sonar.poll( callback );
+         HostSim::advance( LOOP_US );
+      }
+      pings[i] = s_sim.numPings - prev;
+      prev = s_sim.numPings;
+   }
+}
+
+//============================================================================
+// Tracking filter.  Pings at 20 Hz with 10% lost echos while the
+// distance changes at -5 cm/sec.  Returns the worst velocity error
+// after the tracker settles.
+static int
+runTracker()
+{
+   const uint64_t DURATION_US = 20000000;
+   const uint64_t LOOP_US = 20;
+
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::onWrite( TRIGGER_PIN, triggerWrite );
+
+   s_sim.dist_cm = 95;
+   s_sim.speed_cmps = -5;
+   s_sim.moveBeg_us = 0;
+   s_sim.moveEnd_us = DURATION_US;
+   s_sim.lostPct = 10;
+   s_sim.lostHigh = false;
+   s_sim.seed = 1;
+   s_sim.numPings = 0;
+   s_sim.numLockups = 0;
+
+   Sonar< ECHO_PIN, TRIGGER_PIN, 3 > sonar;
+   sonar.init( 20 );
+   sonar.setMaxRange( 100 );
+   sonar.setTracker( 64, 8 );
+
+   int worst = 0;
+   while ( HostSim::time_us() < DURATION_US )
+   {
+      if ( sonar.poll() && HostSim::time_us() > 5000000 )
+      {
+         int err = sonar.velocity() + 5;
+         err = err < 0 ? -err : err;
+         worst = err > worst ? err : worst;
+      }
+      HostSim::advance( LOOP_US );
+   }
+
+   return worst;
+}
+
+//============================================================================
+// Return the distance reported for a target at 80 cm.
+static uint16_t
+runUnits( uint8_t units,
+          int8_t temp_c )
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::onWrite( TRIGGER_PIN, triggerWrite );
+
+   s_sim.dist_cm = 80;
+   s_sim.speed_cmps = 0;
+   s_sim.lostPct = 0;
+   s_sim.seed = 1;
+
+   Sonar< ECHO_PIN, TRIGGER_PIN, 0 > sonar;
+   sonar.init( 0 );
+   sonar.setUnits( (Sonar< ECHO_PIN, TRIGGER_PIN, 0 >::Units)units );
+   if ( temp_c != -128 )
+   {
+      sonar.setTemperature( temp_c );
+   }
+
+   uint16_t dist = 0;
+   while ( ! dist )
+   {
+      dist = sonar.poll();
+      HostSim::advance( 20 );
+   }
+
+   return dist;
+}
+
+//============================================================================
+int
+main()
+{
+   struct Case
+   {
+      const char* name;
+      uint16_t dist_cm;
+      int lostPct;
+      bool lostHigh;
+   };
+   const Case CASES[] = {
+      { "80 cm, no lost echos      ", 80, 0, false },
+      { "80 cm, 10% no echo        ", 80, 10, false },
+      { "80 cm, 10% 200 ms echo    ", 80, 10, true },
+      { "300 cm, no lost echos     ", 300, 0, false },
+   };
+   const int NUM = sizeof( CASES ) / sizeof( CASES[0] );
+
+   bool fail = false;
+
+   std::cout << "Scenario                     5 m range   1 m range  (pings/sec)\n";
+   for ( int i = 0; i < NUM; i++ )
+   {
+      const Case& c = CASES[i];
+
+      double full = run( 0, c.dist_cm, c.lostPct, c.lostHigh );
+      int fullLockups = s_sim.numLockups;
+      int fullWrong = s_numWrong;
+
+      double tank = run( 100, c.dist_cm, c.lostPct, c.lostHigh );
+      int tankLockups = s_sim.numLockups;
+      int tankWrong = c.dist_cm <= 100 ? s_numWrong : 0;
+
+      std::cout << c.name << "  " << full << "\t" << tank << "\n";
+
+      if ( fullLockups || tankLockups || fullWrong || tankWrong )
+      {
+         fail = true;
+         std::cout << "Error: lockups=" << fullLockups << "/" << tankLockups
+                   << " wrong=" << fullWrong << "/" << tankWrong << "\n";
+      }
+      if ( tank < full )
+      {
+         fail = true;
+         std::cout << "Error: shorter range is slower\n";
+      }
+   }
+
+   // Fixed 20 Hz would be 1200 / 200 / 1200 pings.  The moving rate
+   // should be at least 5x the still rate.
+   int pings[3];
+   runAdaptive( pings );
+   std::cout << "Adaptive 1-20 Hz pings: still " << pings[0] << ", moving "
+             << pings[1] << ", still " << pings[2] << "\n";
+   if ( pings[0] > 120 || pings[2] > 120 || 6 * pings[1] < 5 * pings[0] )
+   {
+      fail = true;
+      std::cout << "Error: adaptive rate not adapting\n";
+   }
+
+   int velErr = runTracker();
+   std::cout << "Tracker velocity error at -5 cm/sec: " << velErr
+             << " cm/sec\n";
+   if ( velErr > 2 )
+   {
+      fail = true;
+      std::cout << "Error: tracker velocity is wrong\n";
+   }
+
+   // Sim uses 58 us/cm which is about 24 deg C.
+   typedef Sonar< ECHO_PIN, TRIGGER_PIN, 0 > Sonar0;
+   const uint16_t cm = runUnits( Sonar0::CM, -128 );
+   const uint16_t mm = runUnits( Sonar0::MM, -128 );
+   const uint16_t mm0 = runUnits( Sonar0::MM, 0 );
+   const uint16_t mm24 = runUnits( Sonar0::MM, 24 );
+   std::cout << "80 cm target: " << cm << " cm, " << mm << " mm, " << mm0
+             << " mm at 0 C, " << mm24 << " mm at 24 C\n";
+   if ( cm != 80 || mm != 800 || mm0 != 768 || mm24 < 798 || mm24 > 802 )
+   {
+      fail = true;
+      std::cout << "Error: wrong distance conversion\n";
+   }
+
+   if ( ! fail )
+   {
+      std::cout << "Passed\n";
+   }
+
+   return 0;
+}
@@ -1,6 +1,7 @@
 #include "Arduino.h"
 #include "Sonar.h"
 #include "MedianFilter.h"
+#include "AlphaBetaFilter.h"
 #include "DigitalIO.h"
 
 #define ECHO_PIN 3
@@ -0,0 +1,60 @@
+#include "Arduino.h"
+#include "SonarArray.h"
+#include "MedianFilter.h"
+
+// Wiring:
+//
+// Sensor 0: echo D8,  trigger D4  (pointing forward)
+// Sensor 1: echo D9,  trigger D5  (pointing forward)
+// Sensor 2: echo D10, trigger D6  (pointing backward)
+// Sensor 3: echo D11, trigger D7  (pointing backward)
+//
+// Sensors pointing the same way interfere with each other so the
+// array should use 2 slots: { 0, 2 } and { 1, 3 }.
+#define NUM_SONAR 4
+#define PING_RATE_HZ 10
+#define MEDIAN_SAMPLES 5 // for smoothing - set to 0 for none
+
+static const uint8_t ECHO_PINS[NUM_SONAR] = { 8, 9, 10, 11 };
+static const uint8_t TRIGGER_PINS[NUM_SONAR] = { 4, 5, 6, 7 };
+
+SonarArray< NUM_SONAR, MEDIAN_SAMPLES > g_sonars;
+
+void callback( uint8_t sensor, uint16_t dist_cm );
+
+// D8-D13 pin change interrupt.
+ISR( PCINT0_vect )
+{
+   g_sonars.echoChange();
+}
+
+void
+setup()
+{
+   Serial.begin( 19200 );
+
+   g_sonars.init( ECHO_PINS, TRIGGER_PINS, PING_RATE_HZ );
+   g_sonars.setCrosstalk( 0, bit( 1 ) );
+   g_sonars.setCrosstalk( 2, bit( 3 ) );
+
+   Serial.print( "Starting with " );
+   Serial.print( g_sonars.numSlots() );
+   Serial.println( " slots..." );
+}
+
+void
+loop()
+{
+   g_sonars.poll( callback );
+}      
+
+void
+callback( uint8_t sensor,
+          uint16_t dist_cm )
+{
+   Serial.print( "Sensor " );
+   Serial.print( sensor );
+   Serial.print( ": " );
+   Serial.print( dist_cm );
+   Serial.println( " cm" );
+}
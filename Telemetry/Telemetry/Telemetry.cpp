@@ -0,0 +1,147 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "Telemetry.h"
+
+uint8_t Telemetry::s_buffer[TELEMETRY_BUFFER_SIZE];
+uint8_t Telemetry::s_head = 0;
+uint8_t Telemetry::s_size = 0;
+uint16_t Telemetry::s_dropped = 0;
+
+//============================================================================
+// Log a record.
+//
+// The record is copied into the buffer to be sent by drain().
+//
+//= INPUTS
+//- id        Record id.  See TelemetryId.
+//- payload   Record data.
+//- len       Number of bytes of data.
+//
+//= RETURNS
+//- Returns false if there wasn't room and the record was dropped.
+//
+bool
+Telemetry::
+log( uint8_t id,
+     const void* payload,
+     uint8_t len )
+{
+   // Report earlier drops first so the stream shows where the gap is.
+   if ( s_dropped )
+   {
+      if ( ! write( TELEMETRY_DROPPED, &s_dropped, sizeof( s_dropped ) ) )
+      {
+         if ( s_dropped != 0xFFFF )
+         {
+            s_dropped++;
+         }
+         return false;
+      }
+      s_dropped = 0;
+   }
+
+   if ( ! write( id, payload, len ) )
+   {
+      s_dropped = 1;
+      return false;
+   }
+   return true;
+}
+
+//============================================================================
+// Send buffered bytes.
+//
+// Call this once per loop().  Only sends what the output can take
+// without blocking (availableForWrite()) so the output must support
+// that (HardwareSerial does).
+//
+//= INPUTS
+//- out      Where to send the bytes (e.g. Serial).
+//- budget   Max number of bytes to send.
+//
+//= RETURNS
+//- Returns the number of bytes sent.
+//
+size_t
+Telemetry::
+drain( Print& out,
+       uint8_t budget )
+{
+   int room = out.availableForWrite();
+   uint8_t num = min( (int)min( budget, s_size ), room );
+
+   for ( uint8_t i = 0; i < num; ++i )
+   {
+      out.write( s_buffer[s_head] );
+      s_head = s_head + 1 < TELEMETRY_BUFFER_SIZE ? s_head + 1 : 0;
+   }
+   s_size -= num;
+   return num;
+}
+
+//============================================================================
+// Throw away everything in the buffer.
+//
+void
+Telemetry::
+clear()
+{
+   s_head = 0;
+   s_size = 0;
+   s_dropped = 0;
+}
+
+//============================================================================
+// Add a whole record to the buffer if there is room.
+//
+bool
+Telemetry::
+write( uint8_t id,
+       const void* payload,
+       uint8_t len )
+{
+   if ( TELEMETRY_HEADER_SIZE + len > available() )
+   {
+      return false;
+   }
+
+   uint32_t time_us = micros();
+   uint8_t header[3] = { TELEMETRY_SYNC, id, len };
+   put( header, sizeof( header ) );
+   put( &time_us, sizeof( time_us ) );
+   put( payload, len );
+   return true;
+}
+
+//============================================================================
+// Copy bytes into the buffer (wrapping at the end).
+//
+void
+Telemetry::
+put( const void* data,
+     uint8_t len )
+{
+   const uint8_t* bytes = (const uint8_t*)data;
+   uint16_t tail = s_head + s_size;
+   for ( uint8_t i = 0; i < len; ++i, ++tail )
+   {
+      s_buffer[tail < TELEMETRY_BUFFER_SIZE ? tail :
+                                              tail - TELEMETRY_BUFFER_SIZE] =
+         bytes[i];
+   }
+   s_size += len;
+}
+
+//============================================================================
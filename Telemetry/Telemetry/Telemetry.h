@@ -0,0 +1,148 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Deferred binary telemetry logger.
+//
+// Printing text to Serial blocks loop() once the serial transmit
+// buffer is full.  At 19200 baud that's ~0.5 ms per character so a
+// few lines of debug output can stall the loop for tens of ms and
+// change the timing being measured.  Instead, log() copies a small
+// binary record into a ring buffer (a few us) and drain() writes the
+// buffer out later, only as many bytes as the output can take without
+// blocking and no more than a per loop budget.
+//
+// Records are:
+//
+//    0xA5  id  len  time (4 bytes)  payload (len bytes)
+//
+// where time is micros() when the record was logged and multi-byte
+// values are little endian.  If the buffer is full, the record is
+// dropped and a TELEMETRY_DROPPED record with the number of dropped
+// records is logged once there is room.  Ids below TELEMETRY_USER are
+// used by this library (see the enum below).  Use TELEMETRY_USER and
+// up for sketch records.
+//
+// log() and drain() aren't interrupt safe so don't log from an ISR.
+//
+// tools/telemetry_decode.cpp decodes a captured stream into text or
+// CSV on a normal computer.
+//
+//= Example
+//
+//   void loop()
+//   {
+//      ...
+//      int16_t level = analogRead( A0 );
+//      Telemetry::log( TELEMETRY_USER, &level, sizeof( level ) );
+//
+//      // Send at most 16 bytes per loop.
+//      Telemetry::drain( Serial, 16 );
+//   }
+//
+#ifndef TELEMETRY_BUFFER_SIZE
+#define TELEMETRY_BUFFER_SIZE 128
+#endif
+#if TELEMETRY_BUFFER_SIZE > 255
+#error TELEMETRY_BUFFER_SIZE must be 255 or less
+#endif
+
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_HEADER_SIZE 7
+
+// Record ids.
+enum TelemetryId {
+   TELEMETRY_DROPPED = 0,        // uint16 number of dropped records
+   TELEMETRY_LOOPFREQ = 1,       // LoopFreq report (see LoopFreq.cpp)
+   TELEMETRY_LOOPFREQ_HIST = 2,  // LoopFreq histogram report
+   TELEMETRY_DIGITALINPUT = 3,   // DIGITALINPUT_DBG message id, value
+   TELEMETRY_USER = 32,          // first id for sketch records
+};
+
+class Telemetry
+{
+public:
+   static bool log( uint8_t id, const void* payload, uint8_t len );
+   static bool log( uint8_t id, int32_t value );
+   static size_t drain( Print& out, uint8_t budget );
+
+   static uint8_t used();
+   static uint8_t available();
+   static uint16_t dropped();
+   static void clear();
+
+private:
+   static uint8_t s_buffer[TELEMETRY_BUFFER_SIZE];
+
+   // Index of the first byte to send and the number of bytes stored.
+   static uint8_t s_head;
+   static uint8_t s_size;
+
+   // Number of records dropped since the last TELEMETRY_DROPPED record.
+   static uint16_t s_dropped;
+
+   static void put( const void* data, uint8_t len );
+   static bool write( uint8_t id, const void* payload, uint8_t len );
+};
+
+//============================================================================
+// Return the number of bytes waiting to be sent.
+//
+inline
+uint8_t
+Telemetry::
+used()
+{
+   return s_size;
+}
+
+//============================================================================
+// Return the number of free bytes in the buffer.
+//
+inline
+uint8_t
+Telemetry::
+available()
+{
+   return TELEMETRY_BUFFER_SIZE - s_size;
+}
+
+//============================================================================
+// Return the number of records dropped that haven't been reported yet.
+//
+inline
+uint16_t
+Telemetry::
+dropped()
+{
+   return s_dropped;
+}
+
+//============================================================================
+// Log an integer value.
+//
+// The payload is the 4 byte value.
+//
+inline
+bool
+Telemetry::
+log( uint8_t id,
+     int32_t value )
+{
+   return log( id, &value, sizeof( value ) );
+}
+
+//============================================================================
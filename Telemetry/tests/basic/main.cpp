@@ -0,0 +1,122 @@
+#include "HostSim.h"
+#include "Telemetry.h"
+#include <iostream>
+#include <vector>
+
+// Telemetry test.  Checks the record format, that drain() stays
+// within the budget and the room in the output, and that records that
+// don't fit are reported with a TELEMETRY_DROPPED record.
+//
+// Compile and run:
+// g++ -I../../Telemetry -I../../../HostSim -o test main.cpp ../../Telemetry/Telemetry.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+// Output that saves the bytes and only has room for 'room' bytes per
+// drain() (like a serial buffer that empties between loops).
+class Capture : public Print
+{
+public:
+   std::vector<uint8_t> bytes;
+   int room = 64;
+
+   size_t write( uint8_t c )
+   {
+      bytes.push_back( c );
+      return 1;
+   }
+   int availableForWrite()
+   {
+      return room;
+   }
+};
+
+static bool
+check( bool ok,
+       const char* msg,
+       uint32_t value )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << ": " << value << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   HostSim::reset();
+   Telemetry::clear();
+   bool ok = true;
+
+   // Record format.
+   HostSim::advance( 0x01020304 );
+   uint8_t payload[3] = { 7, 8, 9 };
+   ok &= check( Telemetry::log( TELEMETRY_USER, payload, 3 ), "log", 0 );
+   ok &= check( Telemetry::used() == 10, "used", Telemetry::used() );
+
+   Capture out;
+   ok &= check( Telemetry::drain( out, 64 ) == 10, "drain", out.bytes.size() );
+   const uint8_t expect[] = { 0xA5, TELEMETRY_USER, 3, 4, 3, 2, 1, 7, 8, 9 };
+   ok &= check( out.bytes.size() == sizeof( expect ) &&
+                memcmp( &out.bytes[0], expect, sizeof( expect ) ) == 0,
+                "record bytes", out.bytes.size() );
+   ok &= check( Telemetry::used() == 0, "empty", Telemetry::used() );
+
+   // Budget and room in the output.  4 records of 11 bytes.
+   out.bytes.clear();
+   for ( int32_t i = 0; i < 4; ++i )
+   {
+      Telemetry::log( TELEMETRY_USER + 1, i );
+   }
+   ok &= check( Telemetry::used() == 44, "used 4", Telemetry::used() );
+   ok &= check( Telemetry::drain( out, 16 ) == 16, "budget", 16 );
+   out.room = 5;
+   ok &= check( Telemetry::drain( out, 16 ) == 5, "room", out.bytes.size() );
+   out.room = 0;
+   ok &= check( Telemetry::drain( out, 16 ) == 0, "no room", 0 );
+   out.room = 64;
+   while ( Telemetry::drain( out, 16 ) )
+   {
+   }
+   ok &= check( out.bytes.size() == 44, "drained", out.bytes.size() );
+   ok &= check( out.bytes[33] == 0xA5 && out.bytes[40] == 3,
+                "last record", out.bytes[40] );
+
+   // Overflow.  Fill the buffer (wrapping past the end) then drop 5
+   // records.  Once there is room, the next log() sends the drop
+   // count first.
+   out.bytes.clear();
+   int numLogged = 0;
+   while ( Telemetry::log( TELEMETRY_USER, numLogged ) )
+   {
+      ++numLogged;
+   }
+   for ( int i = 0; i < 4; ++i )
+   {
+      Telemetry::log( TELEMETRY_USER, i );
+   }
+   ok &= check( numLogged == TELEMETRY_BUFFER_SIZE / 11, "fill", numLogged );
+   ok &= check( Telemetry::dropped() == 5, "dropped", Telemetry::dropped() );
+
+   while ( Telemetry::drain( out, 16 ) )
+   {
+   }
+   ok &= check( Telemetry::log( TELEMETRY_USER, 99 ), "log after", 0 );
+   ok &= check( Telemetry::dropped() == 0, "reported", Telemetry::dropped() );
+   Telemetry::drain( out, 64 );
+
+   size_t drop = numLogged * 11;
+   ok &= check( out.bytes.size() == drop + 9 + 11, "size", out.bytes.size() );
+   ok &= check( out.bytes[drop + 1] == TELEMETRY_DROPPED &&
+                out.bytes[drop + 2] == 2 && out.bytes[drop + 7] == 5 &&
+                out.bytes[drop + 8] == 0, "drop record", out.bytes[drop + 7] );
+   ok &= check( out.bytes[drop + 9 + 7] == 99, "next record",
+                out.bytes[drop + 9 + 7] );
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
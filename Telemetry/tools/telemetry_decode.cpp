@@ -0,0 +1,231 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Decode a Telemetry stream into text or CSV.
+//
+// Build and run on a normal computer:
+// g++ -o telemetry_decode telemetry_decode.cpp
+// ./telemetry_decode [-csv] [file]
+//
+// Reads the raw bytes captured from the serial port (e.g. with
+// "cat /dev/ttyUSB0 > log.bin") from the file or stdin.  Bytes before
+// the first 0xA5 sync byte or in a broken record are skipped so a
+// capture can start in the middle of the stream.  Known record ids
+// are decoded and other records print the payload bytes in hex.
+//
+// Text output is one line per record:
+//
+//    12.345678 LOOPFREQ calls=1000 elapsed_ms=503
+//
+// CSV output has the columns: time_us,id,name,values
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const uint8_t SYNC = 0xA5;
+static const int HEADER_SIZE = 7;
+
+static bool s_csv = false;
+
+//============================================================================
+// Read little endian values from the payload.
+//
+static uint32_t
+get( const uint8_t* p,
+     int size )
+{
+   uint32_t value = 0;
+   for ( int i = size - 1; i >= 0; --i )
+   {
+      value = ( value << 8 ) | p[i];
+   }
+   return value;
+}
+
+//============================================================================
+// Return the name for a record id.
+//
+static const char*
+idName( uint8_t id )
+{
+   switch ( id )
+   {
+   case 0: return "DROPPED";
+   case 1: return "LOOPFREQ";
+   case 2: return "LOOPFREQ_HIST";
+   case 3: return "DIGITALINPUT";
+   }
+   return id >= 32 ? "USER" : "UNKNOWN";
+}
+
+//============================================================================
+// Write the decoded values for a record.
+//
+// Fields are written as name=value separated by spaces (text) or ';'
+// (CSV).  Unknown records or payloads with the wrong size are written
+// as hex.
+//
+static void
+printValues( uint8_t id,
+             const uint8_t* p,
+             int len )
+{
+   const char* sep = s_csv ? ";" : " ";
+
+   if ( id == 0 && len == 2 )
+   {
+      printf( "count=%u", get( p, 2 ) );
+   }
+   else if ( id == 1 && len == 6 )
+   {
+      printf( "calls=%u%selapsed_ms=%u", get( p, 2 ), sep, get( p + 2, 4 ) );
+   }
+   else if ( id == 2 && len == 28 )
+   {
+      printf( "count=%u%sover=%u%smin_us=%u%smax_us=%u%sp50_us=%u%s"
+              "p99_us=%u%sp999_us=%u%sdeadline_us=%u",
+              get( p, 2 ), sep, get( p + 2, 2 ), sep, get( p + 4, 4 ), sep,
+              get( p + 8, 4 ), sep, get( p + 12, 4 ), sep, get( p + 16, 4 ),
+              sep, get( p + 20, 4 ), sep, get( p + 24, 4 ) );
+   }
+   else if ( id == 3 && len == 3 )
+   {
+      static const char* msgs[] = { "init pin", "init shift", "change" };
+      uint8_t msg = p[0];
+      if ( msg < sizeof( msgs ) / sizeof( msgs[0] ) )
+      {
+         printf( "msg=%s", msgs[msg] );
+      }
+      else
+      {
+         printf( "msg=%u", msg );
+      }
+      printf( "%svalue=%u", sep, get( p + 1, 2 ) );
+   }
+   else
+   {
+      printf( "data=" );
+      for ( int i = 0; i < len; ++i )
+      {
+         printf( "%02x", p[i] );
+      }
+   }
+}
+
+//============================================================================
+int
+main( int argc,
+      char** argv )
+{
+   const char* path = NULL;
+   for ( int i = 1; i < argc; ++i )
+   {
+      if ( strcmp( argv[i], "-csv" ) == 0 )
+      {
+         s_csv = true;
+      }
+      else if ( argv[i][0] == '-' && argv[i][1] )
+      {
+         fprintf( stderr, "Usage: %s [-csv] [file]\n", argv[0] );
+         return 1;
+      }
+      else
+      {
+         path = argv[i];
+      }
+   }
+
+   FILE* fp = stdin;
+   if ( path && strcmp( path, "-" ) != 0 )
+   {
+      fp = fopen( path, "rb" );
+      if ( ! fp )
+      {
+         perror( path );
+         return 1;
+      }
+   }
+
+   std::vector<uint8_t> data;
+   uint8_t buf[4096];
+   size_t n;
+   while ( ( n = fread( buf, 1, sizeof( buf ), fp ) ) > 0 )
+   {
+      data.insert( data.end(), buf, buf + n );
+   }
+   if ( fp != stdin )
+   {
+      fclose( fp );
+   }
+
+   if ( s_csv )
+   {
+      printf( "time_us,id,name,values\n" );
+   }
+
+   size_t skipped = 0;
+   size_t i = 0;
+   while ( i < data.size() )
+   {
+      // Resync on the next sync byte.  A record must fit in the data
+      // and be followed by another sync byte (or the end of the data)
+      // or the sync byte was part of a payload.
+      if ( data[i] != SYNC || i + HEADER_SIZE > data.size() )
+      {
+         ++i;
+         ++skipped;
+         continue;
+      }
+      size_t end = i + HEADER_SIZE + data[i + 2];
+      if ( end > data.size() || ( end < data.size() && data[end] != SYNC ) )
+      {
+         ++i;
+         ++skipped;
+         continue;
+      }
+
+      uint8_t id = data[i + 1];
+      uint32_t time_us = get( &data[i + 3], 4 );
+      const uint8_t* payload = &data[i + HEADER_SIZE];
+      int len = data[i + 2];
+
+      if ( s_csv )
+      {
+         printf( "%u,%u,%s,", time_us, id, idName( id ) );
+      }
+      else
+      {
+         printf( "%u.%06u %s", time_us / 1000000, time_us % 1000000,
+                 idName( id ) );
+         if ( id >= 32 )
+         {
+            printf( "+%u", id - 32 );
+         }
+         printf( " " );
+      }
+      printValues( id, payload, len );
+      printf( "\n" );
+
+      i = end;
+   }
+
+   if ( skipped )
+   {
+      fprintf( stderr, "Skipped %zu bytes\n", skipped );
+   }
+   return 0;
+}
@@ -0,0 +1,260 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Time stamp storage for the Timer and Valve compact modes.
+//
+// The library classes keep times as 32 bit millis.  With a lot of
+// objects on a 2 KB board, that's a big part of the RAM.  CompactTime
+// keeps them as 16 bit counts of ticks instead.  A tick is 2^SHIFT
+// millis so longer times fit at a coarser resolution.  FullTime has
+// the same interface and keeps the 32 bit millis so a class can pick
+// one with a typedef and use the same code either way.
+//
+// Times in and out are still long millis - only the storage changes.
+// A Stamp is a point in time.  Reading it expands the 16 bit tick
+// relative to the current time so it has to be within MAX_TICKS of
+// the current time (either way) - the tick counter wraps every
+// 2^( 16 + SHIFT ) millis.  refresh() keeps an old stamp from
+// wrapping by pulling it forward to MAX_TICKS ago.  That's fine for
+// any stamp that's only compared against a Duration since a Duration
+// is at most MAX_TICKS.  A Duration is rounded up to whole ticks and a
+// Stamp down so a time out never ends more than a tick early.  Longer
+// durations don't fit and are clamped so the classes check fits()
+// first and report times that are too long instead of running them
+// short.
+//
+// The owning class has to look at its stamps at least every MAX_WAIT
+// millis.  Classes use MAX_WAIT as the "nothing due" deadline so the
+// Scheduler does that.
+//
+//= Example
+//
+//   SHIFT 0: 1 ms ticks, times up to 16.3 seconds.
+//   SHIFT 2: 4 ms ticks, times up to 65.5 seconds.
+//   SHIFT 4: 16 ms ticks, times up to 4.3 minutes.
+//
+template< uint8_t SHIFT >
+struct CompactTime
+{
+   // Longest duration and the furthest a stamp can be from the
+   // current time.
+   static const uint16_t MAX_TICKS = 0x3FFF;
+   static const long MAX_WAIT = (long)MAX_TICKS << SHIFT;
+
+   static uint16_t tick( long millis );
+   static bool fits( long millis );
+
+   class Duration
+   {
+   public:
+      operator long() const;
+      Duration& operator=( long millis );
+
+   private:
+      uint16_t m_ticks;
+   };
+
+   class Stamp
+   {
+   public:
+      long get( long currentMillis ) const;
+      void set( long millis );
+      void refresh( long currentMillis );
+
+   private:
+      uint16_t m_tick;
+   };
+};
+
+//============================================================================
+// 32 bit millis with the same interface as CompactTime.
+//
+struct FullTime
+{
+   static const long MAX_WAIT = 0x3FFFFFFF;
+
+   static bool fits( long millis );
+
+   typedef long Duration;
+
+   class Stamp
+   {
+   public:
+      long get( long currentMillis ) const;
+      void set( long millis );
+      void refresh( long currentMillis );
+
+   private:
+      long m_millis;
+   };
+};
+
+//============================================================================
+// Return the 16 bit tick count at a time.
+//
+// Shifts the unsigned value so the count doesn't jump when millis()
+// rolls over.
+//
+template< uint8_t SHIFT >
+inline
+uint16_t
+CompactTime< SHIFT >::
+tick( long millis )
+{
+   return (uint16_t)( (unsigned long)millis >> SHIFT );
+}
+
+//============================================================================
+// Return true if a duration can be stored without clamping.
+//
+//= INPUTS
+//- millis   The duration in millis.
+//
+template< uint8_t SHIFT >
+inline
+bool
+CompactTime< SHIFT >::
+fits( long millis )
+{
+   return millis <= MAX_WAIT;
+}
+
+//============================================================================
+// Return the duration in millis.
+//
+template< uint8_t SHIFT >
+inline
+CompactTime< SHIFT >::Duration::
+operator long() const
+{
+   return (long)m_ticks << SHIFT;
+}
+
+//============================================================================
+// Set the duration.
+//
+// Rounds up to whole ticks and clamps to 0 to MAX_TICKS.
+//
+//= INPUTS
+//- millis   The duration in millis.
+//
+template< uint8_t SHIFT >
+inline
+typename CompactTime< SHIFT >::Duration&
+CompactTime< SHIFT >::Duration::
+operator=( long millis )
+{
+   long ticks = ( millis + ( 1L << SHIFT ) - 1 ) >> SHIFT;
+   m_ticks = ticks < 0 ? 0 : ticks > MAX_TICKS ? MAX_TICKS : ticks;
+   return *this;
+}
+
+//============================================================================
+// Return the stamp in millis.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+template< uint8_t SHIFT >
+inline
+long
+CompactTime< SHIFT >::Stamp::
+get( long currentMillis ) const
+{
+   int16_t delta = (int16_t)( m_tick - tick( currentMillis ) );
+   return (long)( ( ( (unsigned long)currentMillis >> SHIFT ) + delta )
+                  << SHIFT );
+}
+
+//============================================================================
+// Set the stamp.
+//
+//= INPUTS
+//- millis   The time in millis.  Must be within MAX_TICKS of the
+//           current time.
+//
+template< uint8_t SHIFT >
+inline
+void
+CompactTime< SHIFT >::Stamp::
+set( long millis )
+{
+   m_tick = tick( millis );
+}
+
+//============================================================================
+// Keep a stamp in the past from wrapping.
+//
+// If the stamp is more than MAX_TICKS ago, it's moved up to MAX_TICKS
+// ago.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+template< uint8_t SHIFT >
+inline
+void
+CompactTime< SHIFT >::Stamp::
+refresh( long currentMillis )
+{
+   uint16_t now = tick( currentMillis );
+   if ( (int16_t)( now - m_tick ) > (int16_t)MAX_TICKS )
+   {
+      m_tick = now - MAX_TICKS;
+   }
+}
+
+//============================================================================
+// Any duration fits in 32 bits.
+//
+inline
+bool
+FullTime::
+fits( long )
+{
+   return true;
+}
+
+//============================================================================
+inline
+long
+FullTime::Stamp::
+get( long ) const
+{
+   return m_millis;
+}
+
+//============================================================================
+inline
+void
+FullTime::Stamp::
+set( long millis )
+{
+   m_millis = millis;
+}
+
+//============================================================================
+// Nothing to do - 32 bit stamps don't wrap for 24 days.
+//
+inline
+void
+FullTime::Stamp::
+refresh( long )
+{
+}
+
+//============================================================================
@@ -34,31 +34,19 @@ Timer::
 poll( long currentMillis,
       TimerCb callback )
 {
-   // If there are remaining firings and enough time has passed, fire
-   // the timer.
-   if ( m_count != 0 && ( currentMillis - m_nextTime ) >= 0 )
+   PROFILE_SCOPE( "Timer::poll" );
+
+   if ( ! due( currentMillis ) )
    {
-      m_nextTime = millis() + m_duration;
-      if ( callback )
-      {
-         callback( m_identifier );
-      }
+      return 0;
+   }
 
-      // Only reduce the count if it's not infinity (-1).
-      if ( m_count > 0 )
-      {
-         // Return count and then decrement.  Otherwise we'd return 0
-         // on the last firing which would indicate nothing happened.
-         return m_count--;
-      }
-      // Infinite timer.
-      else
-      {
-         return -1;
-      }
+   if ( callback )
+   {
+      callback( m_identifier );
    }
 
-   return 0;
+   return fired();
 }
 
 //============================================================================
@@ -14,6 +14,8 @@
 // this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 #include "Arduino.h"
+#include "CompactTime.h"
+#include "Profile.h"
 
 // Elapsed time trigger class.
 //
@@ -23,13 +25,25 @@
 // timer should fire.  poll() returns true if enough time has passed
 // and can call an arbitrary function when that occurs.
 //
+// Define TIMER_COMPACT to store the duration and next firing as 16
+// bit ticks (see CompactTime.h).  That cuts a Timer (and so each
+// DigitalOutput) from 10 to 6 bytes on AVR.  A tick is
+// 2^TIMER_TICK_SHIFT millis (default 1 ms) and durations are limited
+// to 0x3FFF ticks (16.3 seconds with 1 ms ticks).  once() and repeat()
+// return false and leave the timer off for longer times.  poll() must
+// be called at least that often while the timer is on.
+//
+#if defined( TIMER_COMPACT ) && ! defined( TIMER_TICK_SHIFT )
+#   define TIMER_TICK_SHIFT 0
+#endif
+
 class Timer
 {
 public:
    Timer( int8_t identifier=0 );
 
-   void once( long timeMillis );
-   void repeat( long timeMillis, int8_t count=-1 );
+   bool once( long timeMillis );
+   bool repeat( long timeMillis, int8_t count=-1 );
    void off();
 
    int8_t remaining();
@@ -42,8 +56,20 @@ public:
    // overs for duration computations.  For details, see:
    // http://playground.arduino.cc/Code/TimingRollover
    int8_t poll( long currentMillis, TimerCb callback=NULL );
+   long deadline( long currentMillis );
+
+   // Same as poll() with the handler bound at compile time - a
+   // function or a member function of an object.  The compiler can
+   // inline the poll and the handler together.
+   template< TimerCb CB >
+   int8_t poll( long currentMillis );
+   template< typename T, void (T::*HANDLER)( int8_t ) >
+   int8_t poll( long currentMillis, T& object );
 
 private:
+   bool due( long currentMillis );
+   int8_t fired();
+
    // Arbitrary identifier passed to the callback function.  
    int8_t m_identifier;
 
@@ -52,11 +78,17 @@ private:
    // infinitely.
    int8_t m_count;
 
+#if defined( TIMER_COMPACT )
+   typedef CompactTime< TIMER_TICK_SHIFT > Time;
+#else
+   typedef FullTime Time;
+#endif
+
    // Duration between timer firings in millis.
-   long m_duration;
+   Time::Duration m_duration;
 
    // Time in millis of the next timer firing.
-   long m_nextTime;
+   Time::Stamp m_nextTime;
 };
 
 //============================================================================
@@ -85,16 +117,27 @@ Timer( int8_t identifier )
 //- timeMillis   Duration from now at which to signal the timer.
 //- count        Number of times to signal.  <0 for infinite.
 //
+//= RETURNS
+//- Returns false if the time is too long for TIMER_COMPACT.  The timer
+//  is turned off.
+//
 inline
-void
+bool
 Timer::
 repeat( long timeMillis,
         int8_t count )
 {
+   if ( ! Time::fits( timeMillis ) )
+   {
+      m_count = 0;
+      return false;
+   }
+
    // Constrain the count to -1 for infinite timers.
    m_count = count < 0 ? -1 : count;
    m_duration = timeMillis;
-   m_nextTime = millis() + m_duration;
+   m_nextTime.set( millis() + m_duration );
+   return true;
 }   
 
 
@@ -107,12 +150,16 @@ repeat( long timeMillis,
 //
 //- timeMillis   Duration from now at which to signal the timer.
 //
+//= RETURNS
+//- Returns false if the time is too long for TIMER_COMPACT.  The timer
+//  is turned off.
+//
 inline
-void
+bool
 Timer::
 once( long timeMillis )
 {
-   repeat( timeMillis, 1 );
+   return repeat( timeMillis, 1 );
 }   
 
 //============================================================================
@@ -126,6 +173,134 @@ off()
    m_count = 0;
 }
 
+//============================================================================
+// Return the time poll() next has something to do.
+//
+// That's the next firing if the timer is on.  Code that sleeps (or a
+// simulation that skips ahead) can wait until then.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the time in millis of the next firing.
+//
+inline
+long
+Timer::
+deadline( long currentMillis )
+{
+   // Nothing due - check back well before the times could wrap.
+   return m_count ? m_nextTime.get( currentMillis ) :
+      currentMillis + Time::MAX_WAIT;
+}
+
+//============================================================================
+// Poll the timer and run a handler function bound at compile time.
+//
+// Same as poll() with a callback.  Use it like:
+//
+//   g_timer.poll< timerCb >( t );
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the same value as poll().
+//
+template< Timer::TimerCb CB >
+inline
+int8_t
+Timer::
+poll( long currentMillis )
+{
+   PROFILE_SCOPE( "Timer::poll" );
+
+   if ( ! due( currentMillis ) )
+   {
+      return 0;
+   }
+
+   CB( m_identifier );
+   return fired();
+}
+
+//============================================================================
+// Poll the timer and run a member function bound at compile time.
+//
+// Same as poll() with a callback.  Use it like:
+//
+//   g_timer.poll< Board, &Board::report >( t, g_board );
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- object          The object to run the member function on.
+//
+//= RETURNS
+//- Returns the same value as poll().
+//
+template< typename T, void (T::*HANDLER)( int8_t ) >
+inline
+int8_t
+Timer::
+poll( long currentMillis,
+      T& object )
+{
+   PROFILE_SCOPE( "Timer::poll" );
+
+   if ( ! due( currentMillis ) )
+   {
+      return 0;
+   }
+
+   ( object.*HANDLER )( m_identifier );
+   return fired();
+}
+
+//============================================================================
+// Check if the timer should fire.
+//
+// If there are remaining firings and enough time has passed, this
+// schedules the next firing and returns true.  The caller then runs
+// the callback and calls fired().
+//
+inline
+bool
+Timer::
+due( long currentMillis )
+{
+   if ( m_count != 0 &&
+        ( currentMillis - m_nextTime.get( currentMillis ) ) >= 0 )
+   {
+      m_nextTime.set( currentMillis + m_duration );
+      return true;
+   }
+
+   return false;
+}
+
+//============================================================================
+// Count a firing.
+//
+// Returns the poll() return value for the firing.
+//
+inline
+int8_t
+Timer::
+fired()
+{
+   // Only reduce the count if it's not infinity (-1).
+   if ( m_count > 0 )
+   {
+      // Return count and then decrement.  Otherwise we'd return 0 on
+      // the last firing which would indicate nothing happened.
+      return m_count--;
+   }
+
+   // Infinite timer.
+   return -1;
+}
+
 //============================================================================
 // Number of times the timer will fire before stopping.
 //
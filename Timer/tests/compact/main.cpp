@@ -0,0 +1,305 @@
+#include "HostSim.h"
+#include "CompactTime.h"
+#include "DigitalInput.h"
+#include "DigitalOutput.h"
+#include "Timer.h"
+#include "Valve.h"
+#include <iostream>
+
+// Compact time stamp test.
+//
+// Built with DIGITALINPUT_COMPACT, TIMER_COMPACT, and VALVE_COMPACT.
+// Checks the CompactTime stamps and durations at 1 and 4 ms ticks,
+// then runs a timer, an input, and a valve across the 32 bit millis()
+// roll over and several 16 bit tick wraps:
+//
+// - A repeating timer fires exactly on time and times that don't fit
+//   are rejected.
+// - Short and long presses (including one longer than the 16 bit
+//   range) are reported correctly.
+// - A valve that sat idle for 3 minutes moves right away, waits for
+//   the cycle time out between moves, and stalls on the power on time
+//   out.
+//
+// Prints the size of each class (host sizes - see the README for AVR).
+//
+// Compile and run:
+// g++ -O2 -DDIGITALINPUT_COMPACT -DTIMER_COMPACT -DVALVE_COMPACT -I../../Timer -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Valve/Valve -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../Timer/Timer.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Valve/Valve/Valve.cpp ../../../Valve/Valve/ValveStats.cpp ../../../Valve/Valve/ValveStore.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static_assert( sizeof( CompactTime< 0 >::Stamp ) == 2, "16 bit stamp" );
+static_assert( sizeof( CompactTime< 2 >::Duration ) == 2, "16 bit duration" );
+static_assert( sizeof( Timer ) == 6, "Timer is 6 bytes" );
+
+static const uint8_t INPUT_PIN = 2;
+static const uint8_t OPEN_PIN = 16;
+static const uint8_t CLOSE_PIN = 17;
+static const uint8_t OPENED_PIN = 18;
+static const uint8_t CLOSED_PIN = 19;
+
+// Start 30 seconds before millis() rolls over.
+static const uint64_t START_US = ( 0x7FFFFFFFULL - 30000 ) * 1000;
+
+static bool s_ok = true;
+
+static void
+check( bool ok,
+       const char* msg )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED: " << msg << std::endl;
+      s_ok = false;
+   }
+}
+
+//============================================================================
+template< uint8_t SHIFT >
+static void
+checkCompactTime()
+{
+   typedef CompactTime< SHIFT > Time;
+   const long tick = 1L << SHIFT;
+
+   // Round trip stamps around the current time across the roll over.
+   for ( long i = 0; i < 200; ++i )
+   {
+      long now = (int32_t)( 0x7FFFFFFFUL - 100000 + i * 997 );
+      for ( long d = -Time::MAX_WAIT; d <= Time::MAX_WAIT; d += 61 )
+      {
+         typename Time::Stamp stamp;
+         stamp.set( now + d );
+         long error = stamp.get( now ) - ( now + d );
+         if ( error > 0 || error <= -tick )
+         {
+            check( false, "stamp round trip" );
+            return;
+         }
+      }
+   }
+
+   // An old stamp is pulled forward to MAX_WAIT ago.
+   long now = 0x7FFFFFFFL - 10;
+   typename Time::Stamp stamp;
+   stamp.set( now );
+   now += 2 * Time::MAX_WAIT;
+   stamp.refresh( now );
+   long age = now - stamp.get( now ) - Time::MAX_WAIT;
+   check( age >= 0 && age < tick, "stamp refresh" );
+
+   // Durations round up to ticks and clamp.
+   typename Time::Duration duration;
+   duration = 1;
+   check( duration == tick, "duration round up" );
+   duration = 0x7FFFFFFF;
+   check( duration == Time::MAX_WAIT, "duration max" );
+   duration = -5;
+   check( duration == 0, "duration min" );
+   check( Time::fits( Time::MAX_WAIT ) && ! Time::fits( Time::MAX_WAIT + 1 ),
+          "duration fits" );
+}
+
+//============================================================================
+static void
+checkTimer()
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::advanceTo( START_US );
+
+   Timer timer;
+   timer.repeat( 1000 );
+   long last = millis();
+   int fired = 0;
+   for ( int i = 0; i < 200000; ++i )
+   {
+      HostSim::advance( 1000 );
+      long t = millis();
+      if ( timer.poll( t ) )
+      {
+         check( t - last == 1000, "timer period" );
+         last = t;
+         fired++;
+      }
+   }
+   check( fired == 200, "timer count" );
+
+   // Times past the 16.3 second limit are rejected rather than run
+   // short.  An output pulse that's too long isn't started either.
+   check( ! timer.repeat( 60000 ) && timer.remaining() == 0,
+          "timer too long" );
+   check( timer.once( 16000 ) && timer.remaining() == 1, "timer fits" );
+
+   DigitalOutput output;
+   output.init( OPEN_PIN );
+   check( ! output.on( 60000 ) && ! output.isOn(), "output too long" );
+   check( output.on( 1000 ) && output.isOn(), "output fits" );
+}
+
+//============================================================================
+// Hold the input for each time and return the poll() result on
+// release.
+//
+static DigitalInput::Status
+press( DigitalInput& input,
+       long holdMillis )
+{
+   DigitalInput::Status result = DigitalInput::NONE;
+   HostSim::setPin( INPUT_PIN, LOW );
+   for ( long i = 0; i < holdMillis + 1000; ++i )
+   {
+      if ( i == holdMillis )
+      {
+         HostSim::setPin( INPUT_PIN, HIGH );
+      }
+      HostSim::advance( 1000 );
+      DigitalInput::Status status = input.poll( millis() );
+      if ( status < 0 )
+      {
+         result = status;
+      }
+   }
+   return result;
+}
+
+static void
+checkInput()
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::setPin( INPUT_PIN, HIGH );
+   HostSim::advanceTo( START_US );
+
+   DigitalInput input;
+   input.init( INPUT_PIN, LOW );
+   check( press( input, 500 ) == DigitalInput::OPENED, "short press" );
+   check( press( input, 3000 ) == DigitalInput::OPENED_LONG, "long press" );
+   check( press( input, 40000 ) == DigitalInput::OPENED_LONG,
+          "40 second press" );
+   check( press( input, 100 ) == DigitalInput::OPENED, "short press again" );
+}
+
+//============================================================================
+// Valve takes 2 seconds to move unless it's jammed.
+//
+static bool s_jammed = false;
+static uintptr_t s_move = 0;
+
+static void
+valveArrived( void* move )
+{
+   if ( (uintptr_t)move != s_move )
+   {
+      return;
+   }
+   bool open = HostSim::pin( OPEN_PIN ) && ! HostSim::pin( CLOSE_PIN );
+   HostSim::setPin( open ? OPENED_PIN : CLOSED_PIN, LOW );
+}
+
+static void
+motorWrite( uint8_t,
+            uint8_t,
+            void* )
+{
+   bool open = HostSim::pin( OPEN_PIN );
+   bool close = HostSim::pin( CLOSE_PIN );
+   s_move++;
+   if ( open != close && ! s_jammed )
+   {
+      HostSim::setPin( open ? CLOSED_PIN : OPENED_PIN, HIGH );
+      HostSim::at( HostSim::time_us() + 2000000, valveArrived,
+                   (void*)s_move );
+   }
+}
+
+// Poll until the valve status is one of the inputs.  Returns the
+// millis it took.
+static long
+waitFor( Valve& valve,
+         Valve::Status status )
+{
+   long start = millis();
+   for ( long i = 0; i < 60000; ++i )
+   {
+      HostSim::advance( 1000 );
+      valve.poll( millis() );
+      if ( valve.status() == status )
+      {
+         break;
+      }
+   }
+   return millis() - start;
+}
+
+static void
+checkValve()
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+   HostSim::setPin( OPENED_PIN, LOW );
+   HostSim::setPin( CLOSED_PIN, HIGH );
+   HostSim::onWrite( OPEN_PIN, motorWrite );
+   HostSim::onWrite( CLOSE_PIN, motorWrite );
+   HostSim::advanceTo( START_US );
+
+   // 4 ms ticks allow time outs up to 65 seconds.
+   Valve tooLong;
+   check( tooLong.init( 8, 9, 10, 11, 70000, 5000 ) == Valve::NONE,
+          "valve time out too long" );
+   tooLong.open( true );
+   tooLong.close();
+   tooLong.poll( millis() );
+   check( tooLong.status() == Valve::NONE && HostSim::pin( 8 ) &&
+          HostSim::pin( 9 ), "unconfigured valve stays off" );
+
+   Valve valve;
+   valve.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN, CLOSED_PIN, 10000, 5000 );
+   check( valve.status() == Valve::OPENED, "valve init" );
+
+   // Close right away.
+   valve.close();
+   check( waitFor( valve, Valve::CLOSING ) <= 4, "valve close starts" );
+   long travel = waitFor( valve, Valve::CLOSED );
+   check( travel >= 2000 && travel < 2030, "valve closed" );
+
+   // Sit idle for 3 minutes (long enough for the 16 bit ticks to look
+   // like the last move was in the future) then open right away.
+   for ( long i = 0; i < 180000; ++i )
+   {
+      HostSim::advance( 1000 );
+      valve.poll( millis() );
+   }
+   valve.open();
+   check( waitFor( valve, Valve::OPENING ) <= 4, "valve open after idle" );
+   check( waitFor( valve, Valve::OPENED ) < 2030, "valve opened" );
+
+   // Jammed - waits for the cycle time out to close then stalls.
+   s_jammed = true;
+   valve.close();
+   long cycle = waitFor( valve, Valve::CLOSING );
+   check( cycle >= 4990 && cycle <= 5010, "valve cycle time out" );
+   long stall = waitFor( valve, Valve::STALLED );
+   check( stall >= 9990 && stall <= 10010, "valve power on time out" );
+}
+
+//============================================================================
+int
+main()
+{
+   checkCompactTime< 0 >();
+   checkCompactTime< 2 >();
+   checkTimer();
+   checkInput();
+   checkValve();
+
+   std::cout << "Host sizes: DigitalInput " << sizeof( DigitalInput )
+             << ", Timer " << sizeof( Timer ) << ", DigitalOutput "
+             << sizeof( DigitalOutput ) << ", Valve " << sizeof( Valve )
+             << std::endl;
+
+   if ( s_ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return s_ok ? 0 : 1;
+}
@@ -14,6 +14,95 @@
 // this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "Valve.h"
 
+//============================================================================
+//
+// State machine
+//
+//============================================================================
+namespace
+{
+   // Events that change the valve state.
+   enum Event {
+      OPEN_SWITCH_ON = 0,    // Open switch became active.
+      OPEN_SWITCH_OFF = 1,   // Open switch became inactive.
+      CLOSE_SWITCH_ON = 2,   // Close switch became active.
+      CLOSE_SWITCH_OFF = 3,  // Close switch became inactive.
+      TIMED_OUT = 4,         // Power on time out or over current.
+      READY = 5,             // Pending command and cycle time out done.
+      NUM_EVENTS = 6
+   };
+
+   // Actions run on a transition.
+   enum Action {
+      NO_ACTION = 0,
+      POWER_OFF = 1,
+      RUN_PENDING = 2,
+   };
+
+   // Status flags.  MOVING statuses check the power on time out and
+   // IDLE statuses can run the pending command.
+   enum Flags {
+      MOVING = 0x01,
+      IDLE = 0x02,
+   };
+
+   // Table entry: the next status in the low 4 bits (NONE to keep the
+   // current status) and the action in the high 4 bits.
+#define STEP( next, action ) (uint8_t)( Valve::next | ( action << 4 ) )
+#define SWITCHES STEP( OPENED, POWER_OFF ), STEP( CLOSING, NO_ACTION ), \
+                 STEP( CLOSED, POWER_OFF ), STEP( OPENING, NO_ACTION )
+
+   // Transitions indexed by the current status (NONE, OPENED,
+   // OPENING, CLOSED, CLOSING, UNKNOWN, STALLED) and the event.  The
+   // limit switches always win no matter what the status is.
+   constexpr uint8_t TRANSITIONS[Valve::STALLED + 1][NUM_EVENTS] PROGMEM = {
+      // Switches  TIMED_OUT                   READY
+      { SWITCHES, STEP( NONE, NO_ACTION ),    STEP( NONE, NO_ACTION ) },
+      { SWITCHES, STEP( NONE, NO_ACTION ),    STEP( NONE, RUN_PENDING ) },
+      { SWITCHES, STEP( STALLED, POWER_OFF ), STEP( NONE, NO_ACTION ) },
+      { SWITCHES, STEP( NONE, NO_ACTION ),    STEP( NONE, RUN_PENDING ) },
+      { SWITCHES, STEP( STALLED, POWER_OFF ), STEP( NONE, NO_ACTION ) },
+      { SWITCHES, STEP( NONE, NO_ACTION ),    STEP( NONE, NO_ACTION ) },
+      { SWITCHES, STEP( NONE, NO_ACTION ),    STEP( NONE, NO_ACTION ) },
+   };
+
+   // Flags indexed by the status.
+   constexpr uint8_t STATE_FLAGS[Valve::STALLED + 1] PROGMEM = {
+      0,       // NONE
+      IDLE,    // OPENED
+      MOVING,  // OPENING
+      IDLE,    // CLOSED
+      MOVING,  // CLOSING
+      0,       // UNKNOWN
+      0,       // STALLED
+   };
+
+#undef SWITCHES
+#undef STEP
+}
+
+//============================================================================
+//
+// Shared ADC
+//
+//============================================================================
+#if defined( VALVE_CURRENT_SENSE ) && defined( __AVR__ ) && \
+    defined( ADCSRA ) && defined( ADSC )
+#define VALVE_ASYNC_ADC
+
+namespace
+{
+   // There is one ADC for all the valves.  The valve that started the
+   // running conversion owns it (NULL if it's free) and is the only
+   // one that reads the result.
+   Valve* s_adcOwner = NULL;
+
+   // Set when a valve wanted the ADC while another one owned it.  The
+   // owner gives it up after its next sample so the valves take turns.
+   bool s_adcWaiting = false;
+}
+#endif
+
 //============================================================================
 // Initialize the valve using pins.
 //
@@ -39,7 +128,8 @@
 //
 //- Returns the current valve status.  Possible values are UNKNOWN,
 //  OPENED, CLOSED).  If the valve is partially open, UNKNOWN is
-//  returned.
+//  returned.  Returns NONE if a time out is too long for VALVE_COMPACT.
+//  The valve is then left unconfigured and won't open or close.
 //
 Valve::Status
 Valve::
@@ -64,10 +154,7 @@ init( uint8_t pinOpen,
                     closedMode == DIGITAL ? DigitalInput::DIGITAL :
                                             DigitalInput::ANALOG );
 
-   m_powerOnTimeOut = powerOnTimeOut;
-   m_dutyCycleTimeOut = dutyCycleTimeOut;
-
-   return initialState();
+   return initialState( powerOnTimeOut, dutyCycleTimeOut );
 }
 
 //============================================================================
@@ -96,7 +183,8 @@ init( uint8_t pinOpen,
 //
 //- Returns the current valve status.  Possible values are UNKNOWN,
 //  OPENED, CLOSED).  If the valve is partially open, UNKNOWN is
-//  returned.
+//  returned.  Returns NONE if a time out is too long for VALVE_COMPACT.
+//  The valve is then left unconfigured and won't open or close.
 //
 Valve::Status
 Valve::
@@ -115,32 +203,75 @@ init( const DigitalOutput& open,
    m_isOpened = isOpened;
    m_isClosed = isClosed;
    
-   m_powerOnTimeOut = powerOnTimeOut;
-   m_dutyCycleTimeOut = dutyCycleTimeOut;
-
-   return initialState();
+   return initialState( powerOnTimeOut, dutyCycleTimeOut );
 }
 
 //============================================================================
 // Configure the initial valve state.
 //
+//= INPUTS
+//- powerOnTimeOut    Power on time out in milliseconds.  See init().
+//- dutyCycleTimeOut  Power cycle time out in milliseconds.  See init().
+//
 //= RETURN VALUE
 //
 //- Returns the current valve status.  Possible values are UNKNOWN,
 //  OPENED, CLOSED).  If the valve is partially open, UNKNOWN is
-//  returned.
+//  returned.  Returns NONE if a time out doesn't fit in a Duration.
 //
 Valve::Status
 Valve::
-initialState()
+initialState( long powerOnTimeOut,
+              long dutyCycleTimeOut )
 {
+   m_powerOnTimeOut = powerOnTimeOut;
+   m_dutyCycleTimeOut = dutyCycleTimeOut;
+
    // Initial state is unknown.  If neither switch is latched, then
    // the valve is in an intermediate state.  Up to the caller to
    // decide what to do about that.
    m_status = UNKNOWN;
+   m_pendingState = NONE;
+#if defined( VALVE_STATS )
+   m_stats = 0;
+#endif
+#if defined( VALVE_ADAPTIVE )
+   m_adaptMargin = 0;
+   m_maxPowerOnTimeOut = m_powerOnTimeOut;
+   m_maxDutyCycleTimeOut = m_dutyCycleTimeOut;
+#endif
+#if defined( VALVE_CURRENT_SENSE )
+   m_sensePin = NO_SENSE;
+   m_overCurrent = false;
+#endif
+#if defined( VALVE_SOFT_START )
+   m_rampMillis = 0;
+   m_rampOutput = 0;
+#endif
+#if defined( VALVE_STORE )
+   m_store = 0;
+#endif
+#if VALVE_QUEUE_SIZE > 0
+   m_queueSize = 0;
+#endif
+#if defined( VALVE_DEADLINE )
+   m_wake = true;
+   m_deadline.set( 0 );
+#endif
+#if FLIGHTRECORDER_ENABLE
+   m_recordedStatus = NONE;
+#endif
 
    // Make sure power is off to the valve.
-   powerOff();
+   powerOff( millis() );
+
+   // A time out that doesn't fit would be cut short.  Stay in NONE,
+   // which refuses all commands, until init() gets valid values.
+   if ( ! Time::fits( powerOnTimeOut ) || ! Time::fits( dutyCycleTimeOut ) )
+   {
+      m_status = NONE;
+      return NONE;
+   }
 
    // Read the open/close pins directly to get the status.  We don't
    // want to wait for the debounce interval here since this is the
@@ -156,7 +287,7 @@ initialState()
 
    // Reset the last cycle time far enough in the past so that the
    // valve can be powered right away on startup.
-   m_lastPowerCycle = millis() - m_dutyCycleTimeOut;
+   m_lastPowerCycle.set( millis() - m_dutyCycleTimeOut );
 
    return m_status;
 }
@@ -186,113 +317,760 @@ poll( long currentMillis,
       StateChangeCb callback,
       int8_t identifier )
 {
+   PROFILE_SCOPE( "Valve::poll" );
+
+   Status status = update( currentMillis, identifier );
+
+   // Run the state change callback if supplied.
+   if ( status != NONE && callback )
+   {
+      callback( status, identifier );
+   }
+
+   return status;
+}
+
+//============================================================================
+// Update the valve.
+//
+// This is poll() without the callback.  The poll() overloads call it
+// and then run their callback.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- identifier      Identifier for the FlightRecorder.
+//
+//= RETURNS
+//- Returns the same value as poll().
+//
+Valve::Status
+Valve::
+update( long currentMillis,
+        int8_t identifier )
+{
+   // init() failed so the valve isn't configured.
+   if ( m_status == NONE )
+   {
+      return NONE;
+   }
+
    // Poll the status switches.  Do this first so they get basically
    // the same time.
    DigitalInput::Status openedState = m_isOpened.poll( currentMillis );
    DigitalInput::Status closedState = m_isClosed.poll( currentMillis );
 
+#if defined( VALVE_DEADLINE )
+   // Nothing changed and nothing is due.
+   if ( openedState == DigitalInput::NONE &&
+        closedState == DigitalInput::NONE &&
+        ! m_wake && currentMillis - m_deadline.get( currentMillis ) < 0 )
+   {
+      return NONE;
+   }
+#endif
+
    Status prevState = m_status;
 
-   // Handle status change on the open switch.
-   switch ( openedState )
+#if defined( VALVE_STATS )
+   // Time power was turned on (if the valve is moving).  powerOff()
+   // overwrites this.
+   long powerOnMillis = m_lastPowerCycle.get( currentMillis );
+#endif
+
+   // Switch changes.  CLOSED (> 0) means the switch is active.
+   if ( openedState != DigitalInput::NONE )
    {
-   // Open status received from the valve.
-   case DigitalInput::CLOSED:
-      // Set the open status and power off the valve.
-      m_status = OPENED;
-      powerOff();
-      break;
-      
-   // Open status no longer active - valve must be closing.  
-   case DigitalInput::OPENED:
-   case DigitalInput::OPENED_LONG:
-      m_status = CLOSING;
-      break;
+      transition( openedState > 0 ? OPEN_SWITCH_ON : OPEN_SWITCH_OFF,
+                  currentMillis );
+   }
+   if ( closedState != DigitalInput::NONE )
+   {
+      transition( closedState > 0 ? CLOSE_SWITCH_ON : CLOSE_SWITCH_OFF,
+                  currentMillis );
+   }
 
-   default:
-      break;
+#if VALVE_QUEUE_SIZE > 0
+   // Move timed commands that are due to the pending command.
+   if ( m_queueSize && currentMillis - m_queue[0].atMillis >= 0 )
+   {
+      runQueue( currentMillis );
+   }
+#endif
+
+   // Check ongoing status vs timeouts to see if we should cut power
+   // or issue any pending commands.
+   uint8_t flags = pgm_read_byte( &STATE_FLAGS[m_status] );
+   if ( flags & MOVING )
+   {
+#if defined( VALVE_SOFT_START )
+      if ( m_rampOutput )
+      {
+         ramp( currentMillis );
+      }
+#endif
+
+      // If we are opening/closing the valve, turn off the power after
+      // the time out has ellapsed.  This should only happen if the
+      // valve stops for some reason (or the time out is too short).
+      // The current sense catches a jammed valve much sooner.
+      bool timedOut = currentMillis - ( m_lastPowerCycle.get( currentMillis ) +
+                                        m_powerOnTimeOut ) >= 0;
+#if defined( VALVE_CURRENT_SENSE )
+      timedOut = timedOut ||
+         ( m_sensePin != NO_SENSE && checkCurrent( currentMillis ) );
+#endif
+      if ( timedOut )
+      {
+         transition( TIMED_OUT, currentMillis );
+      }
+   }
+   // We have a pending command.  See if enough time has ellapsed to
+   // execute the pending command.
+   else if ( ( flags & IDLE ) && m_pendingState != NONE &&
+             currentMillis - ( m_lastPowerCycle.get( currentMillis ) +
+                               m_dutyCycleTimeOut ) >= 0 )
+   {
+      transition( READY, currentMillis );
    }
 
-   // Handle status change on the close switch.
-   switch ( closedState )
+#if defined( VALVE_STORE )
+   if ( m_store )
    {
-   // Close status received from the valve.
-   case DigitalInput::CLOSED:
-      // Set the close status and power off the valve.
-      m_status = CLOSED;
-      powerOff();
+      saveState();
+   }
+#endif
+
+   // Return the new status if it's changed.
+   Status status = NONE;
+   if ( m_status != prevState )
+   {
+#if defined( VALVE_STATS )
+      if ( m_stats )
+      {
+         recordTravel( prevState, currentMillis - powerOnMillis );
+      }
+#endif
+      status = m_status;
+   }
+
+#if FLIGHTRECORDER_ENABLE
+   if ( m_status != m_recordedStatus )
+   {
+      FlightRecorder::record( currentMillis, FlightRecorder::VALVE,
+                              identifier, m_recordedStatus, m_status );
+      m_recordedStatus = m_status;
+   }
+#else
+   (void)identifier; // only used by the flight recorder
+#endif
+
+   // Keep the last power cycle from wrapping while the valve is idle.
+   m_lastPowerCycle.refresh( currentMillis );
+
+#if defined( VALVE_DEADLINE )
+   // Poll again right away if something has to be checked each time.
+   long deadline = nextDeadline( currentMillis );
+   m_wake = deadline == currentMillis;
+   m_deadline.set( deadline );
+#endif
+
+   return status;
+}
+
+//============================================================================
+// Return the time poll() next has something to do.
+//
+// That's the earliest of the switch debouncing, the power on or cycle
+// time outs, and the timed commands.  If a command was just given (or
+// the soft start or current sense is running), it's now.  Without
+// VALVE_DEADLINE, it's worked out on each call instead of by poll().
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the time in millis poll() should be called by.
+//
+long
+Valve::
+deadline( long currentMillis )
+{
+#if defined( VALVE_DEADLINE )
+   if ( m_wake )
+   {
+      return currentMillis;
+   }
+
+   long deadline = m_deadline.get( currentMillis );
+#else
+   long deadline = nextDeadline( currentMillis );
+#endif
+   long switchDeadline = m_isOpened.deadline( currentMillis );
+   if ( switchDeadline - deadline < 0 )
+   {
+      deadline = switchDeadline;
+   }
+   switchDeadline = m_isClosed.deadline( currentMillis );
+   if ( switchDeadline - deadline < 0 )
+   {
+      deadline = switchDeadline;
+   }
+   return deadline;
+}
+
+//============================================================================
+// Run a state machine event.
+//
+// Looks up the current status and event in the transition table, sets
+// the next status and runs the action.
+//
+//= INPUTS
+//- event           Event enum value.
+//- currentMillis   The current elapsed time in milliseconds.
+//
+void
+Valve::
+transition( uint8_t event,
+            long currentMillis )
+{
+   uint8_t step = pgm_read_byte( &TRANSITIONS[m_status][event] );
+
+   if ( step & 0x0F )
+   {
+      m_status = (Status)( step & 0x0F );
+   }
+
+   switch ( step >> 4 )
+   {
+   case POWER_OFF:
+      powerOff( currentMillis );
       break;
-      
-   // Close status no longer active - valve must be opening.  
-   case DigitalInput::OPENED:
-   case DigitalInput::OPENED_LONG:
-      m_status = OPENING;
+
+   case RUN_PENDING:
+      // Command the valve go to the opening or closing state.  If
+      // the valve is already in this state, this is a null op.
+      powerOn( m_pendingState, currentMillis );
+      m_pendingState = NONE;
       break;
 
    default:
       break;
    }
+}
 
-   // Check ongoing status vs timeouts to see if we should cut power
-   // or issue any pending commands.
-   switch( m_status )
+//============================================================================
+// Find the next time poll() has to do something.
+//
+// That's the power on time out while the valve is moving, the end of
+// the cycle time out if there is a pending command, or the first
+// timed command.  The soft start ramp and current sense need every
+// poll() while moving.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns the time in millis poll() should be called by.
+//
+long
+Valve::
+nextDeadline( long currentMillis )
+{
+   // Nothing due - check back well before the times could wrap.
+   long deadline = currentMillis + Time::MAX_WAIT;
+
+   uint8_t flags = pgm_read_byte( &STATE_FLAGS[m_status] );
+   if ( flags & MOVING )
    {
-   case OPENING:
-   case CLOSING:
-      // If we are opening/closing the valve, turn off the power after
-      // the time out has ellapsed.  This should only happen if the
-      // valve stops for some reason (or the time out is too short).
-      if ( currentMillis - ( m_lastPowerCycle + m_powerOnTimeOut ) >= 0 )
+#if defined( VALVE_SOFT_START )
+      if ( m_rampOutput )
+      {
+         return currentMillis;
+      }
+#endif
+#if defined( VALVE_CURRENT_SENSE )
+      if ( m_sensePin != NO_SENSE )
+      {
+         return currentMillis;
+      }
+#endif
+      deadline = m_lastPowerCycle.get( currentMillis ) + m_powerOnTimeOut;
+   }
+   else if ( ( flags & IDLE ) && m_pendingState != NONE )
+   {
+      deadline = m_lastPowerCycle.get( currentMillis ) + m_dutyCycleTimeOut;
+   }
+
+#if VALVE_QUEUE_SIZE > 0
+   if ( m_queueSize && m_queue[0].atMillis - deadline < 0 )
+   {
+      deadline = m_queue[0].atMillis;
+   }
+#endif
+
+   return deadline;
+}
+
+#if VALVE_QUEUE_SIZE > 0
+//============================================================================
+// Add a timed command to the queue.
+//
+// The queue is kept sorted by time.  Commands at the same time stay
+// in the order they were added.
+//
+//= INPUTS
+//- command    OPENING or CLOSING.
+//- atMillis   Time (in millis()) to run the command.
+//
+//= RETURNS
+//- Returns false if the queue is full or the valve isn't configured.
+//
+bool
+Valve::
+schedule( Status command,
+          long atMillis )
+{
+   if ( m_status == NONE )
+   {
+      return false;
+   }
+   wake();
+
+   // Find the insert position.
+   uint8_t idx = m_queueSize;
+   while ( idx > 0 && m_queue[idx - 1].atMillis - atMillis > 0 )
+   {
+      idx--;
+   }
+
+   if ( m_queueSize == VALVE_QUEUE_SIZE )
+   {
+      return false;
+   }
+
+   for ( uint8_t i = m_queueSize; i > idx; --i )
+   {
+      m_queue[i] = m_queue[i - 1];
+   }
+   m_queue[idx].atMillis = atMillis;
+   m_queue[idx].command = command;
+   m_queueSize++;
+   return true;
+}
+
+//============================================================================
+// Run the timed commands that are due.
+//
+// Only the last due command is used - earlier ones would be replaced
+// by it anyway.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+void
+Valve::
+runQueue( long currentMillis )
+{
+   uint8_t num = 0;
+   while ( num < m_queueSize &&
+           currentMillis - m_queue[num].atMillis >= 0 )
+   {
+      num++;
+   }
+
+   if ( m_queue[num - 1].command == OPENING )
+   {
+      open();
+   }
+   else
+   {
+      close();
+   }
+
+   m_queueSize -= num;
+   for ( uint8_t i = 0; i < m_queueSize; ++i )
+   {
+      m_queue[i] = m_queue[i + num];
+   }
+}
+#endif
+
+#if defined( VALVE_STORE )
+//============================================================================
+// Save and restore the valve state with EEPROM.
+//
+// Loads the saved state from the store.  If the valve was rebooted in
+// the middle of a move, that move is finished.  If the valve is
+// UNKNOWN (neither switch is active) the move is started right away.
+// Otherwise it's made the pending command.  The saved pending command
+// is restored as well.  Nothing is resumed after a stall.
+//
+//= INPUTS
+//- store    Store to use.  Must remain in scope with the valve.  NULL to
+//           stop saving.  Must be called after init() and store.init().
+//
+//= RETURN VALUE
+//
+//- Returns the current valve status.  This is OPENING or CLOSING if an
+//  interrupted move was resumed.
+//
+Valve::Status
+Valve::
+setStore( ValveStore* store )
+{
+   m_store = store;
+   if ( ! store || ! store->load() )
+   {
+      return m_status;
+   }
+
+   Status commanded = (Status)store->commanded();
+   Status confirmed = (Status)store->confirmed();
+   Status target = commanded == OPENING ? OPENED : CLOSED;
+   m_pendingState = (Status)store->pending();
+   wake();
+
+   if ( ( commanded == OPENING || commanded == CLOSING ) &&
+        confirmed != target && confirmed != STALLED && m_status != target )
+   {
+      if ( m_status == UNKNOWN )
+      {
+         powerOn( commanded, millis() );
+      }
+      else if ( m_pendingState == NONE )
       {
-         m_status = STALLED;
-         powerOff();
+         m_pendingState = commanded;
       }
+   }
+
+   return m_status;
+}
+
+//============================================================================
+// Save the valve state to the store.
+//
+// The store only writes to EEPROM if something changed.
+//
+void
+Valve::
+saveState()
+{
+   uint8_t commanded = m_store->commanded();
+   uint8_t confirmed = m_store->confirmed();
+   switch ( m_status )
+   {
+   case OPENING:
+   case CLOSING:
+      commanded = m_status;
       break;
-      
+
    case OPENED:
    case CLOSED:
-      // We have a pending command.  See if enough time has ellapsed
-      // to execute the pending command.
-      if ( m_pendingState != NONE &&
-           ( currentMillis - ( m_lastPowerCycle + m_dutyCycleTimeOut ) >= 0 ) )
-      {
-         // Command the valve go to the opening or closing state.  If
-         // the valve is already in this state, this is a null op.
-         powerOn( m_pendingState );
-         m_pendingState = NONE;
-      }
+   case STALLED:
+      confirmed = m_status;
       break;
 
    default:
       break;
    }
 
-   // Return the new status if it's changed.
-   if ( m_status != prevState )
+   m_store->save( commanded, confirmed, m_pendingState );
+}
+#endif
+
+#if defined( VALVE_STATS )
+//============================================================================
+// Record a finished move or a stall in the stats.
+//
+//= INPUTS
+//- prevState       The status before the change.
+//- travelMillis    Time since the power was turned on.
+//
+void
+Valve::
+recordTravel( Status prevState,
+              long travelMillis )
+{
+   if ( prevState != OPENING && prevState != CLOSING )
+   {
+      return;
+   }
+
+   ValveStats::Direction dir = prevState == OPENING ? ValveStats::OPEN :
+                                                      ValveStats::CLOSE;
+   if ( m_status == STALLED )
    {
-      // Run the state change callback if supplied.
-      if ( callback )
+      m_stats->stalled( dir );
+
+#if defined( VALVE_ADAPTIVE )
+      // The valve may be slowing down - go back to the safe limit
+      // until the history catches up.
+      if ( m_adaptMargin )
       {
-         callback( m_status, identifier );
+         m_powerOnTimeOut = m_maxPowerOnTimeOut;
+         m_dutyCycleTimeOut = m_maxDutyCycleTimeOut;
       }
-      return m_status;
+#endif
+   }
+   else if ( ( prevState == OPENING && m_status == OPENED ) ||
+             ( prevState == CLOSING && m_status == CLOSED ) )
+   {
+      if ( travelMillis > 0xFFFF )
+      {
+         travelMillis = 0xFFFF;
+      }
+      m_stats->add( dir, travelMillis );
+
+#if defined( VALVE_ADAPTIVE )
+      if ( m_adaptMargin )
+      {
+         adaptTimeOuts( travelMillis );
+      }
+#endif
+   }
+}
+#endif
+
+#if defined( VALVE_ADAPTIVE )
+//============================================================================
+// Update the adaptive time outs after a move.
+//
+//= INPUTS
+//- travelMillis    Time the motor was powered for the move.
+//
+void
+Valve::
+adaptTimeOuts( long travelMillis )
+{
+   // Cool down time scales with the time the motor was on.  The init()
+   // value is for a move that used the whole power on time out.  With
+   // no power on time out there's nothing to scale by.
+   long coolDown = m_maxDutyCycleTimeOut;
+   if ( m_maxPowerOnTimeOut > 0 )
+   {
+      coolDown = m_maxDutyCycleTimeOut * travelMillis / m_maxPowerOnTimeOut;
+   }
+   m_dutyCycleTimeOut = constrain( coolDown, (long)m_minDutyCycleTimeOut,
+                                   (long)m_maxDutyCycleTimeOut );
+
+   // Wait for enough history in both directions.
+   if ( m_stats->count( ValveStats::OPEN ) < m_adaptMinMoves ||
+        m_stats->count( ValveStats::CLOSE ) < m_adaptMinMoves )
+   {
+      return;
+   }
+
+   long p99 = max( m_stats->percentile( ValveStats::OPEN, 99 ),
+                   m_stats->percentile( ValveStats::CLOSE, 99 ) );
+   long timeOut = p99 + p99 * m_adaptMargin / 100;
+   m_powerOnTimeOut = constrain( timeOut, (long)m_minPowerOnTimeOut,
+                                 (long)m_maxPowerOnTimeOut );
+}
+#endif
+
+#if defined( VALVE_CURRENT_SENSE )
+//============================================================================
+// Check the motor current.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+//= RETURNS
+//- Returns true if the motor has been over current for the sustain
+//  time and the valve should be stalled.
+//
+bool
+Valve::
+checkCurrent( long currentMillis )
+{
+   int current = sampleCurrent();
+
+   // No new sample yet or still in the inrush blanking time.
+   if ( current < 0 ||
+        currentMillis - ( m_lastPowerCycle.get( currentMillis ) +
+                          m_senseBlank ) < 0 )
+   {
+      return false;
+   }
+
+   if ( current <= m_senseThreshold )
+   {
+      m_overCurrent = false;
+      return false;
+   }
+
+   // Start timing the over current.  Short spikes are ignored.
+   if ( ! m_overCurrent )
+   {
+      m_overCurrent = true;
+      m_overCurrentMillis.set( currentMillis );
+   }
+
+   return currentMillis - ( m_overCurrentMillis.get( currentMillis ) +
+                            m_senseSustain ) >= 0;
+}
+
+//============================================================================
+// Sample the motor current.
+//
+// On AVR boards, this reads the result of the conversion started by
+// the previous call and starts the next one so there is no waiting
+// for the ADC.  Valves share the ADC (see s_adcOwner) so this skips
+// the sample while another valve's conversion is running.  On other
+// boards, analogRead() is used.
+//
+//= RETURNS
+//- Returns the analog reading or -1 if a new sample isn't ready yet.
+//
+int
+Valve::
+sampleCurrent()
+{
+#if defined( VALVE_ASYNC_ADC )
+   // Another valve's conversion - wait for it to read the result.
+   if ( s_adcOwner && s_adcOwner != this )
+   {
+      s_adcWaiting = true;
+      return -1;
+   }
+
+   // A conversion is still running.  If it isn't ours, it was started
+   // by a valve that stopped (or analogRead()) and changing the channel
+   // now would mix up the result.
+   if ( bit_is_set( ADCSRA, ADSC ) )
+   {
+      return -1;
+   }
+
+   int value = -1;
+   if ( s_adcOwner == this )
+   {
+      // ADCL must be read first - that locks ADCH until it's read.
+      uint8_t low = ADCL;
+      uint8_t high = ADCH;
+      value = ( high << 8 ) | low;
+
+      // Let the waiting valve start the next conversion.
+      if ( s_adcWaiting )
+      {
+         s_adcWaiting = false;
+         s_adcOwner = NULL;
+         return value;
+      }
+   }
+
+   // Same channel selection as analogRead() (AVcc reference).
+   uint8_t channel = m_sensePin >= A0 ? m_sensePin - A0 : m_sensePin;
+#if defined( MUX5 )
+   ADCSRB = ( ADCSRB & ~( 1 << MUX5 ) ) |
+            ( ( ( channel >> 3 ) & 0x01 ) << MUX5 );
+#endif
+   ADMUX = ( DEFAULT << 6 ) | ( channel & 0x07 );
+   ADCSRA |= ( 1 << ADSC );
+   s_adcOwner = this;
+
+   return value;
+#else
+   return analogRead( m_sensePin );
+#endif
+}
+
+//============================================================================
+// Give up the ADC if this valve owns it.
+//
+// Called when the valve stops sampling the current.  A conversion
+// that's still running finishes on its own and nobody reads it.
+//
+void
+Valve::
+releaseAdc()
+{
+#if defined( VALVE_ASYNC_ADC )
+   if ( s_adcOwner == this )
+   {
+      s_adcOwner = NULL;
+   }
+#endif
+}
+#endif
+
+#if defined( VALVE_SOFT_START )
+//============================================================================
+// Return the soft start duty cycle.
+//
+//= INPUTS
+//- elapsedMillis   Time since the power was turned on.
+//
+//= RETURNS
+//- Returns the PWM duty cycle.  255 is full power.
+//
+uint8_t
+Valve::
+rampDuty( long elapsedMillis )
+{
+   if ( m_rampProfile )
+   {
+      long step = elapsedMillis / m_rampMillis;
+      return step < m_rampSize ? m_rampProfile[step] : 255;
+   }
+
+   if ( elapsedMillis >= m_rampMillis )
+   {
+      return 255;
+   }
+   return m_rampStartDuty +
+      ( 255 - m_rampStartDuty ) * elapsedMillis / m_rampMillis;
+}
+
+//============================================================================
+// Update the soft start ramp.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
+void
+Valve::
+ramp( long currentMillis )
+{
+   uint8_t duty = rampDuty( currentMillis -
+                            m_lastPowerCycle.get( currentMillis ) );
+   if ( duty == m_rampDuty )
+   {
+      return;
    }
 
-   return NONE;
+   m_rampDuty = duty;
+   m_rampOutput->pwm( duty );
+
+   // Full power - the ramp is done.
+   if ( duty == 255 )
+   {
+      m_rampOutput = 0;
+   }
 }
+#endif
 
 //============================================================================
 // Power off the valve.
 //
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//
 void
 Valve::
-powerOff()
+powerOff( long currentMillis )
 {
    // Set both control pins to HIGH to power off the h-bridge.
    m_open.on();
    m_close.on();
+#if defined( VALVE_SOFT_START )
+   m_rampOutput = 0;
+#endif
+#if defined( VALVE_CURRENT_SENSE )
+   releaseAdc();
+#endif
 
-   m_lastPowerCycle = millis();
+   m_lastPowerCycle.set( currentMillis );
 }
 
 //============================================================================
@@ -302,13 +1080,19 @@ powerOff()
 // in the input state, the function does nothing and returns.
 //
 //= INPUTS
-//- mode    Must be either OPENING or CLOSING to set the valve into that
-//          state.  Other modes are ignored.
+//- mode            Must be either OPENING or CLOSING to set the valve into
+//                  that state.  Other modes are ignored.
+//- currentMillis   The current elapsed time in milliseconds.
 //
 void
 Valve::
-powerOn( Status mode )
+powerOn( Status mode,
+         long currentMillis )
 {
+   // Output to power the motor with and the one to turn off.
+   DigitalOutput* drive;
+   DigitalOutput* other;
+
    switch( mode )
    {
    case OPENING:
@@ -317,8 +1101,8 @@ powerOn( Status mode )
       {
          return;
       }
-      m_open.on();
-      m_close.off();
+      drive = &m_open;
+      other = &m_close;
       break;
       
    case CLOSING:
@@ -327,16 +1111,38 @@ powerOn( Status mode )
       {
          return;
       }
-      m_open.off();
-      m_close.on();
+      drive = &m_close;
+      other = &m_open;
       break;
       
    default:  // should never get here.
       return;
    }
 
+#if defined( VALVE_SOFT_START )
+   // With a soft start, turn the other output off first so the
+   // H-bridge never sees the reverse direction, then start the ramp.
+   // poll() takes it from there.
+   m_rampOutput = 0;
+   if ( m_rampMillis )
+   {
+      other->off();
+      m_rampDuty = rampDuty( 0 );
+      drive->pwm( m_rampDuty );
+      m_rampOutput = m_rampDuty == 255 ? 0 : drive;
+   }
+   else
+#endif
+   {
+      drive->on();
+      other->off();
+   }
+
    m_status = mode;
-   m_lastPowerCycle = millis();
+   m_lastPowerCycle.set( currentMillis );
+#if defined( VALVE_CURRENT_SENSE )
+   m_overCurrent = false;
+#endif
 }
 
 //============================================================================
@@ -14,8 +14,22 @@
 // this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 #include "Arduino.h"
+#include "FlightRecorder.h"
+#include "Profile.h"
 #include "DigitalInput.h"
 #include "DigitalOutput.h"
+#include "ValveStats.h"
+#include "ValveStore.h"
+#include "ValveConfig.h"
+
+// Define VALVE_COMPACT to store the time outs and time stamps as 16
+// bit ticks of 2^VALVE_TICK_SHIFT millis (see CompactTime.h).  The
+// default 4 ms tick allows time outs up to 65 seconds.  init()
+// returns NONE if a time out is longer than that.  Timed commands
+// (openAt(), closeAt()) are still 32 bit millis.
+#if defined( VALVE_COMPACT ) && ! defined( VALVE_TICK_SHIFT )
+#   define VALVE_TICK_SHIFT 2
+#endif
 
 // Articulated valve with sensor wire controller class.
 //
@@ -54,6 +68,71 @@
 // pending command is stored, multiple calls to open/close will only
 // keep the last command.
 //
+// With VALVE_QUEUE_SIZE, commands can also be scheduled for later
+// with openAt() and closeAt() (e.g. open in 30 seconds and close in
+// 90).  Each valve has a small queue of VALVE_QUEUE_SIZE timed
+// commands sorted by time.  When a command comes due, it becomes the
+// pending command above.  If several come due at once, only the last
+// one is used so redundant open/close pairs cancel out.  Every
+// command takes a queue entry (even one that repeats the command
+// before it) since the valve may be moved by hand in between.  poll()
+// only checks the first entry in the queue unless it's due.
+//
+// The valve logic is a transition table (see Valve.cpp) of the
+// current status and an event (a limit switch change, a time out, or
+// a pending command being ready) giving the next status and an action
+// to run.  With VALVE_DEADLINE, poll() keeps the time of the next
+// thing that can happen and returns right away if the switches
+// haven't changed and that time hasn't come.
+//
+// With VALVE_STATS, travel time statistics can be recorded by passing
+// a ValveStats object to setStats().  See ValveStats.h for details.
+//
+// With VALVE_ADAPTIVE and stats attached, setAdaptiveTimeOuts() will
+// learn the time outs from the travel history instead of using the
+// worst case values from init().  The power on time out is set to a
+// margin over the 99th percentile travel time so stalls are detected
+// sooner.  The cycle time out is scaled by how long the last move
+// actually powered the motor (vs the worst case) so short moves don't
+// wait as long to cool off.  The init() values are always the upper
+// limit and a stall resets both time outs to those limits.
+//
+// A jammed valve is normally only found when the power on time out
+// expires which leaves a stalled motor heating the H-bridge for
+// seconds.  If the motor controller has a current sense output (or a
+// shunt resistor and amplifier), define VALVE_CURRENT_SENSE and pass
+// the analog pin to setCurrentSense().  The current is sampled in
+// poll() while the valve is moving and if it stays over the threshold
+// for the sustain time, the valve is STALLED and the power is cut.
+// The motor inrush current is ignored for a short blanking time
+// after power on.  On AVR boards, the ADC conversion runs in the
+// background between polls so poll() doesn't wait ~100 us for
+// analogRead().  There is only one ADC so valves with current sense
+// that move at the same time take turns: a valve owns the ADC from
+// starting a conversion until it reads the result and the others skip
+// their samples until then.  Each one gets a sample every few polls
+// so set the sustain time to cover that.  Other code shouldn't call
+// analogRead() while a valve with current sense is moving since that
+// changes the channel under the running conversion.  poll() reads
+// ANALOG mode opened/closed pins with analogRead() so setCurrentSense()
+// refuses a valve that uses them.
+//
+// Turning the H-bridge full on pulls a large inrush current through
+// the motor which is a big part of why the driver needs to cool off
+// between moves.  With VALVE_SOFT_START, setSoftStart() ramps the PWM
+// duty cycle of the open (or close) output up to full power over a
+// short time instead.
+// The ramp is either linear or a table of duty cycles and is run by
+// poll() so nothing blocks.  Lower peak current and heat mean the
+// dutyCycleTimeOut can usually be shortened.  The control outputs
+// must be on PWM pins - shift register outputs just turn on.
+//
+// To survive a reboot in the middle of a move, define VALVE_STORE and
+// pass a ValveStore to setStore() after init().  The valve saves its
+// state to EEPROM when it changes and setStore() uses the saved state
+// to finish an interrupted move instead of coming up UNKNOWN.  See
+// ValveStore.h.
+//
 class Valve
 {
 public:
@@ -95,13 +174,58 @@ public:
    // http://playground.arduino.cc/Code/TimingRollover
    Status poll( long currentMillis, StateChangeCb callback=NULL,
                 int8_t identifier=0 );
+   long deadline( long currentMillis );
+
+   // Same as poll() with the handler bound at compile time - a
+   // function or a member function of an object.  The compiler can
+   // inline the handler into the poll.
+   template< StateChangeCb CB >
+   Status poll( long currentMillis, int8_t identifier=0 );
+   template< typename T, void (T::*HANDLER)( Status, int8_t ) >
+   Status poll( long currentMillis, T& object, int8_t identifier=0 );
 
    Status status();
+   long powerOnTimeOut();
+   long dutyCycleTimeOut();
+#if defined( VALVE_STATS )
+   void setStats( ValveStats* stats );
+#endif
+#if defined( VALVE_ADAPTIVE )
+   void setAdaptiveTimeOuts( long minPowerOnTimeOut, long minDutyCycleTimeOut,
+                             uint8_t marginPct=25, uint8_t minMoves=5 );
+#endif
+#if defined( VALVE_CURRENT_SENSE )
+   bool setCurrentSense( uint8_t pin, int threshold, uint16_t sustainMillis=20,
+                         uint16_t blankMillis=100 );
+   void clearCurrentSense();
+#endif
+#if defined( VALVE_SOFT_START )
+   void setSoftStart( uint16_t rampMillis, uint8_t startDuty=64 );
+   void setSoftStart( const uint8_t* profile, uint8_t numSteps,
+                      uint16_t stepMillis );
+   void clearSoftStart();
+#endif
+#if defined( VALVE_STORE )
+   Status setStore( ValveStore* store );
+#endif
    void open( bool force=false );
    void close( bool force=false );
    void toggle();
+   void stop();
+#if VALVE_QUEUE_SIZE > 0
+   bool openAt( long atMillis );
+   bool closeAt( long atMillis );
+   void clearQueue();
+   uint8_t queued();
+#endif
 
 private:
+#if defined( VALVE_COMPACT )
+   typedef CompactTime< VALVE_TICK_SHIFT > Time;
+#else
+   typedef FullTime Time;
+#endif
+
    // Controls to trigger the H-bridge motor controller.  When
    // open/close is HIGH/LOW, the valve should open.  When open/close
    // is LOW/HIGH, the valve should close.
@@ -121,32 +245,204 @@ private:
 
    // Duration to leave power applied to the open/close pins.
    // Normally the open/close signal should trigger and shut this off.
-   long m_powerOnTimeOut;
+   Time::Duration m_powerOnTimeOut;
 
    // Duration to wait between cycling the power.  This allows the
    // H-bridge chip to cool off.
-   long m_dutyCycleTimeOut;
+   Time::Duration m_dutyCycleTimeOut;
 
    // Last time power was turned on (mode==OPENING or CLOSING) or
    // turned off (mode==OPENED or CLOSED).  This plus one of the
    // durations above gives the next time power can be applied.
-   long m_lastPowerCycle;
-
-   void powerOn( Status mode );
-   void powerOff();
-   Status initialState();
-   Status processState( long currentMillis, DigitalInput::Status openedState,
-                        DigitalInput::Status closedState,
-                        StateChangeCb callback, int identifier );
+   Time::Stamp m_lastPowerCycle;
+
+#if defined( VALVE_STATS )
+   // Optional travel time statistics.  NULL if not used.
+   ValveStats* m_stats;
+
+   void recordTravel( Status prevState, long travelMillis );
+#endif
+
+#if defined( VALVE_ADAPTIVE )
+   // Adaptive time out limits.  The max values are the ones from
+   // init() and the min values from setAdaptiveTimeOuts().
+   Time::Duration m_maxPowerOnTimeOut;
+   Time::Duration m_maxDutyCycleTimeOut;
+   Time::Duration m_minPowerOnTimeOut;
+   Time::Duration m_minDutyCycleTimeOut;
+
+   // Percent margin over the P99 travel time for the power on time
+   // out.  Adaptive time outs are off if this is 0.
+   uint8_t m_adaptMargin;
+
+   // Number of moves needed before adapting the power on time out.
+   uint8_t m_adaptMinMoves;
+
+   void adaptTimeOuts( long travelMillis );
+#endif
+
+#if defined( VALVE_CURRENT_SENSE )
+   // Optional current sense analog pin.  NO_SENSE if not used.
+   enum { NO_SENSE = 0xFF };
+   uint8_t m_sensePin;
+
+   // True if the last sample was over the threshold.
+   bool m_overCurrent;
+
+   // Analog reading above which the motor is over current.
+   int m_senseThreshold;
+
+   // Time the current has to stay over the threshold to stall and the
+   // time to ignore the inrush current after power on.
+   uint16_t m_senseSustain;
+   uint16_t m_senseBlank;
+
+   // Time the current first went over the threshold.
+   Time::Stamp m_overCurrentMillis;
+
+   int sampleCurrent();
+   void releaseAdc();
+   bool checkCurrent( long currentMillis );
+#endif
+
+#if defined( VALVE_SOFT_START )
+   // Optional soft start ramp.  If m_rampProfile is NULL, the duty
+   // cycle goes linearly from m_rampStartDuty to full power over
+   // m_rampMillis.  Otherwise each of the m_rampSize profile duty
+   // cycles is used for m_rampMillis.  Off if m_rampMillis is 0.
+   const uint8_t* m_rampProfile;
+   uint8_t m_rampSize;
+   uint8_t m_rampStartDuty;
+   uint16_t m_rampMillis;
+
+   // Output being ramped and its current duty cycle.  NULL if the
+   // ramp is finished.
+   DigitalOutput* m_rampOutput;
+   uint8_t m_rampDuty;
+
+   uint8_t rampDuty( long elapsedMillis );
+   void ramp( long currentMillis );
+#endif
+
+#if defined( VALVE_STORE )
+   // Optional EEPROM state storage.  NULL if not used.
+   ValveStore* m_store;
+
+   void saveState();
+#endif
+
+#if VALVE_QUEUE_SIZE > 0
+   // Timed command (OPENING or CLOSING) to make pending at atMillis.
+   typedef struct {
+      long atMillis;
+      uint8_t command;
+   } Command;
+
+   // Timed commands sorted by time and the number in use.
+   Command m_queue[VALVE_QUEUE_SIZE];
+   uint8_t m_queueSize;
+
+   bool schedule( Status command, long atMillis );
+   void runQueue( long currentMillis );
+#endif
+
+#if defined( VALVE_DEADLINE )
+   // Time poll() next has to do something.  If m_wake is true, the
+   // next poll() always runs (commands changed or something has to be
+   // checked on each poll).
+   Time::Stamp m_deadline;
+   bool m_wake;
+#endif
+
+#if FLIGHTRECORDER_ENABLE
+   // Last status recorded in the FlightRecorder.  Changes made outside
+   // of poll() (open(), close()) are recorded on the next poll().
+   uint8_t m_recordedStatus;
+#endif
+
+   Status update( long currentMillis, int8_t identifier );
+   void transition( uint8_t event, long currentMillis );
+   long nextDeadline( long currentMillis );
+   void wake();
+
+   void powerOn( Status mode, long currentMillis );
+   void powerOff( long currentMillis );
+   Status initialState( long powerOnTimeOut, long dutyCycleTimeOut );
 };
 
+//============================================================================
+// Poll the valve and run a handler function bound at compile time.
+//
+// Same as poll() with a callback.  Use it like:
+//
+//   g_valve.poll< valveChangedCb >( t );
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- identifier      Optional, arbitrary identifer to pass to the handler.
+//
+//= RETURNS
+//- Returns the same value as poll().
+//
+template< Valve::StateChangeCb CB >
+inline
+Valve::Status
+Valve::
+poll( long currentMillis,
+      int8_t identifier )
+{
+   PROFILE_SCOPE( "Valve::poll" );
+
+   Status status = update( currentMillis, identifier );
+   if ( status != NONE )
+   {
+      CB( status, identifier );
+   }
+
+   return status;
+}
+
+//============================================================================
+// Poll the valve and run a member function bound at compile time.
+//
+// Same as poll() with a callback.  Use it like:
+//
+//   g_valve.poll< Board, &Board::valveChanged >( t, g_board );
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- object          The object to run the member function on.
+//- identifier      Optional, arbitrary identifer to pass to the handler.
+//
+//= RETURNS
+//- Returns the same value as poll().
+//
+template< typename T, void (T::*HANDLER)( Valve::Status, int8_t ) >
+inline
+Valve::Status
+Valve::
+poll( long currentMillis,
+      T& object,
+      int8_t identifier )
+{
+   PROFILE_SCOPE( "Valve::poll" );
+
+   Status status = update( currentMillis, identifier );
+   if ( status != NONE )
+   {
+      ( object.*HANDLER )( status, identifier );
+   }
+
+   return status;
+}
+
 //============================================================================
 // Return the current valve status.
 //
-// See the enum docs for details.  Should never return NONE.  If
-// UNKNOWN is returned, then the valve was either not opened or closed
-// on startup or power was cut off by the time out in the middle of
-// cycling.
+// See the enum docs for details.  Only returns NONE if init() failed.
+// If UNKNOWN is returned, then the valve was either not opened or
+// closed on startup or power was cut off by the time out in the middle
+// of cycling.
 //
 inline
 Valve::Status
@@ -156,6 +452,206 @@ status()
    return m_status;
 }
 
+#if defined( VALVE_STATS )
+//============================================================================
+// Record travel time statistics.
+//
+// The valve will record the time it takes to open and close and any
+// stalls in the input stats object.
+//
+//= INPUTS
+//- stats    Stats object to update.  Must remain in scope with the valve.
+//           NULL to stop recording.  Must be called after init().
+//
+inline
+void
+Valve::
+setStats( ValveStats* stats )
+{
+   m_stats = stats;
+}
+#endif
+
+#if defined( VALVE_ADAPTIVE )
+//============================================================================
+// Learn the time outs from the travel time history.
+//
+// setStats() must be called first.  The time outs from init() are
+// used as the upper limits.
+//
+//= INPUTS
+//- minPowerOnTimeOut    Shortest power on time out to ever use.
+//- minDutyCycleTimeOut  Shortest cycle time out to ever use.
+//- marginPct            Percent to add to the 99th percentile travel time
+//                       to get the power on time out.  0 turns adaptive
+//                       time outs off and restores the init() values.
+//- minMoves             Number of moves (in each direction) to record
+//                       before changing the power on time out.
+//
+inline
+void
+Valve::
+setAdaptiveTimeOuts( long minPowerOnTimeOut,
+                     long minDutyCycleTimeOut,
+                     uint8_t marginPct,
+                     uint8_t minMoves )
+{
+   m_minPowerOnTimeOut = minPowerOnTimeOut;
+   m_minDutyCycleTimeOut = minDutyCycleTimeOut;
+   m_adaptMargin = marginPct;
+   m_adaptMinMoves = minMoves;
+   wake();
+
+   if ( ! marginPct )
+   {
+      m_powerOnTimeOut = m_maxPowerOnTimeOut;
+      m_dutyCycleTimeOut = m_maxDutyCycleTimeOut;
+   }
+}
+#endif
+
+//============================================================================
+// Return the current power on time out in millis.
+//
+inline
+long
+Valve::
+powerOnTimeOut()
+{
+   return m_powerOnTimeOut;
+}
+
+//============================================================================
+// Return the current cycle time out in millis.
+//
+inline
+long
+Valve::
+dutyCycleTimeOut()
+{
+   return m_dutyCycleTimeOut;
+}
+
+#if defined( VALVE_CURRENT_SENSE )
+//============================================================================
+// Detect stalls with a motor current sense input.
+//
+// Must be called after init().
+//
+//= INPUTS
+//- pin            Analog pin (A0, A1, etc) reading the motor current.
+//- threshold      analogRead() value above which the motor is over current.
+//                 This should be above the normal running current and
+//                 below the stall current.
+//- sustainMillis  Time the current must stay over the threshold before
+//                 the valve is STALLED and the power is cut.
+//- blankMillis    Time after power on to ignore the current so the motor
+//                 inrush doesn't look like a stall.
+//
+//= RETURNS
+//- Returns false (and current sense stays off) if the opened or closed
+//  input is ANALOG mode.  poll() reading it would change the ADC
+//  channel under the current sense conversion.
+//
+inline
+bool
+Valve::
+setCurrentSense( uint8_t pin,
+                 int threshold,
+                 uint16_t sustainMillis,
+                 uint16_t blankMillis )
+{
+   if ( m_isOpened.isAnalog() || m_isClosed.isAnalog() )
+   {
+      return false;
+   }
+
+   m_sensePin = pin;
+   m_senseThreshold = threshold;
+   m_senseSustain = sustainMillis;
+   m_senseBlank = blankMillis;
+   m_overCurrent = false;
+   releaseAdc();
+   wake();
+   return true;
+}
+
+//============================================================================
+// Stop using the current sense input.
+//
+// Stalls are only detected with the power on time out.
+//
+inline
+void
+Valve::
+clearCurrentSense()
+{
+   m_sensePin = NO_SENSE;
+   releaseAdc();
+}
+#endif
+
+#if defined( VALVE_SOFT_START )
+//============================================================================
+// Soft start the motor with a linear PWM ramp.
+//
+// Must be called after init().
+//
+//= INPUTS
+//- rampMillis   Time to ramp from the start duty cycle to full power.
+//               0 turns the soft start off.
+//- startDuty    PWM duty cycle (0-255) to start the motor with.
+//
+inline
+void
+Valve::
+setSoftStart( uint16_t rampMillis,
+              uint8_t startDuty )
+{
+   m_rampProfile = 0;
+   m_rampSize = 0;
+   m_rampStartDuty = startDuty;
+   m_rampMillis = rampMillis;
+}
+
+//============================================================================
+// Soft start the motor with a PWM ramp profile.
+//
+// Must be called after init().  Full power is used after the last
+// step.
+//
+//= INPUTS
+//- profile      Array of PWM duty cycles (0-255) to use in order.  Must
+//               remain in scope with the valve.
+//- numSteps     Number of entries in profile.
+//- stepMillis   Time to use each duty cycle for.
+//
+inline
+void
+Valve::
+setSoftStart( const uint8_t* profile,
+              uint8_t numSteps,
+              uint16_t stepMillis )
+{
+   m_rampProfile = profile;
+   m_rampSize = numSteps;
+   m_rampMillis = numSteps ? stepMillis : 0;
+}
+
+//============================================================================
+// Turn the soft start off.
+//
+// The motor is turned on at full power.
+//
+inline
+void
+Valve::
+clearSoftStart()
+{
+   m_rampMillis = 0;
+}
+#endif
+
 //============================================================================
 // Open the valve.
 //
@@ -174,20 +670,34 @@ void
 Valve::
 open( bool force )
 {
+   // init() failed so the valve isn't configured.
+   if ( m_status == NONE )
+   {
+      return;
+   }
+
+   // Make sure the next poll() looks at the new command.
+   wake();
+
    // Ignore current state and time outs if and force the valve on.
    // Clear any pending states as well so they don't interfere later.
    if ( force )
    {
-      powerOn( OPENING );
+      powerOn( OPENING, millis() );
       m_pendingState = NONE;
       return;
    }
-   // If the valve is already open, do nothing.  Otherwise schedule a
-   // open() call the next time that the time outs allow.
+   // If the valve is already open, cancel any pending close.
+   // Otherwise schedule a open() call the next time that the time
+   // outs allow.
    else if ( m_status != OPENED && m_status != OPENING )
    {
       m_pendingState = OPENING;
    }
+   else
+   {
+      m_pendingState = NONE;
+   }
 }
 
 //============================================================================
@@ -208,21 +718,35 @@ void
 Valve::
 close( bool force )
 {
+   // init() failed so the valve isn't configured.
+   if ( m_status == NONE )
+   {
+      return;
+   }
+
+   // Make sure the next poll() looks at the new command.
+   wake();
+
    // Ignore current state and time outs if and force the valve on.
    // Clear any pending states as well so they don't interfere later.
    if ( force )
    {
-      powerOn( CLOSING );
+      powerOn( CLOSING, millis() );
       m_pendingState = NONE;
       return;
    }
 
-   // If the valve is already closed, do nothing.  Otherwise schedule a
-   // open() call the next time that the time outs allow.
+   // If the valve is already closed, cancel any pending open.
+   // Otherwise schedule a close() call the next time that the time
+   // outs allow.
    else if ( m_status != CLOSED && m_status != CLOSING )
    {
       m_pendingState = CLOSING;
    }
+   else
+   {
+      m_pendingState = NONE;
+   }
 }
 
 //============================================================================
@@ -247,5 +771,105 @@ toggle()
 }
 
 //============================================================================
+// Stop the valve where it is.
+//
+// Cuts the power if the valve is moving and clears any pending
+// command.  A stopped valve is UNKNOWN since it's part way open.
+// This is done outside of poll() so poll() doesn't report the change.
+//
+inline
+void
+Valve::
+stop()
+{
+   wake();
+   m_pendingState = NONE;
+   if ( m_status == OPENING || m_status == CLOSING )
+   {
+      powerOff( millis() );
+      m_status = UNKNOWN;
+   }
+}
+
+#if VALVE_QUEUE_SIZE > 0
+//============================================================================
+// Open the valve at a later time.
+//
+// At the input time, this acts like calling open().  The time outs
+// still apply so the valve may open later than that.
+//
+//= INPUTS
+//- atMillis   Time (in millis()) to open the valve.
+//
+//= RETURNS
+//- Returns false if the queue is full or the valve isn't configured.
+//
+inline
+bool
+Valve::
+openAt( long atMillis )
+{
+   return schedule( OPENING, atMillis );
+}
+
+//============================================================================
+// Close the valve at a later time.
+//
+// At the input time, this acts like calling close().  The time outs
+// still apply so the valve may close later than that.
+//
+//= INPUTS
+//- atMillis   Time (in millis()) to close the valve.
+//
+//= RETURNS
+//- Returns false if the queue is full or the valve isn't configured.
+//
+inline
+bool
+Valve::
+closeAt( long atMillis )
+{
+   return schedule( CLOSING, atMillis );
+}
+
+//============================================================================
+// Remove all the timed commands.
+//
+// The pending command (if any) is not changed.
+//
+inline
+void
+Valve::
+clearQueue()
+{
+   m_queueSize = 0;
+}
 
+//============================================================================
+// Return the number of timed commands in the queue.
+//
+inline
+uint8_t
+Valve::
+queued()
+{
+   return m_queueSize;
+}
+#endif
+
+//============================================================================
+// Make the next poll() run.
+//
+// Called when something changes that poll() has to look at.
+//
+inline
+void
+Valve::
+wake()
+{
+#if defined( VALVE_DEADLINE )
+   m_wake = true;
+#endif
+}
 
+//============================================================================
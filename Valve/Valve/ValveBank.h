@@ -0,0 +1,589 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+#include "Profile.h"
+#include "Valve.h"
+
+// Bank of valves sharing a power supply and H-bridge drivers.
+//
+// When several valves are powered from the same supply and driver
+// chips, only a few of them can move at once and each driver needs
+// time to cool off after a valve finishes moving.  The ValveBank
+// queues open/close commands for all the valves and starts them when
+// the power budget allows.
+//
+// - At most maxConcurrent valves are moving at any time (supply limit).
+// - Only one valve per driver moves at a time and the driver must cool
+//   for driverCoolDown millis after a valve stops before the next one
+//   on the same driver starts.
+// - EMERGENCY commands are started before NORMAL ones and ignore the
+//   driver cool down (but not the supply limit).  An EMERGENCY command
+//   for a valve that is already moving the other way reverses it right
+//   away.  If another valve on the same driver is moving on a NORMAL
+//   command, that valve is stopped and it's command is queued again
+//   so it finishes after the EMERGENCY one.
+// - Within a priority, valves on the driver with the most queued
+//   commands go first so that all the drivers finish at about the same
+//   time.  Otherwise commands run in the order they were given.
+//
+// Valves must be initialized normally with Valve::init() and then
+// added to the bank.  After that, use the bank to command the valves
+// (not the valve open/close methods) and call the bank poll() instead
+// of the valve poll().  The valve index is passed to the callback as
+// the identifier.
+//
+//= Example
+//
+//   Valve g_valves[4];
+//   ValveBank< 4, 2 > g_bank; // 4 valves, 2 drivers
+//
+//   void setup()
+//   {
+//      ... g_valves[i].init() ...
+//      g_bank.init( 2, 5000 ); // 2 at once, 5 sec driver cool down
+//      g_bank.add( 0, g_valves[0], 0 );
+//      g_bank.add( 1, g_valves[1], 0 );
+//      g_bank.add( 2, g_valves[2], 1 );
+//      g_bank.add( 3, g_valves[3], 1 );
+//   }
+//
+//   void loop()
+//   {
+//      g_bank.poll( millis(), valveChangedCb );
+//   }
+//
+//   void leak()
+//   {
+//      g_bank.closeAll( ValveBank< 4, 2 >::EMERGENCY );
+//   }
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS=1 >
+class ValveBank
+{
+public:
+   // Command priorities.
+   enum Priority {
+      NORMAL = 0,
+      EMERGENCY = 1,
+   };
+
+   // NOTE: Can't use constructors (even though we should) because
+   // Arduino sketch generally requires these to be global variables
+   // so we don't know that the ctor would be called after hardware
+   // init.
+   void init( uint8_t maxConcurrent, long driverCoolDown );
+   void add( uint8_t index, Valve& valve, uint8_t driver=0 );
+
+   void open( uint8_t index, Priority priority=NORMAL );
+   void close( uint8_t index, Priority priority=NORMAL );
+   void openAll( Priority priority=NORMAL );
+   void closeAll( Priority priority=NORMAL );
+
+   // NOTE: long is better than unsigned long - code can ignore roll
+   // overs for duration computations.  For details, see:
+   // http://playground.arduino.cc/Code/TimingRollover
+   uint8_t poll( long currentMillis, Valve::StateChangeCb callback=NULL );
+
+   uint8_t remaining();
+   uint8_t moving();
+
+private:
+   struct Entry
+   {
+      Valve* valve;
+
+      // Driver index the valve is wired to.
+      uint8_t driver;
+
+      // Queued command: NONE, OPENING, or CLOSING.
+      uint8_t pending;
+
+      // Priority of the queued (or moving) command.
+      uint8_t priority;
+
+      // True if the bank started the valve and it's still moving.
+      uint8_t active;
+
+      // True if command() reversed the valve and poll() hasn't run the
+      // callback for it yet.
+      uint8_t reversed;
+
+      // Order the command was given for first in first out.
+      uint16_t order;
+   };
+
+   Entry m_valves[NUM_VALVES];
+
+   // Maximum number of valves that can move at once.
+   uint8_t m_maxConcurrent;
+
+   // Duration a driver must rest after a valve stops.
+   long m_driverCoolDown;
+
+   // Time each driver is ready to use again.
+   long m_driverReady[NUM_DRIVERS];
+
+   // True if a valve on the driver is moving.
+   bool m_driverBusy[NUM_DRIVERS];
+
+   // Number of valves currently moving.
+   uint8_t m_numActive;
+
+   // Counter for the command order.
+   uint16_t m_order;
+
+   void command( uint8_t index, Valve::Status mode, Priority priority );
+   void preempt( long currentMillis, Valve::StateChangeCb callback );
+   int8_t next( long currentMillis );
+};
+
+//============================================================================
+// Initialize the bank.
+//
+//= INPUTS
+//- maxConcurrent    Maximum number of valves that can move at once.
+//- driverCoolDown   Time in milliseconds a driver must rest after a valve
+//                   stops before another valve on that driver can start.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+inline
+void
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+init( uint8_t maxConcurrent,
+      long driverCoolDown )
+{
+   m_maxConcurrent = maxConcurrent ? maxConcurrent : 1;
+   m_driverCoolDown = driverCoolDown;
+   m_numActive = 0;
+   m_order = 0;
+
+   long now = millis();
+   for ( uint8_t i = 0; i < NUM_DRIVERS; i++ )
+   {
+      m_driverReady[i] = now;
+      m_driverBusy[i] = false;
+   }
+
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      m_valves[i].valve = 0;
+      m_valves[i].driver = 0;
+      m_valves[i].pending = Valve::NONE;
+      m_valves[i].priority = NORMAL;
+      m_valves[i].active = 0;
+      m_valves[i].reversed = 0;
+      m_valves[i].order = 0;
+   }
+}
+
+//============================================================================
+// Add a valve to the bank.
+//
+//= INPUTS
+//- index    Index of the valve in the bank (0 to NUM_VALVES-1).
+//- valve    The valve.  Must already be initialized.
+//- driver   Index of the driver the valve is wired to (0 to NUM_DRIVERS-1).
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+inline
+void
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+add( uint8_t index,
+     Valve& valve,
+     uint8_t driver )
+{
+   m_valves[index].valve = &valve;
+   m_valves[index].driver = driver;
+}
+
+//============================================================================
+// Queue a command to open a valve.
+//
+// Replaces any queued command for the valve.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+inline
+void
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+open( uint8_t index,
+      Priority priority )
+{
+   command( index, Valve::OPENING, priority );
+}
+
+//============================================================================
+// Queue a command to close a valve.
+//
+// Replaces any queued command for the valve.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+inline
+void
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+close( uint8_t index,
+       Priority priority )
+{
+   command( index, Valve::CLOSING, priority );
+}
+
+//============================================================================
+// Queue a command to open every valve.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+inline
+void
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+openAll( Priority priority )
+{
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      command( i, Valve::OPENING, priority );
+   }
+}
+
+//============================================================================
+// Queue a command to close every valve.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+inline
+void
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+closeAll( Priority priority )
+{
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      command( i, Valve::CLOSING, priority );
+   }
+}
+
+//============================================================================
+// Return the number of commands that are queued or moving.
+//
+// Zero means every valve has reached it's commanded state (or
+// stalled).
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+inline
+uint8_t
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+remaining()
+{
+   uint8_t num = m_numActive;
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      if ( m_valves[i].pending != Valve::NONE )
+      {
+         num++;
+      }
+   }
+
+   return num;
+}
+
+//============================================================================
+// Return the number of valves that are moving.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+inline
+uint8_t
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+moving()
+{
+   return m_numActive;
+}
+
+//============================================================================
+// Poll the bank.
+//
+// Polls every valve and then starts as many queued commands as the
+// power budget allows.  This should be called in each loop().
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- callback        Optional callback function.  Will be called if a
+//                  valve status changes with the valve index as the
+//                  identifier.
+//
+//= RETURNS
+//- Returns the number of commands that are queued or moving.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+uint8_t
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+poll( long currentMillis,
+      Valve::StateChangeCb callback )
+{
+   PROFILE_SCOPE( "ValveBank::poll" );
+
+   // Poll the valves and release the drivers of any that stopped.
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      Entry& e = m_valves[i];
+      if ( ! e.valve )
+      {
+         continue;
+      }
+
+      // An emergency reversal was started outside of the valve poll()
+      // so report it first to keep the callbacks in order.
+      if ( e.reversed )
+      {
+         e.reversed = 0;
+         if ( callback )
+         {
+            callback( e.valve->status(), i );
+         }
+      }
+
+      e.valve->poll( currentMillis, callback, i );
+
+      Valve::Status status = e.valve->status();
+      if ( e.active && status != Valve::OPENING && status != Valve::CLOSING )
+      {
+         e.active = 0;
+         m_numActive--;
+         m_driverBusy[e.driver] = false;
+         m_driverReady[e.driver] = currentMillis + m_driverCoolDown;
+      }
+   }
+
+   // Make room for emergency commands on busy drivers.
+   preempt( currentMillis, callback );
+
+   // Start commands until the budget is used up.
+   int8_t idx;
+   while ( ( idx = next( currentMillis ) ) >= 0 )
+   {
+      Entry& e = m_valves[idx];
+      Valve::Status mode = (Valve::Status)e.pending;
+      e.pending = Valve::NONE;
+
+      // Valve may have gotten there on it's own while queued.
+      Valve::Status status = e.valve->status();
+      if ( status == ( mode == Valve::OPENING ? Valve::OPENED :
+                                                Valve::CLOSED ) )
+      {
+         continue;
+      }
+
+      if ( mode == Valve::OPENING )
+      {
+         e.valve->open( true );
+      }
+      else
+      {
+         e.valve->close( true );
+      }
+
+      e.active = 1;
+      m_numActive++;
+      m_driverBusy[e.driver] = true;
+
+      // The valve was started outside of it's poll() so report the
+      // status change here.
+      if ( callback )
+      {
+         callback( e.valve->status(), idx );
+      }
+   }
+
+   return remaining();
+}
+
+//============================================================================
+// Queue a command.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+void
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+command( uint8_t index,
+         Valve::Status mode,
+         Priority priority )
+{
+   Entry& e = m_valves[index];
+   if ( ! e.valve )
+   {
+      return;
+   }
+
+   Valve::Status status = e.valve->status();
+   Valve::Status done = mode == Valve::OPENING ? Valve::OPENED : Valve::CLOSED;
+
+   // Emergency reversal of a moving valve.  It's already using it's
+   // share of the power so there's no need to wait.  The next poll()
+   // reports the new status.
+   if ( priority == EMERGENCY && e.active && status != mode )
+   {
+      e.pending = Valve::NONE;
+      e.priority = EMERGENCY;
+      e.reversed = 1;
+      if ( mode == Valve::OPENING )
+      {
+         e.valve->open( true );
+      }
+      else
+      {
+         e.valve->close( true );
+      }
+      return;
+   }
+
+   // Already there or on the way - nothing to do.
+   if ( status == done || status == mode )
+   {
+      e.pending = Valve::NONE;
+      return;
+   }
+
+   e.pending = mode;
+   e.priority = priority;
+   e.order = m_order++;
+}
+
+//============================================================================
+// Stop normal moves that are in the way of emergency commands.
+//
+// A queued emergency command can't start while another valve on it's
+// driver is moving.  If that valve is moving on a normal command, it's
+// stopped and the command is queued again.  It keeps it's place in
+// the order so it runs before newer normal commands.
+//
+//= INPUTS
+//- currentMillis   The current elapsed time in milliseconds.
+//- callback        Optional callback function.  Called with the new
+//                  status of each stopped valve.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+void
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+preempt( long currentMillis,
+         Valve::StateChangeCb callback )
+{
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      const Entry& e = m_valves[i];
+      if ( e.pending == Valve::NONE || e.priority != EMERGENCY ||
+           ! m_driverBusy[e.driver] )
+      {
+         continue;
+      }
+
+      for ( uint8_t j = 0; j < NUM_VALVES; j++ )
+      {
+         Entry& m = m_valves[j];
+         if ( ! m.active || m.driver != e.driver || m.priority != NORMAL )
+         {
+            continue;
+         }
+
+         Valve::Status mode = m.valve->status();
+         m.valve->stop();
+         m.active = 0;
+         m_numActive--;
+         m_driverBusy[m.driver] = false;
+         m_driverReady[m.driver] = currentMillis + m_driverCoolDown;
+
+         // A newer command for the valve replaces the stopped one.
+         if ( m.pending == Valve::NONE )
+         {
+            m.pending = mode;
+         }
+
+         if ( callback )
+         {
+            callback( m.valve->status(), j );
+         }
+      }
+   }
+}
+
+//============================================================================
+// Pick the next command to start.
+//
+// Returns the valve index or -1 if nothing can start right now.
+//
+template< uint8_t NUM_VALVES, uint8_t NUM_DRIVERS >
+int8_t
+ValveBank< NUM_VALVES, NUM_DRIVERS >::
+next( long currentMillis )
+{
+   if ( m_numActive >= m_maxConcurrent )
+   {
+      return -1;
+   }
+
+   // Number of queued commands on each driver.
+   uint8_t queued[NUM_DRIVERS];
+   for ( uint8_t d = 0; d < NUM_DRIVERS; d++ )
+   {
+      queued[d] = 0;
+   }
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      if ( m_valves[i].pending != Valve::NONE )
+      {
+         queued[m_valves[i].driver]++;
+      }
+   }
+
+   int8_t best = -1;
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      const Entry& e = m_valves[i];
+      if ( e.pending == Valve::NONE || m_driverBusy[e.driver] )
+      {
+         continue;
+      }
+
+      // Normal commands must wait for the driver to cool off.
+      if ( e.priority == NORMAL &&
+           currentMillis - m_driverReady[e.driver] < 0 )
+      {
+         continue;
+      }
+
+      if ( best < 0 )
+      {
+         best = i;
+         continue;
+      }
+
+      // Priority first, then the busiest driver, then the oldest.
+      const Entry& b = m_valves[best];
+      if ( e.priority != b.priority )
+      {
+         if ( e.priority > b.priority )
+         {
+            best = i;
+         }
+      }
+      else if ( queued[e.driver] != queued[b.driver] )
+      {
+         if ( queued[e.driver] > queued[b.driver] )
+         {
+            best = i;
+         }
+      }
+      else if ( (int16_t)( e.order - b.order ) < 0 )
+      {
+         best = i;
+      }
+   }
+
+   return best;
+}
+
+//============================================================================
@@ -0,0 +1,57 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+// Valve feature switches.
+//
+// Each optional Valve feature adds RAM to every valve so they're left
+// out unless they're turned on here.  Valve.h includes this file so a
+// sketch and Valve.cpp always agree on the layout of a Valve (a
+// #define in the sketch doesn't reach the library).  They can also be
+// defined with -D build flags for the whole build.  The bytes each one
+// adds to a valve on AVR are in ().
+//
+// A valve with none of them is 63 bytes (62 with
+// FLIGHTRECORDER_ENABLE=0).
+
+// Travel time statistics with setStats() (2).
+//#define VALVE_STATS
+
+// Learn the time outs with setAdaptiveTimeOuts() (18).  Turns on
+// VALVE_STATS.
+//#define VALVE_ADAPTIVE
+
+// Stall detection with setCurrentSense() (12).
+//#define VALVE_CURRENT_SENSE
+
+// PWM soft start with setSoftStart() (9).
+//#define VALVE_SOFT_START
+
+// Save the state to EEPROM with setStore() (2).
+//#define VALVE_STORE
+
+// Number of timed commands each valve can queue (5 each plus 1).  See
+// openAt().  0 leaves out openAt() and closeAt().
+#ifndef VALVE_QUEUE_SIZE
+#define VALVE_QUEUE_SIZE 0
+#endif
+
+// Keep the next deadline so poll() returns right away when nothing
+// is due (5).
+//#define VALVE_DEADLINE
+
+#if defined( VALVE_ADAPTIVE ) && ! defined( VALVE_STATS )
+#   define VALVE_STATS
+#endif
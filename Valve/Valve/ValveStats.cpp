@@ -0,0 +1,195 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "ValveStats.h"
+
+//============================================================================
+// Clear all the stats.
+//
+void
+ValveStats::
+clear()
+{
+   memset( m_hist, 0, sizeof( m_hist ) );
+}
+
+//============================================================================
+// Record a completed move.
+//
+//= INPUTS
+//- dir            Direction the valve moved.
+//- travelMillis   Time from power on until the limit switch tripped.
+//
+void
+ValveStats::
+add( Direction dir,
+     uint16_t travelMillis )
+{
+   Hist& h = m_hist[dir];
+
+   // 16 bits - a slow move can be more than 255 buckets long.
+   uint16_t idx = travelMillis / m_bucketMillis;
+   if ( idx >= VALVESTATS_NUM_BUCKETS )
+   {
+      idx = VALVESTATS_NUM_BUCKETS - 1;
+   }
+
+   // Keep all the counters in range.
+   if ( h.count == 0xFFFF || h.buckets[idx] == 0xFFFF ||
+        h.sum > 0xFFFFFFFF - travelMillis )
+   {
+      halve( h );
+   }
+
+   if ( h.count == 0 || travelMillis < h.min )
+   {
+      h.min = travelMillis;
+   }
+   if ( travelMillis > h.max )
+   {
+      h.max = travelMillis;
+   }
+
+   h.count++;
+   h.sum += travelMillis;
+   h.buckets[idx]++;
+}
+
+//============================================================================
+// Record a stall (power on time out).
+//
+void
+ValveStats::
+stalled( Direction dir )
+{
+   if ( m_hist[dir].stalls != 0xFFFF )
+   {
+      m_hist[dir].stalls++;
+   }
+}
+
+//============================================================================
+// Return an upper bound on a travel time percentile.
+//
+// This is the end of the histogram bucket the percentile falls in (or
+// the max time if that's smaller) so it's never less than the real
+// percentile.  Returns 0 if no moves have been recorded.
+//
+//= INPUTS
+//- dir   Direction to use.
+//- pct   Percentile (1-100).  99 returns the time 99% of the moves are
+//        shorter than.
+//
+uint16_t
+ValveStats::
+percentile( Direction dir,
+            uint8_t pct )
+{
+   const Hist& h = m_hist[dir];
+
+   uint32_t total = 0;
+   for ( uint8_t i = 0; i < VALVESTATS_NUM_BUCKETS; i++ )
+   {
+      total += h.buckets[i];
+   }
+   if ( total == 0 )
+   {
+      return 0;
+   }
+
+   uint32_t need = ( total * pct + 99 ) / 100;
+   uint32_t sum = 0;
+   for ( uint8_t i = 0; i < VALVESTATS_NUM_BUCKETS - 1; i++ )
+   {
+      sum += h.buckets[i];
+      if ( sum >= need )
+      {
+         uint32_t end = (uint32_t)( i + 1 ) * m_bucketMillis;
+         return end < h.max ? end : h.max;
+      }
+   }
+
+   return h.max;
+}
+
+//============================================================================
+// Write the stats in binary.
+//
+// The format is (all values little endian):
+//
+//    uint8_t   'V'
+//    uint8_t   'S'
+//    uint8_t   version (1)
+//    uint8_t   number of buckets
+//    uint16_t  bucket width in millis
+//    Then for OPEN and CLOSE:
+//       uint16_t  count
+//       uint16_t  stalls
+//       uint16_t  min millis
+//       uint16_t  max millis
+//       uint32_t  sum of millis
+//       uint16_t  bucket counts (number of buckets)
+//
+//= RETURNS
+//- Returns the number of bytes written.
+//
+size_t
+ValveStats::
+dump( Print& out )
+{
+   uint8_t header[6] = {
+      'V', 'S', 1, VALVESTATS_NUM_BUCKETS,
+      (uint8_t)( m_bucketMillis & 0xFF ), (uint8_t)( m_bucketMillis >> 8 ),
+   };
+   size_t num = out.write( header, sizeof( header ) );
+
+   for ( uint8_t d = 0; d < 2; d++ )
+   {
+      const Hist& h = m_hist[d];
+      uint16_t values[6 + VALVESTATS_NUM_BUCKETS] = {
+         h.count, h.stalls, h.min, h.max,
+         (uint16_t)( h.sum & 0xFFFF ), (uint16_t)( h.sum >> 16 ),
+      };
+      for ( uint8_t i = 0; i < VALVESTATS_NUM_BUCKETS; i++ )
+      {
+         values[6 + i] = h.buckets[i];
+      }
+
+      for ( uint8_t i = 0; i < sizeof( values ) / sizeof( values[0] ); i++ )
+      {
+         num += out.write( (uint8_t)( values[i] & 0xFF ) );
+         num += out.write( (uint8_t)( values[i] >> 8 ) );
+      }
+   }
+
+   return num;
+}
+
+//============================================================================
+// Cut all the counts in half.
+//
+void
+ValveStats::
+halve( Hist& h )
+{
+   for ( uint8_t i = 0; i < VALVESTATS_NUM_BUCKETS; i++ )
+   {
+      h.buckets[i] /= 2;
+   }
+
+   h.count /= 2;
+   h.sum /= 2;
+}
+
+//============================================================================
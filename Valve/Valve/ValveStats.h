@@ -0,0 +1,205 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Valve travel time statistics.
+//
+// Records how long a valve takes to open and close in a small fixed
+// size histogram along with the min, max, and mean times and the
+// number of times the valve stalled.  A valve that is starting to
+// wear out will take longer to move before it stalls completely so
+// this can be used to spot problems early.
+//
+// Attach the stats to a valve with Valve::setStats().  The valve
+// records the time from power on until the limit switch trips.  The
+// stats don't use any memory unless they're created so valves that
+// don't need them don't pay for them.
+//
+// The histogram has VALVESTATS_NUM_BUCKETS buckets of bucketMillis
+// each.  The last bucket holds all the times past the end of the
+// histogram.  When any counter would overflow, all of the counts are
+// cut in half so that recent moves are weighted more than old ones.
+//
+//= Example
+//
+//   Valve g_valve;
+//   ValveStats g_stats;
+//
+//   void setup()
+//   {
+//      g_valve.init( ... );
+//      g_stats.init( 500 ); // 0.5 sec buckets
+//      g_valve.setStats( &g_stats );
+//   }
+//
+//   // Send the stats on request.
+//   g_stats.dump( Serial );
+//
+#define VALVESTATS_NUM_BUCKETS 8
+
+class ValveStats
+{
+public:
+   // Direction the valve was moving.
+   enum Direction {
+      OPEN = 0,
+      CLOSE = 1,
+   };
+
+   void init( uint16_t bucketMillis );
+   void clear();
+
+   void add( Direction dir, uint16_t travelMillis );
+   void stalled( Direction dir );
+
+   uint16_t count( Direction dir );
+   uint16_t stalls( Direction dir );
+   uint16_t minTime( Direction dir );
+   uint16_t maxTime( Direction dir );
+   uint16_t meanTime( Direction dir );
+   uint16_t bucket( Direction dir, uint8_t index );
+   uint16_t percentile( Direction dir, uint8_t pct );
+   uint16_t bucketMillis();
+
+   size_t dump( Print& out );
+
+private:
+   // Stats for one direction.  30 bytes.
+   typedef struct {
+      // Number of moves recorded.
+      uint16_t count;
+
+      // Number of times the valve stalled.
+      uint16_t stalls;
+
+      // Min and max travel time in millis.
+      uint16_t min;
+      uint16_t max;
+
+      // Sum of the travel times in millis for the mean.
+      uint32_t sum;
+
+      // Number of moves in each bucket.
+      uint16_t buckets[VALVESTATS_NUM_BUCKETS];
+   } Hist;
+
+   // Width of each histogram bucket in millis.
+   uint16_t m_bucketMillis;
+
+   Hist m_hist[2];
+
+   void halve( Hist& h );
+};
+
+//============================================================================
+// Initialize the stats.
+//
+//= INPUTS
+//- bucketMillis   Width of each histogram bucket in milliseconds.  The
+//                 histogram covers 0 to VALVESTATS_NUM_BUCKETS times this.
+//
+inline
+void
+ValveStats::
+init( uint16_t bucketMillis )
+{
+   m_bucketMillis = bucketMillis ? bucketMillis : 1;
+   clear();
+}
+
+//============================================================================
+// Return the number of moves recorded in a direction.
+//
+inline
+uint16_t
+ValveStats::
+count( Direction dir )
+{
+   return m_hist[dir].count;
+}
+
+//============================================================================
+// Return the number of stalls recorded in a direction.
+//
+inline
+uint16_t
+ValveStats::
+stalls( Direction dir )
+{
+   return m_hist[dir].stalls;
+}
+
+//============================================================================
+// Return the shortest travel time in millis (0 if none were recorded).
+//
+inline
+uint16_t
+ValveStats::
+minTime( Direction dir )
+{
+   return m_hist[dir].count ? m_hist[dir].min : 0;
+}
+
+//============================================================================
+// Return the longest travel time in millis.
+//
+inline
+uint16_t
+ValveStats::
+maxTime( Direction dir )
+{
+   return m_hist[dir].max;
+}
+
+//============================================================================
+// Return the mean travel time in millis (0 if none were recorded).
+//
+inline
+uint16_t
+ValveStats::
+meanTime( Direction dir )
+{
+   const Hist& h = m_hist[dir];
+   return h.count ? h.sum / h.count : 0;
+}
+
+//============================================================================
+// Return the number of moves in a histogram bucket.
+//
+// Bucket i holds the times from i*bucketMillis up to (i+1)*bucketMillis.
+// The last bucket holds everything past the end.
+//
+inline
+uint16_t
+ValveStats::
+bucket( Direction dir,
+        uint8_t index )
+{
+   return m_hist[dir].buckets[index];
+}
+
+//============================================================================
+// Return the width of the histogram buckets in millis.
+//
+inline
+uint16_t
+ValveStats::
+bucketMillis()
+{
+   return m_bucketMillis;
+}
+
+//============================================================================
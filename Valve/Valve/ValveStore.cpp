@@ -0,0 +1,131 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "ValveStore.h"
+#include <EEPROM.h>
+
+//============================================================================
+// Find the current record.
+//
+// Scans the ring for the valid record with the newest sequence
+// number.
+//
+//= RETURNS
+//- Returns true if a record was found.  Otherwise the values are all
+//  NONE.
+//
+bool
+ValveStore::
+load()
+{
+   bool found = false;
+   for ( uint8_t i = 0; i < m_numRecords; ++i )
+   {
+      int addr = m_address + i * VALVESTORE_RECORD_SIZE;
+      uint8_t seq = EEPROM.read( addr );
+      uint8_t state = EEPROM.read( addr + 1 );
+      uint8_t pending = EEPROM.read( addr + 2 );
+      if ( EEPROM.read( addr + 3 ) != checksum( seq, state, pending ) )
+      {
+         continue;
+      }
+
+      // Sequence numbers wrap so compare the difference.  This works
+      // as long as there are fewer than 128 slots.
+      if ( ! found || (int8_t)( seq - m_seq ) > 0 )
+      {
+         found = true;
+         m_slot = i;
+         m_seq = seq;
+         m_commanded = state >> 4;
+         m_confirmed = state & 0x0F;
+         m_pending = pending;
+      }
+   }
+
+   return found;
+}
+
+//============================================================================
+// Save the valve state.
+//
+// Nothing is written if the state hasn't changed.
+//
+//= INPUTS
+//- commanded    Last commanded move.
+//- confirmed    Last confirmed state.
+//- pending      Pending command.
+//
+void
+ValveStore::
+save( uint8_t commanded,
+      uint8_t confirmed,
+      uint8_t pending )
+{
+   if ( commanded == m_commanded && confirmed == m_confirmed &&
+        pending == m_pending )
+   {
+      return;
+   }
+
+   m_commanded = commanded;
+   m_confirmed = confirmed;
+   m_pending = pending;
+
+   // Next slot in the ring.  The checksum is written last so a
+   // partial write leaves an invalid record.
+   m_slot = m_slot + 1 < m_numRecords ? m_slot + 1 : 0;
+   m_seq++;
+
+   uint8_t state = ( commanded << 4 ) | ( confirmed & 0x0F );
+   int addr = m_address + m_slot * VALVESTORE_RECORD_SIZE;
+   EEPROM.update( addr, m_seq );
+   EEPROM.update( addr + 1, state );
+   EEPROM.update( addr + 2, pending );
+   EEPROM.update( addr + 3, checksum( m_seq, state, pending ) );
+}
+
+//============================================================================
+// Forget the saved state.
+//
+// Writes an empty record so the valve won't resume anything on boot.
+//
+void
+ValveStore::
+clear()
+{
+   // Force the write even if the values are already all NONE.
+   m_pending = 0xFF;
+   save( 0, 0, 0 );
+}
+
+//============================================================================
+// Compute the record checksum.
+//
+// Erased (all 0xFF) and zeroed records both fail the check.
+//
+uint8_t
+ValveStore::
+checksum( uint8_t seq,
+          uint8_t state,
+          uint8_t pending )
+{
+   uint8_t sum = 0x5A;
+   sum = ( sum << 1 | sum >> 7 ) + seq;
+   sum = ( sum << 1 | sum >> 7 ) + state;
+   sum = ( sum << 1 | sum >> 7 ) + pending;
+   return sum;
+}
+
+//============================================================================
@@ -0,0 +1,155 @@
+// Copyright 2016 by Ted Drain
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Arduino.h"
+
+// Wear levelled EEPROM storage for the valve state.
+//
+// Without this, a valve that is rebooted while it's moving comes up
+// with neither limit switch active and the status is UNKNOWN.  The
+// only safe thing to do then is a full open or close cycle.  With a
+// store attached (see Valve::setStore()), the valve saves the last
+// commanded move, the last confirmed state, and the pending command.
+// On boot it can then finish the interrupted move instead.
+//
+// Each save is a small record written to the next slot of a ring of
+// numRecords slots so the writes are spread out over the EEPROM
+// instead of wearing out one address.  Records have a sequence number
+// and a checksum.  The newest valid record is the current one so a
+// save that's cut off by a power failure just leaves the previous
+// record in place.  Nothing is written unless the state changes and
+// unchanged bytes aren't rewritten.  On AVR, each changed byte blocks
+// for about 3.3 ms so a save takes up to ~13 ms.
+//
+// The store uses VALVESTORE_RECORD_SIZE * numRecords bytes starting at
+// the input address.  Use a different address range for each valve.
+//
+//= Example
+//
+//   Valve g_valve;
+//   ValveStore g_store;
+//
+//   void setup()
+//   {
+//      Valve::Status status = g_valve.init( ... );
+//      g_store.init( 0, 32 ); // EEPROM bytes 0-127
+//      status = g_valve.setStore( &g_store );
+//   }
+//
+#define VALVESTORE_RECORD_SIZE 4
+
+class ValveStore
+{
+public:
+   void init( int address, uint8_t numRecords );
+
+   bool load();
+   void save( uint8_t commanded, uint8_t confirmed, uint8_t pending );
+   void clear();
+
+   uint8_t commanded();
+   uint8_t confirmed();
+   uint8_t pending();
+   int size();
+
+private:
+   // First EEPROM address and number of record slots (max 127).
+   int m_address;
+   uint8_t m_numRecords;
+
+   // Slot and sequence number of the current record.
+   uint8_t m_slot;
+   uint8_t m_seq;
+
+   // Current record values.  These are Valve::Status values.
+   uint8_t m_commanded;
+   uint8_t m_confirmed;
+   uint8_t m_pending;
+
+   static uint8_t checksum( uint8_t seq, uint8_t state, uint8_t pending );
+};
+
+//============================================================================
+// Initialize the store.
+//
+// Call load() (or Valve::setStore() which calls it) to read the
+// saved state.
+//
+//= INPUTS
+//- address      First EEPROM address to use.
+//- numRecords   Number of record slots in the ring (1-127).  More slots
+//               spread the writes out more.
+//
+inline
+void
+ValveStore::
+init( int address,
+      uint8_t numRecords )
+{
+   m_address = address;
+   m_numRecords = constrain( numRecords, (uint8_t)1, (uint8_t)127 );
+   m_slot = m_numRecords - 1;
+   m_seq = 0;
+   m_commanded = 0;
+   m_confirmed = 0;
+   m_pending = 0;
+}
+
+//============================================================================
+// Return the last commanded move (Valve::OPENING, CLOSING, or NONE).
+//
+inline
+uint8_t
+ValveStore::
+commanded()
+{
+   return m_commanded;
+}
+
+//============================================================================
+// Return the last confirmed state (Valve::OPENED, CLOSED, STALLED, or
+// NONE).
+//
+inline
+uint8_t
+ValveStore::
+confirmed()
+{
+   return m_confirmed;
+}
+
+//============================================================================
+// Return the pending command (Valve::OPENING, CLOSING, or NONE).
+//
+inline
+uint8_t
+ValveStore::
+pending()
+{
+   return m_pending;
+}
+
+//============================================================================
+// Return the number of EEPROM bytes used.
+//
+inline
+int
+ValveStore::
+size()
+{
+   return m_numRecords * VALVESTORE_RECORD_SIZE;
+}
+
+//============================================================================
@@ -0,0 +1,215 @@
+#include "HostSim.h"
+#include "Valve.h"
+#include "ValveStats.h"
+#include <iostream>
+
+// Adaptive time out test.  Moves a simulated valve back and forth
+// and checks that the power on time out is learned from the travel
+// times, that the cycle time out scales with the move, that a stall
+// goes back to the init() time outs, and that the time outs stay
+// inside the limits.
+//
+// Compile and run:
+// g++ -DVALVE_ADAPTIVE -I../../Valve -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../Valve/Valve.cpp ../../Valve/ValveStats.cpp ../../Valve/ValveStore.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint8_t OPEN_PIN = 4;
+static const uint8_t CLOSE_PIN = 5;
+static const uint8_t OPENED_PIN = 6;
+static const uint8_t CLOSED_PIN = 7;
+
+static const long POWER_ON_MS = 10000;
+static const long CYCLE_MS = 4000;
+static const long MIN_POWER_ON_MS = 2000;
+static const long MIN_CYCLE_MS = 1000;
+
+// Simulated valve.  The position is the number of millis of travel
+// from closed.  A jammed valve doesn't move.
+struct SimValve
+{
+   long travelMs;
+   long position;
+   bool jammed;
+};
+
+static SimValve s_sim;
+
+// Move the valve for one milli and update the limit switches.
+static void
+simUpdate()
+{
+   bool open = HostSim::pin( OPEN_PIN );
+   bool close = HostSim::pin( CLOSE_PIN );
+   int dir = ( open && ! close ) ? 1 : ( ! open && close ) ? -1 : 0;
+   if ( s_sim.jammed )
+   {
+      dir = 0;
+   }
+
+   s_sim.position = constrain( s_sim.position + dir, 0L, s_sim.travelMs );
+   HostSim::setPin( OPENED_PIN,
+                    s_sim.position == s_sim.travelMs ? LOW : HIGH );
+   HostSim::setPin( CLOSED_PIN, s_sim.position == 0 ? LOW : HIGH );
+}
+
+// Move the valve to the other end and poll until it stops.  Returns
+// the final status.
+static Valve::Status
+move( Valve& valve,
+      bool force=false )
+{
+   s_sim.position ? valve.close( force ) : valve.open( force );
+   for ( long i = 0; i < 60000; ++i )
+   {
+      simUpdate();
+      Valve::Status status = valve.poll( millis() );
+      HostSim::advance( 1000 );
+      if ( status == Valve::OPENED || status == Valve::CLOSED ||
+           status == Valve::STALLED )
+      {
+         return status;
+      }
+   }
+   return valve.status();
+}
+
+// Make a number of moves each way with the input travel time.
+static bool
+moves( Valve& valve,
+       long travelMs,
+       int count )
+{
+   // Keep the valve at the same end when the travel changes.
+   bool opened = s_sim.position == s_sim.travelMs;
+   s_sim.travelMs = travelMs;
+   s_sim.position = opened ? travelMs : 0;
+
+   bool ok = true;
+   for ( int i = 0; i < 2 * count; ++i )
+   {
+      Valve::Status status = move( valve );
+      ok &= status == Valve::OPENED || status == Valve::CLOSED;
+   }
+   return ok;
+}
+
+static bool
+check( bool ok,
+       const char* msg )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   HostSim::reset();
+   s_sim.travelMs = 3000;
+   simUpdate();
+   bool ok = true;
+
+   Valve valve;
+   ValveStats stats;
+   valve.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN, CLOSED_PIN, POWER_ON_MS,
+               CYCLE_MS );
+   stats.init( 500 );
+   valve.setStats( &stats );
+   valve.setAdaptiveTimeOuts( MIN_POWER_ON_MS, MIN_CYCLE_MS, 25, 5 );
+   for ( int i = 0; i < 100; ++i )
+   {
+      simUpdate();
+      valve.poll( millis() );
+      HostSim::advance( 1000 );
+   }
+
+   // 3 second moves.  The cycle time out scales right away, the power
+   // on time out waits for 5 moves each way.
+   ok &= check( moves( valve, 3000, 4 ), "3 s moves" );
+   std::cout << "After 4 moves: power on " << valve.powerOnTimeOut()
+             << " ms, cycle " << valve.dutyCycleTimeOut() << " ms"
+             << std::endl;
+   ok &= check( valve.powerOnTimeOut() == POWER_ON_MS, "no history" );
+   ok &= check( valve.dutyCycleTimeOut() >= 1200 &&
+                valve.dutyCycleTimeOut() < 1220, "cycle scaled" );
+
+   ok &= check( moves( valve, 3000, 1 ), "5th move" );
+   std::cout << "After 5 moves: power on " << valve.powerOnTimeOut()
+             << " ms, cycle " << valve.dutyCycleTimeOut() << " ms"
+             << std::endl;
+   ok &= check( valve.powerOnTimeOut() >= 3750 &&
+                valve.powerOnTimeOut() < 3800, "power on learned" );
+
+   // A jam is caught by the learned time out and both time outs go
+   // back to the init() values.  The move waits for the cycle time out
+   // before the power goes on.
+   s_sim.jammed = true;
+   long start = millis();
+   Valve::Status status = move( valve );
+   long stalledMs = millis() - start;
+   s_sim.jammed = false;
+   std::cout << "Stalled after " << stalledMs << " ms: power on "
+             << valve.powerOnTimeOut() << " ms, cycle "
+             << valve.dutyCycleTimeOut() << " ms" << std::endl;
+   ok &= check( status == Valve::STALLED && stalledMs < 1202 + 3800,
+                "stall" );
+   ok &= check( valve.powerOnTimeOut() == POWER_ON_MS &&
+                valve.dutyCycleTimeOut() == CYCLE_MS, "stall reset" );
+
+   // The valve moves again once it's free.  A stalled valve only
+   // takes forced commands.  Start a new history so the next moves
+   // aren't held to the 3 s times.
+   stats.clear();
+   ok &= check( move( valve, true ) == Valve::OPENED, "unstall" );
+
+   // Slow moves never go past the init() time outs.
+   ok &= check( moves( valve, 9000, 5 ), "9 s moves" );
+   std::cout << "9 s moves: power on " << valve.powerOnTimeOut()
+             << " ms, cycle " << valve.dutyCycleTimeOut() << " ms"
+             << std::endl;
+   ok &= check( valve.powerOnTimeOut() == POWER_ON_MS, "power on max" );
+   ok &= check( valve.dutyCycleTimeOut() <= CYCLE_MS, "cycle max" );
+
+   // Fast moves never go under the minimums.
+   stats.clear();
+   ok &= check( moves( valve, 300, 5 ), "0.3 s moves" );
+   std::cout << "0.3 s moves: power on " << valve.powerOnTimeOut()
+             << " ms, cycle " << valve.dutyCycleTimeOut() << " ms"
+             << std::endl;
+   ok &= check( valve.powerOnTimeOut() == MIN_POWER_ON_MS, "power on min" );
+   ok &= check( valve.dutyCycleTimeOut() == MIN_CYCLE_MS, "cycle min" );
+
+   // Turning it off restores the init() values.
+   valve.setAdaptiveTimeOuts( MIN_POWER_ON_MS, MIN_CYCLE_MS, 0 );
+   ok &= check( valve.powerOnTimeOut() == POWER_ON_MS &&
+                valve.dutyCycleTimeOut() == CYCLE_MS, "adaptive off" );
+
+   // A zero power on time out has nothing to scale the cycle by.  The
+   // valve stalls on every poll so force it open each time until the
+   // switch trips.
+   s_sim.position = 0;
+   Valve zero;
+   zero.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN, CLOSED_PIN, 0, CYCLE_MS );
+   zero.setStats( &stats );
+   zero.setAdaptiveTimeOuts( 0, MIN_CYCLE_MS );
+   status = Valve::NONE;
+   for ( long i = 0; i < 1000 && status != Valve::OPENED; ++i )
+   {
+      zero.open( true );
+      simUpdate();
+      status = zero.poll( millis() );
+      HostSim::advance( 1000 );
+   }
+   ok &= check( status == Valve::OPENED &&
+                zero.dutyCycleTimeOut() == CYCLE_MS, "zero power on" );
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
+
@@ -0,0 +1,257 @@
+#include "HostSim.h"
+#include "Valve.h"
+#include <iostream>
+
+// Simulated motor current test.  Drives a simulated valve motor and
+// checks that a jammed valve is stalled by the current sense within
+// a few milliseconds while the inrush current and normal moves don't
+// trigger a stall.  Also checks that the soft start PWM ramp cuts the
+// peak inrush current.
+//
+// Compile and run:
+// g++ -DVALVE_STATS -DVALVE_CURRENT_SENSE -DVALVE_SOFT_START -I../../Valve -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../Valve/Valve.cpp ../../Valve/ValveStats.cpp ../../Valve/ValveStore.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint8_t OPEN_PIN = 4;
+static const uint8_t CLOSE_PIN = 5;
+static const uint8_t OPENED_PIN = 6;
+static const uint8_t CLOSED_PIN = 7;
+static const uint8_t SENSE_PIN = A0;
+
+// Analog current readings.
+static const int RUN_CURRENT = 200;
+static const int INRUSH_CURRENT = 700;
+static const int STALL_CURRENT = 800;
+static const int THRESHOLD = 500;
+
+// Simulated motor.  When powered, the current starts at the inrush
+// level and decays to the running level over 50 ms.  The current is
+// scaled by the PWM duty cycle of the drive pin.  The valve
+// reaches the end of travel after 3 seconds and the limit switch
+// goes LOW.  A jammed valve stops moving at jamAt_us and the current
+// rises to the stall level.
+struct SimMotor
+{
+   int dir;            // 1 opening, -1 closing, 0 off
+   uint64_t start_us;
+   uint64_t travel_us;
+   uint64_t jamAt_us;  // 0 if not jammed
+   uint64_t powerOff_us;
+   int peak;           // peak current of the last move
+};
+
+static SimMotor s_motor;
+
+static int
+motorCurrent( uint64_t t )
+{
+   if ( ! s_motor.dir )
+   {
+      return 0;
+   }
+   int current = RUN_CURRENT;
+   uint64_t dt = t - s_motor.start_us;
+   if ( s_motor.jamAt_us && t >= s_motor.jamAt_us )
+   {
+      current = STALL_CURRENT;
+   }
+   else if ( dt < 50000 )
+   {
+      current = INRUSH_CURRENT -
+                (int)( ( INRUSH_CURRENT - RUN_CURRENT ) * dt / 50000 );
+   }
+   int duty = HostSim::analogOut( s_motor.dir > 0 ? OPEN_PIN : CLOSE_PIN );
+   return current * duty / 255;
+}
+
+static void
+endOfTravel( void* )
+{
+   if ( ! s_motor.dir || s_motor.jamAt_us ||
+        HostSim::time_us() < s_motor.start_us + s_motor.travel_us )
+   {
+      return;
+   }
+   HostSim::setPin( s_motor.dir > 0 ? OPENED_PIN : CLOSED_PIN, LOW );
+}
+
+// Evaluate the control pins after both have been written.
+static void
+controlChange( void* )
+{
+   bool open = HostSim::analogOut( OPEN_PIN ) > 0;
+   bool close = HostSim::analogOut( CLOSE_PIN ) > 0;
+   int dir = ( open && ! close ) ? 1 : ( ! open && close ) ? -1 : 0;
+   if ( dir == s_motor.dir )
+   {
+      return;
+   }
+
+   s_motor.dir = dir;
+   if ( ! dir )
+   {
+      s_motor.powerOff_us = HostSim::time_us();
+      return;
+   }
+
+   s_motor.start_us = HostSim::time_us();
+   HostSim::setPin( OPENED_PIN, HIGH );
+   HostSim::setPin( CLOSED_PIN, HIGH );
+   HostSim::at( s_motor.start_us + s_motor.travel_us, endOfTravel );
+}
+
+static void
+controlWrite( uint8_t,
+              uint8_t,
+              void* )
+{
+   HostSim::at( HostSim::time_us() + 1, controlChange );
+}
+
+// Move the valve with 500 us loops and return the final status.
+static Valve::Status
+run( Valve& valve,
+     bool doOpen,
+     uint64_t jamAfter_us )
+{
+   doOpen ? valve.open() : valve.close();
+
+   s_motor.jamAt_us = 0;
+   s_motor.peak = 0;
+   uint64_t end = HostSim::time_us() + 15000000;
+   while ( HostSim::time_us() < end )
+   {
+      if ( jamAfter_us && ! s_motor.jamAt_us && s_motor.dir )
+      {
+         s_motor.jamAt_us = s_motor.start_us + jamAfter_us;
+      }
+      int current = motorCurrent( HostSim::time_us() );
+      s_motor.peak = current > s_motor.peak ? current : s_motor.peak;
+      HostSim::setAnalog( SENSE_PIN, current );
+
+      Valve::Status status = valve.poll( millis() );
+      if ( status == Valve::OPENED || status == Valve::CLOSED ||
+           status == Valve::STALLED )
+      {
+         HostSim::advance( 100000 );
+         return status;
+      }
+      HostSim::advance( 500 );
+   }
+   return valve.status();
+}
+
+int
+main()
+{
+   HostSim::reset();
+   s_motor.travel_us = 3000000;
+   HostSim::setPin( OPENED_PIN, HIGH );
+   HostSim::setPin( CLOSED_PIN, LOW );
+   HostSim::onWrite( OPEN_PIN, controlWrite );
+   HostSim::onWrite( CLOSE_PIN, controlWrite );
+
+   Valve valve;
+   ValveStats stats;
+   valve.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN, CLOSED_PIN, 10000, 100 );
+   HostSim::setPin( OPENED_PIN, HIGH );
+   HostSim::setPin( CLOSED_PIN, LOW );
+   stats.init( 1000 );
+   valve.setStats( &stats );
+   bool ok = true;
+   if ( ! valve.setCurrentSense( SENSE_PIN, THRESHOLD, 20, 100 ) )
+   {
+      std::cout << "FAILED current sense refused" << std::endl;
+      ok = false;
+   }
+
+   // Let the switch debouncing settle.
+   for ( int i = 0; i < 200; ++i )
+   {
+      valve.poll( millis() );
+      HostSim::advance( 500 );
+   }
+
+   // Normal moves - the inrush must not stall the valve.  The last
+   // two use a linear and a profile soft start.
+   static const uint8_t profile[] = { 50, 100, 150, 200 };
+   int peaks[3];
+   for ( int i = 0; i < 3; ++i )
+   {
+      if ( i == 1 )
+      {
+         valve.setSoftStart( 200, 64 );
+      }
+      else if ( i == 2 )
+      {
+         valve.setSoftStart( profile, sizeof( profile ), 25 );
+      }
+
+      Valve::Status s1 = run( valve, true, 0 );
+      peaks[i] = s_motor.peak;
+      Valve::Status s2 = run( valve, false, 0 );
+      if ( s1 != Valve::OPENED || s2 != Valve::CLOSED )
+      {
+         std::cout << "FAILED normal move " << i << ": " << s1 << " "
+                   << s2 << std::endl;
+         ok = false;
+      }
+   }
+   valve.clearSoftStart();
+
+   std::cout << "Peak current: " << peaks[0] << " full on, " << peaks[1]
+             << " linear ramp, " << peaks[2] << " profile" << std::endl;
+   if ( peaks[0] < INRUSH_CURRENT - 10 || peaks[1] > RUN_CURRENT + 10 ||
+        peaks[2] > RUN_CURRENT + 10 )
+   {
+      std::cout << "FAILED soft start peaks" << std::endl;
+      ok = false;
+   }
+
+   // Jam 1 second into the move.  Power should be cut within the
+   // sustain time plus a poll.
+   Valve::Status status = run( valve, true, 1000000 );
+   uint64_t cutOff_ms = ( s_motor.powerOff_us - s_motor.jamAt_us ) / 1000;
+   std::cout << "Jam to power off: " << cutOff_ms << " ms" << std::endl;
+   if ( status != Valve::STALLED || s_motor.dir || cutOff_ms > 25 )
+   {
+      std::cout << "FAILED jam: status " << status << std::endl;
+      ok = false;
+   }
+   if ( stats.stalls( ValveStats::OPEN ) != 1 )
+   {
+      std::cout << "FAILED stall not recorded" << std::endl;
+      ok = false;
+   }
+
+   // Without current sense the jam is only found by the time out.
+   valve.clearCurrentSense();
+   valve.close( true );
+   s_motor.jamAt_us = 0;
+   run( valve, false, 0 );
+   status = run( valve, true, 1000000 );
+   cutOff_ms = ( s_motor.powerOff_us - s_motor.jamAt_us ) / 1000;
+   std::cout << "Jam to power off (time out only): " << cutOff_ms << " ms"
+             << std::endl;
+   if ( status != Valve::STALLED || cutOff_ms < 8000 )
+   {
+      std::cout << "FAILED time out: status " << status << std::endl;
+      ok = false;
+   }
+
+   // ANALOG mode switches are read with analogRead() in poll() which
+   // would change the channel under the current sense conversion.
+   Valve analog;
+   analog.init( 8, 9, A1, A2, 10000, 100, Valve::DIGITAL, Valve::ANALOG );
+   if ( analog.setCurrentSense( SENSE_PIN, THRESHOLD ) )
+   {
+      std::cout << "FAILED current sense with ANALOG switches" << std::endl;
+      ok = false;
+   }
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #include "DigitalOutput.h"
 #include "DigitalInput.h"
 #include "Valve.h"
+#include <EEPROM.h>
 #include "Timer.h"
 #include "LoopFreq.h"
 
@@ -43,6 +44,13 @@ DigitalOutput g_led;
 // Articulated valve.  See init for wiring.
 Valve g_valve;
 
+// Saved valve state so a reboot in the middle of a move can finish it
+// instead of starting over.  EEPROM bytes 0-63.  Only when
+// VALVE_STORE is turned on in ValveConfig.h.
+#if defined( VALVE_STORE )
+ValveStore g_valveStore;
+#endif
+
 // Leak sensor.  These must be wired 5V->sensor->PIN with a pull down
 // resistor from PIN->GND.  Wired to D3
 DigitalInput g_sensor;
@@ -78,11 +86,16 @@ void setup()
          10000, // 10 sec, max power on time
          10000  // 10 sec, cool down time between cycling
          );
+#if defined( VALVE_STORE )
+   g_valveStore.init( 0, 16 );
+   status = g_valve.setStore( &g_valveStore );
+#endif
    valveChangedCb( status, 0 );
 
-   // If either valve isn't in the full opened state, there is a
-   // problem so switch to leak alert status.
-   if ( status != Valve::OPENED )
+   // If either valve isn't in the full opened state (or finishing an
+   // open that was interrupted by a reboot), there is a problem so
+   // switch to leak alert status.
+   if ( status != Valve::OPENED && status != Valve::OPENING )
    {
       statusChange( LEAK_SHUTOFF );
    }
@@ -0,0 +1,251 @@
+#include "HostSim.h"
+#include "../leak_sensor/leak_sensor.ino"
+#include <chrono>
+#include <iostream>
+
+// Runs the leak_sensor sketch on the host against a simulated valve,
+// leak sensor, and button for 1000 hours of simulated time.  Leaks
+// happen at random (repeatable) times and the button clears them an
+// hour later.  Checks that every leak closes the valve and every clear
+// opens it again within 15 seconds.
+//
+// Instead of running loop() every milli second, the test jumps to the
+// next time something can happen with HostSim::fastForward() (the
+// earliest of the component deadline() values and the simulated device
+// events) so it runs thousands of simulated hours per second.  Runs
+// are kept under the 49.7 day millis() roll over since long is 64 bits
+// on most hosts and the roll over math only works with 32 bit longs.
+//
+// Compile and run:
+// g++ -O2 -DVALVE_STORE -I../../Valve -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../LoopFreq -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../Valve/Valve.cpp ../../Valve/ValveStats.cpp ../../Valve/ValveStore.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../LoopFreq/LoopFreq.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+// Pins used by the sketch.
+static const uint8_t BUTTON_PIN = 14;
+static const uint8_t SENSOR_PIN = 3;
+static const uint8_t OPEN_PIN = 16;
+static const uint8_t CLOSE_PIN = 17;
+static const uint8_t OPENED_PIN = 18;
+static const uint8_t CLOSED_PIN = 19;
+
+static const uint64_t SECOND = 1000000;
+static const uint64_t HOUR = 3600 * SECOND;
+static const uint64_t RUN_TIME = 1000 * HOUR;
+
+// Max time to react to a leak or a clear.
+static const long MAX_REACT_MS = 15000;
+
+//============================================================================
+// Simulated valve.  The position is the micro seconds of travel from
+// closed and it takes 3 seconds to go end to end.  Instead of moving
+// it a step at a time, an event is scheduled for when the motor
+// reaches the end.  Each change of direction bumps the move number so
+// events from earlier moves are ignored.
+//
+static const int64_t TRAVEL_US = 3 * SECOND;
+
+struct SimValve
+{
+   int64_t position;
+   int dir;
+   uint64_t lastTime;
+   uintptr_t move;
+};
+
+static SimValve s_valve;
+
+static void
+valveUpdate()
+{
+   uint64_t now = HostSim::time_us();
+   s_valve.position += s_valve.dir * (int64_t)( now - s_valve.lastTime );
+   s_valve.position = constrain( s_valve.position, (int64_t)0, TRAVEL_US );
+   s_valve.lastTime = now;
+
+   HostSim::setPin( OPENED_PIN, s_valve.position == TRAVEL_US ? LOW : HIGH );
+   HostSim::setPin( CLOSED_PIN, s_valve.position == 0 ? LOW : HIGH );
+}
+
+// Motor reached the end or moved off of a switch.
+static void
+valveArrived( void* move )
+{
+   if ( (uintptr_t)move == s_valve.move )
+   {
+      valveUpdate();
+   }
+}
+
+// Motor pins written by the sketch.
+static void
+motorWrite( uint8_t,
+            uint8_t,
+            void* )
+{
+   bool open = HostSim::pin( OPEN_PIN );
+   bool close = HostSim::pin( CLOSE_PIN );
+   int dir = ( open && ! close ) ? 1 : ( ! open && close ) ? -1 : 0;
+   if ( dir == s_valve.dir )
+   {
+      return;
+   }
+
+   valveUpdate();
+   s_valve.dir = dir;
+   s_valve.move++;
+   if ( dir )
+   {
+      uint64_t now = HostSim::time_us();
+      int64_t left = dir > 0 ? TRAVEL_US - s_valve.position :
+                               s_valve.position;
+      HostSim::at( now + left, valveArrived, (void*)s_valve.move );
+
+      // The end switch opens once the valve moves a little.
+      HostSim::at( now + 50000, valveArrived, (void*)s_valve.move );
+   }
+}
+
+//============================================================================
+// Leaks and button presses.
+//
+static uint32_t s_random = 12345;
+static int s_numLeaks = 0;
+static uint64_t s_leakTime = 0;
+static uint64_t s_clearTime = 0;
+
+static void scheduleLeak( uint64_t fromTime );
+
+static void
+pinLow( void* pin )
+{
+   HostSim::setPin( (uintptr_t)pin, LOW );
+}
+
+static void
+pinHigh( void* pin )
+{
+   HostSim::setPin( (uintptr_t)pin, HIGH );
+}
+
+// Leak ends after 10 minutes.  An hour after the leak, the button is
+// pressed for 300 ms to clear it.
+static void
+leak( void* )
+{
+   uint64_t now = HostSim::time_us();
+   s_leakTime = now;
+   s_numLeaks++;
+   HostSim::setPin( SENSOR_PIN, HIGH );
+   HostSim::at( now + 600 * SECOND, pinLow, (void*)(uintptr_t)SENSOR_PIN );
+
+   s_clearTime = now + HOUR;
+   HostSim::at( s_clearTime, pinLow, (void*)(uintptr_t)BUTTON_PIN );
+   HostSim::at( s_clearTime + 300000, pinHigh, (void*)(uintptr_t)BUTTON_PIN );
+   scheduleLeak( s_clearTime );
+}
+
+// Next leak 1-48 hours after the last one is cleared.  No leaks in
+// the last 2 hours so they're all cleared by the end.
+static void
+scheduleLeak( uint64_t fromTime )
+{
+   s_random = s_random * 1103515245 + 12345;
+   uint64_t time = fromTime + HOUR +
+      ( s_random >> 8 ) % ( 47 * HOUR / SECOND ) * SECOND;
+   if ( time < RUN_TIME - 2 * HOUR )
+   {
+      HostSim::at( time, leak );
+   }
+}
+
+//============================================================================
+// Return the earlier of two times in millis.
+static long
+earliest( long a,
+          long b )
+{
+   return a - b < 0 ? a : b;
+}
+
+int
+main()
+{
+   HostSim::reset();
+   HostSim::serialOutput( NULL );
+
+   // Valve starts opened, no leak, button up.
+   s_valve.position = TRAVEL_US;
+   valveUpdate();
+   HostSim::setPin( SENSOR_PIN, LOW );
+   HostSim::setPin( BUTTON_PIN, HIGH );
+   HostSim::onWrite( OPEN_PIN, motorWrite );
+   HostSim::onWrite( CLOSE_PIN, motorWrite );
+   scheduleLeak( 0 );
+
+   setup();
+
+   bool ok = g_valve.status() == Valve::OPENED;
+   long maxClose = 0;
+   long maxOpen = 0;
+   int numClosed = 0;
+   int numOpened = 0;
+   uint64_t loops = 0;
+   Valve::Status last = g_valve.status();
+
+   std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+   while ( HostSim::time_us() < RUN_TIME )
+   {
+      loop();
+      ++loops;
+
+      // Time from the leak to closed and from the button to opened.
+      Valve::Status status = g_valve.status();
+      if ( status != last )
+      {
+         long dt = ( HostSim::time_us() - s_leakTime ) / 1000;
+         if ( status == Valve::CLOSED )
+         {
+            maxClose = max( maxClose, dt );
+            numClosed++;
+         }
+         else if ( status == Valve::OPENED )
+         {
+            dt = ( HostSim::time_us() - s_clearTime ) / 1000;
+            maxOpen = max( maxOpen, dt );
+            numOpened++;
+         }
+         last = status;
+      }
+
+      // Skip to the next time the sketch has something to do.
+      long t = millis();
+      long next = g_valve.deadline( t );
+      next = earliest( next, g_button.deadline( t ) );
+      next = earliest( next, g_sensor.deadline( t ) );
+      next = earliest( next, g_led.deadline( t ) );
+      uint64_t nextTime = ( t + max( next - t, 1L ) ) * 1000ULL;
+      HostSim::fastForward( min( nextTime, RUN_TIME ) );
+   }
+
+   double wall = std::chrono::duration< double >(
+      std::chrono::steady_clock::now() - start ).count();
+
+   ok &= numClosed == s_numLeaks && numOpened == s_numLeaks;
+   ok &= maxClose < MAX_REACT_MS && maxOpen < MAX_REACT_MS;
+
+   std::cout << s_numLeaks << " leaks, " << numClosed << " closes (max "
+             << maxClose << " ms), " << numOpened << " opens (max "
+             << maxOpen << " ms)" << std::endl;
+   std::cout << RUN_TIME / HOUR << " simulated hours, " << loops
+             << " loops in " << wall << " s = "
+             << (long)( RUN_TIME / HOUR / wall ) << " simulated hours/s"
+             << std::endl;
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+#include "HostSim.h"
+#include "ValveStats.h"
+#include <iostream>
+#include <vector>
+
+// Valve travel time stats test.  Checks the histogram, min/max/mean,
+// the percentiles, the stall counts, halving the counts when they
+// would overflow, and the binary dump() format.
+//
+// Compile and run:
+// g++ -I../../Valve -I../../../HostSim -o test main.cpp ../../Valve/ValveStats.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+// Print that keeps the bytes written to it.
+class Capture : public Print
+{
+public:
+   std::vector< uint8_t > bytes;
+
+   size_t write( uint8_t c )
+   {
+      bytes.push_back( c );
+      return 1;
+   }
+
+   uint16_t u16( size_t offset )
+   {
+      return bytes[offset] | bytes[offset + 1] << 8;
+   }
+};
+
+static bool
+check( bool ok,
+       const char* msg )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   HostSim::reset();
+   bool ok = true;
+
+   const ValveStats::Direction OPEN = ValveStats::OPEN;
+   const ValveStats::Direction CLOSE = ValveStats::CLOSE;
+
+   ValveStats stats;
+   stats.init( 500 );
+   ok &= check( stats.count( OPEN ) == 0 && stats.minTime( OPEN ) == 0 &&
+                stats.meanTime( OPEN ) == 0 &&
+                stats.percentile( OPEN, 99 ) == 0, "empty" );
+
+   // Buckets are 500 ms wide and the last one holds everything past
+   // 3.5 sec.
+   stats.add( OPEN, 1200 );
+   stats.add( OPEN, 1700 );
+   stats.add( OPEN, 800 );
+   stats.add( OPEN, 5000 );
+   ok &= check( stats.count( OPEN ) == 4 && stats.count( CLOSE ) == 0,
+                "count" );
+   ok &= check( stats.minTime( OPEN ) == 800 &&
+                stats.maxTime( OPEN ) == 5000 &&
+                stats.meanTime( OPEN ) == 2175, "min/max/mean" );
+   ok &= check( stats.bucket( OPEN, 1 ) == 1 && stats.bucket( OPEN, 2 ) == 1 &&
+                stats.bucket( OPEN, 3 ) == 1 && stats.bucket( OPEN, 7 ) == 1 &&
+                stats.bucket( OPEN, 0 ) == 0, "buckets" );
+
+   // Percentiles are the end of the bucket they fall in, or the max
+   // time if that's smaller.
+   std::cout << "Percentiles 50/75/99: " << stats.percentile( OPEN, 50 )
+             << " " << stats.percentile( OPEN, 75 ) << " "
+             << stats.percentile( OPEN, 99 ) << std::endl;
+   ok &= check( stats.percentile( OPEN, 50 ) == 1500 &&
+                stats.percentile( OPEN, 75 ) == 2000 &&
+                stats.percentile( OPEN, 99 ) == 5000, "percentiles" );
+   stats.add( CLOSE, 1100 );
+   ok &= check( stats.percentile( CLOSE, 99 ) == 1100, "percentile max" );
+
+   // Stalls saturate instead of wrapping.
+   stats.stalled( CLOSE );
+   stats.stalled( CLOSE );
+   ok &= check( stats.stalls( CLOSE ) == 2 && stats.stalls( OPEN ) == 0,
+                "stalls" );
+
+   // Binary dump.
+   Capture out;
+   size_t num = stats.dump( out );
+   const size_t DIR_SIZE = 2 * ( 6 + VALVESTATS_NUM_BUCKETS );
+   ok &= check( num == 6 + 2 * DIR_SIZE && out.bytes.size() == num,
+                "dump size" );
+   ok &= check( out.bytes[0] == 'V' && out.bytes[1] == 'S' &&
+                out.bytes[2] == 1 &&
+                out.bytes[3] == VALVESTATS_NUM_BUCKETS &&
+                out.u16( 4 ) == 500, "dump header" );
+
+   // count, stalls, min, max, sum (low, high), buckets
+   size_t open = 6;
+   size_t close = 6 + DIR_SIZE;
+   ok &= check( out.u16( open ) == 4 && out.u16( open + 2 ) == 0 &&
+                out.u16( open + 4 ) == 800 && out.u16( open + 6 ) == 5000 &&
+                out.u16( open + 8 ) == 8700 && out.u16( open + 10 ) == 0 &&
+                out.u16( open + 12 + 2 * 7 ) == 1, "dump open" );
+   ok &= check( out.u16( close ) == 1 && out.u16( close + 2 ) == 2 &&
+                out.u16( close + 4 ) == 1100 &&
+                out.u16( close + 12 + 2 * 2 ) == 1, "dump close" );
+
+   // Fill the counter.  The next move halves everything first.
+   stats.clear();
+   for ( long i = 0; i < 0xFFFF; ++i )
+   {
+      stats.add( CLOSE, 1000 );
+   }
+   ok &= check( stats.count( CLOSE ) == 0xFFFF &&
+                stats.bucket( CLOSE, 2 ) == 0xFFFF &&
+                stats.meanTime( CLOSE ) == 1000, "full" );
+   stats.add( CLOSE, 3000 );
+   std::cout << "After halving: count " << stats.count( CLOSE )
+             << ", mean " << stats.meanTime( CLOSE ) << std::endl;
+   ok &= check( stats.count( CLOSE ) == 0x7FFF + 1 &&
+                stats.bucket( CLOSE, 2 ) == 0x7FFF &&
+                stats.bucket( CLOSE, 6 ) == 1 &&
+                stats.meanTime( CLOSE ) == 1000 &&
+                stats.maxTime( CLOSE ) == 3000, "halved" );
+
+   for ( long i = 0; i < 0x10000; ++i )
+   {
+      stats.stalled( OPEN );
+   }
+   ok &= check( stats.stalls( OPEN ) == 0xFFFF, "stalls saturate" );
+
+   // Zero width buckets would divide by zero.
+   stats.init( 0 );
+   stats.add( OPEN, 10 );
+   ok &= check( stats.bucketMillis() == 1 &&
+                stats.bucket( OPEN, VALVESTATS_NUM_BUCKETS - 1 ) == 1,
+                "zero bucket width" );
+
+   // 260 buckets long used to wrap to bucket 4 in 8 bits.
+   stats.init( 20 );
+   stats.add( OPEN, 5200 );
+   ok &= check( stats.bucket( OPEN, VALVESTATS_NUM_BUCKETS - 1 ) == 1 &&
+                stats.bucket( OPEN, 4 ) == 0, "long travel bucket" );
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#include "DigitalOutput.h"
+#include "DigitalInput.h"
+#include "Valve.h"
+#include "ValveBank.h"
+#include "Timer.h"
+
+// Four valves on two dual H-bridge drivers sharing one supply.  Only
+// two valves can move at once and each driver needs 2 seconds to cool
+// off after a valve stops.
+//
+// Wiring:         open  close  opened  closed
+//   valve 0       D4    D5     D14     D15     (driver 0)
+//   valve 1       D6    D7     D16     D17     (driver 0)
+//   valve 2       D8    D9     D18     D19     (driver 1)
+//   valve 3       D10   D11    D2      D3      (driver 1)
+//
+// Push button on D12 (GND->button->pin).  Short press toggles all the
+// valves.  Long press is an emergency close.
+#define NUM_VALVES 4
+#define NUM_DRIVERS 2
+
+typedef ValveBank< NUM_VALVES, NUM_DRIVERS > Bank;
+
+Valve g_valves[NUM_VALVES];
+Bank g_bank;
+DigitalInput g_button;
+bool g_open = false;
+long g_start = 0;
+
+void valveChangedCb( Valve::Status status, int8_t valveId );
+
+void
+setup()
+{
+   Serial.begin( 19200 );
+
+   const uint8_t PINS[NUM_VALVES][4] = {
+      { 4, 5, 14, 15 },
+      { 6, 7, 16, 17 },
+      { 8, 9, 18, 19 },
+      { 10, 11, 2, 3 },
+   };
+
+   g_bank.init( 2, 2000 );
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      g_valves[i].init( PINS[i][0], PINS[i][1], PINS[i][2], PINS[i][3],
+                        10000, 0 );
+      g_bank.add( i, g_valves[i], i < 2 ? 0 : 1 );
+   }
+
+   g_button.init( 12 );
+
+   Serial.println( "Closing all valves..." );
+   g_bank.closeAll();
+   g_start = millis();
+}
+
+void
+loop()
+{
+   long t = millis();
+
+   DigitalInput::Status s = g_button.poll( t );
+   if ( s == DigitalInput::OPENED )
+   {
+      g_open = ! g_open;
+      Serial.println( g_open ? "Opening all valves..." :
+                               "Closing all valves..." );
+      g_start = t;
+      if ( g_open )
+      {
+         g_bank.openAll();
+      }
+      else
+      {
+         g_bank.closeAll();
+      }
+   }
+   else if ( s == DigitalInput::OPENED_LONG )
+   {
+      Serial.println( "Emergency close..." );
+      g_open = false;
+      g_start = t;
+      g_bank.closeAll( Bank::EMERGENCY );
+   }
+
+   if ( g_bank.poll( t, valveChangedCb ) == 0 && g_start )
+   {
+      Serial.print( "All valves finished in " );
+      Serial.print( t - g_start );
+      Serial.println( " ms" );
+      g_start = 0;
+   }
+}
+
+void
+valveChangedCb( Valve::Status status,
+                int8_t valveId )
+{
+   Serial.print( "Valve " ); Serial.print( valveId );
+   Serial.print( " -> " ); Serial.println( status );
+}
@@ -0,0 +1,257 @@
+#include "HostSim.h"
+#include "Valve.h"
+#include "ValveBank.h"
+#include <iostream>
+
+// Valve bank test.  Four simulated valves on two drivers (like the
+// valve_bank sketch) and checks the supply limit, the driver cool
+// down, the order commands start in, that an emergency reversal is
+// reported to the callback, and that an emergency command preempts a
+// normal move on it's driver.
+//
+// Compile and run:
+// g++ -I../../Valve -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../Valve/Valve.cpp ../../Valve/ValveStats.cpp ../../Valve/ValveStore.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+#define NUM_VALVES 4
+#define NUM_DRIVERS 2
+
+typedef ValveBank< NUM_VALVES, NUM_DRIVERS > Bank;
+
+// Control and limit switch pins for each valve: open, close, opened,
+// closed.  Valves 0 and 1 are on driver 0, 2 and 3 on driver 1.
+static const uint8_t PINS[NUM_VALVES][4] = {
+   { 4, 5, 14, 15 },
+   { 6, 7, 16, 17 },
+   { 8, 9, 18, 19 },
+   { 10, 11, 2, 3 },
+};
+
+static const long TRAVEL_MS = 3000;
+static const long COOL_DOWN_MS = 2000;
+
+// Simulated valves.  The position is the number of millis of travel
+// from closed.
+static long s_position[NUM_VALVES];
+
+// Most valves moving at once over the whole test and on each driver.
+static int s_maxMoving;
+static int s_maxDriverMoving;
+
+// Time each valve last started and stopped moving (from the callback)
+// and the order the bank started them in.
+static long s_startMillis[NUM_VALVES];
+static long s_stopMillis[NUM_VALVES];
+static int8_t s_starts[16];
+static int s_numStarts;
+
+// Move the valves for one milli and update the limit switches.
+static void
+simUpdate()
+{
+   int moving = 0;
+   int driverMoving[NUM_DRIVERS] = { 0, 0 };
+   for ( int i = 0; i < NUM_VALVES; ++i )
+   {
+      bool open = HostSim::pin( PINS[i][0] );
+      bool close = HostSim::pin( PINS[i][1] );
+      int dir = ( open && ! close ) ? 1 : ( ! open && close ) ? -1 : 0;
+      if ( dir )
+      {
+         moving++;
+         driverMoving[i / 2]++;
+      }
+
+      s_position[i] = constrain( s_position[i] + dir, 0L, TRAVEL_MS );
+      HostSim::setPin( PINS[i][2],
+                       s_position[i] == TRAVEL_MS ? LOW : HIGH );
+      HostSim::setPin( PINS[i][3], s_position[i] == 0 ? LOW : HIGH );
+   }
+
+   s_maxMoving = max( s_maxMoving, moving );
+   for ( int d = 0; d < NUM_DRIVERS; ++d )
+   {
+      s_maxDriverMoving = max( s_maxDriverMoving, driverMoving[d] );
+   }
+}
+
+static void
+valveChanged( Valve::Status status,
+              int8_t valveId )
+{
+   if ( status == Valve::OPENING || status == Valve::CLOSING )
+   {
+      s_startMillis[valveId] = millis();
+      if ( s_numStarts < (int)sizeof( s_starts ) )
+      {
+         s_starts[s_numStarts++] = valveId;
+      }
+   }
+   else
+   {
+      s_stopMillis[valveId] = millis();
+   }
+}
+
+// Run the bank for a number of millis.
+static void
+run( Bank& bank,
+     long ms )
+{
+   for ( long i = 0; i < ms; ++i )
+   {
+      simUpdate();
+      bank.poll( millis(), valveChanged );
+      HostSim::advance( 1000 );
+   }
+}
+
+// Run the bank until every command is done.
+static void
+finish( Bank& bank )
+{
+   for ( long i = 0; i < 60000 && bank.remaining(); ++i )
+   {
+      run( bank, 1 );
+   }
+}
+
+static void
+clearStarts()
+{
+   s_numStarts = 0;
+   s_maxMoving = 0;
+   s_maxDriverMoving = 0;
+}
+
+static bool
+check( bool ok,
+       const char* msg )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   HostSim::reset();
+   simUpdate();
+   bool ok = true;
+
+   Valve valves[NUM_VALVES];
+   Bank bank;
+   bank.init( 2, COOL_DOWN_MS );
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      valves[i].init( PINS[i][0], PINS[i][1], PINS[i][2], PINS[i][3],
+                      10000, 0 );
+      bank.add( i, valves[i], i / 2 );
+   }
+   run( bank, 100 );
+
+   // Two at a time, one per driver.  The second valve on each driver
+   // waits for the cool down after the first one stops.
+   long t0 = millis();
+   clearStarts();
+   bank.openAll();
+   finish( bank );
+   std::cout << "Open all: started at";
+   for ( int i = 0; i < NUM_VALVES; ++i )
+   {
+      std::cout << " " << s_startMillis[i] - t0;
+   }
+   std::cout << " ms" << std::endl;
+   ok &= check( s_maxMoving == 2 && s_maxDriverMoving == 1,
+                "supply limit" );
+   ok &= check( s_startMillis[0] - t0 < 5 && s_startMillis[2] - t0 < 5,
+                "first starts" );
+   ok &= check( s_startMillis[1] - s_stopMillis[0] >= COOL_DOWN_MS &&
+                s_startMillis[1] - s_stopMillis[0] < COOL_DOWN_MS + 5,
+                "driver 0 cool down" );
+   ok &= check( s_startMillis[3] - s_stopMillis[2] >= COOL_DOWN_MS &&
+                s_startMillis[3] - s_stopMillis[2] < COOL_DOWN_MS + 5,
+                "driver 1 cool down" );
+   ok &= check( bank.remaining() == 0, "open all done" );
+
+   // Right after the last moves, both drivers are cooling off.  An
+   // emergency command skips that, a normal one waits.
+   t0 = millis();
+   bank.close( 0 );
+   bank.close( 2, Bank::EMERGENCY );
+   finish( bank );
+   std::cout << "Cool down: normal started at " << s_startMillis[0] - t0
+             << " ms, emergency at " << s_startMillis[2] - t0 << " ms"
+             << std::endl;
+   ok &= check( s_startMillis[2] - t0 < 5, "emergency skips cool down" );
+   ok &= check( s_startMillis[0] - s_stopMillis[1] >= COOL_DOWN_MS &&
+                s_startMillis[0] - t0 > COOL_DOWN_MS - 100,
+                "normal waits for cool down" );
+
+   // One at a time with no cool down.  Emergency first, then the
+   // driver with the most queued, then the oldest command.
+   Bank single;
+   single.init( 1, 0 );
+   for ( uint8_t i = 0; i < NUM_VALVES; i++ )
+   {
+      single.add( i, valves[i], i / 2 );
+   }
+   clearStarts();
+   single.close( 3 );
+   single.close( 1 );
+   single.open( 0 );
+   single.open( 2, Bank::EMERGENCY );
+   run( single, 4 * ( TRAVEL_MS + 100 ) );
+   std::cout << "Start order:";
+   for ( int i = 0; i < s_numStarts; ++i )
+   {
+      std::cout << " " << (int)s_starts[i];
+   }
+   std::cout << std::endl;
+   ok &= check( s_numStarts == 4 && s_starts[0] == 2 &&
+                s_starts[1] == 1 && s_starts[2] == 3 && s_starts[3] == 0,
+                "priority order" );
+   ok &= check( s_maxMoving == 1, "one at a time" );
+
+   // An emergency close of an opening valve reverses it right away and
+   // the callback sees the valve start closing.
+   clearStarts();
+   single.open( 1 );
+   run( single, 1000 );
+   long reversed = millis();
+   single.close( 1, Bank::EMERGENCY );
+   run( single, 1100 );
+   ok &= check( s_numStarts == 2 && s_starts[1] == 1 &&
+                s_startMillis[1] == reversed, "reversal reported" );
+   ok &= check( valves[1].status() == Valve::CLOSED &&
+                single.remaining() == 0, "reversal done" );
+
+   // An emergency command on a driver that's busy with a normal move
+   // stops that move right away.  The normal move finishes after the
+   // emergency one and the cool down.
+   clearStarts();
+   bank.open( 1 );
+   run( bank, 1000 );
+   t0 = millis();
+   bank.close( 0, Bank::EMERGENCY );
+   run( bank, 5 );
+   ok &= check( valves[0].status() == Valve::CLOSING &&
+                valves[1].status() == Valve::UNKNOWN, "emergency preempts" );
+   finish( bank );
+   std::cout << "Preempt: emergency started at " << s_startMillis[0] - t0
+             << " ms, normal resumed at " << s_startMillis[1] - t0 << " ms"
+             << std::endl;
+   ok &= check( s_maxDriverMoving == 1, "one per driver with preempt" );
+   ok &= check( s_startMillis[1] - s_stopMillis[0] >= COOL_DOWN_MS &&
+                valves[0].status() == Valve::CLOSED &&
+                valves[1].status() == Valve::OPENED, "preempted move done" );
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
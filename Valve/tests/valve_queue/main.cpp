@@ -0,0 +1,161 @@
+#include "HostSim.h"
+#include "Valve.h"
+#include <iostream>
+
+// Timed command queue test.  Schedules opens and closes on a
+// simulated valve and checks when it moves, that redundant commands
+// cancel out when they come due, that repeated commands are kept, and
+// that a full queue rejects commands.
+//
+// Compile and run:
+// g++ -DVALVE_QUEUE_SIZE=4 -I../../Valve -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../Valve/Valve.cpp ../../Valve/ValveStats.cpp ../../Valve/ValveStore.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const uint8_t OPEN_PIN = 4;
+static const uint8_t CLOSE_PIN = 5;
+static const uint8_t OPENED_PIN = 6;
+static const uint8_t CLOSED_PIN = 7;
+
+// Simulated valve.  The position is the number of millis of travel
+// from closed and takes 3 seconds to go end to end.
+static const long TRAVEL_MS = 3000;
+
+struct SimValve
+{
+   long position;
+   int dir;
+   int numMoves;         // number of times the motor started
+   long openedMillis;    // last time the valve reported OPENED
+   long closedMillis;    // last time the valve reported CLOSED
+};
+
+static SimValve s_sim;
+
+// Move the valve for one milli and update the limit switches.
+static void
+simUpdate()
+{
+   bool open = HostSim::pin( OPEN_PIN );
+   bool close = HostSim::pin( CLOSE_PIN );
+   int dir = ( open && ! close ) ? 1 : ( ! open && close ) ? -1 : 0;
+   if ( dir != s_sim.dir )
+   {
+      s_sim.numMoves += dir != 0;
+      s_sim.dir = dir;
+   }
+
+   s_sim.position = constrain( s_sim.position + dir, 0L, TRAVEL_MS );
+   HostSim::setPin( OPENED_PIN, s_sim.position == TRAVEL_MS ? LOW : HIGH );
+   HostSim::setPin( CLOSED_PIN, s_sim.position == 0 ? LOW : HIGH );
+}
+
+static void
+valveChanged( Valve::Status status,
+              int8_t )
+{
+   if ( status == Valve::OPENED )
+   {
+      s_sim.openedMillis = millis();
+   }
+   else if ( status == Valve::CLOSED )
+   {
+      s_sim.closedMillis = millis();
+   }
+}
+
+// Run the valve for a time.
+static void
+run( Valve& valve,
+     long ms )
+{
+   for ( long i = 0; i < ms; ++i )
+   {
+      simUpdate();
+      valve.poll( millis(), valveChanged );
+      HostSim::advance( 1000 );
+   }
+}
+
+static bool
+check( bool ok,
+       const char* msg )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   HostSim::reset();
+   simUpdate();
+   bool ok = true;
+
+   Valve valve;
+   ok &= check( valve.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN, CLOSED_PIN,
+                            10000, 1000 ) == Valve::CLOSED, "init" );
+   run( valve, 100 );
+
+   // Open in 30 seconds and close in 90.
+   long t0 = millis();
+   valve.closeAt( t0 + 90000 );
+   valve.openAt( t0 + 30000 );
+   ok &= check( valve.queued() == 2, "queued" );
+   run( valve, 100000 );
+   long opened = s_sim.openedMillis - t0;
+   long closed = s_sim.closedMillis - t0;
+   std::cout << "Opened at " << opened << " ms, closed at " << closed
+             << " ms" << std::endl;
+   ok &= check( opened >= 33000 && opened < 33100, "open time" );
+   ok &= check( closed >= 93000 && closed < 93100, "close time" );
+   ok &= check( s_sim.numMoves == 2 && valve.queued() == 0, "two moves" );
+
+   // Open and close due at the same time cancel.  So does an open
+   // followed by a close before the valve can move.
+   t0 = millis();
+   valve.openAt( t0 + 1000 );
+   valve.closeAt( t0 + 1000 );
+   run( valve, 2000 );
+   valve.open();
+   valve.close();
+   run( valve, 2000 );
+   ok &= check( s_sim.numMoves == 2 && valve.status() == Valve::CLOSED,
+                "redundant pairs" );
+
+   // Repeated commands are all kept.  The valve is closed by hand
+   // after the first open so the second one opens it again.
+   t0 = millis();
+   int numMoves = s_sim.numMoves;
+   valve.openAt( t0 + 10 );
+   valve.openAt( t0 + 8000 );
+   ok &= check( valve.queued() == 2, "repeat kept" );
+   run( valve, 4000 );
+   ok &= check( valve.status() == Valve::OPENED, "first open" );
+   valve.close();
+   run( valve, 8000 );
+   opened = s_sim.openedMillis - t0;
+   std::cout << "Opened again at " << opened << " ms" << std::endl;
+   ok &= check( opened >= 11000 && opened < 11100, "second open" );
+   ok &= check( s_sim.numMoves == numMoves + 3 && valve.queued() == 0,
+                "three moves" );
+
+   // A full queue rejects commands.
+   t0 = millis();
+   valve.closeAt( t0 + 1000 );
+   valve.openAt( t0 + 2000 );
+   valve.openAt( t0 + 3000 );
+   valve.closeAt( t0 + 4000 );
+   ok &= check( ! valve.openAt( t0 + 5000 ) &&
+                valve.queued() == VALVE_QUEUE_SIZE, "queue full" );
+   valve.clearQueue();
+   ok &= check( valve.queued() == 0, "clear" );
+
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+#include "DigitalOutput.h"
+#include "DigitalInput.h"
+#include "Valve.h"
+#include "ValveStats.h"
+#include "Timer.h"
+
+// Cycles a valve open and closed every 30 seconds and prints the
+// travel time stats and the adaptive time outs after each move.  Push
+// button on D12 (GND->button->pin) writes the binary stats dump.
+//
+// Valve wiring: see the leak_sensor test.
+//
+// Turn on VALVE_ADAPTIVE in ValveConfig.h to build this.
+#if ! defined( VALVE_ADAPTIVE )
+#   error "valve_stats needs VALVE_ADAPTIVE"
+#endif
+Valve g_valve;
+ValveStats g_stats;
+DigitalInput g_button;
+Timer g_cycle;
+
+void printStats( ValveStats::Direction dir );
+void valveChangedCb( Valve::Status status, int8_t valveId );
+
+void
+setup()
+{
+   Serial.begin( 19200 );
+
+   g_valve.init(
+         16, // control open pin A2
+         17, // control close pin A3
+         18, // report open pin A4
+         19, // report close pin A5
+         10000, // 10 sec, max power on time
+         10000  // 10 sec, cool down time between cycling
+         );
+   g_stats.init( 500 ); // 0.5 sec buckets
+   g_valve.setStats( &g_stats );
+
+   // Learn the time outs - never less than 2 sec power on or 1 sec
+   // cool down.
+   g_valve.setAdaptiveTimeOuts( 2000, 1000 );
+
+   g_button.init( 12 );
+   g_cycle.repeat( 30000 );
+}
+
+void
+loop()
+{
+   long t = millis();
+
+   if ( g_cycle.poll( t ) )
+   {
+      g_valve.toggle();
+   }
+
+   if ( g_button.poll( t ) == DigitalInput::OPENED )
+   {
+      g_stats.dump( Serial );
+   }
+
+   g_valve.poll( t, valveChangedCb );
+}
+
+void
+valveChangedCb( Valve::Status status,
+                int8_t valveId )
+{
+   switch ( status )
+   {
+   case Valve::OPENED:
+   case Valve::CLOSED:
+   case Valve::STALLED:
+      printStats( ValveStats::OPEN );
+      printStats( ValveStats::CLOSE );
+      Serial.print( "Time outs: power on " );
+      Serial.print( g_valve.powerOnTimeOut() );
+      Serial.print( " ms, cool down " );
+      Serial.print( g_valve.dutyCycleTimeOut() );
+      Serial.println( " ms" );
+      break;
+
+   default:
+      break;
+   }
+}
+
+void
+printStats( ValveStats::Direction dir )
+{
+   Serial.print( dir == ValveStats::OPEN ? "Open : " : "Close: " );
+   Serial.print( g_stats.count( dir ) );
+   Serial.print( " moves, " );
+   Serial.print( g_stats.stalls( dir ) );
+   Serial.print( " stalls, min/mean/max " );
+   Serial.print( g_stats.minTime( dir ) );
+   Serial.print( "/" );
+   Serial.print( g_stats.meanTime( dir ) );
+   Serial.print( "/" );
+   Serial.print( g_stats.maxTime( dir ) );
+   Serial.print( " ms, hist" );
+   for ( uint8_t i = 0; i < VALVESTATS_NUM_BUCKETS; i++ )
+   {
+      Serial.print( " " );
+      Serial.print( g_stats.bucket( dir, i ) );
+   }
+   Serial.println();
+}
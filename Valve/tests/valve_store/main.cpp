@@ -0,0 +1,183 @@
+#include "HostSim.h"
+#include "EEPROM.h"
+#include "Valve.h"
+#include <iostream>
+#include <stdio.h>
+
+// Valve state storage test.  Reboots a simulated valve in the middle
+// of a move and checks that the move is finished without a full
+// cycle.  The EEPROM is kept in a file so it survives the reboot.
+// Also checks that the saves are spread over the ring and that a
+// corrupt record falls back to the previous one.
+//
+// Compile and run:
+// g++ -DVALVE_STORE -I../../Valve -I../../../DigitalInput/DigitalInput -I../../../DigitalOutput/DigitalOutput -I../../../Timer/Timer -I../../../Profile/Profile -I../../../FlightRecorder/FlightRecorder -I../../../HostSim -o test main.cpp ../../Valve/Valve.cpp ../../Valve/ValveStats.cpp ../../Valve/ValveStore.cpp ../../../DigitalInput/DigitalInput/DigitalInput.cpp ../../../Timer/Timer/Timer.cpp ../../../FlightRecorder/FlightRecorder/FlightRecorder.cpp ../../../HostSim/HostSim.cpp
+// ./test
+
+static const char* EEPROM_FILE = "valve_store.eeprom";
+
+static const uint8_t OPEN_PIN = 4;
+static const uint8_t CLOSE_PIN = 5;
+static const uint8_t OPENED_PIN = 6;
+static const uint8_t CLOSED_PIN = 7;
+
+static const int NUM_RECORDS = 16;
+
+// Simulated valve.  The position is the number of millis of travel
+// from closed and takes 3 seconds to go end to end.  It's kept
+// outside the HostSim state so it survives a reboot.
+static const long TRAVEL_MS = 3000;
+
+struct SimValve
+{
+   long position;
+   int dir;
+   int numOpens;    // number of times the motor started opening
+   int numCloses;   // number of times the motor started closing
+};
+
+static SimValve s_sim;
+
+// Move the valve for one milli and update the limit switches.
+static void
+simUpdate()
+{
+   bool open = HostSim::pin( OPEN_PIN );
+   bool close = HostSim::pin( CLOSE_PIN );
+   int dir = ( open && ! close ) ? 1 : ( ! open && close ) ? -1 : 0;
+   if ( dir != s_sim.dir )
+   {
+      s_sim.numOpens += dir > 0;
+      s_sim.numCloses += dir < 0;
+      s_sim.dir = dir;
+   }
+
+   s_sim.position = constrain( s_sim.position + dir, 0L, TRAVEL_MS );
+   HostSim::setPin( OPENED_PIN, s_sim.position == TRAVEL_MS ? LOW : HIGH );
+   HostSim::setPin( CLOSED_PIN, s_sim.position == 0 ? LOW : HIGH );
+}
+
+// Boot the valve with the EEPROM from the file.
+static Valve::Status
+boot( Valve& valve,
+      ValveStore& store )
+{
+   HostSim::reset();
+   HostSim::eepromFile( EEPROM_FILE );
+   s_sim.dir = 0;
+   simUpdate();
+
+   Valve::Status status = valve.init( OPEN_PIN, CLOSE_PIN, OPENED_PIN,
+                                      CLOSED_PIN, 10000, 1000 );
+   store.init( 0, NUM_RECORDS );
+   Valve::Status stored = valve.setStore( &store );
+   std::cout << "Boot at " << s_sim.position << ": init " << status
+             << " store " << stored << std::endl;
+   return stored;
+}
+
+// Run the valve for a time.
+static void
+run( Valve& valve,
+     long millis )
+{
+   for ( long i = 0; i < millis; ++i )
+   {
+      simUpdate();
+      valve.poll( ::millis() );
+      HostSim::advance( 1000 );
+   }
+}
+
+static bool
+check( bool ok,
+       const char* msg )
+{
+   if ( ! ok )
+   {
+      std::cout << "FAILED " << msg << std::endl;
+   }
+   return ok;
+}
+
+int
+main()
+{
+   remove( EEPROM_FILE );
+   bool ok = true;
+
+   Valve valve;
+   ValveStore store;
+
+   // First boot - nothing saved and the valve is closed.
+   ok &= check( boot( valve, store ) == Valve::CLOSED, "first boot" );
+
+   // Reboot half way through opening.  The open should be finished
+   // without closing first.
+   valve.open();
+   run( valve, 1500 );
+   ok &= check( boot( valve, store ) == Valve::OPENING, "resume open" );
+   run( valve, 2000 );
+   ok &= check( valve.status() == Valve::OPENED, "finished open" );
+   ok &= check( s_sim.numCloses == 0 && s_sim.numOpens == 2,
+                "open without a cycle" );
+
+   // Normal reboot.
+   ok &= check( boot( valve, store ) == Valve::OPENED, "opened boot" );
+
+   // Reboot while closing with an open pending.  The close is
+   // finished and then the valve opens again.
+   valve.close();
+   run( valve, 1000 );
+   valve.open();
+   run( valve, 1000 );
+   ok &= check( boot( valve, store ) == Valve::CLOSING, "resume close" );
+   run( valve, 1500 );
+   ok &= check( valve.status() == Valve::CLOSED, "finished close" );
+   run( valve, 5000 );
+   ok &= check( valve.status() == Valve::OPENED, "pending open" );
+
+   // Spread the writes over the ring.
+   int numSaves = 1000;
+   for ( int i = 0; i < numSaves; ++i )
+   {
+      store.save( i % 2 ? Valve::OPENING : Valve::CLOSING,
+                  i % 2 ? Valve::CLOSED : Valve::OPENED, Valve::NONE );
+   }
+   uint32_t maxWrites = 0;
+   for ( int i = 0; i < store.size(); ++i )
+   {
+      maxWrites = max( maxWrites, HostSim::eepromWrites( i ) );
+   }
+   std::cout << numSaves << " saves, max writes per byte: " << maxWrites
+             << std::endl;
+   ok &= check( maxWrites <= (uint32_t)numSaves / NUM_RECORDS + 1,
+                "wear levelling" );
+
+   // Corrupt the newest record.  The one before it should be used.
+   store.init( 0, NUM_RECORDS );
+   store.load();
+   uint8_t confirmed = store.confirmed();
+   int slot = -1;
+   for ( int i = 0; i < NUM_RECORDS; ++i )
+   {
+      store.init( 0, NUM_RECORDS );
+      EEPROM.write( i * VALVESTORE_RECORD_SIZE + 3,
+                    ~EEPROM.read( i * VALVESTORE_RECORD_SIZE + 3 ) );
+      store.load();
+      EEPROM.write( i * VALVESTORE_RECORD_SIZE + 3,
+                    ~EEPROM.read( i * VALVESTORE_RECORD_SIZE + 3 ) );
+      if ( store.confirmed() != confirmed )
+      {
+         slot = i;
+      }
+   }
+   ok &= check( slot >= 0, "corrupt record fallback" );
+
+   remove( EEPROM_FILE );
+   if ( ok )
+   {
+      std::cout << "Passed" << std::endl;
+   }
+   return ok ? 0 : 1;
+}